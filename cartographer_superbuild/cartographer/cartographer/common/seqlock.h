@@ -0,0 +1,88 @@
+/*
+ * Copyright 2017 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_COMMON_SEQLOCK_H_
+#define CARTOGRAPHER_COMMON_SEQLOCK_H_
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#include "cartographer/common/port.h"
+
+namespace cartographer {
+namespace common {
+
+// Holds a copy of a small value that one thread publishes and any number of
+// threads read without taking a lock. Readers retry if they overlap with a
+// write, so they never block the writer and never observe a torn value.
+//
+// 'T' must be copyable with memcpy, i.e. it may not own heap memory. Calls to
+// Write() must be serialized by the caller, Read() may be called from any
+// thread.
+template <typename T>
+class SeqLock {
+ public:
+  SeqLock() : SeqLock(T()) {}
+  explicit SeqLock(const T& value) { Write(value); }
+
+  SeqLock(const SeqLock&) = delete;
+  SeqLock& operator=(const SeqLock&) = delete;
+
+  void Write(const T& value) {
+    std::array<uint64, kNumWords> words{};
+    std::memcpy(words.data(), &value, sizeof(T));
+    const uint64 sequence = sequence_.load(std::memory_order_relaxed);
+    // An odd sequence number tells readers that a write is in progress.
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i != kNumWords; ++i) {
+      words_[i].store(words[i], std::memory_order_relaxed);
+    }
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  T Read() const {
+    std::array<uint64, kNumWords> words;
+    uint64 sequence;
+    do {
+      sequence = sequence_.load(std::memory_order_acquire);
+      for (size_t i = 0; i != kNumWords; ++i) {
+        words[i] = words_[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((sequence & 1) != 0 ||
+             sequence != sequence_.load(std::memory_order_relaxed));
+    T value;
+    std::memcpy(static_cast<void*>(&value), words.data(), sizeof(T));
+    return value;
+  }
+
+ private:
+  static_assert(std::is_trivially_destructible<T>::value,
+                "SeqLock requires a type without owned resources.");
+  static constexpr size_t kNumWords =
+      (sizeof(T) + sizeof(uint64) - 1) / sizeof(uint64);
+
+  std::atomic<uint64> sequence_{0};
+  std::array<std::atomic<uint64>, kNumWords> words_;
+};
+
+}  // namespace common
+}  // namespace cartographer
+
+#endif  // CARTOGRAPHER_COMMON_SEQLOCK_H_
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2017 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/common/seqlock.h"
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace common {
+namespace {
+
+struct Values {
+  int count = 0;
+  double values[5] = {0., 0., 0., 0., 0.};
+};
+
+TEST(SeqLockTest, ReadsWrittenValue) {
+  SeqLock<Values> seqlock;
+  EXPECT_EQ(0, seqlock.Read().count);
+  Values values;
+  values.count = 3;
+  values.values[4] = 42.;
+  seqlock.Write(values);
+  EXPECT_EQ(3, seqlock.Read().count);
+  EXPECT_EQ(42., seqlock.Read().values[4]);
+}
+
+TEST(SeqLockTest, ReadersNeverObserveTornValues) {
+  constexpr int kNumWrites = 100000;
+  SeqLock<Values> seqlock;
+  std::vector<std::thread> readers;
+  for (int i = 0; i != 3; ++i) {
+    readers.emplace_back([&seqlock]() {
+      int last_count = 0;
+      while (last_count != kNumWrites) {
+        const Values values = seqlock.Read();
+        EXPECT_LE(last_count, values.count);
+        for (const double value : values.values) {
+          EXPECT_EQ(values.count, value);
+        }
+        last_count = values.count;
+      }
+    });
+  }
+  for (int i = 1; i <= kNumWrites; ++i) {
+    Values values;
+    values.count = i;
+    for (double& value : values.values) {
+      value = i;
+    }
+    seqlock.Write(values);
+  }
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+}
+
+}  // namespace
+}  // namespace common
+}  // namespace cartographer
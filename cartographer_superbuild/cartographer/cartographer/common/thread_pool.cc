@@ -19,6 +19,7 @@
 #include <unistd.h>
 #include <algorithm>
 #include <chrono>
+#include <memory>
 #include <numeric>
 
 #include "glog/logging.h"
@@ -26,10 +27,13 @@
 namespace cartographer {
 namespace common {
 
-ThreadPool::ThreadPool(int num_threads) {
+ThreadPool::ThreadPool(int num_threads)
+    : ThreadPool(num_threads, Priority::kBackground) {}
+
+ThreadPool::ThreadPool(int num_threads, const Priority priority) {
   MutexLocker locker(&mutex_);
   for (int i = 0; i != num_threads; ++i) {
-    pool_.emplace_back([this]() { ThreadPool::DoWork(); });
+    pool_.emplace_back([this, priority]() { ThreadPool::DoWork(priority); });
   }
 }
 
@@ -51,20 +55,34 @@ void ThreadPool::Schedule(std::function<void()> work_item) {
   work_queue_.push_back(work_item);
 }
 
-void ThreadPool::DoWork() {
+bool ThreadPool::TrySchedule(std::function<void()> work_item) {
+  MutexLocker locker(&mutex_);
+  CHECK(running_);
+  if (work_queue_.size() >= static_cast<size_t>(num_idle_threads_)) {
+    return false;
+  }
+  work_queue_.push_back(work_item);
+  return true;
+}
+
+void ThreadPool::DoWork(const Priority priority) {
 #ifdef __linux__
   // This changes the per-thread nice level of the current thread on Linux. We
   // do this so that the background work done by the thread pool is not taking
   // away CPU resources from more important foreground threads.
-  CHECK_NE(nice(10), -1);
+  if (priority == Priority::kBackground) {
+    CHECK_NE(nice(10), -1);
+  }
 #endif
   for (;;) {
     std::function<void()> work_item;
     {
       MutexLocker locker(&mutex_);
+      ++num_idle_threads_;
       locker.Await([this]() REQUIRES(mutex_) {
         return !work_queue_.empty() || !running_;
       });
+      --num_idle_threads_;
       if (!work_queue_.empty()) {
         work_item = work_queue_.front();
         work_queue_.pop_front();
@@ -77,5 +95,64 @@ void ThreadPool::DoWork() {
   }
 }
 
+void ParallelFor(const int num_indices, const int num_workers,
+                 ThreadPool* const thread_pool,
+                 const std::function<void(int, int)>& work_item) {
+  CHECK_GE(num_workers, 1);
+  // Shared with the scheduled workers, which may still be releasing the mutex
+  // when this returns.
+  struct State {
+    Mutex mutex;
+    int next_index GUARDED_BY(mutex) = 0;
+    int num_running_calls GUARDED_BY(mutex) = 0;
+    int num_unstarted_workers GUARDED_BY(mutex) = 0;
+  };
+  const auto state = std::make_shared<State>();
+  // Only called while indices remain, so 'work_item' is still alive.
+  const auto work = [state, num_indices, &work_item](const int worker_index) {
+    for (;;) {
+      int index;
+      {
+        MutexLocker locker(&state->mutex);
+        if (state->next_index == num_indices) {
+          return;
+        }
+        index = state->next_index++;
+        ++state->num_running_calls;
+      }
+      work_item(worker_index, index);
+      MutexLocker locker(&state->mutex);
+      --state->num_running_calls;
+    }
+  };
+  // Only workers which an idle thread picks up right away are scheduled, so
+  // waiting for them to start cannot deadlock.
+  for (int worker_index = 1;
+       worker_index < std::min(num_workers, num_indices); ++worker_index) {
+    {
+      MutexLocker locker(&state->mutex);
+      ++state->num_unstarted_workers;
+    }
+    const bool scheduled = CHECK_NOTNULL(thread_pool)->TrySchedule(
+        [state, work, worker_index]() {
+          {
+            MutexLocker locker(&state->mutex);
+            --state->num_unstarted_workers;
+          }
+          work(worker_index);
+        });
+    if (!scheduled) {
+      MutexLocker locker(&state->mutex);
+      --state->num_unstarted_workers;
+      break;
+    }
+  }
+  work(0);
+  MutexLocker locker(&state->mutex);
+  locker.Await([&state]() REQUIRES(state->mutex) {
+    return state->num_running_calls == 0 && state->num_unstarted_workers == 0;
+  });
+}
+
 }  // namespace common
 }  // namespace cartographer
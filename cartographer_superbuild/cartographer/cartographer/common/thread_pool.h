@@ -17,6 +17,7 @@
 #ifndef CARTOGRAPHER_COMMON_THREAD_POOL_H_
 #define CARTOGRAPHER_COMMON_THREAD_POOL_H_
 
+#include <atomic>
 #include <deque>
 #include <functional>
 #include <thread>
@@ -34,7 +35,12 @@ namespace common {
 // destroy the threads.
 class ThreadPool {
  public:
+  // Threads of a background pool lower their priority, so that they do not
+  // take away CPU resources from more important foreground threads.
+  enum class Priority { kBackground, kForeground };
+
   explicit ThreadPool(int num_threads);
+  ThreadPool(int num_threads, Priority priority);
   ~ThreadPool();
 
   ThreadPool(const ThreadPool&) = delete;
@@ -42,15 +48,40 @@ class ThreadPool {
 
   void Schedule(std::function<void()> work_item);
 
+  // Schedules 'work_item' only if an idle thread will pick it up without
+  // waiting for other queued work items. Returns whether it was scheduled.
+  bool TrySchedule(std::function<void()> work_item);
+
  private:
-  void DoWork();
+  void DoWork(Priority priority);
 
   Mutex mutex_;
   bool running_ GUARDED_BY(mutex_) = true;
+  int num_idle_threads_ GUARDED_BY(mutex_) = 0;
   std::vector<std::thread> pool_ GUARDED_BY(mutex_);
   std::deque<std::function<void()>> work_queue_ GUARDED_BY(mutex_);
 };
 
+// Calls 'work_item'(worker_index, index) for every 'index' in
+// [0, 'num_indices'). Each of the up to 'num_workers' workers is handed out
+// indices in increasing order. Worker 0 is the calling thread, the others are
+// scheduled on idle threads of 'thread_pool', which may be nullptr if
+// 'num_workers' is 1. If 'thread_pool' has no idle threads, e.g. when called
+// from within one of its work items, the calling thread does all the work.
+// Returns once all calls have finished and all scheduled workers have run, so
+// nothing is left in the queue of 'thread_pool'. Workers which start after all
+// indices were handed out return without calling 'work_item'.
+void ParallelFor(int num_indices, int num_workers, ThreadPool* thread_pool,
+                 const std::function<void(int, int)>& work_item);
+
+// Atomically sets 'maximum' to 'value' if that is larger.
+template <typename T>
+void UpdateMaximum(std::atomic<T>* const maximum, const T value) {
+  T current = maximum->load();
+  while (current < value && !maximum->compare_exchange_weak(current, value)) {
+  }
+}
+
 }  // namespace common
 }  // namespace cartographer
 
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/common/thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace common {
+namespace {
+
+TEST(ThreadPoolTest, ParallelForCallsEachIndexOnce) {
+  constexpr int kNumIndices = 1000;
+  std::vector<int> num_calls(kNumIndices, 0);
+  std::vector<int> worker_indices(kNumIndices, -1);
+  {
+    ThreadPool thread_pool(3);
+    ParallelFor(kNumIndices, 4, &thread_pool,
+                [&num_calls, &worker_indices](const int worker_index,
+                                              const int index) {
+                  ++num_calls[index];
+                  worker_indices[index] = worker_index;
+                });
+    // Nothing is left in the queue, so the pool can be destroyed right away.
+  }
+  for (int index = 0; index != kNumIndices; ++index) {
+    EXPECT_EQ(1, num_calls[index]) << index;
+    EXPECT_LE(0, worker_indices[index]) << index;
+    EXPECT_GT(4, worker_indices[index]) << index;
+  }
+}
+
+TEST(ThreadPoolTest, ParallelForOnBusyThreadPool) {
+  constexpr int kNumIndices = 10;
+  std::atomic<bool> busy(false);
+  std::vector<int> worker_indices(kNumIndices, -1);
+  {
+    ThreadPool thread_pool(1);
+    thread_pool.Schedule([&busy]() {
+      busy = true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    });
+    while (!busy) {
+      std::this_thread::yield();
+    }
+    ParallelFor(kNumIndices, 2, &thread_pool,
+                [&worker_indices](const int worker_index, const int index) {
+                  worker_indices[index] = worker_index;
+                });
+    // No worker was left queued behind the busy work item, so the pool can be
+    // destroyed while it is still running.
+  }
+  for (int index = 0; index != kNumIndices; ++index) {
+    EXPECT_EQ(0, worker_indices[index]) << index;
+  }
+}
+
+}  // namespace
+}  // namespace common
+}  // namespace cartographer
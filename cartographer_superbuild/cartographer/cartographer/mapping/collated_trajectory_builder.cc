@@ -46,8 +46,8 @@ CollatedTrajectoryBuilder::CollatedTrajectoryBuilder(
 
 CollatedTrajectoryBuilder::~CollatedTrajectoryBuilder() {}
 
-const TrajectoryBuilder::PoseEstimate&
-CollatedTrajectoryBuilder::pose_estimate() const {
+TrajectoryBuilder::PoseEstimate CollatedTrajectoryBuilder::pose_estimate()
+    const {
   return wrapped_trajectory_builder_->pose_estimate();
 }
 
@@ -56,6 +56,10 @@ void CollatedTrajectoryBuilder::AddSensorData(
   sensor_collator_->AddSensorData(trajectory_id_, sensor_id, std::move(data));
 }
 
+void CollatedTrajectoryBuilder::Flush() {
+  wrapped_trajectory_builder_->Flush();
+}
+
 void CollatedTrajectoryBuilder::HandleCollatedSensorData(
     const string& sensor_id, std::unique_ptr<sensor::Data> data) {
   auto it = rate_timers_.find(sensor_id);
@@ -49,10 +49,11 @@ class CollatedTrajectoryBuilder : public TrajectoryBuilder {
   CollatedTrajectoryBuilder& operator=(const CollatedTrajectoryBuilder&) =
       delete;
 
-  const PoseEstimate& pose_estimate() const override;
+  PoseEstimate pose_estimate() const override;
 
   void AddSensorData(const string& sensor_id,
                      std::unique_ptr<sensor::Data> data) override;
+  void Flush() override;
 
  private:
   void HandleCollatedSensorData(const string& sensor_id,
@@ -48,7 +48,7 @@ class GlobalTrajectoryBuilderInterface {
   GlobalTrajectoryBuilderInterface& operator=(
       const GlobalTrajectoryBuilderInterface&) = delete;
 
-  virtual const PoseEstimate& pose_estimate() const = 0;
+  virtual PoseEstimate pose_estimate() const = 0;
 
   virtual void AddRangefinderData(common::Time time,
                                   const Eigen::Vector3f& origin,
@@ -58,6 +58,9 @@ class GlobalTrajectoryBuilderInterface {
                           const Eigen::Vector3d& angular_velocity) = 0;
   virtual void AddOdometerData(common::Time time,
                                const transform::Rigid3d& pose) = 0;
+
+  // Blocks until all sensor data added so far has been processed.
+  virtual void Flush() = 0;
 };
 
 }  // namespace mapping
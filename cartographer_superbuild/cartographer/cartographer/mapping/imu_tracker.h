@@ -46,6 +46,9 @@ class ImuTracker {
   // Query the current orientation estimate.
   Eigen::Quaterniond orientation() const { return orientation_; }
 
+  // Query the current angular velocity estimate.
+  Eigen::Vector3d angular_velocity() const { return imu_angular_velocity_; }
+
  private:
   const double imu_gravity_time_constant_;
   common::Time time_;
@@ -46,6 +46,8 @@ proto::MapBuilderOptions CreateMapBuilderOptions(
       parameter_dictionary->GetNonNegativeInt("num_background_threads"));
   *options.mutable_sparse_pose_graph_options() = CreateSparsePoseGraphOptions(
       parameter_dictionary->GetDictionary("sparse_pose_graph").get());
+  options.set_serialize_precomputation_grids(
+      parameter_dictionary->GetBool("serialize_precomputation_grids"));
   CHECK_NE(options.use_trajectory_builder_2d(),
            options.use_trajectory_builder_3d());
   return options;
@@ -103,6 +105,9 @@ TrajectoryBuilder* MapBuilder::GetTrajectoryBuilder(
 
 void MapBuilder::FinishTrajectory(const int trajectory_id) {
   sensor_collator_.FinishTrajectory(trajectory_id);
+  // The collator dispatched all remaining sensor data, but range data may
+  // still be in the pipeline of local SLAM.
+  trajectory_builders_.at(trajectory_id)->Flush();
 }
 
 int MapBuilder::GetBlockingTrajectoryId() const {
@@ -155,6 +160,16 @@ void MapBuilder::SerializeState(io::ProtoStreamWriter* const writer) {
         submap_proto->mutable_submap_id()->set_trajectory_id(trajectory_id);
         submap_proto->mutable_submap_id()->set_submap_index(submap_index);
         submap_data[trajectory_id][submap_index].submap->ToProto(submap_proto);
+        if (options_.serialize_precomputation_grids()) {
+          const mapping::SubmapId submap_id{trajectory_id, submap_index};
+          if (sparse_pose_graph_2d_ != nullptr) {
+            sparse_pose_graph_2d_->AddPrecomputationGridsToProto(submap_id,
+                                                                 submap_proto);
+          } else {
+            sparse_pose_graph_3d_->AddPrecomputationGridsToProto(submap_id,
+                                                                 submap_proto);
+          }
+        }
         // TODO(whess): Only enable optionally? Resulting pbstream files will be
         // a lot larger now.
         writer->WriteProto(proto);
@@ -65,7 +65,8 @@ class MapBuilder {
   mapping::TrajectoryBuilder* GetTrajectoryBuilder(int trajectory_id) const;
 
   // Marks the TrajectoryBuilder corresponding to 'trajectory_id' as finished,
-  // i.e. no further sensor data is expected.
+  // i.e. no further sensor data is expected. Returns once all sensor data added
+  // so far has been processed.
   void FinishTrajectory(int trajectory_id);
 
   // Must only be called if at least one unfinished trajectory exists. Returns
@@ -55,6 +55,16 @@ void PoseExtrapolator::AddPose(const common::Time time,
   UpdateVelocitiesFromPoses();
   AdvanceImuTracker(time, imu_tracker_.get());
   TrimImuData();
+  extrapolation_imu_tracker_ = common::make_unique<ImuTracker>(*imu_tracker_);
+  for (auto it = std::lower_bound(
+           imu_data_.begin(), imu_data_.end(), time,
+           [](const sensor::ImuData& imu_data, const common::Time& time) {
+             return imu_data.time < time;
+           });
+       it != imu_data_.end(); ++it) {
+    AddImuDataToExtrapolation(*it);
+  }
+  PublishExtrapolationState();
 }
 
 void PoseExtrapolator::AddImuData(const sensor::ImuData& imu_data) {
@@ -62,18 +72,31 @@ void PoseExtrapolator::AddImuData(const sensor::ImuData& imu_data) {
         imu_data.time >= timed_pose_queue_.back().time);
   imu_data_.push_back(imu_data);
   TrimImuData();
+  if (extrapolation_imu_tracker_ != nullptr) {
+    AddImuDataToExtrapolation(imu_data);
+    PublishExtrapolationState();
+  }
 }
 
-transform::Rigid3d PoseExtrapolator::ExtrapolatePose(const common::Time time) {
-  // TODO(whess): Keep the last extrapolated pose.
-  const TimedPose& newest_timed_pose = timed_pose_queue_.back();
-  CHECK_GE(time, newest_timed_pose.time);
-  const double extrapolation_delta =
-      common::ToSeconds(time - newest_timed_pose.time);
+transform::Rigid3d PoseExtrapolator::ExtrapolatePose(
+    const common::Time time) const {
+  const ExtrapolationState state = extrapolation_state_.Read();
+  CHECK(state.pose_time != common::Time::min()) << "No pose added yet.";
+  CHECK_GE(time, state.pose_time);
+  const double extrapolation_delta = common::ToSeconds(time - state.pose_time);
+  // Same as advancing a copy of 'extrapolation_imu_tracker_' to 'time'. If
+  // 'time' is older than the newest IMU data, this rotates back instead.
+  const Eigen::Quaterniond orientation =
+      (state.imu_orientation *
+       transform::AngleAxisVectorToRotationQuaternion(Eigen::Vector3d(
+           state.imu_angular_velocity *
+           common::ToSeconds(time - state.imu_time))))
+          .normalized();
   return transform::Rigid3d::Translation(extrapolation_delta *
-                                         linear_velocity_from_poses_) *
-         newest_timed_pose.pose *
-         transform::Rigid3d::Rotation(ExtrapolateRotation(time));
+                                         state.linear_velocity) *
+         state.pose *
+         transform::Rigid3d::Rotation(state.pose_orientation.inverse() *
+                                      orientation);
 }
 
 void PoseExtrapolator::UpdateVelocitiesFromPoses() {
@@ -138,12 +161,26 @@ void PoseExtrapolator::AdvanceImuTracker(const common::Time time,
   imu_tracker->Advance(time);
 }
 
-Eigen::Quaterniond PoseExtrapolator::ExtrapolateRotation(
-    const common::Time time) {
-  ImuTracker imu_tracker = *imu_tracker_;
-  AdvanceImuTracker(time, &imu_tracker);
-  const Eigen::Quaterniond last_orientation = imu_tracker_->orientation();
-  return last_orientation.inverse() * imu_tracker.orientation();
+void PoseExtrapolator::AddImuDataToExtrapolation(
+    const sensor::ImuData& imu_data) {
+  extrapolation_imu_tracker_->Advance(imu_data.time);
+  extrapolation_imu_tracker_->AddImuLinearAccelerationObservation(
+      imu_data.linear_acceleration);
+  extrapolation_imu_tracker_->AddImuAngularVelocityObservation(
+      imu_data.angular_velocity);
+}
+
+void PoseExtrapolator::PublishExtrapolationState() {
+  const TimedPose& newest_timed_pose = timed_pose_queue_.back();
+  ExtrapolationState state;
+  state.pose_time = newest_timed_pose.time;
+  state.pose = newest_timed_pose.pose;
+  state.linear_velocity = linear_velocity_from_poses_;
+  state.pose_orientation = imu_tracker_->orientation();
+  state.imu_time = extrapolation_imu_tracker_->time();
+  state.imu_orientation = extrapolation_imu_tracker_->orientation();
+  state.imu_angular_velocity = extrapolation_imu_tracker_->angular_velocity();
+  extrapolation_state_.Write(state);
 }
 
 }  // namespace mapping
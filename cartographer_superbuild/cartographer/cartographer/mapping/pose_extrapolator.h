@@ -20,6 +20,7 @@
 #include <deque>
 #include <memory>
 
+#include "cartographer/common/seqlock.h"
 #include "cartographer/common/time.h"
 #include "cartographer/mapping/imu_tracker.h"
 #include "cartographer/sensor/imu_data.h"
@@ -32,6 +33,10 @@ namespace mapping {
 // and uses the velocities to extrapolate motion. Uses IMU data if available to
 // improve the extrapolation of orientation.
 //
+// Poses and IMU data must be added from a single thread. The state needed to
+// extrapolate is published on each update, so that ExtrapolatePose() can be
+// called from any thread at high rate without taking a lock.
+//
 // TODO(whess): Add odometry and provide improved extrapolation models making
 // use of all available data.
 class PoseExtrapolator {
@@ -48,13 +53,29 @@ class PoseExtrapolator {
 
   void AddPose(common::Time time, const transform::Rigid3d& pose);
   void AddImuData(const sensor::ImuData& imu_data);
-  transform::Rigid3d ExtrapolatePose(common::Time time);
+
+  // Lock-free and safe to call from any thread once a pose was added.
+  transform::Rigid3d ExtrapolatePose(common::Time time) const;
 
  private:
+  // Everything ExtrapolatePose() needs, copied out of the queues below.
+  struct ExtrapolationState {
+    common::Time pose_time = common::Time::min();
+    transform::Rigid3d pose = transform::Rigid3d::Identity();
+    Eigen::Vector3d linear_velocity = Eigen::Vector3d::Zero();
+    // Orientation of 'imu_tracker_' at 'pose_time'.
+    Eigen::Quaterniond pose_orientation = Eigen::Quaterniond::Identity();
+    // State of 'extrapolation_imu_tracker_'.
+    common::Time imu_time = common::Time::min();
+    Eigen::Quaterniond imu_orientation = Eigen::Quaterniond::Identity();
+    Eigen::Vector3d imu_angular_velocity = Eigen::Vector3d::Zero();
+  };
+
   void UpdateVelocitiesFromPoses();
   void TrimImuData();
   void AdvanceImuTracker(common::Time time, ImuTracker* imu_tracker);
-  Eigen::Quaterniond ExtrapolateRotation(common::Time time);
+  void AddImuDataToExtrapolation(const sensor::ImuData& imu_data);
+  void PublishExtrapolationState();
 
   const common::Duration pose_queue_duration_;
   struct TimedPose {
@@ -68,6 +89,10 @@ class PoseExtrapolator {
   const double gravity_time_constant_;
   std::deque<sensor::ImuData> imu_data_;
   std::unique_ptr<ImuTracker> imu_tracker_;
+  // Copy of 'imu_tracker_' advanced through the IMU data after the newest
+  // pose.
+  std::unique_ptr<ImuTracker> extrapolation_imu_tracker_;
+  common::SeqLock<ExtrapolationState> extrapolation_state_;
 };
 
 }  // namespace mapping
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2017 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping/pose_extrapolator.h"
+
+#include <atomic>
+#include <thread>
+
+#include "Eigen/Geometry"
+#include "cartographer/transform/transform.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping {
+namespace {
+
+constexpr double kAngularVelocity = 0.5;
+
+common::Time TimeAt(const double seconds) {
+  return common::FromUniversal(1000000) + common::FromSeconds(seconds);
+}
+
+transform::Rigid3d PoseAt(const double seconds) {
+  return transform::Rigid3d(
+      Eigen::Vector3d(2. * seconds, 1., 0.),
+      Eigen::Quaterniond(Eigen::AngleAxisd(kAngularVelocity * seconds,
+                                           Eigen::Vector3d::UnitZ())));
+}
+
+sensor::ImuData ImuDataAt(const double seconds) {
+  return sensor::ImuData{TimeAt(seconds), 9.81 * Eigen::Vector3d::UnitZ(),
+                         kAngularVelocity * Eigen::Vector3d::UnitZ()};
+}
+
+TEST(PoseExtrapolatorTest, ExtrapolatesConstantMotion) {
+  PoseExtrapolator extrapolator(common::FromSeconds(1.), 10.);
+  for (int i = 0; i != 10; ++i) {
+    extrapolator.AddImuData(ImuDataAt(0.1 * i));
+    extrapolator.AddImuData(ImuDataAt(0.1 * i + 0.05));
+    extrapolator.AddPose(TimeAt(0.1 * i), PoseAt(0.1 * i));
+  }
+  extrapolator.AddImuData(ImuDataAt(0.95));
+  for (const double seconds : {0.9, 0.93, 1.2}) {
+    const transform::Rigid3d expected = PoseAt(seconds);
+    const transform::Rigid3d actual =
+        extrapolator.ExtrapolatePose(TimeAt(seconds));
+    EXPECT_NEAR(0., (expected.translation() - actual.translation()).norm(),
+                1e-6);
+    EXPECT_NEAR(0., transform::GetAngle(expected.inverse() * actual), 1e-6);
+  }
+}
+
+TEST(PoseExtrapolatorTest, ExtrapolatesConcurrentlyWithUpdates) {
+  PoseExtrapolator extrapolator(common::FromSeconds(1.), 10.);
+  extrapolator.AddPose(TimeAt(0.), PoseAt(0.));
+  std::atomic<bool> done(false);
+  std::thread reader([&extrapolator, &done]() {
+    while (!done) {
+      const transform::Rigid3d pose = extrapolator.ExtrapolatePose(TimeAt(10.));
+      EXPECT_NEAR(1., pose.translation().y(), 1e-6);
+      EXPECT_NEAR(1., pose.rotation().norm(), 1e-6);
+    }
+  });
+  for (int i = 1; i != 1000; ++i) {
+    extrapolator.AddImuData(ImuDataAt(0.001 * i - 0.0005));
+    extrapolator.AddPose(TimeAt(0.001 * i), PoseAt(0.001 * i));
+  }
+  done = true;
+  reader.join();
+}
+
+}  // namespace
+}  // namespace mapping
+}  // namespace cartographer
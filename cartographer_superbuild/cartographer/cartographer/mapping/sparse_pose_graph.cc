@@ -55,6 +55,12 @@ proto::SparsePoseGraphOptions CreateSparsePoseGraphOptions(
   CHECK_GT(options.max_num_final_iterations(), 0);
   options.set_global_sampling_ratio(
       parameter_dictionary->GetDouble("global_sampling_ratio"));
+  options.set_place_recognition_num_candidates(
+      parameter_dictionary->GetNonNegativeInt(
+          "place_recognition_num_candidates"));
+  options.set_place_recognition_max_range(
+      parameter_dictionary->GetDouble("place_recognition_max_range"));
+  CHECK_GT(options.place_recognition_max_range(), 0.);
   return options;
 }
 
@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/seqlock.h"
 #include "cartographer/mapping/id.h"
 #include "cartographer/mapping/pose_graph_trimmer.h"
 #include "cartographer/mapping/proto/serialization.pb.h"
@@ -108,6 +109,12 @@ class SparsePoseGraph {
   // discontinuous, loop-closed frame).
   virtual transform::Rigid3d GetLocalToGlobalTransform(int trajectory_id) = 0;
 
+  // Returns a snapshot of GetLocalToGlobalTransform() which is updated when
+  // the transform changes and may be read from any thread without locking.
+  // The snapshot stays valid for the lifetime of the SparsePoseGraph.
+  virtual const common::SeqLock<transform::Rigid3d>&
+  GetLocalToGlobalTransformSnapshot(int trajectory_id) = 0;
+
   // Returns the current optimized trajectories.
   virtual std::vector<std::vector<TrajectoryNode>> GetTrajectoryNodes() = 0;
 
@@ -21,6 +21,7 @@
 #include "cartographer/mapping_3d/scan_matching/ceres_scan_matcher.h"
 #include "cartographer/mapping_3d/scan_matching/fast_correlative_scan_matcher.h"
 #include "cartographer/sensor/voxel_filter.h"
+#include "glog/logging.h"
 
 namespace cartographer {
 namespace mapping {
@@ -43,6 +44,9 @@ proto::ConstraintBuilderOptions CreateConstraintBuilderOptions(
   options.set_loop_closure_rotation_weight(
       parameter_dictionary->GetDouble("loop_closure_rotation_weight"));
   options.set_log_matches(parameter_dictionary->GetBool("log_matches"));
+  options.set_scan_matcher_cache_max_megabytes(
+      parameter_dictionary->GetDouble("scan_matcher_cache_max_megabytes"));
+  CHECK_GE(options.scan_matcher_cache_max_megabytes(), 0.);
   *options.mutable_fast_correlative_scan_matcher_options() =
       mapping_2d::scan_matching::CreateFastCorrelativeScanMatcherOptions(
           parameter_dictionary->GetDictionary("fast_correlative_scan_matcher")
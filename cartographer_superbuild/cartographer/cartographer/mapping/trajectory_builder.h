@@ -59,11 +59,15 @@ class TrajectoryBuilder {
   TrajectoryBuilder(const TrajectoryBuilder&) = delete;
   TrajectoryBuilder& operator=(const TrajectoryBuilder&) = delete;
 
-  virtual const PoseEstimate& pose_estimate() const = 0;
+  virtual PoseEstimate pose_estimate() const = 0;
 
   virtual void AddSensorData(const string& sensor_id,
                              std::unique_ptr<sensor::Data> data) = 0;
 
+  // Blocks until all sensor data which was passed on for processing so far has
+  // been processed. Sensor data may still be held back for collation.
+  virtual void Flush() = 0;
+
   void AddRangefinderData(const string& sensor_id, common::Time time,
                           const Eigen::Vector3f& origin,
                           const sensor::PointCloud& ranges) {
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_2d/admission_controller.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace cartographer {
+namespace mapping_2d {
+
+namespace {
+
+// Degradation levels at which each measure starts to apply. From
+// 'kFirstDroppingLevel' on, 1 of ('level' - 'kFirstDroppingLevel' + 2) range
+// data is admitted.
+constexpr int kShrinkSearchWindowLevel = 1;
+constexpr int kCoarsenVoxelFilterLevel = 2;
+constexpr int kFirstDroppingLevel = 3;
+constexpr int kMaxDegradationLevel = 5;
+
+constexpr double kSearchWindowScale = 0.5;
+constexpr float kVoxelFilterSizeScale = 2.f;
+
+}  // namespace
+
+proto::AdmissionControllerOptions CreateAdmissionControllerOptions(
+    common::LuaParameterDictionary* const parameter_dictionary) {
+  proto::AdmissionControllerOptions options;
+  options.set_measurement_period(
+      parameter_dictionary->GetDouble("measurement_period"));
+  options.set_max_load(parameter_dictionary->GetDouble("max_load"));
+  options.set_min_load(parameter_dictionary->GetDouble("min_load"));
+  options.set_max_queue_depth(
+      parameter_dictionary->GetNonNegativeInt("max_queue_depth"));
+  CHECK_GE(options.measurement_period(), 0.);
+  CHECK_LT(options.min_load(), options.max_load());
+  return options;
+}
+
+AdmissionController::AdmissionController(
+    const proto::AdmissionControllerOptions& options,
+    const bool stages_run_in_parallel)
+    : options_(options), stages_run_in_parallel_(stages_run_in_parallel) {
+  stage_durations_.fill(common::Duration::zero());
+}
+
+bool AdmissionController::Admit(const common::Time time,
+                                const int queue_depth) {
+  if (options_.measurement_period() == 0.) {
+    return true;
+  }
+  common::MutexLocker locker(&mutex_);
+  if (period_start_ == common::Time::min()) {
+    period_start_ = time;
+  }
+  const double period_seconds = common::ToSeconds(time - period_start_);
+  if (period_seconds >= options_.measurement_period()) {
+    const common::Duration busy_duration =
+        stages_run_in_parallel_
+            ? *std::max_element(stage_durations_.begin(),
+                                stage_durations_.end())
+            : stage_durations_[0] + stage_durations_[1];
+    const double load = common::ToSeconds(busy_duration) / period_seconds;
+    if ((load > options_.max_load() ||
+         queue_depth > options_.max_queue_depth()) &&
+        degradation_level_ < kMaxDegradationLevel) {
+      ++degradation_level_;
+      LOG(WARNING) << "Local SLAM is overloaded (load " << load << ", "
+                   << queue_depth << " range data queued), degrading: "
+                   << DescribeDegradation(degradation_level_) << ".";
+    } else if (load < options_.min_load() && queue_depth == 0 &&
+               degradation_level_ > 0) {
+      --degradation_level_;
+      LOG(INFO) << "Local SLAM load is " << load << ", recovering: "
+                << DescribeDegradation(degradation_level_) << ".";
+    }
+    if (num_dropped_ > 0) {
+      LOG(WARNING) << "Dropped " << num_dropped_ << " of " << num_offered_
+                   << " range data due to overload.";
+    }
+    period_start_ = time;
+    stage_durations_.fill(common::Duration::zero());
+    num_offered_ = 0;
+    num_dropped_ = 0;
+  }
+
+  ++num_offered_;
+  if (degradation_level_ >= kFirstDroppingLevel &&
+      num_offered_ % (degradation_level_ - kFirstDroppingLevel + 2) != 0) {
+    ++num_dropped_;
+    return false;
+  }
+  return true;
+}
+
+void AdmissionController::AddStageDuration(const Stage stage,
+                                           const common::Duration duration) {
+  common::MutexLocker locker(&mutex_);
+  stage_durations_[static_cast<int>(stage)] += duration;
+}
+
+double AdmissionController::search_window_scale() const {
+  common::MutexLocker locker(&mutex_);
+  return degradation_level_ >= kShrinkSearchWindowLevel ? kSearchWindowScale
+                                                        : 1.;
+}
+
+float AdmissionController::voxel_filter_size_scale() const {
+  common::MutexLocker locker(&mutex_);
+  return degradation_level_ >= kCoarsenVoxelFilterLevel ? kVoxelFilterSizeScale
+                                                        : 1.f;
+}
+
+int AdmissionController::degradation_level() const {
+  common::MutexLocker locker(&mutex_);
+  return degradation_level_;
+}
+
+string AdmissionController::DescribeDegradation(
+    const int degradation_level) {
+  if (degradation_level == 0) {
+    return "nothing degraded";
+  }
+  std::ostringstream description;
+  if (degradation_level >= kShrinkSearchWindowLevel) {
+    description << "real-time correlative scan matcher search windows scaled "
+                   "by "
+                << kSearchWindowScale;
+  }
+  if (degradation_level >= kCoarsenVoxelFilterLevel) {
+    description << ", voxel filter size scaled by " << kVoxelFilterSizeScale;
+  }
+  if (degradation_level >= kFirstDroppingLevel) {
+    description << ", admitting 1 of "
+                << degradation_level - kFirstDroppingLevel + 2
+                << " range data";
+  }
+  return description.str();
+}
+
+}  // namespace mapping_2d
+}  // namespace cartographer
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_MAPPING_2D_ADMISSION_CONTROLLER_H_
+#define CARTOGRAPHER_MAPPING_2D_ADMISSION_CONTROLLER_H_
+
+#include <array>
+
+#include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/port.h"
+#include "cartographer/common/time.h"
+#include "cartographer/mapping_2d/proto/admission_controller_options.pb.h"
+
+namespace cartographer {
+namespace mapping_2d {
+
+proto::AdmissionControllerOptions CreateAdmissionControllerOptions(
+    common::LuaParameterDictionary* parameter_dictionary);
+
+// Keeps local SLAM from falling behind the sensor data when the CPU is
+// saturated. It measures the time spent in each stage of local SLAM relative
+// to the sensor time of the range data, and under overload degrades local
+// SLAM step by step: first the real-time correlative scan matcher search
+// windows are shrunk, then the voxel filter is coarsened, and finally more and
+// more range data is dropped. Once the load is low again, it recovers step by
+// step.
+//
+// This class is thread-safe.
+class AdmissionController {
+ public:
+  enum class Stage { kPreprocessing, kMatching };
+
+  // If 'stages_run_in_parallel', the load is that of the slowest stage,
+  // otherwise that of all stages together.
+  AdmissionController(const proto::AdmissionControllerOptions& options,
+                      bool stages_run_in_parallel);
+
+  AdmissionController(const AdmissionController&) = delete;
+  AdmissionController& operator=(const AdmissionController&) = delete;
+
+  // Returns false if the range data at 'time' should be dropped. 'queue_depth'
+  // is the number of range data waiting to be processed.
+  bool Admit(common::Time time, int queue_depth) EXCLUDES(mutex_);
+
+  // Records that 'stage' took 'duration' of wall time for one range data.
+  void AddStageDuration(Stage stage, common::Duration duration)
+      EXCLUDES(mutex_);
+
+  // Factor to apply to the real-time correlative scan matcher search windows.
+  double search_window_scale() const EXCLUDES(mutex_);
+
+  // Factor to apply to the voxel filter size.
+  float voxel_filter_size_scale() const EXCLUDES(mutex_);
+
+  // 0 if local SLAM is not degraded, higher the more it is.
+  int degradation_level() const EXCLUDES(mutex_);
+
+ private:
+  // Returns a description of what is degraded at 'degradation_level'.
+  static string DescribeDegradation(int degradation_level);
+
+  const proto::AdmissionControllerOptions options_;
+  const bool stages_run_in_parallel_;
+
+  mutable common::Mutex mutex_;
+  int degradation_level_ GUARDED_BY(mutex_) = 0;
+  // Start of the current measurement period and the wall time spent in each
+  // stage since.
+  common::Time period_start_ GUARDED_BY(mutex_) = common::Time::min();
+  std::array<common::Duration, 2> stage_durations_ GUARDED_BY(mutex_);
+  int num_offered_ GUARDED_BY(mutex_) = 0;
+  int num_dropped_ GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace mapping_2d
+}  // namespace cartographer
+
+#endif  // CARTOGRAPHER_MAPPING_2D_ADMISSION_CONTROLLER_H_
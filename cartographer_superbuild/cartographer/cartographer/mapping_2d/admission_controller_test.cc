@@ -0,0 +1,117 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_2d/admission_controller.h"
+
+#include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace {
+
+class AdmissionControllerTest : public ::testing::Test {
+ protected:
+  AdmissionControllerTest() {
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          measurement_period = 1.,
+          max_load = 0.8,
+          min_load = 0.4,
+          max_queue_depth = 2,
+        })text");
+    options_ = CreateAdmissionControllerOptions(parameter_dictionary.get());
+  }
+
+  // Offers range data at 10 Hz for one second, each taking 'seconds' of wall
+  // time in both stages. Returns the number of admitted range data.
+  int OfferForOneSecond(const double seconds, const int queue_depth,
+                        AdmissionController* const admission_controller) {
+    int num_admitted = 0;
+    for (int i = 0; i != 10; ++i) {
+      time_ += common::FromSeconds(0.1);
+      if (admission_controller->Admit(time_, queue_depth)) {
+        ++num_admitted;
+        admission_controller->AddStageDuration(
+            AdmissionController::Stage::kPreprocessing,
+            common::FromSeconds(seconds));
+        admission_controller->AddStageDuration(
+            AdmissionController::Stage::kMatching,
+            common::FromSeconds(seconds));
+      }
+    }
+    return num_admitted;
+  }
+
+  proto::AdmissionControllerOptions options_;
+  common::Time time_ = common::FromUniversal(0);
+};
+
+TEST_F(AdmissionControllerTest, DegradesUnderLoadAndRecovers) {
+  AdmissionController admission_controller(options_,
+                                           false /* stages_run_in_parallel */);
+  EXPECT_EQ(10, OfferForOneSecond(0.02, 0, &admission_controller));
+  EXPECT_EQ(0, admission_controller.degradation_level());
+
+  // Both stages together take longer than the time between range data. The
+  // load of each second is acted upon at the start of the next.
+  EXPECT_EQ(10, OfferForOneSecond(0.06, 0, &admission_controller));
+  EXPECT_EQ(0, admission_controller.degradation_level());
+  EXPECT_EQ(10, OfferForOneSecond(0.06, 0, &admission_controller));
+  EXPECT_EQ(1, admission_controller.degradation_level());
+  EXPECT_EQ(0.5, admission_controller.search_window_scale());
+  EXPECT_EQ(1.f, admission_controller.voxel_filter_size_scale());
+  OfferForOneSecond(0.06, 0, &admission_controller);
+  EXPECT_EQ(2, admission_controller.degradation_level());
+  EXPECT_EQ(2.f, admission_controller.voxel_filter_size_scale());
+  EXPECT_EQ(5, OfferForOneSecond(0.06, 0, &admission_controller));
+  EXPECT_EQ(3, admission_controller.degradation_level());
+  // Dropping half of the range data is enough for this load.
+  OfferForOneSecond(0.06, 0, &admission_controller);
+  EXPECT_EQ(3, admission_controller.degradation_level());
+  for (int i = 0; i != 5; ++i) {
+    OfferForOneSecond(0.2, 0, &admission_controller);
+  }
+  EXPECT_EQ(5, admission_controller.degradation_level());
+
+  for (int i = 0; i != 6; ++i) {
+    OfferForOneSecond(0.01, 0, &admission_controller);
+  }
+  EXPECT_EQ(0, admission_controller.degradation_level());
+  EXPECT_EQ(1., admission_controller.search_window_scale());
+  EXPECT_EQ(10, OfferForOneSecond(0.01, 0, &admission_controller));
+}
+
+TEST_F(AdmissionControllerTest, ParallelStagesAndQueueDepth) {
+  AdmissionController admission_controller(options_,
+                                           true /* stages_run_in_parallel */);
+  // Each stage on its own keeps up.
+  OfferForOneSecond(0.06, 0, &admission_controller);
+  OfferForOneSecond(0.06, 0, &admission_controller);
+  EXPECT_EQ(0, admission_controller.degradation_level());
+
+  // Range data piling up in the pipeline counts as overload.
+  OfferForOneSecond(0.01, 3, &admission_controller);
+  EXPECT_EQ(1, admission_controller.degradation_level());
+  OfferForOneSecond(0.01, 1, &admission_controller);
+  EXPECT_EQ(1, admission_controller.degradation_level());
+  OfferForOneSecond(0.01, 0, &admission_controller);
+  EXPECT_EQ(0, admission_controller.degradation_level());
+}
+
+}  // namespace
+}  // namespace mapping_2d
+}  // namespace cartographer
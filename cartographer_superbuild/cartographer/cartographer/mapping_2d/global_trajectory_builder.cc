@@ -24,7 +24,12 @@ GlobalTrajectoryBuilder::GlobalTrajectoryBuilder(
     const int trajectory_id, SparsePoseGraph* sparse_pose_graph)
     : trajectory_id_(trajectory_id),
       sparse_pose_graph_(sparse_pose_graph),
-      local_trajectory_builder_(options) {}
+      local_trajectory_builder_(
+          options,
+          [this](std::unique_ptr<LocalTrajectoryBuilder::InsertionResult>
+                     insertion_result) {
+            AddInsertionResult(std::move(insertion_result));
+          }) {}
 
 GlobalTrajectoryBuilder::~GlobalTrajectoryBuilder() {}
 
@@ -34,16 +39,20 @@ void GlobalTrajectoryBuilder::AddRangefinderData(
   std::unique_ptr<LocalTrajectoryBuilder::InsertionResult> insertion_result =
       local_trajectory_builder_.AddHorizontalRangeData(
           time, sensor::RangeData{origin, ranges, {}});
-  if (insertion_result == nullptr) {
-    return;
+  if (insertion_result != nullptr) {
+    AddInsertionResult(std::move(insertion_result));
   }
+}
+
+void GlobalTrajectoryBuilder::AddInsertionResult(
+    std::unique_ptr<LocalTrajectoryBuilder::InsertionResult>
+        insertion_result) {
   // Insert scan into submap at best estimated pose
   sparse_pose_graph_->AddScan(
       insertion_result->time, insertion_result->tracking_to_tracking_2d,
       insertion_result->range_data_in_tracking_2d,
       insertion_result->pose_estimate_2d, trajectory_id_,
       std::move(insertion_result->insertion_submaps));
-
 }
 
 void GlobalTrajectoryBuilder::AddImuData(
@@ -60,7 +69,9 @@ void GlobalTrajectoryBuilder::AddOdometerData(const common::Time time,
   local_trajectory_builder_.AddOdometerData(time, pose);
 }
 
-const mapping::GlobalTrajectoryBuilderInterface::PoseEstimate&
+void GlobalTrajectoryBuilder::Flush() { local_trajectory_builder_.Flush(); }
+
+mapping::GlobalTrajectoryBuilderInterface::PoseEstimate
 GlobalTrajectoryBuilder::pose_estimate() const {
   return local_trajectory_builder_.pose_estimate();
 }
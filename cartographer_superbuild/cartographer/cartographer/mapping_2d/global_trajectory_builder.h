@@ -35,7 +35,7 @@ class GlobalTrajectoryBuilder
   GlobalTrajectoryBuilder(const GlobalTrajectoryBuilder&) = delete;
   GlobalTrajectoryBuilder& operator=(const GlobalTrajectoryBuilder&) = delete;
 
-  const mapping::GlobalTrajectoryBuilderInterface::PoseEstimate& pose_estimate()
+  mapping::GlobalTrajectoryBuilderInterface::PoseEstimate pose_estimate()
       const override;
 
   // Projects 'ranges' into 2D. Therefore, 'ranges' should be approximately
@@ -46,8 +46,13 @@ class GlobalTrajectoryBuilder
                   const Eigen::Vector3d& angular_velocity) override;
   void AddOdometerData(common::Time time,
                        const transform::Rigid3d& pose) override;
+  void Flush() override;
 
  private:
+  void AddInsertionResult(
+      std::unique_ptr<LocalTrajectoryBuilder::InsertionResult>
+          insertion_result);
+
   const int trajectory_id_;
   SparsePoseGraph* const sparse_pose_graph_;
   LocalTrajectoryBuilder local_trajectory_builder_;
@@ -16,6 +16,7 @@
 
 #include "cartographer/mapping_2d/local_trajectory_builder.h"
 
+#include <chrono>
 #include <limits>
 
 #include "cartographer/common/make_unique.h"
@@ -24,34 +25,136 @@
 namespace cartographer {
 namespace mapping_2d {
 
+namespace {
+
+common::Duration WallTimeSince(
+    const std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<common::Duration>(
+      std::chrono::steady_clock::now() - start);
+}
+
+}  // namespace
+
 LocalTrajectoryBuilder::LocalTrajectoryBuilder(
     const proto::LocalTrajectoryBuilderOptions& options)
+    : LocalTrajectoryBuilder(options, nullptr) {}
+
+LocalTrajectoryBuilder::LocalTrajectoryBuilder(
+    const proto::LocalTrajectoryBuilderOptions& options,
+    InsertionResultCallback insertion_result_callback)
     : options_(options),
+      insertion_result_callback_(std::move(insertion_result_callback)),
       active_submaps_(options.submaps_options()),
+      admission_controller_(options_.admission_controller_options(),
+                            options_.pipeline_queue_size() > 0),
       motion_filter_(options_.motion_filter_options()),
       real_time_correlative_scan_matcher_(
           options_.real_time_correlative_scan_matcher_options()),
       ceres_scan_matcher_(options_.ceres_scan_matcher_options()),
-      odometry_state_tracker_(options_.num_odometry_states()) {}
+      odometry_state_tracker_(options_.num_odometry_states()),
+      preprocessing_queue_(options_.pipeline_queue_size()),
+      matching_queue_(options_.pipeline_queue_size()) {
+  if (options_.pipeline_queue_size() > 0) {
+    CHECK(insertion_result_callback_ != nullptr)
+        << "Pipelining requires an insertion result callback.";
+    preprocessing_thread_ = std::thread([this]() { RunPreprocessing(); });
+    matching_thread_ = std::thread([this]() { RunMatching(); });
+  }
+}
 
-LocalTrajectoryBuilder::~LocalTrajectoryBuilder() {}
+LocalTrajectoryBuilder::~LocalTrajectoryBuilder() {
+  if (options_.pipeline_queue_size() > 0) {
+    // Range data already in the pipeline is still matched and inserted.
+    preprocessing_queue_.Push(nullptr);
+    preprocessing_thread_.join();
+    matching_thread_.join();
+  }
+}
 
 sensor::RangeData LocalTrajectoryBuilder::TransformAndFilterRangeData(
     const transform::Rigid3f& tracking_to_tracking_2d,
-    const sensor::RangeData& range_data) const {
+    const float voxel_filter_size, const sensor::RangeData& range_data) const {
   const sensor::RangeData cropped = sensor::CropRangeData(
       sensor::TransformRangeData(range_data, tracking_to_tracking_2d),
       options_.min_z(), options_.max_z());
   return sensor::RangeData{
       cropped.origin,
-      sensor::VoxelFiltered(cropped.returns, options_.voxel_filter_size()),
-      sensor::VoxelFiltered(cropped.misses, options_.voxel_filter_size())};
+      sensor::VoxelFiltered(cropped.returns, voxel_filter_size),
+      sensor::VoxelFiltered(cropped.misses, voxel_filter_size)};
+}
+
+bool LocalTrajectoryBuilder::Preprocess(
+    AccumulatedRangeData* const accumulated_range_data) {
+  const auto start = std::chrono::steady_clock::now();
+  accumulated_range_data->range_data = TransformAndFilterRangeData(
+      accumulated_range_data->tracking_to_tracking_2d.cast<float>(),
+      admission_controller_.voxel_filter_size_scale() *
+          options_.voxel_filter_size(),
+      accumulated_range_data->range_data);
+  if (accumulated_range_data->range_data.returns.empty()) {
+    LOG(WARNING) << "Dropped empty horizontal range data.";
+    admission_controller_.AddStageDuration(
+        AdmissionController::Stage::kPreprocessing, WallTimeSince(start));
+    return false;
+  }
+  sensor::AdaptiveVoxelFilter adaptive_voxel_filter(
+      options_.adaptive_voxel_filter_options());
+  accumulated_range_data->filtered_point_cloud_in_tracking_2d =
+      adaptive_voxel_filter.Filter(accumulated_range_data->range_data.returns);
+  admission_controller_.AddStageDuration(
+      AdmissionController::Stage::kPreprocessing, WallTimeSince(start));
+  return true;
+}
+
+void LocalTrajectoryBuilder::RunPreprocessing() {
+  for (;;) {
+    std::unique_ptr<AccumulatedRangeData> accumulated_range_data =
+        preprocessing_queue_.Pop();
+    if (accumulated_range_data == nullptr) {
+      matching_queue_.Push(nullptr);
+      return;
+    }
+    if (Preprocess(accumulated_range_data.get())) {
+      matching_queue_.Push(std::move(accumulated_range_data));
+    } else {
+      FinishPipelinedRangeData();
+    }
+  }
+}
+
+void LocalTrajectoryBuilder::RunMatching() {
+  for (;;) {
+    const std::unique_ptr<AccumulatedRangeData> accumulated_range_data =
+        matching_queue_.Pop();
+    if (accumulated_range_data == nullptr) {
+      return;
+    }
+    std::unique_ptr<InsertionResult> insertion_result =
+        MatchAndInsert(*accumulated_range_data);
+    if (insertion_result != nullptr) {
+      insertion_result_callback_(std::move(insertion_result));
+    }
+    FinishPipelinedRangeData();
+  }
+}
+
+void LocalTrajectoryBuilder::FinishPipelinedRangeData() {
+  common::MutexLocker lock(&mutex_);
+  CHECK_GT(num_pipelined_range_data_, 0);
+  --num_pipelined_range_data_;
+}
+
+void LocalTrajectoryBuilder::Flush() {
+  common::MutexLocker lock(&mutex_);
+  lock.Await([this]() REQUIRES(mutex_) {
+    return num_pipelined_range_data_ == 0;
+  });
 }
 
 void LocalTrajectoryBuilder::ScanMatch(
-    common::Time time, const transform::Rigid3d& pose_prediction,
+    const transform::Rigid3d& pose_prediction,
     const transform::Rigid3d& tracking_to_tracking_2d,
-    const sensor::RangeData& range_data_in_tracking_2d,
+    const sensor::PointCloud& filtered_point_cloud_in_tracking_2d,
     transform::Rigid3d* pose_observation) {
   std::shared_ptr<const Submap> matching_submap =
       active_submaps_.submaps().front();
@@ -60,22 +163,21 @@ void LocalTrajectoryBuilder::ScanMatch(
   // The online correlative scan matcher will refine the initial estimate for
   // the Ceres scan matcher.
   transform::Rigid2d initial_ceres_pose = pose_prediction_2d;
-  sensor::AdaptiveVoxelFilter adaptive_voxel_filter(
-      options_.adaptive_voxel_filter_options());
-  const sensor::PointCloud filtered_point_cloud_in_tracking_2d =
-      adaptive_voxel_filter.Filter(range_data_in_tracking_2d.returns);
+  const std::shared_ptr<const ProbabilityLookupGrid> probability_lookup_grid =
+      matching_submap->probability_lookup_grid();
   if (options_.use_online_correlative_scan_matching()) {
     real_time_correlative_scan_matcher_.Match(
         pose_prediction_2d, filtered_point_cloud_in_tracking_2d,
-        matching_submap->probability_grid(), &initial_ceres_pose);
+        *probability_lookup_grid, admission_controller_.search_window_scale(),
+        &initial_ceres_pose);
   }
 
   transform::Rigid2d tracking_2d_to_map;
   ceres::Solver::Summary summary;
   ceres_scan_matcher_.Match(pose_prediction_2d, initial_ceres_pose,
                             filtered_point_cloud_in_tracking_2d,
-                            matching_submap->probability_grid(),
-                            &tracking_2d_to_map, &summary);
+                            *probability_lookup_grid, &tracking_2d_to_map,
+                            &summary);
 
   *pose_observation =
       transform::Embed3D(tracking_2d_to_map) * tracking_to_tracking_2d;
@@ -84,27 +186,32 @@ void LocalTrajectoryBuilder::ScanMatch(
 std::unique_ptr<LocalTrajectoryBuilder::InsertionResult>
 LocalTrajectoryBuilder::AddHorizontalRangeData(
     const common::Time time, const sensor::RangeData& range_data) {
-  // Initialize IMU tracker now if we do not ever use an IMU.
-  if (!options_.use_imu_data()) {
-    InitializeImuTracker(time);
-  }
+  transform::Rigid3f pose_estimate;
+  {
+    common::MutexLocker lock(&mutex_);
+    // Initialize IMU tracker now if we do not ever use an IMU.
+    if (!options_.use_imu_data()) {
+      InitializeImuTracker(time);
+    }
 
-  if (imu_tracker_ == nullptr) {
-    // Until we've initialized the IMU tracker with our first IMU message, we
-    // cannot compute the orientation of the rangefinder.
-    LOG(INFO) << "ImuTracker not yet initialized.";
-    return nullptr;
-  }
+    if (imu_tracker_ == nullptr) {
+      // Until we've initialized the IMU tracker with our first IMU message, we
+      // cannot compute the orientation of the rangefinder.
+      LOG(INFO) << "ImuTracker not yet initialized.";
+      return nullptr;
+    }
 
-  Predict(time);
+    Predict(time);
+    pose_estimate = pose_estimate_.cast<float>();
+  }
   if (num_accumulated_ == 0) {
-    first_pose_estimate_ = pose_estimate_.cast<float>();
+    first_pose_estimate_ = pose_estimate;
     accumulated_range_data_ =
         sensor::RangeData{Eigen::Vector3f::Zero(), {}, {}};
   }
 
   const transform::Rigid3f tracking_delta =
-      first_pose_estimate_.inverse() * pose_estimate_.cast<float>();
+      first_pose_estimate_.inverse() * pose_estimate;
   const sensor::RangeData range_data_in_first_tracking =
       sensor::TransformRangeData(range_data, tracking_delta);
   // Drop any returns below the minimum range and convert returns beyond the
@@ -136,68 +243,95 @@ LocalTrajectoryBuilder::AddHorizontalRangeData(
 std::unique_ptr<LocalTrajectoryBuilder::InsertionResult>
 LocalTrajectoryBuilder::AddAccumulatedRangeData(
     const common::Time time, const sensor::RangeData& range_data) {
-  const transform::Rigid3d odometry_prediction =
-      pose_estimate_ * odometry_correction_;
-  const transform::Rigid3d model_prediction = pose_estimate_;
-  // TODO(whess): Prefer IMU over odom orientation if configured?
-  const transform::Rigid3d& pose_prediction = odometry_prediction;
+  if (!admission_controller_.Admit(
+          time, preprocessing_queue_.Size() + matching_queue_.Size())) {
+    return nullptr;
+  }
+  auto accumulated_range_data = common::make_unique<AccumulatedRangeData>();
+  accumulated_range_data->time = time;
+  transform::Rigid3d pose_prediction;
+  {
+    common::MutexLocker lock(&mutex_);
+    accumulated_range_data->imu_orientation = imu_tracker_->orientation();
+    accumulated_range_data->odometry_correction = odometry_correction_;
+    // TODO(whess): Prefer IMU over odom orientation if configured?
+    pose_prediction = pose_estimate_ * odometry_correction_;
+  }
 
   // Computes the rotation without yaw, as defined by GetYaw().
-  const transform::Rigid3d tracking_to_tracking_2d =
+  accumulated_range_data->tracking_to_tracking_2d =
       transform::Rigid3d::Rotation(
           Eigen::Quaterniond(Eigen::AngleAxisd(
               -transform::GetYaw(pose_prediction), Eigen::Vector3d::UnitZ())) *
           pose_prediction.rotation());
+  accumulated_range_data->range_data = range_data;
 
-  const sensor::RangeData range_data_in_tracking_2d =
-      TransformAndFilterRangeData(tracking_to_tracking_2d.cast<float>(),
-                                  range_data);
-
-  if (range_data_in_tracking_2d.returns.empty()) {
-    LOG(WARNING) << "Dropped empty horizontal range data.";
+  if (options_.pipeline_queue_size() > 0) {
+    {
+      common::MutexLocker lock(&mutex_);
+      ++num_pipelined_range_data_;
+    }
+    // Blocks while the pipeline is full.
+    preprocessing_queue_.Push(std::move(accumulated_range_data));
     return nullptr;
   }
-
-  ScanMatch(time, pose_prediction, tracking_to_tracking_2d,
-            range_data_in_tracking_2d, &pose_estimate_);
-  odometry_correction_ = transform::Rigid3d::Identity();
-  if (!odometry_state_tracker_.empty()) {
-    // We add an odometry state, so that the correction from the scan matching
-    // is not removed by the next odometry data we get.
-    odometry_state_tracker_.AddOdometryState(
-        {time, odometry_state_tracker_.newest().odometer_pose,
-         odometry_state_tracker_.newest().state_pose *
-             odometry_prediction.inverse() * pose_estimate_});
+  if (!Preprocess(accumulated_range_data.get())) {
+    return nullptr;
   }
+  return MatchAndInsert(*accumulated_range_data);
+}
 
-  // Improve the velocity estimate.
-  if (last_scan_match_time_ > common::Time::min() &&
-      time > last_scan_match_time_) {
-    const double delta_t = common::ToSeconds(time - last_scan_match_time_);
-    // This adds the observed difference in velocity that would have reduced the
-    // error to zero.
-    velocity_estimate_ += (pose_estimate_.translation().head<2>() -
-                           model_prediction.translation().head<2>()) /
-                          delta_t;
+std::unique_ptr<LocalTrajectoryBuilder::InsertionResult>
+LocalTrajectoryBuilder::MatchAndInsert(
+    const AccumulatedRangeData& accumulated_range_data) {
+  const auto start = std::chrono::steady_clock::now();
+  const common::Time time = accumulated_range_data.time;
+  const transform::Rigid3d& tracking_to_tracking_2d =
+      accumulated_range_data.tracking_to_tracking_2d;
+  const sensor::RangeData& range_data_in_tracking_2d =
+      accumulated_range_data.range_data;
+
+  transform::Rigid3d pose_prediction;
+  transform::Rigid3d model_prediction;
+  {
+    common::MutexLocker lock(&mutex_);
+    // The current estimate includes the scan matches of all earlier range
+    // data, even those which finished after this range data was accumulated.
+    // Without pipelining, 'time_' equals 'time'.
+    model_prediction = ExtrapolatePose(
+        pose_estimate_, time_, imu_tracker_->orientation(), time,
+        accumulated_range_data.imu_orientation);
+    pose_prediction =
+        model_prediction * accumulated_range_data.odometry_correction;
   }
-  last_scan_match_time_ = time_;
 
+  transform::Rigid3d pose_observation;
+  ScanMatch(pose_prediction, tracking_to_tracking_2d,
+            accumulated_range_data.filtered_point_cloud_in_tracking_2d,
+            &pose_observation);
   // Remove the untracked z-component which floats around 0 in the UKF.
-  const auto translation = pose_estimate_.translation();
-  pose_estimate_ = transform::Rigid3d(
+  const auto translation = pose_observation.translation();
+  pose_observation = transform::Rigid3d(
       transform::Rigid3d::Vector(translation.x(), translation.y(), 0.),
-      pose_estimate_.rotation());
+      pose_observation.rotation());
 
   const transform::Rigid3d tracking_2d_to_map =
-      pose_estimate_ * tracking_to_tracking_2d.inverse();
-  last_pose_estimate_ = {
-      time, pose_estimate_,
-      sensor::TransformPointCloud(range_data_in_tracking_2d.returns,
-                                  tracking_2d_to_map.cast<float>())};
+      pose_observation * tracking_to_tracking_2d.inverse();
+  {
+    common::MutexLocker lock(&mutex_);
+    ApplyScanMatch(time, accumulated_range_data.imu_orientation,
+                   pose_prediction, model_prediction, pose_observation);
+    last_pose_estimate_ = {
+        time, pose_observation,
+        sensor::TransformPointCloud(range_data_in_tracking_2d.returns,
+                                    tracking_2d_to_map.cast<float>())};
+  }
 
   const transform::Rigid2d pose_estimate_2d =
       transform::Project2D(tracking_2d_to_map);
   if (motion_filter_.IsSimilar(time, transform::Embed3D(pose_estimate_2d))) {
+    admission_controller_.AddStageDuration(
+        AdmissionController::Stage::kMatching, WallTimeSince(start));
     return nullptr;
   }
 
@@ -210,14 +344,53 @@ LocalTrajectoryBuilder::AddAccumulatedRangeData(
   active_submaps_.InsertRangeData(
       TransformRangeData(range_data_in_tracking_2d,
                          transform::Embed3D(pose_estimate_2d.cast<float>())));
+  admission_controller_.AddStageDuration(AdmissionController::Stage::kMatching,
+                                         WallTimeSince(start));
 
   return common::make_unique<InsertionResult>(InsertionResult{
       time, std::move(insertion_submaps), tracking_to_tracking_2d,
       range_data_in_tracking_2d, pose_estimate_2d});
 }
 
-const LocalTrajectoryBuilder::PoseEstimate&
-LocalTrajectoryBuilder::pose_estimate() const {
+void LocalTrajectoryBuilder::ApplyScanMatch(
+    const common::Time time, const Eigen::Quaterniond& imu_orientation,
+    const transform::Rigid3d& pose_prediction,
+    const transform::Rigid3d& model_prediction,
+    const transform::Rigid3d& pose_observation) {
+  // Improve the velocity estimate.
+  if (last_scan_match_time_ > common::Time::min() &&
+      time > last_scan_match_time_) {
+    const double delta_t = common::ToSeconds(time - last_scan_match_time_);
+    // This adds the observed difference in velocity that would have reduced the
+    // error to zero.
+    velocity_estimate_ += (pose_observation.translation().head<2>() -
+                           model_prediction.translation().head<2>()) /
+                          delta_t;
+  }
+  last_scan_match_time_ = time;
+
+  // With pipelining, more sensor data may have been added since 'time'.
+  const transform::Rigid3d odometry_prediction =
+      pose_estimate_ * odometry_correction_;
+  pose_estimate_ =
+      time_ == time
+          ? pose_observation
+          : ExtrapolatePose(pose_observation, time, imu_orientation, time_,
+                            imu_tracker_->orientation());
+  odometry_correction_ = transform::Rigid3d::Identity();
+  if (!odometry_state_tracker_.empty()) {
+    // We add an odometry state, so that the correction from the scan matching
+    // is not removed by the next odometry data we get.
+    odometry_state_tracker_.AddOdometryState(
+        {time_, odometry_state_tracker_.newest().odometer_pose,
+         odometry_state_tracker_.newest().state_pose *
+             odometry_prediction.inverse() * pose_estimate_});
+  }
+}
+
+LocalTrajectoryBuilder::PoseEstimate LocalTrajectoryBuilder::pose_estimate()
+    const {
+  common::MutexLocker lock(&mutex_);
   return last_pose_estimate_;
 }
 
@@ -226,6 +399,7 @@ void LocalTrajectoryBuilder::AddImuData(
     const Eigen::Vector3d& angular_velocity) {
   CHECK(options_.use_imu_data()) << "An unexpected IMU packet was added.";
 
+  common::MutexLocker lock(&mutex_);
   InitializeImuTracker(time);
   Predict(time);
   imu_tracker_->AddImuLinearAccelerationObservation(linear_acceleration);
@@ -234,6 +408,7 @@ void LocalTrajectoryBuilder::AddImuData(
 
 void LocalTrajectoryBuilder::AddOdometerData(
     const common::Time time, const transform::Rigid3d& odometer_pose) {
+  common::MutexLocker lock(&mutex_);
   if (imu_tracker_ == nullptr) {
     // Until we've initialized the IMU tracker we do not want to call Predict().
     LOG(INFO) << "ImuTracker not yet initialized.";
@@ -263,26 +438,34 @@ void LocalTrajectoryBuilder::InitializeImuTracker(const common::Time time) {
 void LocalTrajectoryBuilder::Predict(const common::Time time) {
   CHECK(imu_tracker_ != nullptr);
   CHECK_LE(time_, time);
-  const double last_yaw = transform::GetYaw(imu_tracker_->orientation());
+  const Eigen::Quaterniond last_orientation = imu_tracker_->orientation();
   imu_tracker_->Advance(time);
   if (time_ > common::Time::min()) {
-    const double delta_t = common::ToSeconds(time - time_);
-    // Constant velocity model.
-    const Eigen::Vector3d translation =
-        pose_estimate_.translation() +
-        delta_t *
-            Eigen::Vector3d(velocity_estimate_.x(), velocity_estimate_.y(), 0.);
-    // Use the current IMU tracker roll and pitch for gravity alignment, and
-    // apply its change in yaw.
-    const Eigen::Quaterniond rotation =
-        Eigen::AngleAxisd(
-            transform::GetYaw(pose_estimate_.rotation()) - last_yaw,
-            Eigen::Vector3d::UnitZ()) *
-        imu_tracker_->orientation();
-    pose_estimate_ = transform::Rigid3d(translation, rotation);
+    pose_estimate_ = ExtrapolatePose(pose_estimate_, time_, last_orientation,
+                                     time, imu_tracker_->orientation());
   }
   time_ = time;
 }
 
+transform::Rigid3d LocalTrajectoryBuilder::ExtrapolatePose(
+    const transform::Rigid3d& pose, const common::Time pose_time,
+    const Eigen::Quaterniond& pose_imu_orientation, const common::Time time,
+    const Eigen::Quaterniond& imu_orientation) const {
+  const double delta_t = common::ToSeconds(time - pose_time);
+  // Constant velocity model.
+  const Eigen::Vector3d translation =
+      pose.translation() +
+      delta_t *
+          Eigen::Vector3d(velocity_estimate_.x(), velocity_estimate_.y(), 0.);
+  // Use the IMU tracker roll and pitch at 'time' for gravity alignment, and
+  // apply its change in yaw.
+  const Eigen::Quaterniond rotation =
+      Eigen::AngleAxisd(transform::GetYaw(pose.rotation()) -
+                            transform::GetYaw(pose_imu_orientation),
+                        Eigen::Vector3d::UnitZ()) *
+      imu_orientation;
+  return transform::Rigid3d(translation, rotation);
+}
+
 }  // namespace mapping_2d
 }  // namespace cartographer
@@ -17,12 +17,17 @@
 #ifndef CARTOGRAPHER_MAPPING_2D_LOCAL_TRAJECTORY_BUILDER_H_
 #define CARTOGRAPHER_MAPPING_2D_LOCAL_TRAJECTORY_BUILDER_H_
 
+#include <functional>
 #include <memory>
+#include <thread>
 
+#include "cartographer/common/blocking_queue.h"
+#include "cartographer/common/mutex.h"
 #include "cartographer/common/time.h"
 #include "cartographer/mapping/global_trajectory_builder_interface.h"
 #include "cartographer/mapping/imu_tracker.h"
 #include "cartographer/mapping/odometry_state_tracker.h"
+#include "cartographer/mapping_2d/admission_controller.h"
 #include "cartographer/mapping_2d/proto/local_trajectory_builder_options.pb.h"
 #include "cartographer/mapping_2d/scan_matching/ceres_scan_matcher.h"
 #include "cartographer/mapping_2d/scan_matching/real_time_correlative_scan_matcher.h"
@@ -36,6 +41,12 @@ namespace mapping_2d {
 
 // Wires up the local SLAM stack (i.e. UKF, scan matching, etc.) without loop
 // closure.
+//
+// If 'pipeline_queue_size' is positive, preprocessing of range data runs on a
+// thread of its own, overlapping with scan matching and submap insertion of
+// the previous range data on another thread. Insertion results are then
+// passed to the 'insertion_result_callback' on that thread instead of being
+// returned. Flush() waits for range data still in the pipeline.
 class LocalTrajectoryBuilder {
  public:
   using PoseEstimate = mapping::GlobalTrajectoryBuilderInterface::PoseEstimate;
@@ -48,66 +59,144 @@ class LocalTrajectoryBuilder {
     transform::Rigid2d pose_estimate_2d;
   };
 
+  using InsertionResultCallback =
+      std::function<void(std::unique_ptr<InsertionResult>)>;
+
   explicit LocalTrajectoryBuilder(
       const proto::LocalTrajectoryBuilderOptions& options);
+  LocalTrajectoryBuilder(const proto::LocalTrajectoryBuilderOptions& options,
+                         InsertionResultCallback insertion_result_callback);
   ~LocalTrajectoryBuilder();
 
   LocalTrajectoryBuilder(const LocalTrajectoryBuilder&) = delete;
   LocalTrajectoryBuilder& operator=(const LocalTrajectoryBuilder&) = delete;
 
-  const PoseEstimate& pose_estimate() const;
+  PoseEstimate pose_estimate() const;
   std::unique_ptr<InsertionResult> AddHorizontalRangeData(
       common::Time, const sensor::RangeData& range_data);
   void AddImuData(common::Time time, const Eigen::Vector3d& linear_acceleration,
                   const Eigen::Vector3d& angular_velocity);
   void AddOdometerData(common::Time time, const transform::Rigid3d& pose);
 
+  // Blocks until all range data added so far has been matched and inserted,
+  // or dropped, and all insertion results have been passed to the
+  // 'insertion_result_callback'. Returns immediately without pipelining.
+  void Flush();
+
  private:
+  // Accumulated range data on its way through preprocessing and scan
+  // matching.
+  struct AccumulatedRangeData {
+    common::Time time;
+    // IMU tracker orientation and odometry correction at 'time'. The pose
+    // prediction is only computed for scan matching, once the scan matches
+    // of all earlier range data have been applied.
+    Eigen::Quaterniond imu_orientation;
+    transform::Rigid3d odometry_correction;
+    transform::Rigid3d tracking_to_tracking_2d;
+    // In tracking before and in tracking 2D after preprocessing.
+    sensor::RangeData range_data;
+    // Point cloud used for scan matching, filled in by preprocessing.
+    sensor::PointCloud filtered_point_cloud_in_tracking_2d;
+  };
+
   std::unique_ptr<InsertionResult> AddAccumulatedRangeData(
       common::Time time, const sensor::RangeData& range_data);
   sensor::RangeData TransformAndFilterRangeData(
       const transform::Rigid3f& tracking_to_tracking_2d,
-      const sensor::RangeData& range_data) const;
-
-  // Scan matches 'range_data_in_tracking_2d' and fill in the 'pose_observation'
-  // with the result.
-  void ScanMatch(common::Time time, const transform::Rigid3d& pose_prediction,
-                 const transform::Rigid3d& tracking_to_tracking_2d,
-                 const sensor::RangeData& range_data_in_tracking_2d,
-                 transform::Rigid3d* pose_observation);
+      float voxel_filter_size, const sensor::RangeData& range_data) const;
+
+  // Projects the range data of 'accumulated_range_data' into 2D and computes
+  // the point cloud for scan matching. Returns false if no returns are left.
+  bool Preprocess(AccumulatedRangeData* accumulated_range_data);
+
+  // Scan matches and inserts preprocessed range data.
+  std::unique_ptr<InsertionResult> MatchAndInsert(
+      const AccumulatedRangeData& accumulated_range_data);
+
+  // Scan matches 'filtered_point_cloud_in_tracking_2d' and fill in the
+  // 'pose_observation' with the result.
+  void ScanMatch(
+      const transform::Rigid3d& pose_prediction,
+      const transform::Rigid3d& tracking_to_tracking_2d,
+      const sensor::PointCloud& filtered_point_cloud_in_tracking_2d,
+      transform::Rigid3d* pose_observation);
+
+  // Updates the velocity estimate from 'pose_observation' at 'time' and
+  // extrapolates it to the current estimate at 'time_'.
+  void ApplyScanMatch(common::Time time,
+                      const Eigen::Quaterniond& imu_orientation,
+                      const transform::Rigid3d& pose_prediction,
+                      const transform::Rigid3d& model_prediction,
+                      const transform::Rigid3d& pose_observation)
+      REQUIRES(mutex_);
+
+  // Pipeline stages run on 'preprocessing_thread_' and 'matching_thread_'.
+  void RunPreprocessing();
+  void RunMatching();
+
+  // Called once range data that was pushed into the pipeline has been
+  // inserted or dropped.
+  void FinishPipelinedRangeData();
 
   // Lazily constructs an ImuTracker.
-  void InitializeImuTracker(common::Time time);
+  void InitializeImuTracker(common::Time time) REQUIRES(mutex_);
 
   // Updates the current estimate to reflect the given 'time'.
-  void Predict(common::Time time);
+  void Predict(common::Time time) REQUIRES(mutex_);
+
+  // Extrapolates 'pose' at 'pose_time', when the IMU tracker had the
+  // 'pose_imu_orientation', to 'time', when it has the 'imu_orientation',
+  // using the constant velocity model. Works backwards in time as well.
+  transform::Rigid3d ExtrapolatePose(
+      const transform::Rigid3d& pose, common::Time pose_time,
+      const Eigen::Quaterniond& pose_imu_orientation, common::Time time,
+      const Eigen::Quaterniond& imu_orientation) const REQUIRES(mutex_);
 
   const proto::LocalTrajectoryBuilderOptions options_;
+  const InsertionResultCallback insertion_result_callback_;
   ActiveSubmaps active_submaps_;
+  AdmissionController admission_controller_;
 
-  PoseEstimate last_pose_estimate_;
+  // Guards the estimates shared between the thread adding sensor data and
+  // 'matching_thread_'.
+  mutable common::Mutex mutex_;
+
+  PoseEstimate last_pose_estimate_ GUARDED_BY(mutex_);
+  // Range data pushed into the pipeline which was not yet inserted or dropped.
+  int num_pipelined_range_data_ GUARDED_BY(mutex_) = 0;
 
   // Current 'pose_estimate_' and 'velocity_estimate_' at 'time_'.
-  common::Time time_ = common::Time::min();
-  transform::Rigid3d pose_estimate_ = transform::Rigid3d::Identity();
-  Eigen::Vector2d velocity_estimate_ = Eigen::Vector2d::Zero();
-  common::Time last_scan_match_time_ = common::Time::min();
+  common::Time time_ GUARDED_BY(mutex_) = common::Time::min();
+  transform::Rigid3d pose_estimate_ GUARDED_BY(mutex_) =
+      transform::Rigid3d::Identity();
+  Eigen::Vector2d velocity_estimate_ GUARDED_BY(mutex_) =
+      Eigen::Vector2d::Zero();
+  common::Time last_scan_match_time_ GUARDED_BY(mutex_) = common::Time::min();
   // This is the difference between the model (constant velocity, IMU)
   // prediction 'pose_estimate_' and the odometry prediction. To get the
   // odometry prediction, right-multiply this to 'pose_estimate_'.
-  transform::Rigid3d odometry_correction_ = transform::Rigid3d::Identity();
+  transform::Rigid3d odometry_correction_ GUARDED_BY(mutex_) =
+      transform::Rigid3d::Identity();
 
   mapping_3d::MotionFilter motion_filter_;
   scan_matching::RealTimeCorrelativeScanMatcher
       real_time_correlative_scan_matcher_;
   scan_matching::CeresScanMatcher ceres_scan_matcher_;
 
-  std::unique_ptr<mapping::ImuTracker> imu_tracker_;
-  mapping::OdometryStateTracker odometry_state_tracker_;
+  std::unique_ptr<mapping::ImuTracker> imu_tracker_ GUARDED_BY(mutex_);
+  mapping::OdometryStateTracker odometry_state_tracker_ GUARDED_BY(mutex_);
 
   int num_accumulated_ = 0;
   transform::Rigid3f first_pose_estimate_ = transform::Rigid3f::Identity();
   sensor::RangeData accumulated_range_data_;
+
+  // Bounded queues between the pipeline stages. A nullptr stops the stages.
+  common::BlockingQueue<std::unique_ptr<AccumulatedRangeData>>
+      preprocessing_queue_;
+  common::BlockingQueue<std::unique_ptr<AccumulatedRangeData>> matching_queue_;
+  std::thread preprocessing_thread_;
+  std::thread matching_thread_;
 };
 
 }  // namespace mapping_2d
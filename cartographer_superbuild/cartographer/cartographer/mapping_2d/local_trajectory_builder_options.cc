@@ -16,6 +16,7 @@
 
 #include "cartographer/mapping_2d/local_trajectory_builder_options.h"
 
+#include "cartographer/mapping_2d/admission_controller.h"
 #include "cartographer/mapping_2d/scan_matching/ceres_scan_matcher.h"
 #include "cartographer/mapping_2d/scan_matching/real_time_correlative_scan_matcher.h"
 #include "cartographer/mapping_2d/submaps.h"
@@ -62,6 +63,11 @@ proto::LocalTrajectoryBuilderOptions CreateLocalTrajectoryBuilderOptions(
   *options.mutable_submaps_options() = CreateSubmapsOptions(
       parameter_dictionary->GetDictionary("submaps").get());
   options.set_use_imu_data(parameter_dictionary->GetBool("use_imu_data"));
+  options.set_pipeline_queue_size(
+      parameter_dictionary->GetNonNegativeInt("pipeline_queue_size"));
+  *options.mutable_admission_controller_options() =
+      CreateAdmissionControllerOptions(
+          parameter_dictionary->GetDictionary("admission_controller").get());
   return options;
 }
 
@@ -0,0 +1,277 @@
+/*
+ * Copyright 2017 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_2d/local_trajectory_builder.h"
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Eigen/Core"
+#include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
+#include "cartographer/common/make_unique.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/time.h"
+#include "cartographer/mapping_2d/local_trajectory_builder_options.h"
+#include "cartographer/transform/rigid_transform_test_helpers.h"
+#include "cartographer/transform/transform.h"
+#include "gmock/gmock.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace {
+
+constexpr int kNumScans = 40;
+
+class LocalTrajectoryBuilderTest : public ::testing::Test {
+ protected:
+  struct TrajectoryNode {
+    common::Time time;
+    transform::Rigid2d pose;
+  };
+
+  proto::LocalTrajectoryBuilderOptions CreateTrajectoryBuilderOptions(
+      const int pipeline_queue_size) {
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          use_imu_data = false,
+          min_range = 0.,
+          max_range = 30.,
+          min_z = -0.8,
+          max_z = 2.,
+          missing_data_ray_length = 5.,
+          scans_per_accumulation = 1,
+          voxel_filter_size = 0.025,
+
+          adaptive_voxel_filter = {
+            max_length = 0.5,
+            min_num_points = 200,
+            max_range = 50.,
+          },
+
+          use_online_correlative_scan_matching = false,
+          real_time_correlative_scan_matcher = {
+            linear_search_window = 0.1,
+            angular_search_window = math.rad(20.),
+            translation_delta_cost_weight = 1e-1,
+            rotation_delta_cost_weight = 1e-1,
+            num_threads = 1,
+            coarse_search_width = 1,
+          },
+
+          ceres_scan_matcher = {
+            occupied_space_weight = 1.,
+            translation_weight = 1.,
+            rotation_weight = 1.,
+            use_analytic_derivatives = true,
+            reuse_problems = false,
+            ceres_solver_options = {
+              use_nonmonotonic_steps = false,
+              max_num_iterations = 20,
+              num_threads = 1,
+            },
+          },
+
+          -- Every scan is inserted.
+          motion_filter = {
+            max_time_seconds = 0.,
+            max_distance_meters = 0.,
+            max_angle_radians = 0.,
+          },
+
+          imu_gravity_time_constant = 10.,
+          num_odometry_states = 1,
+
+          submaps = {
+            resolution = 0.05,
+            num_range_data = 20,
+            range_data_inserter = {
+              insert_free_space = true,
+              hit_probability = 0.55,
+              miss_probability = 0.49,
+            },
+          },
+
+          pipeline_queue_size = )text" +
+        std::to_string(pipeline_queue_size) + R"text(,
+
+          admission_controller = {
+            measurement_period = 0.,
+            max_load = 0.9,
+            min_load = 0.5,
+            max_queue_depth = 2,
+          },
+        })text");
+    return CreateLocalTrajectoryBuilderOptions(parameter_dictionary.get());
+  }
+
+  // Returns the distance from 'origin' in 'direction' to the walls of a 10 m
+  // by 6 m room centered at the origin, or to one of a few round pillars in
+  // it.
+  float CastRay(const Eigen::Vector2f& origin,
+                const Eigen::Vector2f& direction) {
+    float range = std::numeric_limits<float>::infinity();
+    for (int i = 0; i != 2; ++i) {
+      const float half_extent = i == 0 ? 5.f : 3.f;
+      if (direction[i] != 0.f) {
+        const float wall =
+            std::copysign(half_extent, direction[i]) - origin[i];
+        range = std::min(range, wall / direction[i]);
+      }
+    }
+    constexpr float kPillarRadius = 0.3f;
+    for (const Eigen::Vector2f& center :
+         {Eigen::Vector2f(2.f, 1.5f), Eigen::Vector2f(-1.5f, -1.f),
+          Eigen::Vector2f(3.5f, -2.f), Eigen::Vector2f(-3.f, 2.f)}) {
+      const float beta = direction.dot(origin - center);
+      const float discriminant = beta * beta -
+                                 (origin - center).squaredNorm() +
+                                 kPillarRadius * kPillarRadius;
+      if (discriminant < 0.f) {
+        continue;
+      }
+      const float solution = -beta - std::sqrt(discriminant);
+      if (solution > 0.f) {
+        range = std::min(range, solution);
+      }
+    }
+    return range;
+  }
+
+  sensor::RangeData GenerateRangeData(const transform::Rigid2d& pose) {
+    const transform::Rigid2f pose_f = pose.cast<float>();
+    sensor::PointCloud returns;
+    for (int i = 0; i != 720; ++i) {
+      const Eigen::Vector2f direction =
+          Eigen::Rotation2Df(M_PI * i / 360.) * Eigen::Vector2f::UnitX();
+      const float range =
+          CastRay(pose_f.translation(), pose_f.rotation() * direction);
+      returns.emplace_back(range * direction.x(), range * direction.y(), 0.f);
+    }
+    return sensor::RangeData{Eigen::Vector3f::Zero(), returns, {}};
+  }
+
+  std::vector<TrajectoryNode> GenerateTrajectory() {
+    std::vector<TrajectoryNode> trajectory;
+    common::Time time = common::FromUniversal(12345678);
+    for (int i = 0; i != kNumScans; ++i) {
+      time += common::FromSeconds(0.1);
+      trajectory.push_back(TrajectoryNode{
+          time, transform::Rigid2d({0.04 * i, 0.01 * i}, 0.01 * i)});
+    }
+    return trajectory;
+  }
+
+  // Adds range data along the 'trajectory' to a local trajectory builder
+  // and returns all insertion results. If 'flush_after_each_scan' is true,
+  // the pipeline is drained after adding each range data.
+  std::vector<LocalTrajectoryBuilder::InsertionResult> AddRangeData(
+      const std::vector<TrajectoryNode>& trajectory,
+      const int pipeline_queue_size, const bool flush_after_each_scan) {
+    common::Mutex mutex;
+    std::vector<LocalTrajectoryBuilder::InsertionResult> insertion_results;
+    LocalTrajectoryBuilder local_trajectory_builder(
+        CreateTrajectoryBuilderOptions(pipeline_queue_size),
+        [&mutex, &insertion_results](
+            std::unique_ptr<LocalTrajectoryBuilder::InsertionResult>
+                insertion_result) {
+          common::MutexLocker locker(&mutex);
+          insertion_results.push_back(*insertion_result);
+        });
+    for (const TrajectoryNode& node : trajectory) {
+      std::unique_ptr<LocalTrajectoryBuilder::InsertionResult>
+          insertion_result = local_trajectory_builder.AddHorizontalRangeData(
+              node.time, GenerateRangeData(node.pose));
+      if (insertion_result != nullptr) {
+        common::MutexLocker locker(&mutex);
+        insertion_results.push_back(*insertion_result);
+      }
+      if (flush_after_each_scan) {
+        local_trajectory_builder.Flush();
+      }
+    }
+    local_trajectory_builder.Flush();
+    common::MutexLocker locker(&mutex);
+    // Nothing may be left in the pipeline after Flush().
+    EXPECT_EQ(trajectory.size(), insertion_results.size());
+    if (!insertion_results.empty()) {
+      const LocalTrajectoryBuilder::PoseEstimate pose_estimate =
+          local_trajectory_builder.pose_estimate();
+      EXPECT_EQ(insertion_results.back().time, pose_estimate.time);
+      EXPECT_THAT(pose_estimate.pose,
+                  transform::IsNearly(
+                      transform::Embed3D(
+                          insertion_results.back().pose_estimate_2d),
+                      1e-9));
+    }
+    return insertion_results;
+  }
+};
+
+TEST_F(LocalTrajectoryBuilderTest, MatchesWithoutPipelining) {
+  const std::vector<TrajectoryNode> trajectory = GenerateTrajectory();
+  const std::vector<LocalTrajectoryBuilder::InsertionResult> insertion_results =
+      AddRangeData(trajectory, 0 /* pipeline_queue_size */,
+                   false /* flush_after_each_scan */);
+  ASSERT_EQ(trajectory.size(), insertion_results.size());
+  for (size_t i = 0; i != trajectory.size(); ++i) {
+    EXPECT_EQ(trajectory[i].time, insertion_results[i].time);
+    EXPECT_THAT(insertion_results[i].pose_estimate_2d,
+                transform::IsNearly(trajectory[i].pose, 0.05));
+  }
+}
+
+TEST_F(LocalTrajectoryBuilderTest, PipeliningGivesSameResultWhenFlushed) {
+  const std::vector<TrajectoryNode> trajectory = GenerateTrajectory();
+  const std::vector<LocalTrajectoryBuilder::InsertionResult> expected =
+      AddRangeData(trajectory, 0 /* pipeline_queue_size */,
+                   false /* flush_after_each_scan */);
+  const std::vector<LocalTrajectoryBuilder::InsertionResult> actual =
+      AddRangeData(trajectory, 2 /* pipeline_queue_size */,
+                   true /* flush_after_each_scan */);
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i != expected.size(); ++i) {
+    EXPECT_EQ(expected[i].time, actual[i].time);
+    EXPECT_THAT(actual[i].pose_estimate_2d,
+                transform::IsNearly(expected[i].pose_estimate_2d, 1e-6));
+    EXPECT_EQ(expected[i].range_data_in_tracking_2d.returns.size(),
+              actual[i].range_data_in_tracking_2d.returns.size());
+  }
+}
+
+TEST_F(LocalTrajectoryBuilderTest, PipeliningGivesSameResult) {
+  const std::vector<TrajectoryNode> trajectory = GenerateTrajectory();
+  const std::vector<LocalTrajectoryBuilder::InsertionResult> expected =
+      AddRangeData(trajectory, 0 /* pipeline_queue_size */,
+                   false /* flush_after_each_scan */);
+  // Range data is accumulated before the scan matches of earlier range data
+  // are known, and only drained by the final Flush().
+  const std::vector<LocalTrajectoryBuilder::InsertionResult> actual =
+      AddRangeData(trajectory, 2 /* pipeline_queue_size */,
+                   false /* flush_after_each_scan */);
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i != expected.size(); ++i) {
+    EXPECT_EQ(expected[i].time, actual[i].time);
+    EXPECT_THAT(actual[i].pose_estimate_2d,
+                transform::IsNearly(expected[i].pose_estimate_2d, 1e-6));
+  }
+}
+
+}  // namespace
+}  // namespace mapping_2d
+}  // namespace cartographer
@@ -39,14 +39,21 @@ namespace mapping_2d {
 // Represents a 2D grid of probabilities.
 class ProbabilityGrid {
  public:
+  // Cells are grouped into square tiles of (1 << kTileSizeLog2) cells per side
+  // to keep track of which regions of the grid have been modified.
+  static constexpr int kTileSizeLog2 = 5;
+
   explicit ProbabilityGrid(const MapLimits& limits)
       : limits_(limits),
         cells_(limits_.cell_limits().num_x_cells *
                    limits_.cell_limits().num_y_cells,
-               mapping::kUnknownProbabilityValue) {}
+               mapping::kUnknownProbabilityValue),
+        tile_generations_(ComputeNumTiles(limits_.cell_limits()), 0) {}
 
   explicit ProbabilityGrid(const proto::ProbabilityGrid& proto)
-      : limits_(proto.limits()), cells_() {
+      : limits_(proto.limits()),
+        cells_(),
+        tile_generations_(ComputeNumTiles(limits_.cell_limits()), 0) {
     if (proto.has_min_x()) {
       known_cells_box_ =
           Eigen::AlignedBox2i(Eigen::Vector2i(proto.min_x(), proto.min_y()),
@@ -64,6 +71,9 @@ class ProbabilityGrid {
 
   // Finishes the update sequence.
   void FinishUpdate() {
+    if (!update_indices_.empty()) {
+      ++generation_;
+    }
     while (!update_indices_.empty()) {
       DCHECK_GE(cells_[update_indices_.back()], mapping::kUpdateMarker);
       cells_[update_indices_.back()] -= mapping::kUpdateMarker;
@@ -79,6 +89,7 @@ class ProbabilityGrid {
     CHECK_EQ(cell, mapping::kUnknownProbabilityValue);
     cell = mapping::ProbabilityToValue(probability);
     known_cells_box_.extend(cell_index.matrix());
+    tile_generations_[ToTileFlatIndex(cell_index)] = ++generation_;
   }
 
   // Applies the 'odds' specified when calling ComputeLookupTableToApplyOdds()
@@ -100,6 +111,8 @@ class ProbabilityGrid {
     cell = table[cell];
     DCHECK_GE(cell, mapping::kUpdateMarker);
     known_cells_box_.extend(cell_index.matrix());
+    // The update becomes visible in 'generation_' once it is finished.
+    tile_generations_[ToTileFlatIndex(cell_index)] = generation_ + 1;
     return true;
   }
 
@@ -162,9 +175,32 @@ class ProbabilityGrid {
       if (!known_cells_box_.isEmpty()) {
         known_cells_box_.translate(Eigen::Vector2i(x_offset, y_offset));
       }
+      // All cells moved, so every tile counts as modified.
+      ++generation_;
+      tile_generations_.assign(ComputeNumTiles(limits_.cell_limits()),
+                               generation_);
     }
   }
 
+  // Returns a number which increases whenever cells are modified. Readers can
+  // remember it to later find the tiles that changed in the meantime.
+  uint32 generation() const { return generation_; }
+
+  // Returns the number of tiles covering the grid in each direction.
+  CellLimits tile_limits() const {
+    return CellLimits(ComputeNumTiles(limits_.cell_limits().num_x_cells),
+                      ComputeNumTiles(limits_.cell_limits().num_y_cells));
+  }
+
+  // Returns the 'generation()' at which a cell of the tile with 'tile_index'
+  // was last modified. Tile (i, j) contains the cells with xy-indices
+  // (i << kTileSizeLog2, j << kTileSizeLog2) up to, but excluding,
+  // ((i + 1) << kTileSizeLog2, (j + 1) << kTileSizeLog2).
+  uint32 tile_generation(const Eigen::Array2i& tile_index) const {
+    return tile_generations_[tile_limits().num_x_cells * tile_index.y() +
+                             tile_index.x()];
+  }
+
   proto::ProbabilityGrid ToProto() const {
     proto::ProbabilityGrid result;
     *result.mutable_limits() = cartographer::mapping_2d::ToProto(limits_);
@@ -190,12 +226,33 @@ class ProbabilityGrid {
     return limits_.cell_limits().num_x_cells * cell_index.y() + cell_index.x();
   }
 
+  // Converts a 'cell_index' into an index into 'tile_generations_'.
+  int ToTileFlatIndex(const Eigen::Array2i& cell_index) const {
+    return ComputeNumTiles(limits_.cell_limits().num_x_cells) *
+               (cell_index.y() >> kTileSizeLog2) +
+           (cell_index.x() >> kTileSizeLog2);
+  }
+
+  static int ComputeNumTiles(const int num_cells) {
+    return (num_cells + (1 << kTileSizeLog2) - 1) >> kTileSizeLog2;
+  }
+
+  static int ComputeNumTiles(const CellLimits& cell_limits) {
+    return ComputeNumTiles(cell_limits.num_x_cells) *
+           ComputeNumTiles(cell_limits.num_y_cells);
+  }
+
   MapLimits limits_;
   std::vector<uint16> cells_;  // Highest bit is update marker.
   std::vector<int> update_indices_;
 
   // Bounding box of known cells to efficiently compute cropping limits.
   Eigen::AlignedBox2i known_cells_box_;
+
+  // Incremented whenever cells are modified, and for each tile, the value it
+  // had when the tile was last modified.
+  uint32 generation_ = 0;
+  std::vector<uint32> tile_generations_;
 };
 
 }  // namespace mapping_2d
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_2d/probability_lookup_grid.h"
+
+#include "cartographer/mapping/probability_values.h"
+#include "cartographer/mapping_2d/xy_index.h"
+#include "glog/logging.h"
+
+namespace cartographer {
+namespace mapping_2d {
+
+ProbabilityLookupGrid::ProbabilityLookupGrid(
+    const ProbabilityGrid& probability_grid)
+    : limits_(probability_grid.limits()),
+      generation_(probability_grid.generation()),
+      num_padded_x_cells_(limits_.cell_limits().num_x_cells + 2),
+      num_padded_y_cells_(limits_.cell_limits().num_y_cells + 2),
+      values_(num_padded_x_cells_ * num_padded_y_cells_,
+              mapping::kMinProbability) {
+  CopyCells(probability_grid, Eigen::Array2i::Zero(),
+            Eigen::Array2i(limits_.cell_limits().num_x_cells - 1,
+                           limits_.cell_limits().num_y_cells - 1));
+}
+
+bool ProbabilityLookupGrid::Update(const ProbabilityGrid& probability_grid) {
+  const CellLimits& cell_limits = probability_grid.limits().cell_limits();
+  if (cell_limits.num_x_cells != limits_.cell_limits().num_x_cells ||
+      cell_limits.num_y_cells != limits_.cell_limits().num_y_cells ||
+      probability_grid.limits().resolution() != limits_.resolution() ||
+      probability_grid.limits().max() != limits_.max()) {
+    return false;
+  }
+  constexpr int kTileSize = 1 << ProbabilityGrid::kTileSizeLog2;
+  const Eigen::Array2i max_xy_index(cell_limits.num_x_cells - 1,
+                                    cell_limits.num_y_cells - 1);
+  for (const Eigen::Array2i& tile_index :
+       XYIndexRangeIterator(probability_grid.tile_limits())) {
+    if (probability_grid.tile_generation(tile_index) > generation_) {
+      const Eigen::Array2i tile_min = kTileSize * tile_index;
+      CopyCells(probability_grid, tile_min,
+                (tile_min + (kTileSize - 1)).min(max_xy_index));
+    }
+  }
+  generation_ = probability_grid.generation();
+  return true;
+}
+
+void ProbabilityLookupGrid::CopyCells(const ProbabilityGrid& probability_grid,
+                                      const Eigen::Array2i& min_xy_index,
+                                      const Eigen::Array2i& max_xy_index) {
+  for (int y = min_xy_index.y(); y <= max_xy_index.y(); ++y) {
+    float* const row = &values_[ToFlatIndex(0, y)];
+    for (int x = min_xy_index.x(); x <= max_xy_index.x(); ++x) {
+      row[x] = probability_grid.GetProbability(Eigen::Array2i(x, y));
+    }
+  }
+}
+
+}  // namespace mapping_2d
+}  // namespace cartographer
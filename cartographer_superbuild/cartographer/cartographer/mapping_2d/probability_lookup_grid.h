@@ -0,0 +1,91 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_MAPPING_2D_PROBABILITY_LOOKUP_GRID_H_
+#define CARTOGRAPHER_MAPPING_2D_PROBABILITY_LOOKUP_GRID_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "Eigen/Core"
+#include "cartographer/common/port.h"
+#include "cartographer/mapping_2d/map_limits.h"
+#include "cartographer/mapping_2d/probability_grid.h"
+
+namespace cartographer {
+namespace mapping_2d {
+
+// A contiguous copy of the probabilities of a 'ProbabilityGrid' as floats,
+// surrounded by a border of cells with 'kMinProbability'. Lookups clamp indices
+// into the border instead of checking the grid bounds and decoding cell values,
+// which makes sampling it many times cheap, e.g. for the bicubic interpolation
+// in the Ceres scan matcher.
+class ProbabilityLookupGrid {
+ public:
+  explicit ProbabilityLookupGrid(const ProbabilityGrid& probability_grid);
+
+  // Copies the tiles of 'probability_grid' which were modified since this was
+  // built or last updated from it. Returns false and leaves this unchanged if
+  // 'probability_grid' has different limits now, e.g. because it grew.
+  bool Update(const ProbabilityGrid& probability_grid);
+
+  // Returns the limits of the 'ProbabilityGrid' this was built from.
+  const MapLimits& limits() const { return limits_; }
+
+  // Returns the 'ProbabilityGrid::generation()' this is up to date with.
+  uint32 generation() const { return generation_; }
+
+  // Returns the probability of the cell at ('x', 'y'), or 'kMinProbability' if
+  // it is outside the limits.
+  float GetProbability(const int x, const int y) const {
+    return values_[ToFlatIndex(x, y)];
+  }
+
+  // Returns a pointer to the probabilities of the 'num_cells' cells starting at
+  // ('x', 'y') in increasing x direction, or nullptr if they do not all lie
+  // within the limits or the border around them.
+  const float* GetProbabilities(const int x, const int y,
+                                const int num_cells) const {
+    if (x < -1 || y < -1 || y + 1 >= num_padded_y_cells_ ||
+        x + num_cells >= num_padded_x_cells_) {
+      return nullptr;
+    }
+    return &values_[(y + 1) * num_padded_x_cells_ + x + 1];
+  }
+
+ private:
+  int ToFlatIndex(const int x, const int y) const {
+    return std::min(std::max(y + 1, 0), num_padded_y_cells_ - 1) *
+               num_padded_x_cells_ +
+           std::min(std::max(x + 1, 0), num_padded_x_cells_ - 1);
+  }
+
+  void CopyCells(const ProbabilityGrid& probability_grid,
+                 const Eigen::Array2i& min_xy_index,
+                 const Eigen::Array2i& max_xy_index);
+
+  MapLimits limits_;
+  uint32 generation_;
+  // The grid has a border of one cell on each side.
+  int num_padded_x_cells_;
+  int num_padded_y_cells_;
+  std::vector<float> values_;
+};
+
+}  // namespace mapping_2d
+}  // namespace cartographer
+
+#endif  // CARTOGRAPHER_MAPPING_2D_PROBABILITY_LOOKUP_GRID_H_
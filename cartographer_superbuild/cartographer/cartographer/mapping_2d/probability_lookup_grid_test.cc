@@ -0,0 +1,103 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_2d/probability_lookup_grid.h"
+
+#include <random>
+
+#include "cartographer/mapping/probability_values.h"
+#include "cartographer/mapping_2d/xy_index.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace {
+
+void ExpectMatchesProbabilityGrid(const ProbabilityGrid& probability_grid,
+                                  const ProbabilityLookupGrid& lookup_grid) {
+  const CellLimits& cell_limits = probability_grid.limits().cell_limits();
+  for (int y = -2; y < cell_limits.num_y_cells + 2; ++y) {
+    for (int x = -2; x < cell_limits.num_x_cells + 2; ++x) {
+      EXPECT_EQ(probability_grid.GetProbability(Eigen::Array2i(x, y)),
+                lookup_grid.GetProbability(x, y))
+          << "x: " << x << " y: " << y;
+    }
+  }
+}
+
+void SetRandomProbabilities(const int num_cells, std::mt19937* prng,
+                            ProbabilityGrid* probability_grid) {
+  const CellLimits& cell_limits = probability_grid->limits().cell_limits();
+  std::uniform_int_distribution<int> x_distribution(
+      0, cell_limits.num_x_cells - 1);
+  std::uniform_int_distribution<int> y_distribution(
+      0, cell_limits.num_y_cells - 1);
+  std::uniform_real_distribution<float> probability_distribution(
+      mapping::kMinProbability, mapping::kMaxProbability);
+  for (int i = 0; i < num_cells; ++i) {
+    const Eigen::Array2i xy_index(x_distribution(*prng),
+                                  y_distribution(*prng));
+    if (!probability_grid->IsKnown(xy_index)) {
+      probability_grid->SetProbability(xy_index,
+                                       probability_distribution(*prng));
+    }
+  }
+}
+
+TEST(ProbabilityLookupGridTest, MatchesProbabilityGrid) {
+  std::mt19937 prng(42);
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(1., 2.), CellLimits(70, 45)));
+  SetRandomProbabilities(500, &prng, &probability_grid);
+  const ProbabilityLookupGrid lookup_grid(probability_grid);
+  EXPECT_EQ(probability_grid.generation(), lookup_grid.generation());
+  ExpectMatchesProbabilityGrid(probability_grid, lookup_grid);
+  EXPECT_EQ(mapping::kMinProbability, lookup_grid.GetProbability(-1000, 5));
+  EXPECT_EQ(mapping::kMinProbability, lookup_grid.GetProbability(5, 1000));
+}
+
+TEST(ProbabilityLookupGridTest, UpdateCopiesModifiedCells) {
+  std::mt19937 prng(42);
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(1., 2.), CellLimits(70, 45)));
+  SetRandomProbabilities(100, &prng, &probability_grid);
+  ProbabilityLookupGrid lookup_grid(probability_grid);
+
+  SetRandomProbabilities(100, &prng, &probability_grid);
+  probability_grid.ApplyLookupTable(
+      Eigen::Array2i(69, 44),
+      mapping::ComputeLookupTableToApplyOdds(mapping::Odds(0.9)));
+  probability_grid.FinishUpdate();
+  EXPECT_TRUE(lookup_grid.Update(probability_grid));
+  EXPECT_EQ(probability_grid.generation(), lookup_grid.generation());
+  ExpectMatchesProbabilityGrid(probability_grid, lookup_grid);
+}
+
+TEST(ProbabilityLookupGridTest, UpdateFailsAfterGrowing) {
+  ProbabilityGrid probability_grid(
+      MapLimits(1., Eigen::Vector2d(1., 1.), CellLimits(2, 2)));
+  probability_grid.SetProbability(Eigen::Array2i(1, 0), 0.7);
+  ProbabilityLookupGrid lookup_grid(probability_grid);
+
+  probability_grid.GrowLimits(Eigen::Vector2f(5.f, 5.f));
+  EXPECT_FALSE(lookup_grid.Update(probability_grid));
+  EXPECT_EQ(2, lookup_grid.limits().cell_limits().num_x_cells);
+  EXPECT_NEAR(0.7, lookup_grid.GetProbability(1, 0), 1e-3);
+}
+
+}  // namespace
+}  // namespace mapping_2d
+}  // namespace cartographer
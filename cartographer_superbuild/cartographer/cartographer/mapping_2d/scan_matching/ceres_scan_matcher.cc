@@ -22,7 +22,9 @@
 #include "Eigen/Core"
 #include "cartographer/common/ceres_solver_options.h"
 #include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/make_unique.h"
 #include "cartographer/mapping_2d/probability_grid.h"
+#include "cartographer/mapping_2d/scan_matching/occupied_space_cost_function.h"
 #include "cartographer/mapping_2d/scan_matching/occupied_space_cost_functor.h"
 #include "cartographer/mapping_2d/scan_matching/rotation_delta_cost_functor.h"
 #include "cartographer/mapping_2d/scan_matching/translation_delta_cost_functor.h"
@@ -43,12 +45,49 @@ proto::CeresScanMatcherOptions CreateCeresScanMatcherOptions(
       parameter_dictionary->GetDouble("translation_weight"));
   options.set_rotation_weight(
       parameter_dictionary->GetDouble("rotation_weight"));
+  options.set_use_analytic_derivatives(
+      parameter_dictionary->GetBool("use_analytic_derivatives"));
+  options.set_reuse_problems(parameter_dictionary->GetBool("reuse_problems"));
   *options.mutable_ceres_solver_options() =
       common::CreateCeresSolverOptionsProto(
           parameter_dictionary->GetDictionary("ceres_solver_options").get());
   return options;
 }
 
+struct CeresScanMatcher::ReusableProblem {
+  explicit ReusableProblem(const proto::CeresScanMatcherOptions& options)
+      : problem(CreateProblemOptions()),
+        translation_delta_cost_functor(new TranslationDeltaCostFunctor(
+            options.translation_weight(), transform::Rigid2d::Identity())),
+        rotation_delta_cost_functor(
+            new RotationDeltaCostFunctor(options.rotation_weight(), 0.)),
+        translation_delta_cost_function(
+            common::make_unique<ceres::AutoDiffCostFunction<
+                TranslationDeltaCostFunctor, 2, 3>>(
+                translation_delta_cost_functor)),
+        rotation_delta_cost_function(
+            common::make_unique<
+                ceres::AutoDiffCostFunction<RotationDeltaCostFunctor, 1, 3>>(
+                rotation_delta_cost_functor)) {}
+
+  static ceres::Problem::Options CreateProblemOptions() {
+    ceres::Problem::Options problem_options;
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.enable_fast_removal = true;
+    return problem_options;
+  }
+
+  ceres::Problem problem;
+  double ceres_pose_estimate[3] = {0., 0., 0.};
+  // Created on first use, only with analytic derivatives.
+  std::unique_ptr<OccupiedSpaceCostFunction> occupied_space_cost_function;
+  // Owned by the respective cost functions.
+  TranslationDeltaCostFunctor* const translation_delta_cost_functor;
+  RotationDeltaCostFunctor* const rotation_delta_cost_functor;
+  const std::unique_ptr<ceres::CostFunction> translation_delta_cost_function;
+  const std::unique_ptr<ceres::CostFunction> rotation_delta_cost_function;
+};
+
 CeresScanMatcher::CeresScanMatcher(
     const proto::CeresScanMatcherOptions& options)
     : options_(options),
@@ -65,20 +104,43 @@ void CeresScanMatcher::Match(const transform::Rigid2d& previous_pose,
                              const ProbabilityGrid& probability_grid,
                              transform::Rigid2d* const pose_estimate,
                              ceres::Solver::Summary* const summary) const {
+  Match(previous_pose, initial_pose_estimate, point_cloud,
+        ProbabilityLookupGrid(probability_grid), pose_estimate, summary);
+}
+
+void CeresScanMatcher::Match(const transform::Rigid2d& previous_pose,
+                             const transform::Rigid2d& initial_pose_estimate,
+                             const sensor::PointCloud& point_cloud,
+                             const ProbabilityLookupGrid& probability_grid,
+                             transform::Rigid2d* const pose_estimate,
+                             ceres::Solver::Summary* const summary) const {
+  if (options_.reuse_problems()) {
+    MatchWithReusableProblem(previous_pose, initial_pose_estimate, point_cloud,
+                             probability_grid, pose_estimate, summary);
+    return;
+  }
   double ceres_pose_estimate[3] = {initial_pose_estimate.translation().x(),
                                    initial_pose_estimate.translation().y(),
                                    initial_pose_estimate.rotation().angle()};
   ceres::Problem problem;
   CHECK_GT(options_.occupied_space_weight(), 0.);
-  problem.AddResidualBlock(
-      new ceres::AutoDiffCostFunction<OccupiedSpaceCostFunctor, ceres::DYNAMIC,
-                                      3>(
-          new OccupiedSpaceCostFunctor(
-              options_.occupied_space_weight() /
-                  std::sqrt(static_cast<double>(point_cloud.size())),
-              point_cloud, probability_grid),
-          point_cloud.size()),
-      nullptr, ceres_pose_estimate);
+  const double occupied_space_scaling_factor =
+      options_.occupied_space_weight() /
+      std::sqrt(static_cast<double>(point_cloud.size()));
+  if (options_.use_analytic_derivatives()) {
+    problem.AddResidualBlock(
+        new OccupiedSpaceCostFunction(occupied_space_scaling_factor,
+                                      point_cloud, probability_grid),
+        nullptr, ceres_pose_estimate);
+  } else {
+    problem.AddResidualBlock(
+        new ceres::AutoDiffCostFunction<OccupiedSpaceCostFunctor,
+                                        ceres::DYNAMIC, 3>(
+            new OccupiedSpaceCostFunctor(occupied_space_scaling_factor,
+                                         point_cloud, probability_grid),
+            point_cloud.size()),
+        nullptr, ceres_pose_estimate);
+  }
   CHECK_GT(options_.translation_weight(), 0.);
   problem.AddResidualBlock(
       new ceres::AutoDiffCostFunction<TranslationDeltaCostFunctor, 2, 3>(
@@ -98,6 +160,92 @@ void CeresScanMatcher::Match(const transform::Rigid2d& previous_pose,
       {ceres_pose_estimate[0], ceres_pose_estimate[1]}, ceres_pose_estimate[2]);
 }
 
+void CeresScanMatcher::MatchWithReusableProblem(
+    const transform::Rigid2d& previous_pose,
+    const transform::Rigid2d& initial_pose_estimate,
+    const sensor::PointCloud& point_cloud,
+    const ProbabilityLookupGrid& probability_grid,
+    transform::Rigid2d* const pose_estimate,
+    ceres::Solver::Summary* const summary) const {
+  std::unique_ptr<ReusableProblem> reusable_problem = AcquireProblem();
+  double* const ceres_pose_estimate = reusable_problem->ceres_pose_estimate;
+  ceres_pose_estimate[0] = initial_pose_estimate.translation().x();
+  ceres_pose_estimate[1] = initial_pose_estimate.translation().y();
+  ceres_pose_estimate[2] = initial_pose_estimate.rotation().angle();
+
+  CHECK_GT(options_.occupied_space_weight(), 0.);
+  const double occupied_space_scaling_factor =
+      options_.occupied_space_weight() /
+      std::sqrt(static_cast<double>(point_cloud.size()));
+  // Only used with automatic differentiation, whose number of residuals is
+  // fixed on construction.
+  std::unique_ptr<ceres::CostFunction> auto_diff_cost_function;
+  ceres::CostFunction* occupied_space_cost_function;
+  if (options_.use_analytic_derivatives()) {
+    if (reusable_problem->occupied_space_cost_function == nullptr) {
+      reusable_problem->occupied_space_cost_function =
+          common::make_unique<OccupiedSpaceCostFunction>(
+              occupied_space_scaling_factor, point_cloud, probability_grid);
+    } else {
+      reusable_problem->occupied_space_cost_function->Rebind(
+          occupied_space_scaling_factor, point_cloud, probability_grid);
+    }
+    occupied_space_cost_function =
+        reusable_problem->occupied_space_cost_function.get();
+  } else {
+    auto_diff_cost_function = common::make_unique<
+        ceres::AutoDiffCostFunction<OccupiedSpaceCostFunctor, ceres::DYNAMIC,
+                                    3>>(
+        new OccupiedSpaceCostFunctor(occupied_space_scaling_factor,
+                                     point_cloud, probability_grid),
+        point_cloud.size());
+    occupied_space_cost_function = auto_diff_cost_function.get();
+  }
+  CHECK_GT(options_.translation_weight(), 0.);
+  reusable_problem->translation_delta_cost_functor->Rebind(previous_pose);
+  CHECK_GT(options_.rotation_weight(), 0.);
+  reusable_problem->rotation_delta_cost_functor->Rebind(
+      ceres_pose_estimate[2]);
+
+  ceres::Problem& problem = reusable_problem->problem;
+  const ceres::ResidualBlockId residual_block_ids[] = {
+      problem.AddResidualBlock(occupied_space_cost_function, nullptr,
+                               ceres_pose_estimate),
+      problem.AddResidualBlock(
+          reusable_problem->translation_delta_cost_function.get(), nullptr,
+          ceres_pose_estimate),
+      problem.AddResidualBlock(
+          reusable_problem->rotation_delta_cost_function.get(), nullptr,
+          ceres_pose_estimate)};
+
+  ceres::Solve(ceres_solver_options_, &problem, summary);
+
+  *pose_estimate = transform::Rigid2d(
+      {ceres_pose_estimate[0], ceres_pose_estimate[1]}, ceres_pose_estimate[2]);
+  // The parameter block stays, so the problem can be reused as is.
+  for (const ceres::ResidualBlockId residual_block_id : residual_block_ids) {
+    problem.RemoveResidualBlock(residual_block_id);
+  }
+  ReleaseProblem(std::move(reusable_problem));
+}
+
+std::unique_ptr<CeresScanMatcher::ReusableProblem>
+CeresScanMatcher::AcquireProblem() const {
+  common::MutexLocker locker(&mutex_);
+  if (idle_problems_.empty()) {
+    return common::make_unique<ReusableProblem>(options_);
+  }
+  std::unique_ptr<ReusableProblem> problem = std::move(idle_problems_.back());
+  idle_problems_.pop_back();
+  return problem;
+}
+
+void CeresScanMatcher::ReleaseProblem(
+    std::unique_ptr<ReusableProblem> problem) const {
+  common::MutexLocker locker(&mutex_);
+  idle_problems_.push_back(std::move(problem));
+}
+
 }  // namespace scan_matching
 }  // namespace mapping_2d
 }  // namespace cartographer
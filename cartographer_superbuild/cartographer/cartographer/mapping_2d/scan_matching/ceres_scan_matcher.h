@@ -22,7 +22,9 @@
 
 #include "Eigen/Core"
 #include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/mutex.h"
 #include "cartographer/mapping_2d/probability_grid.h"
+#include "cartographer/mapping_2d/probability_lookup_grid.h"
 #include "cartographer/mapping_2d/scan_matching/proto/ceres_scan_matcher_options.pb.h"
 #include "cartographer/sensor/point_cloud.h"
 #include "ceres/ceres.h"
@@ -53,9 +55,39 @@ class CeresScanMatcher {
              transform::Rigid2d* pose_estimate,
              ceres::Solver::Summary* summary) const;
 
+  // Same as above, but matches against a precomputed 'probability_grid' which
+  // can be shared by several matches against the same grid.
+  void Match(const transform::Rigid2d& previous_pose,
+             const transform::Rigid2d& initial_pose_estimate,
+             const sensor::PointCloud& point_cloud,
+             const ProbabilityLookupGrid& probability_grid,
+             transform::Rigid2d* pose_estimate,
+             ceres::Solver::Summary* summary) const;
+
  private:
+  // A problem whose parameter block and cost functions are kept across
+  // matches. Only the point cloud, grid and pose estimates are rebound.
+  struct ReusableProblem;
+
+  // Returns an idle problem, or a new one if all are in use.
+  std::unique_ptr<ReusableProblem> AcquireProblem() const;
+  void ReleaseProblem(std::unique_ptr<ReusableProblem> problem) const;
+
+  // Same as Match(), but rebinds an idle problem instead of setting up a new
+  // one.
+  void MatchWithReusableProblem(const transform::Rigid2d& previous_pose,
+                                const transform::Rigid2d& initial_pose_estimate,
+                                const sensor::PointCloud& point_cloud,
+                                const ProbabilityLookupGrid& probability_grid,
+                                transform::Rigid2d* pose_estimate,
+                                ceres::Solver::Summary* summary) const;
+
   const proto::CeresScanMatcherOptions options_;
   ceres::Solver::Options ceres_solver_options_;
+
+  mutable common::Mutex mutex_;
+  mutable std::vector<std::unique_ptr<ReusableProblem>> idle_problems_
+      GUARDED_BY(mutex_);
 };
 
 }  // namespace scan_matching
@@ -17,6 +17,7 @@
 #include "cartographer/mapping_2d/scan_matching/ceres_scan_matcher.h"
 
 #include <memory>
+#include <string>
 
 #include "cartographer/common/lua_parameter_dictionary.h"
 #include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
@@ -42,20 +43,27 @@ class CeresScanMatcherTest : public ::testing::Test {
 
     point_cloud_.emplace_back(-3.f, 2.f, 0.f);
 
+    ceres_scan_matcher_ = CreateCeresScanMatcher(false /* reuse_problems */);
+  }
+
+  std::unique_ptr<CeresScanMatcher> CreateCeresScanMatcher(
+      const bool reuse_problems) {
     auto parameter_dictionary = common::MakeDictionary(R"text(
         return {
           occupied_space_weight = 1.,
           translation_weight = 0.1,
           rotation_weight = 1.5,
+          use_analytic_derivatives = true,
+          reuse_problems = )text" +
+        std::string(reuse_problems ? "true" : "false") + R"text(,
           ceres_solver_options = {
             use_nonmonotonic_steps = true,
             max_num_iterations = 50,
             num_threads = 1,
           },
         })text");
-    const proto::CeresScanMatcherOptions options =
-        CreateCeresScanMatcherOptions(parameter_dictionary.get());
-    ceres_scan_matcher_ = common::make_unique<CeresScanMatcher>(options);
+    return common::make_unique<CeresScanMatcher>(
+        CreateCeresScanMatcherOptions(parameter_dictionary.get()));
   }
 
   void TestFromInitialPose(const transform::Rigid2d& initial_pose) {
@@ -92,6 +100,43 @@ TEST_F(CeresScanMatcherTest, testOptimizeAlongXY) {
   TestFromInitialPose(transform::Rigid2d::Translation({-0.3, 0.3}));
 }
 
+TEST_F(CeresScanMatcherTest, testReusesProblemAcrossMatches) {
+  ceres_scan_matcher_ = CreateCeresScanMatcher(true /* reuse_problems */);
+  TestFromInitialPose(transform::Rigid2d::Translation({-0.3, 0.5}));
+  // A different number of points changes the number of residuals.
+  point_cloud_.emplace_back(-3.f, 2.f, 0.f);
+  TestFromInitialPose(transform::Rigid2d::Translation({-0.45, 0.3}));
+  point_cloud_.pop_back();
+  TestFromInitialPose(transform::Rigid2d::Translation({-0.3, 0.3}));
+}
+
+TEST_F(CeresScanMatcherTest, testReusedProblemGivesSameResult) {
+  const std::unique_ptr<CeresScanMatcher> reusing_ceres_scan_matcher =
+      CreateCeresScanMatcher(true /* reuse_problems */);
+  sensor::PointCloud two_points = point_cloud_;
+  two_points.emplace_back(-3.2f, 2.1f, 0.f);
+  for (const transform::Rigid2d& initial_pose :
+       {transform::Rigid2d({-0.3, 0.5}, 0.1),
+        transform::Rigid2d({-0.45, 0.3}, -0.05),
+        transform::Rigid2d({-0.3, 0.3}, 0.)}) {
+    for (const sensor::PointCloud& point_cloud : {point_cloud_, two_points}) {
+      transform::Rigid2d expected_pose;
+      ceres::Solver::Summary expected_summary;
+      ceres_scan_matcher_->Match(initial_pose, initial_pose, point_cloud,
+                                 probability_grid_, &expected_pose,
+                                 &expected_summary);
+      transform::Rigid2d pose;
+      ceres::Solver::Summary summary;
+      reusing_ceres_scan_matcher->Match(initial_pose, initial_pose,
+                                        point_cloud, probability_grid_, &pose,
+                                        &summary);
+      EXPECT_NEAR(expected_summary.initial_cost, summary.initial_cost, 1e-12);
+      EXPECT_NEAR(expected_summary.final_cost, summary.final_cost, 1e-12);
+      EXPECT_THAT(pose, transform::IsNearly(expected_pose, 1e-12));
+    }
+  }
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_2d
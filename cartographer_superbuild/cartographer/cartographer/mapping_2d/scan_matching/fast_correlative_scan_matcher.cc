@@ -18,10 +18,14 @@
 
 #include <algorithm>
 #include <cmath>
-#include <deque>
+#include <cstring>
 #include <functional>
 #include <limits>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "Eigen/Geometry"
 #include "cartographer/common/math.h"
 #include "cartographer/mapping_2d/probability_grid.h"
@@ -35,43 +39,117 @@ namespace scan_matching {
 
 namespace {
 
-// A collection of values which can be added and later removed, and the maximum
-// of the current values in the collection can be retrieved.
-// All of it in (amortized) O(1).
-class SlidingWindowMaximum {
- public:
-  void AddValue(const float value) {
-    while (!non_ascending_maxima_.empty() &&
-           value > non_ascending_maxima_.back()) {
-      non_ascending_maxima_.pop_back();
+// Computes for each 'i' in [0, 'num_values' + 'width' - 1) the maximum of the
+// values 'i' - 'width' + 1 to 'i' of 'num_lanes' independent sequences. Values
+// outside [0, 'num_values') are taken to be 'kMinProbability', i.e. they never
+// change the maximum of probabilities. Entry 'i' of all sequences is stored
+// contiguously starting at 'values' + 'i' * 'num_lanes', and likewise for
+// 'maxima'.
+//
+// This is the van Herk/Gil-Werman algorithm: the values are split into blocks of
+// 'width', and each maximum is combined from a suffix maximum of one block and a
+// prefix maximum of the next. This needs three comparisons per value for any
+// 'width', and the loops over the lanes have no branches, so that the compiler
+// can vectorize them.
+void ComputeSlidingWindowMaxima(const float* const values, const int num_values,
+                                const int width, const int num_lanes,
+                                float* const maxima,
+                                std::vector<float>* const running_maxima) {
+  const int num_maxima = num_values + width - 1;
+  // Values are indexed by 'i' + 'width' - 1 below, so that blocks start at 0.
+  const int num_padded_values = num_values + 2 * (width - 1);
+  std::vector<float>& running = *running_maxima;
+  running.resize(num_lanes);
+  const auto update_running = [&](const int padded_index) {
+    const int i = padded_index - (width - 1);
+    if (i < 0 || i >= num_values) {
+      return;
+    }
+    const float* const row = values + i * num_lanes;
+    for (int lane = 0; lane != num_lanes; ++lane) {
+      running[lane] = std::max(running[lane], row[lane]);
+    }
+  };
+  // Suffix maxima of the blocks.
+  for (int block_begin = 0; block_begin < num_maxima; block_begin += width) {
+    std::fill(running.begin(), running.end(), mapping::kMinProbability);
+    for (int padded_index =
+             std::min(block_begin + width, num_padded_values) - 1;
+         padded_index >= block_begin; --padded_index) {
+      update_running(padded_index);
+      if (padded_index < num_maxima) {
+        std::copy(running.begin(), running.end(),
+                  maxima + padded_index * num_lanes);
+      }
     }
-    non_ascending_maxima_.push_back(value);
   }
-
-  void RemoveValue(const float value) {
-    // DCHECK for performance, since this is done for every value in the
-    // precomputation grid.
-    DCHECK(!non_ascending_maxima_.empty());
-    DCHECK_LE(value, non_ascending_maxima_.front());
-    if (value == non_ascending_maxima_.front()) {
-      non_ascending_maxima_.pop_front();
+  // Prefix maxima of the blocks, combined with the suffix maxima.
+  for (int block_begin = 0; block_begin < num_padded_values;
+       block_begin += width) {
+    std::fill(running.begin(), running.end(), mapping::kMinProbability);
+    for (int padded_index = block_begin;
+         padded_index != std::min(block_begin + width, num_padded_values);
+         ++padded_index) {
+      update_running(padded_index);
+      const int i = padded_index - (width - 1);
+      if (i >= 0) {
+        float* const row = maxima + i * num_lanes;
+        for (int lane = 0; lane != num_lanes; ++lane) {
+          row[lane] = std::max(row[lane], running[lane]);
+        }
+      }
     }
   }
+}
 
-  float GetMaximum() const {
-    // DCHECK for performance, since this is done for every value in the
-    // precomputation grid.
-    DCHECK_GT(non_ascending_maxima_.size(), 0);
-    return non_ascending_maxima_.front();
+// Computes 'maxima'[i] = max('values'[i - 'shift'], 'values'[i]) for 'i' in
+// [0, 'num_values' + 'shift'), where values outside [0, 'num_values') are 0.
+// Entries consist of 'num_lanes' contiguous values as above.
+void ComputeShiftedMaxima(const uint8* const values, const int num_values,
+                          const int shift, const int num_lanes,
+                          uint8* const maxima) {
+  CHECK_LE(shift, num_values);
+  std::copy(values, values + shift * num_lanes, maxima);
+  for (int i = shift * num_lanes; i != num_values * num_lanes; ++i) {
+    maxima[i] = std::max(values[i - shift * num_lanes], values[i]);
   }
+  std::copy(values + (num_values - shift) * num_lanes,
+            values + num_values * num_lanes, maxima + num_values * num_lanes);
+}
 
-  void CheckIsEmpty() const { CHECK_EQ(non_ascending_maxima_.size(), 0); }
-
- private:
-  // Maximum of the current sliding window at the front. Then the maximum of the
-  // remaining window that came after this values first occurence, and so on.
-  std::deque<float> non_ascending_maxima_;
-};
+#ifdef __SSE2__
+// Adds to 'sums'[0] and 'sums'[1] the two adjacent 'cells' starting at
+// 'first_base', and to 'sums'[2] and 'sums'[3] those starting at
+// 'second_base', relative to the flat index of each point of 'scan'. Each pair
+// of cells is read with a single load, and the sums are accumulated together.
+void SumPairsOfCells(const uint8* const cells, const int stride,
+                     const FlatDiscreteScan& scan, const int first_base,
+                     const int second_base, int* const sums) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i vector_sums = zero;
+  const int num_points = scan.x_indices.size();
+  for (int j = 0; j != num_points; ++j) {
+    const uint8* const cell =
+        cells + scan.x_indices[j] + scan.y_indices[j] * stride;
+    uint16 first_pair;
+    uint16 second_pair;
+    std::memcpy(&first_pair, cell + first_base, sizeof(first_pair));
+    std::memcpy(&second_pair, cell + second_base, sizeof(second_pair));
+    // Interleaving the two pairs gives the four cell values in order, which
+    // are widened to 32 bits.
+    const __m128i values = _mm_unpacklo_epi16(_mm_cvtsi32_si128(first_pair),
+                                              _mm_cvtsi32_si128(second_pair));
+    vector_sums = _mm_add_epi32(
+        vector_sums,
+        _mm_unpacklo_epi16(_mm_unpacklo_epi8(values, zero), zero));
+  }
+  int lane_sums[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lane_sums), vector_sums);
+  for (int i = 0; i != 4; ++i) {
+    sums[i] += lane_sums[i];
+  }
+}
+#endif
 
 }  // namespace
 
@@ -85,13 +163,52 @@ CreateFastCorrelativeScanMatcherOptions(
       parameter_dictionary->GetDouble("angular_search_window"));
   options.set_branch_and_bound_depth(
       parameter_dictionary->GetInt("branch_and_bound_depth"));
+  options.set_num_threads(parameter_dictionary->GetInt("num_threads"));
+  CHECK_GT(options.num_threads(), 0);
   return options;
 }
 
+uint64 ComputeProbabilityGridHash(const ProbabilityGrid& probability_grid) {
+  // FNV-1a over the limits and the bit patterns of all probabilities.
+  uint64 hash = 14695981039346656037ull;
+  const auto add_bytes = [&hash](const void* const data, const size_t size) {
+    const unsigned char* const bytes =
+        reinterpret_cast<const unsigned char*>(data);
+    for (size_t i = 0; i != size; ++i) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+  };
+  const MapLimits& limits = probability_grid.limits();
+  const double resolution = limits.resolution();
+  add_bytes(&resolution, sizeof(resolution));
+  add_bytes(limits.max().data(), 2 * sizeof(double));
+  const CellLimits& cell_limits = limits.cell_limits();
+  add_bytes(&cell_limits.num_x_cells, sizeof(cell_limits.num_x_cells));
+  add_bytes(&cell_limits.num_y_cells, sizeof(cell_limits.num_y_cells));
+  for (const Eigen::Array2i& xy_index : XYIndexRangeIterator(cell_limits)) {
+    const float probability = probability_grid.GetProbability(xy_index);
+    add_bytes(&probability, sizeof(probability));
+  }
+  return hash;
+}
+
 PrecomputationGrid::PrecomputationGrid(
     const ProbabilityGrid& probability_grid, const CellLimits& limits,
     const int width, std::vector<float>* reusable_intermediate_grid)
-    : offset_(-width + 1, -width + 1),
+    : PrecomputationGrid(ProbabilityLookupGrid(probability_grid), limits,
+                         width, reusable_intermediate_grid) {}
+
+PrecomputationGrid::PrecomputationGrid(
+    const ProbabilityLookupGrid& probability_grid, const CellLimits& limits,
+    const int width, std::vector<float>* reusable_intermediate_grid)
+    : PrecomputationGrid(probability_grid, Eigen::Array2i::Zero(), limits,
+                         width, reusable_intermediate_grid) {}
+
+PrecomputationGrid::PrecomputationGrid(
+    const ProbabilityLookupGrid& probability_grid, const Eigen::Array2i& origin,
+    const CellLimits& limits, const int width,
+    std::vector<float>* reusable_intermediate_grid)
+    : offset_(origin - Eigen::Array2i::Constant(width - 1)),
       wide_limits_(limits.num_x_cells + width - 1,
                    limits.num_y_cells + width - 1),
       cells_(wide_limits_.num_x_cells * wide_limits_.num_y_cells) {
@@ -103,58 +220,172 @@ PrecomputationGrid::PrecomputationGrid(
   // span defined by x0 <= x < x0 + width.
   std::vector<float>& intermediate = *reusable_intermediate_grid;
   intermediate.resize(wide_limits_.num_x_cells * limits.num_y_cells);
+  std::vector<float> running_maxima;
   for (int y = 0; y != limits.num_y_cells; ++y) {
-    SlidingWindowMaximum current_values;
-    current_values.AddValue(
-        probability_grid.GetProbability(Eigen::Array2i(0, y)));
-    for (int x = -width + 1; x != 0; ++x) {
-      intermediate[x + width - 1 + y * stride] = current_values.GetMaximum();
-      if (x + width < limits.num_x_cells) {
-        current_values.AddValue(
-            probability_grid.GetProbability(Eigen::Array2i(x + width, y)));
-      }
-    }
-    for (int x = 0; x < limits.num_x_cells - width; ++x) {
-      intermediate[x + width - 1 + y * stride] = current_values.GetMaximum();
-      current_values.RemoveValue(
-          probability_grid.GetProbability(Eigen::Array2i(x, y)));
-      current_values.AddValue(
-          probability_grid.GetProbability(Eigen::Array2i(x + width, y)));
-    }
-    for (int x = std::max(limits.num_x_cells - width, 0);
-         x != limits.num_x_cells; ++x) {
-      intermediate[x + width - 1 + y * stride] = current_values.GetMaximum();
-      current_values.RemoveValue(
-          probability_grid.GetProbability(Eigen::Array2i(x, y)));
-    }
-    current_values.CheckIsEmpty();
+    const float* const probabilities =
+        probability_grid.GetProbabilities(origin.x(), origin.y() + y,
+                                          limits.num_x_cells);
+    CHECK(probabilities != nullptr);
+    ComputeSlidingWindowMaxima(probabilities, limits.num_x_cells, width,
+                               1 /* num_lanes */, &intermediate[y * stride],
+                               &running_maxima);
   }
   // For each (x, y), we compute the maximum probability in the width x width
   // region starting at each (x, y) and precompute the resulting bound on the
-  // score.
-  for (int x = 0; x != wide_limits_.num_x_cells; ++x) {
-    SlidingWindowMaximum current_values;
-    current_values.AddValue(intermediate[x]);
-    for (int y = -width + 1; y != 0; ++y) {
-      cells_[x + (y + width - 1) * stride] =
-          ComputeCellValue(current_values.GetMaximum());
-      if (y + width < limits.num_y_cells) {
-        current_values.AddValue(intermediate[x + (y + width) * stride]);
+  // score. All columns are processed at once, one row at a time.
+  std::vector<float> maxima(wide_limits_.num_x_cells *
+                            wide_limits_.num_y_cells);
+  ComputeSlidingWindowMaxima(intermediate.data(), limits.num_y_cells, width,
+                             stride, maxima.data(), &running_maxima);
+  for (size_t i = 0; i != maxima.size(); ++i) {
+    cells_[i] = ComputeCellValue(maxima[i]);
+  }
+}
+
+PrecomputationGrid::PrecomputationGrid(
+    const PrecomputationGrid& precomputation_grid, const int width)
+    : offset_(-width + 1, -width + 1),
+      wide_limits_(
+          precomputation_grid.wide_limits_.num_x_cells + width - 1 +
+              precomputation_grid.offset_.x(),
+          precomputation_grid.wide_limits_.num_y_cells + width - 1 +
+              precomputation_grid.offset_.y()),
+      cells_(wide_limits_.num_x_cells * wide_limits_.num_y_cells) {
+  // The width x width region starting at (x0, y0) is covered by the four
+  // regions of 'precomputation_grid' starting at (x0, y0) and shifted by
+  // 'shift' in x, y or both.
+  const int shift = precomputation_grid.offset_.x() - offset_.x();
+  CHECK_GE(shift, 0);
+  CHECK_LE(width, 2 * (1 - precomputation_grid.offset_.x()));
+  // Rounding to uint8 is monotonic, so taking maxima of the cell values gives
+  // the same result as rounding the maximum probability.
+  std::vector<uint8> intermediate(wide_limits_.num_x_cells *
+                                  precomputation_grid.wide_limits_.num_y_cells);
+  for (int y = 0; y != precomputation_grid.wide_limits_.num_y_cells; ++y) {
+    ComputeShiftedMaxima(
+        &precomputation_grid
+             .cells_[y * precomputation_grid.wide_limits_.num_x_cells],
+        precomputation_grid.wide_limits_.num_x_cells, shift, 1 /* num_lanes */,
+        &intermediate[y * wide_limits_.num_x_cells]);
+  }
+  ComputeShiftedMaxima(intermediate.data(),
+                       precomputation_grid.wide_limits_.num_y_cells, shift,
+                       wide_limits_.num_x_cells, cells_.data());
+}
+
+PrecomputationGrid::PrecomputationGrid(const proto::PrecomputationGrid& proto)
+    : offset_(proto.offset_x(), proto.offset_y()),
+      wide_limits_(proto.num_x_cells(), proto.num_y_cells()),
+      cells_(wide_limits_.num_x_cells * wide_limits_.num_y_cells) {
+  CHECK_EQ(proto.cells().size(), cells_.size());
+  std::copy(proto.cells().begin(), proto.cells().end(), cells_.begin());
+}
+
+proto::PrecomputationGrid PrecomputationGrid::ToProto() const {
+  proto::PrecomputationGrid result;
+  result.set_offset_x(offset_.x());
+  result.set_offset_y(offset_.y());
+  result.set_num_x_cells(wide_limits_.num_x_cells);
+  result.set_num_y_cells(wide_limits_.num_y_cells);
+  result.set_cells(reinterpret_cast<const char*>(cells_.data()),
+                   cells_.size());
+  return result;
+}
+
+constexpr int PrecomputationGrid::kMaxNumSummedOffsets;
+
+FlatDiscreteScan::FlatDiscreteScan(const DiscreteScan& discrete_scan)
+    : min_xy_index(Eigen::Array2i::Zero()),
+      max_xy_index(Eigen::Array2i::Zero()) {
+  x_indices.reserve(discrete_scan.size());
+  y_indices.reserve(discrete_scan.size());
+  for (const Eigen::Array2i& xy_index : discrete_scan) {
+    x_indices.push_back(xy_index.x());
+    y_indices.push_back(xy_index.y());
+  }
+  if (!discrete_scan.empty()) {
+    min_xy_index = max_xy_index = discrete_scan.front();
+    for (const Eigen::Array2i& xy_index : discrete_scan) {
+      min_xy_index = min_xy_index.min(xy_index);
+      max_xy_index = max_xy_index.max(xy_index);
+    }
+  }
+}
+
+void PrecomputationGrid::SumValues(const FlatDiscreteScan& scan,
+                                   const Eigen::Array2i* const offsets,
+                                   const int num_offsets,
+                                   int* const sums) const {
+  CHECK_LE(num_offsets, kMaxNumSummedOffsets);
+  const int stride = wide_limits_.num_x_cells;
+  const int num_points = scan.x_indices.size();
+  // Offsets which keep all points within the grid are summed together below.
+  // For each, the flat index of a point plus its 'unchecked_bases' entry is
+  // the index into 'cells_'.
+  int num_unchecked_offsets = 0;
+  int unchecked_offset_indices[kMaxNumSummedOffsets];
+  int unchecked_bases[kMaxNumSummedOffsets];
+  for (int i = 0; i != num_offsets; ++i) {
+    const Eigen::Array2i min_xy_index =
+        scan.min_xy_index + offsets[i] - offset_;
+    const Eigen::Array2i max_xy_index =
+        scan.max_xy_index + offsets[i] - offset_;
+    if (num_points > 0 && (min_xy_index >= 0).all() &&
+        max_xy_index.x() < wide_limits_.num_x_cells &&
+        max_xy_index.y() < wide_limits_.num_y_cells) {
+      const Eigen::Array2i local_offset = offsets[i] - offset_;
+      unchecked_offset_indices[num_unchecked_offsets] = i;
+      unchecked_bases[num_unchecked_offsets] =
+          local_offset.x() + local_offset.y() * stride;
+      ++num_unchecked_offsets;
+    } else {
+      sums[i] = 0;
+      for (int j = 0; j != num_points; ++j) {
+        sums[i] += GetValue(
+            Eigen::Array2i(scan.x_indices[j], scan.y_indices[j]) + offsets[i]);
       }
     }
-    for (int y = 0; y < limits.num_y_cells - width; ++y) {
-      cells_[x + (y + width - 1) * stride] =
-          ComputeCellValue(current_values.GetMaximum());
-      current_values.RemoveValue(intermediate[x + y * stride]);
-      current_values.AddValue(intermediate[x + (y + width) * stride]);
+  }
+  if (num_unchecked_offsets == 0) {
+    return;
+  }
+
+#ifdef __SSE2__
+  // Branch and bound scores 2 x 2 neighboring candidates at the highest
+  // resolution. Their offsets read two runs of two adjacent cells, which are
+  // summed in vector registers.
+  if (num_unchecked_offsets == 4) {
+    int sorted_indices[4] = {0, 1, 2, 3};
+    std::sort(sorted_indices, sorted_indices + 4,
+              [&unchecked_bases](const int lhs, const int rhs) {
+                return unchecked_bases[lhs] < unchecked_bases[rhs];
+              });
+    int sorted_bases[4];
+    for (int k = 0; k != 4; ++k) {
+      sorted_bases[k] = unchecked_bases[sorted_indices[k]];
+    }
+    if (sorted_bases[1] == sorted_bases[0] + 1 &&
+        sorted_bases[2] > sorted_bases[1] &&
+        sorted_bases[3] == sorted_bases[2] + 1) {
+      int sorted_sums[4] = {};
+      SumPairsOfCells(cells_.data(), stride, scan, sorted_bases[0],
+                      sorted_bases[2], sorted_sums);
+      for (int k = 0; k != 4; ++k) {
+        sums[unchecked_offset_indices[sorted_indices[k]]] = sorted_sums[k];
+      }
+      return;
     }
-    for (int y = std::max(limits.num_y_cells - width, 0);
-         y != limits.num_y_cells; ++y) {
-      cells_[x + (y + width - 1) * stride] =
-          ComputeCellValue(current_values.GetMaximum());
-      current_values.RemoveValue(intermediate[x + y * stride]);
+  }
+#endif
+  int unchecked_sums[kMaxNumSummedOffsets] = {};
+  for (int j = 0; j != num_points; ++j) {
+    const int flat_index = scan.x_indices[j] + scan.y_indices[j] * stride;
+    for (int i = 0; i != num_unchecked_offsets; ++i) {
+      unchecked_sums[i] += cells_[flat_index + unchecked_bases[i]];
     }
-    current_values.CheckIsEmpty();
+  }
+  for (int i = 0; i != num_unchecked_offsets; ++i) {
+    sums[unchecked_offset_indices[i]] = unchecked_sums[i];
   }
 }
 
@@ -173,16 +404,35 @@ class PrecomputationGridStack {
       const ProbabilityGrid& probability_grid,
       const proto::FastCorrelativeScanMatcherOptions& options) {
     CHECK_GE(options.branch_and_bound_depth(), 1);
-    const int max_width = 1 << (options.branch_and_bound_depth() - 1);
+    // Reserved up front, since each level refers to the previous one while it
+    // is constructed.
     precomputation_grids_.reserve(options.branch_and_bound_depth());
     std::vector<float> reusable_intermediate_grid;
     const CellLimits limits = probability_grid.limits().cell_limits();
-    reusable_intermediate_grid.reserve((limits.num_x_cells + max_width - 1) *
-                                       limits.num_y_cells);
-    for (int i = 0; i != options.branch_and_bound_depth(); ++i) {
-      const int width = 1 << i;
-      precomputation_grids_.emplace_back(probability_grid, limits, width,
-                                         &reusable_intermediate_grid);
+    const ProbabilityLookupGrid probability_lookup_grid(probability_grid);
+    precomputation_grids_.emplace_back(probability_lookup_grid, limits,
+                                       1 /* width */,
+                                       &reusable_intermediate_grid);
+    // Each deeper level is derived from the previous one of half its width.
+    for (int i = 1; i != options.branch_and_bound_depth(); ++i) {
+      precomputation_grids_.emplace_back(precomputation_grids_.back(), 1 << i);
+    }
+  }
+
+  explicit PrecomputationGridStack(
+      const proto::PrecomputationGridStack& proto) {
+    CHECK_GE(proto.precomputation_grid_size(), 1);
+    precomputation_grids_.reserve(proto.precomputation_grid_size());
+    for (const proto::PrecomputationGrid& precomputation_grid_proto :
+         proto.precomputation_grid()) {
+      precomputation_grids_.emplace_back(precomputation_grid_proto);
+    }
+  }
+
+  void ToProto(proto::PrecomputationGridStack* const proto) const {
+    for (const PrecomputationGrid& precomputation_grid :
+         precomputation_grids_) {
+      *proto->add_precomputation_grid() = precomputation_grid.ToProto();
     }
   }
 
@@ -192,20 +442,77 @@ class PrecomputationGridStack {
 
   int max_depth() const { return precomputation_grids_.size() - 1; }
 
+  size_t num_bytes() const {
+    size_t num_bytes = 0;
+    for (const PrecomputationGrid& precomputation_grid :
+         precomputation_grids_) {
+      num_bytes += precomputation_grid.num_bytes();
+    }
+    return num_bytes;
+  }
+
  private:
   std::vector<PrecomputationGrid> precomputation_grids_;
 };
 
 FastCorrelativeScanMatcher::FastCorrelativeScanMatcher(
     const ProbabilityGrid& probability_grid,
-    const proto::FastCorrelativeScanMatcherOptions& options)
+    const proto::FastCorrelativeScanMatcherOptions& options,
+    common::ThreadPool* const thread_pool)
     : options_(options),
+      thread_pool_(thread_pool),
+      probability_grid_(probability_grid),
       limits_(probability_grid.limits()),
       precomputation_grid_stack_(
-          new PrecomputationGridStack(probability_grid, options)) {}
+          new PrecomputationGridStack(probability_grid, options)),
+      has_probability_grid_hash_(false),
+      probability_grid_hash_(0) {}
+
+FastCorrelativeScanMatcher::FastCorrelativeScanMatcher(
+    const ProbabilityGrid& probability_grid,
+    const proto::PrecomputationGridStack& proto,
+    const proto::FastCorrelativeScanMatcherOptions& options,
+    common::ThreadPool* const thread_pool)
+    : options_(options),
+      thread_pool_(thread_pool),
+      probability_grid_(probability_grid),
+      limits_(probability_grid.limits()),
+      precomputation_grid_stack_(new PrecomputationGridStack(proto)),
+      has_probability_grid_hash_(true),
+      probability_grid_hash_(proto.probability_grid_hash()) {
+  CHECK_EQ(proto.precomputation_grid_size(), options.branch_and_bound_depth());
+}
 
 FastCorrelativeScanMatcher::~FastCorrelativeScanMatcher() {}
 
+bool FastCorrelativeScanMatcher::IsUpToDate(
+    const ProbabilityGrid& probability_grid,
+    const proto::PrecomputationGridStack& proto,
+    const proto::FastCorrelativeScanMatcherOptions& options) {
+  return proto.precomputation_grid_size() ==
+             options.branch_and_bound_depth() &&
+         proto.probability_grid_hash() ==
+             ComputeProbabilityGridHash(probability_grid);
+}
+
+proto::PrecomputationGridStack FastCorrelativeScanMatcher::ToProto() const {
+  proto::PrecomputationGridStack result;
+  {
+    common::MutexLocker locker(&mutex_);
+    if (!has_probability_grid_hash_) {
+      probability_grid_hash_ = ComputeProbabilityGridHash(probability_grid_);
+      has_probability_grid_hash_ = true;
+    }
+    result.set_probability_grid_hash(probability_grid_hash_);
+  }
+  precomputation_grid_stack_->ToProto(&result);
+  return result;
+}
+
+size_t FastCorrelativeScanMatcher::num_bytes() const {
+  return precomputation_grid_stack_->num_bytes();
+}
+
 bool FastCorrelativeScanMatcher::Match(
     const transform::Rigid2d& initial_pose_estimate,
     const sensor::PointCloud& point_cloud, const float min_score, float* score,
@@ -255,12 +562,18 @@ bool FastCorrelativeScanMatcher::MatchWithSearchParameters(
       Eigen::Translation2f(initial_pose_estimate.translation().x(),
                            initial_pose_estimate.translation().y()));
   search_parameters.ShrinkToFit(discrete_scans, limits_.cell_limits());
+  std::vector<FlatDiscreteScan> flat_discrete_scans;
+  flat_discrete_scans.reserve(discrete_scans.size());
+  for (const DiscreteScan& discrete_scan : discrete_scans) {
+    flat_discrete_scans.emplace_back(discrete_scan);
+  }
 
   const std::vector<Candidate> lowest_resolution_candidates =
-      ComputeLowestResolutionCandidates(discrete_scans, search_parameters);
-  const Candidate best_candidate = BranchAndBound(
-      discrete_scans, search_parameters, lowest_resolution_candidates,
-      precomputation_grid_stack_->max_depth(), min_score);
+      ComputeLowestResolutionCandidates(flat_discrete_scans,
+                                        search_parameters);
+  const Candidate best_candidate =
+      ParallelBranchAndBound(flat_discrete_scans, search_parameters,
+                             lowest_resolution_candidates, min_score);
   if (best_candidate.score > min_score) {
     *score = best_candidate.score;
     *pose_estimate = transform::Rigid2d(
@@ -274,7 +587,7 @@ bool FastCorrelativeScanMatcher::MatchWithSearchParameters(
 
 std::vector<Candidate>
 FastCorrelativeScanMatcher::ComputeLowestResolutionCandidates(
-    const std::vector<DiscreteScan>& discrete_scans,
+    const std::vector<FlatDiscreteScan>& discrete_scans,
     const SearchParameters& search_parameters) const {
   std::vector<Candidate> lowest_resolution_candidates =
       GenerateLowestResolutionCandidates(search_parameters);
@@ -324,29 +637,86 @@ FastCorrelativeScanMatcher::GenerateLowestResolutionCandidates(
 
 void FastCorrelativeScanMatcher::ScoreCandidates(
     const PrecomputationGrid& precomputation_grid,
-    const std::vector<DiscreteScan>& discrete_scans,
+    const std::vector<FlatDiscreteScan>& discrete_scans,
     const SearchParameters& search_parameters,
     std::vector<Candidate>* const candidates) const {
-  for (Candidate& candidate : *candidates) {
-    int sum = 0;
-    for (const Eigen::Array2i& xy_index :
-         discrete_scans[candidate.scan_index]) {
-      const Eigen::Array2i proposed_xy_index(
-          xy_index.x() + candidate.x_index_offset,
-          xy_index.y() + candidate.y_index_offset);
-      sum += precomputation_grid.GetValue(proposed_xy_index);
+  // Consecutive candidates for the same scan are scored together.
+  Eigen::Array2i offsets[PrecomputationGrid::kMaxNumSummedOffsets];
+  int sums[PrecomputationGrid::kMaxNumSummedOffsets];
+  for (auto begin = candidates->begin(); begin != candidates->end();) {
+    const int scan_index = begin->scan_index;
+    auto end = begin;
+    int num_offsets = 0;
+    while (end != candidates->end() && end->scan_index == scan_index &&
+           num_offsets != PrecomputationGrid::kMaxNumSummedOffsets) {
+      offsets[num_offsets++] =
+          Eigen::Array2i(end->x_index_offset, end->y_index_offset);
+      ++end;
+    }
+    const FlatDiscreteScan& discrete_scan = discrete_scans[scan_index];
+    precomputation_grid.SumValues(discrete_scan, offsets, num_offsets, sums);
+    for (int i = 0; begin != end; ++begin, ++i) {
+      begin->score = PrecomputationGrid::ToProbability(
+          sums[i] / static_cast<float>(discrete_scan.x_indices.size()));
     }
-    candidate.score = PrecomputationGrid::ToProbability(
-        sum / static_cast<float>(discrete_scans[candidate.scan_index].size()));
   }
   std::sort(candidates->begin(), candidates->end(), std::greater<Candidate>());
 }
 
+Candidate FastCorrelativeScanMatcher::ParallelBranchAndBound(
+    const std::vector<FlatDiscreteScan>& discrete_scans,
+    const SearchParameters& search_parameters,
+    const std::vector<Candidate>& candidates, const float min_score) const {
+  std::atomic<float> best_score(min_score);
+  const int max_depth = precomputation_grid_stack_->max_depth();
+  if (options_.num_threads() == 1 || max_depth == 0) {
+    return BranchAndBound(discrete_scans, search_parameters, candidates,
+                          max_depth, min_score, &best_score);
+  }
+
+  // Each thread searches the candidates it is handed out in order, like the
+  // sequential search, and keeps the first best candidate it finds. Scores of
+  // other threads only prune candidates which cannot even tie with them, so
+  // the first best candidate overall is always found by some thread.
+  Candidate initial_candidate(0, 0, 0, search_parameters);
+  initial_candidate.score = min_score;
+  std::vector<Candidate> best_candidates(options_.num_threads(),
+                                         initial_candidate);
+  std::vector<int> best_candidate_indices(options_.num_threads(),
+                                          candidates.size());
+  common::ParallelFor(
+      candidates.size(), options_.num_threads(), thread_pool_,
+      [&](const int thread_index, const int index) {
+        Candidate& best_candidate = best_candidates[thread_index];
+        const Candidate candidate = BranchAndBound(
+            discrete_scans, search_parameters, {candidates[index]}, max_depth,
+            best_candidate.score, &best_score);
+        if (candidate.score > best_candidate.score) {
+          best_candidate = candidate;
+          best_candidate_indices[thread_index] = index;
+        }
+      });
+
+  int best_thread_index = 0;
+  for (int thread_index = 1; thread_index != options_.num_threads();
+       ++thread_index) {
+    const float score = best_candidates[thread_index].score;
+    const float best_thread_score = best_candidates[best_thread_index].score;
+    if (score > best_thread_score ||
+        (score == best_thread_score &&
+         best_candidate_indices[thread_index] <
+             best_candidate_indices[best_thread_index])) {
+      best_thread_index = thread_index;
+    }
+  }
+  return best_candidates[best_thread_index];
+}
+
 Candidate FastCorrelativeScanMatcher::BranchAndBound(
-    const std::vector<DiscreteScan>& discrete_scans,
+    const std::vector<FlatDiscreteScan>& discrete_scans,
     const SearchParameters& search_parameters,
     const std::vector<Candidate>& candidates, const int candidate_depth,
-    float min_score) const {
+    float min_score, std::atomic<float>* const best_score) const {
   if (candidate_depth == 0) {
     // Return the best candidate.
     return *candidates.begin();
@@ -355,7 +725,7 @@ Candidate FastCorrelativeScanMatcher::BranchAndBound(
   Candidate best_high_resolution_candidate(0, 0, 0, search_parameters);
   best_high_resolution_candidate.score = min_score;
   for (const Candidate& candidate : candidates) {
-    if (candidate.score <= min_score) {
+    if (candidate.score <= min_score || candidate.score < best_score->load()) {
       break;
     }
     std::vector<Candidate> higher_resolution_candidates;
@@ -382,7 +752,8 @@ Candidate FastCorrelativeScanMatcher::BranchAndBound(
         best_high_resolution_candidate,
         BranchAndBound(discrete_scans, search_parameters,
                        higher_resolution_candidates, candidate_depth - 1,
-                       best_high_resolution_candidate.score));
+                       best_high_resolution_candidate.score, best_score));
+    common::UpdateMaximum(best_score, best_high_resolution_candidate.score);
   }
   return best_high_resolution_candidate;
 }
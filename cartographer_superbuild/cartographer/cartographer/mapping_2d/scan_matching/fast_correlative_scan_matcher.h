@@ -25,14 +25,19 @@
 #ifndef CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_FAST_CORRELATIVE_SCAN_MATCHER_H_
 #define CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_FAST_CORRELATIVE_SCAN_MATCHER_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
 #include "Eigen/Core"
+#include "cartographer/common/mutex.h"
 #include "cartographer/common/port.h"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/mapping_2d/probability_grid.h"
+#include "cartographer/mapping_2d/probability_lookup_grid.h"
 #include "cartographer/mapping_2d/scan_matching/correlative_scan_matcher.h"
 #include "cartographer/mapping_2d/scan_matching/proto/fast_correlative_scan_matcher_options.pb.h"
+#include "cartographer/mapping_2d/scan_matching/proto/precomputation_grid.pb.h"
 #include "cartographer/sensor/point_cloud.h"
 
 namespace cartographer {
@@ -43,14 +48,49 @@ proto::FastCorrelativeScanMatcherOptions
 CreateFastCorrelativeScanMatcherOptions(
     common::LuaParameterDictionary* parameter_dictionary);
 
+// Returns a hash of the limits and probabilities of 'probability_grid', used
+// to detect serialized precomputation grids which are stale.
+uint64 ComputeProbabilityGridHash(const ProbabilityGrid& probability_grid);
+
+// A 'DiscreteScan' laid out for scoring candidates: the x and y cell indices
+// are stored in separate arrays, so that flat indices can be computed for
+// several points at once, together with their bounding box.
+struct FlatDiscreteScan {
+  explicit FlatDiscreteScan(const DiscreteScan& discrete_scan);
+
+  std::vector<int> x_indices;
+  std::vector<int> y_indices;
+  Eigen::Array2i min_xy_index;
+  Eigen::Array2i max_xy_index;
+};
+
 // A precomputed grid that contains in each cell (x0, y0) the maximum
 // probability in the width x width area defined by x0 <= x < x0 + width and
 // y0 <= y < y0.
 class PrecomputationGrid {
  public:
+  // Maximum number of offsets handled by a single call to SumValues().
+  static constexpr int kMaxNumSummedOffsets = 4;
+
   PrecomputationGrid(const ProbabilityGrid& probability_grid,
                      const CellLimits& limits, int width,
                      std::vector<float>* reusable_intermediate_grid);
+  PrecomputationGrid(const ProbabilityLookupGrid& probability_grid,
+                     const CellLimits& limits, int width,
+                     std::vector<float>* reusable_intermediate_grid);
+  // Same as above, but only the cells within 'limits' starting at 'origin' are
+  // taken into account, all others count as having 'kMinProbability'.
+  PrecomputationGrid(const ProbabilityLookupGrid& probability_grid,
+                     const Eigen::Array2i& origin, const CellLimits& limits,
+                     int width,
+                     std::vector<float>* reusable_intermediate_grid);
+  // Derives the grid for 'width' from the narrower 'precomputation_grid'. This
+  // is much cheaper than starting from the probabilities, but 'width' must be
+  // at most twice the width of 'precomputation_grid', which has to start at
+  // the origin.
+  PrecomputationGrid(const PrecomputationGrid& precomputation_grid,
+                     int width);
+  explicit PrecomputationGrid(const proto::PrecomputationGrid& proto);
 
   // Returns a value between 0 and 255 to represent probabilities between
   // kMinProbability and kMaxProbability.
@@ -71,6 +111,18 @@ class PrecomputationGrid {
     return cells_[local_xy_index.x() + local_xy_index.y() * stride];
   }
 
+  // Computes into 'sums' the sum of GetValue() over the cells of 'scan'
+  // shifted by each of the first 'num_offsets' of 'offsets'. The flat index of
+  // each point is computed once for all offsets, and no bounds are checked
+  // for offsets keeping 'scan' within the grid.
+  void SumValues(const FlatDiscreteScan& scan, const Eigen::Array2i* offsets,
+                 int num_offsets, int* sums) const;
+
+  proto::PrecomputationGrid ToProto() const;
+
+  // Returns the number of bytes used by the cell values.
+  size_t num_bytes() const { return cells_.size() * sizeof(uint8); }
+
   // Maps values from [0, 255] to [kMinProbability, kMaxProbability].
   static float ToProbability(float value) {
     return mapping::kMinProbability +
@@ -97,9 +149,23 @@ class PrecomputationGridStack;
 // An implementation of "Real-Time Correlative Scan Matching" by Olson.
 class FastCorrelativeScanMatcher {
  public:
+  // The 'thread_pool' runs all but one of the 'num_threads' threads of a match.
+  // It may be nullptr if 'num_threads' is 1. The 'probability_grid' is hashed
+  // by the first call to ToProto(), so it must stay valid and unchanged until
+  // then.
   FastCorrelativeScanMatcher(
       const ProbabilityGrid& probability_grid,
-      const proto::FastCorrelativeScanMatcherOptions& options);
+      const proto::FastCorrelativeScanMatcherOptions& options,
+      common::ThreadPool* thread_pool);
+  // Restores the scan matcher for 'probability_grid' from precomputation grids
+  // serialized by ToProto(), which is much faster than computing them. The
+  // 'proto' must have been serialized for the same 'probability_grid' and
+  // 'branch_and_bound_depth', see IsUpToDate().
+  FastCorrelativeScanMatcher(
+      const ProbabilityGrid& probability_grid,
+      const proto::PrecomputationGridStack& proto,
+      const proto::FastCorrelativeScanMatcherOptions& options,
+      common::ThreadPool* thread_pool);
   ~FastCorrelativeScanMatcher();
 
   FastCorrelativeScanMatcher(const FastCorrelativeScanMatcher&) = delete;
@@ -121,6 +187,22 @@ class FastCorrelativeScanMatcher {
   bool MatchFullSubmap(const sensor::PointCloud& point_cloud, float min_score,
                        float* score, transform::Rigid2d* pose_estimate) const;
 
+  // Returns true if 'proto' can be used to restore the scan matcher for
+  // 'probability_grid' with 'options'.
+  static bool IsUpToDate(
+      const ProbabilityGrid& probability_grid,
+      const proto::PrecomputationGridStack& proto,
+      const proto::FastCorrelativeScanMatcherOptions& options);
+
+  proto::PrecomputationGridStack ToProto() const;
+
+  // Returns the limits of the 'probability_grid' this was built for.
+  const MapLimits& limits() const { return limits_; }
+
+  // Returns the number of bytes used by the precomputation grids, which make up
+  // nearly all of the memory used by this scan matcher.
+  size_t num_bytes() const;
+
  private:
   // The actual implementation of the scan matcher, called by Match() and
   // MatchFullSubmap() with appropriate 'initial_pose_estimate' and
@@ -131,22 +213,39 @@ class FastCorrelativeScanMatcher {
       const sensor::PointCloud& point_cloud, float min_score, float* score,
       transform::Rigid2d* pose_estimate) const;
   std::vector<Candidate> ComputeLowestResolutionCandidates(
-      const std::vector<DiscreteScan>& discrete_scans,
+      const std::vector<FlatDiscreteScan>& discrete_scans,
       const SearchParameters& search_parameters) const;
   std::vector<Candidate> GenerateLowestResolutionCandidates(
       const SearchParameters& search_parameters) const;
   void ScoreCandidates(const PrecomputationGrid& precomputation_grid,
-                       const std::vector<DiscreteScan>& discrete_scans,
+                       const std::vector<FlatDiscreteScan>& discrete_scans,
                        const SearchParameters& search_parameters,
                        std::vector<Candidate>* const candidates) const;
-  Candidate BranchAndBound(const std::vector<DiscreteScan>& discrete_scans,
+  // Searches the lowest resolution 'candidates' with 'num_threads' threads.
+  // Returns the same candidate as the sequential BranchAndBound().
+  Candidate ParallelBranchAndBound(
+      const std::vector<FlatDiscreteScan>& discrete_scans,
+      const SearchParameters& search_parameters,
+      const std::vector<Candidate>& candidates, float min_score) const;
+  // Candidates are pruned if their score is at most 'min_score', or below
+  // 'best_score', which is the best score found so far by any thread.
+  Candidate BranchAndBound(const std::vector<FlatDiscreteScan>& discrete_scans,
                            const SearchParameters& search_parameters,
                            const std::vector<Candidate>& candidates,
-                           int candidate_depth, float min_score) const;
+                           int candidate_depth, float min_score,
+                           std::atomic<float>* best_score) const;
 
   const proto::FastCorrelativeScanMatcherOptions options_;
+  common::ThreadPool* const thread_pool_;
+  const ProbabilityGrid& probability_grid_;
   MapLimits limits_;
   std::unique_ptr<PrecomputationGridStack> precomputation_grid_stack_;
+
+  mutable common::Mutex mutex_;
+  // Only computed when needed by ToProto(), or taken from the proto this was
+  // restored from.
+  mutable bool has_probability_grid_hash_ GUARDED_BY(mutex_);
+  mutable uint64 probability_grid_hash_ GUARDED_BY(mutex_);
 };
 
 }  // namespace scan_matching
@@ -23,6 +23,7 @@
 #include <string>
 
 #include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/mapping_2d/probability_grid.h"
 #include "cartographer/mapping_2d/range_data_inserter.h"
 #include "cartographer/transform/rigid_transform_test_helpers.h"
@@ -104,6 +105,87 @@ TEST(PrecomputationGridTest, TinyProbabilityGrid) {
   }
 }
 
+TEST(PrecomputationGridTest, DerivedFromNarrowerGrid) {
+  std::mt19937 prng(42);
+  std::uniform_real_distribution<float> distribution(mapping::kMinProbability,
+                                                     mapping::kMaxProbability);
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(5., 5.), CellLimits(100, 70)));
+  for (const Eigen::Array2i& xy_index :
+       XYIndexRangeIterator(Eigen::Array2i(20, 10), Eigen::Array2i(89, 69))) {
+    probability_grid.SetProbability(xy_index, distribution(prng));
+  }
+
+  const CellLimits& limits = probability_grid.limits().cell_limits();
+  std::vector<float> reusable_intermediate_grid;
+  for (const int narrow_width : {1, 2, 3, 8}) {
+    const PrecomputationGrid narrow_grid(probability_grid, limits, narrow_width,
+                                         &reusable_intermediate_grid);
+    for (int width = narrow_width; width <= 2 * narrow_width; ++width) {
+      const PrecomputationGrid expected_grid(
+          probability_grid, limits, width, &reusable_intermediate_grid);
+      const PrecomputationGrid derived_grid(narrow_grid, width);
+      for (const Eigen::Array2i& xy_index : XYIndexRangeIterator(
+               Eigen::Array2i(-width - 1, -width - 1),
+               Eigen::Array2i(limits.num_x_cells, limits.num_y_cells))) {
+        EXPECT_EQ(expected_grid.GetValue(xy_index),
+                  derived_grid.GetValue(xy_index));
+      }
+    }
+  }
+}
+
+TEST(PrecomputationGridTest, SumValuesMatchesGetValue) {
+  std::mt19937 prng(42);
+  std::uniform_real_distribution<float> distribution(mapping::kMinProbability,
+                                                     mapping::kMaxProbability);
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(5., 5.), CellLimits(60, 50)));
+  for (const Eigen::Array2i& xy_index :
+       XYIndexRangeIterator(probability_grid.limits().cell_limits())) {
+    probability_grid.SetProbability(xy_index, distribution(prng));
+  }
+  std::vector<float> reusable_intermediate_grid;
+  const PrecomputationGrid precomputation_grid(
+      probability_grid, probability_grid.limits().cell_limits(), 4,
+      &reusable_intermediate_grid);
+
+  std::uniform_int_distribution<int> index_distribution(-5, 30);
+  for (int i = 0; i != 100; ++i) {
+    DiscreteScan discrete_scan;
+    for (int j = 0; j != i % 37; ++j) {
+      discrete_scan.emplace_back(index_distribution(prng),
+                                 index_distribution(prng));
+    }
+    const FlatDiscreteScan flat_discrete_scan(discrete_scan);
+    // Some offsets keep the scan within the grid, others move it partially or
+    // fully outside. Every other time, they are 2 x 2 neighbors as scored by
+    // branch and bound.
+    Eigen::Array2i offsets[PrecomputationGrid::kMaxNumSummedOffsets];
+    for (Eigen::Array2i& offset : offsets) {
+      offset = Eigen::Array2i(index_distribution(prng),
+                              index_distribution(prng)) -
+               Eigen::Array2i(5, 5);
+    }
+    if (i % 2 == 0) {
+      offsets[1] = offsets[0] + Eigen::Array2i(0, 1);
+      offsets[2] = offsets[0] + Eigen::Array2i(1, 0);
+      offsets[3] = offsets[0] + Eigen::Array2i(1, 1);
+    }
+    int sums[PrecomputationGrid::kMaxNumSummedOffsets];
+    precomputation_grid.SumValues(flat_discrete_scan, offsets,
+                                  PrecomputationGrid::kMaxNumSummedOffsets,
+                                  sums);
+    for (int k = 0; k != PrecomputationGrid::kMaxNumSummedOffsets; ++k) {
+      int expected_sum = 0;
+      for (const Eigen::Array2i& xy_index : discrete_scan) {
+        expected_sum += precomputation_grid.GetValue(xy_index + offsets[k]);
+      }
+      EXPECT_EQ(expected_sum, sums[k]);
+    }
+  }
+}
+
 proto::FastCorrelativeScanMatcherOptions
 CreateFastCorrelativeScanMatcherTestOptions(const int branch_and_bound_depth) {
   auto parameter_dictionary =
@@ -111,6 +193,7 @@ CreateFastCorrelativeScanMatcherTestOptions(const int branch_and_bound_depth) {
       return {
          linear_search_window = 3.,
          angular_search_window = 1.,
+         num_threads = 1,
          branch_and_bound_depth = )text" +
                              std::to_string(branch_and_bound_depth) + "}");
   return CreateFastCorrelativeScanMatcherOptions(parameter_dictionary.get());
@@ -159,8 +242,8 @@ TEST(FastCorrelativeScanMatcherTest, CorrectPose) {
         &probability_grid);
     probability_grid.FinishUpdate();
 
-    FastCorrelativeScanMatcher fast_correlative_scan_matcher(probability_grid,
-                                                             options);
+    FastCorrelativeScanMatcher fast_correlative_scan_matcher(
+        probability_grid, options, nullptr /* thread_pool */);
     transform::Rigid2d pose_estimate;
     float score;
     EXPECT_TRUE(fast_correlative_scan_matcher.Match(
@@ -180,6 +263,9 @@ TEST(FastCorrelativeScanMatcherTest, FullSubmapMatching) {
   RangeDataInserter range_data_inserter(CreateRangeDataInserterTestOptions());
   constexpr float kMinScore = 0.1f;
   const auto options = CreateFastCorrelativeScanMatcherTestOptions(6);
+  auto parallel_options = options;
+  parallel_options.set_num_threads(4);
+  common::ThreadPool thread_pool(3);
 
   sensor::PointCloud unperturbed_point_cloud;
   unperturbed_point_cloud.emplace_back(-2.5f, 0.5f, 0.f);
@@ -211,8 +297,8 @@ TEST(FastCorrelativeScanMatcherTest, FullSubmapMatching) {
         &probability_grid);
     probability_grid.FinishUpdate();
 
-    FastCorrelativeScanMatcher fast_correlative_scan_matcher(probability_grid,
-                                                             options);
+    FastCorrelativeScanMatcher fast_correlative_scan_matcher(
+        probability_grid, options, nullptr /* thread_pool */);
     transform::Rigid2d pose_estimate;
     float score;
     EXPECT_TRUE(fast_correlative_scan_matcher.MatchFullSubmap(
@@ -222,9 +308,81 @@ TEST(FastCorrelativeScanMatcherTest, FullSubmapMatching) {
                 transform::IsNearly(pose_estimate.cast<float>(), 0.03f))
         << "Actual: " << transform::ToProto(pose_estimate).DebugString()
         << "\nExpected: " << transform::ToProto(expected_pose).DebugString();
+
+    // The parallel search has to find exactly the same pose.
+    FastCorrelativeScanMatcher parallel_fast_correlative_scan_matcher(
+        probability_grid, parallel_options, &thread_pool);
+    transform::Rigid2d parallel_pose_estimate;
+    float parallel_score;
+    EXPECT_TRUE(parallel_fast_correlative_scan_matcher.MatchFullSubmap(
+        point_cloud, kMinScore, &parallel_score, &parallel_pose_estimate));
+    EXPECT_EQ(score, parallel_score);
+    EXPECT_EQ(pose_estimate.translation(),
+              parallel_pose_estimate.translation());
+    EXPECT_EQ(pose_estimate.rotation().angle(),
+              parallel_pose_estimate.rotation().angle());
   }
 }
 
+TEST(FastCorrelativeScanMatcherTest, RestoredFromProto) {
+  RangeDataInserter range_data_inserter(CreateRangeDataInserterTestOptions());
+  constexpr float kMinScore = 0.1f;
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(3);
+
+  sensor::PointCloud point_cloud;
+  point_cloud.emplace_back(-2.5f, 0.5f, 0.f);
+  point_cloud.emplace_back(-2.f, 0.5f, 0.f);
+  point_cloud.emplace_back(0.f, -0.5f, 0.f);
+  point_cloud.emplace_back(0.5f, -1.6f, 0.f);
+  point_cloud.emplace_back(2.5f, 0.5f, 0.f);
+  point_cloud.emplace_back(2.5f, 1.7f, 0.f);
+
+  const transform::Rigid2f expected_pose({0.4f, -0.3f}, 0.2f);
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(5., 5.), CellLimits(200, 200)));
+  range_data_inserter.Insert(
+      sensor::RangeData{
+          Eigen::Vector3f(expected_pose.translation().x(),
+                          expected_pose.translation().y(), 0.f),
+          sensor::TransformPointCloud(point_cloud,
+                                      transform::Embed3D(expected_pose)),
+          {}},
+      &probability_grid);
+  probability_grid.FinishUpdate();
+
+  const FastCorrelativeScanMatcher fast_correlative_scan_matcher(
+      probability_grid, options, nullptr /* thread_pool */);
+  const proto::PrecomputationGridStack proto =
+      fast_correlative_scan_matcher.ToProto();
+  ASSERT_EQ(options.branch_and_bound_depth(),
+            proto.precomputation_grid_size());
+  EXPECT_TRUE(
+      FastCorrelativeScanMatcher::IsUpToDate(probability_grid, proto, options));
+  EXPECT_FALSE(FastCorrelativeScanMatcher::IsUpToDate(
+      probability_grid, proto, CreateFastCorrelativeScanMatcherTestOptions(4)));
+
+  const FastCorrelativeScanMatcher restored_fast_correlative_scan_matcher(
+      probability_grid, proto, options, nullptr /* thread_pool */);
+  EXPECT_EQ(fast_correlative_scan_matcher.num_bytes(),
+            restored_fast_correlative_scan_matcher.num_bytes());
+  transform::Rigid2d pose_estimate;
+  transform::Rigid2d restored_pose_estimate;
+  float score;
+  float restored_score;
+  EXPECT_TRUE(fast_correlative_scan_matcher.MatchFullSubmap(
+      point_cloud, kMinScore, &score, &pose_estimate));
+  EXPECT_TRUE(restored_fast_correlative_scan_matcher.MatchFullSubmap(
+      point_cloud, kMinScore, &restored_score, &restored_pose_estimate));
+  EXPECT_EQ(score, restored_score);
+  EXPECT_THAT(restored_pose_estimate,
+              transform::IsNearly(pose_estimate, 1e-9));
+
+  // Changing the probability grid makes the serialized grids stale.
+  probability_grid.SetProbability(Eigen::Array2i(10, 10), 0.9f);
+  EXPECT_FALSE(
+      FastCorrelativeScanMatcher::IsUpToDate(probability_grid, proto, options));
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_2d
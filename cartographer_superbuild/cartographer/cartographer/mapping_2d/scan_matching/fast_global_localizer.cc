@@ -16,6 +16,12 @@
 
 #include "cartographer/mapping_2d/scan_matching/fast_global_localizer.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
 #include "glog/logging.h"
 
 namespace cartographer {
@@ -34,26 +40,109 @@ bool PerformGlobalLocalization(
       << "Need a non-null output_pose_estimate!";
   CHECK(best_score != nullptr) << "Need a non-null best_score!";
   *best_score = cutoff;
-  transform::Rigid2d pose_estimate;
-  const sensor::PointCloud filtered_point_cloud =
-      voxel_filter.Filter(point_cloud);
-  bool success = false;
+  std::vector<GlobalLocalizationResult> results;
+  if (!PerformGlobalLocalization(
+          cutoff, 0.f /* alternatives_score_margin */, voxel_filter, matchers,
+          {} /* priorities */, point_cloud, 1 /* num_threads */,
+          nullptr /* thread_pool */, &results)) {
+    return false;
+  }
+  *best_score = results.front().score;
+  *best_pose_estimate = results.front().pose_estimate;
+  return true;
+}
+
+bool PerformGlobalLocalization(
+    const float cutoff, const float alternatives_score_margin,
+    const cartographer::sensor::AdaptiveVoxelFilter& voxel_filter,
+    const std::vector<
+        cartographer::mapping_2d::scan_matching::FastCorrelativeScanMatcher*>&
+        matchers,
+    const std::vector<float>& priorities,
+    const cartographer::sensor::PointCloud& point_cloud, const int num_threads,
+    common::ThreadPool* const thread_pool,
+    std::vector<GlobalLocalizationResult>* const results) {
+  CHECK(results != nullptr) << "Need a non-null results!";
+  CHECK_GE(alternatives_score_margin, 0.f);
+  results->clear();
   if (matchers.size() == 0) {
     LOG(WARNING) << "Map not yet large enough to localize in!";
     return false;
   }
-  for (auto& matcher : matchers) {
-    float score = -1;
-    transform::Rigid2d pose_estimate;
-    if (matcher->MatchFullSubmap(filtered_point_cloud, *best_score, &score,
-                                 &pose_estimate)) {
-      CHECK_GT(score, *best_score) << "MatchFullSubmap lied!";
-      *best_score = score;
-      *best_pose_estimate = pose_estimate;
-      success = true;
+  CHECK(priorities.empty() || priorities.size() == matchers.size());
+  std::vector<int> search_order(matchers.size());
+  std::iota(search_order.begin(), search_order.end(), 0);
+  if (!priorities.empty()) {
+    std::stable_sort(search_order.begin(), search_order.end(),
+                     [&priorities](const int lhs, const int rhs) {
+                       return priorities[lhs] > priorities[rhs];
+                     });
+  }
+  const sensor::PointCloud filtered_point_cloud =
+      voxel_filter.Filter(point_cloud);
+
+  // Matchers only need to find poses scoring at least this much below the
+  // best score found so far by any thread. Since the best score only grows,
+  // every pose which ends up in 'results' is found, no matter in which order
+  // the threads finish.
+  std::atomic<float> best_score(cutoff);
+  const auto compute_min_score = [cutoff,
+                                  alternatives_score_margin](const float score) {
+    return std::max(cutoff, score - alternatives_score_margin);
+  };
+  std::vector<GlobalLocalizationResult> matches(matchers.size());
+  common::ParallelFor(
+      matchers.size(), num_threads, thread_pool,
+      [&](const int /* thread_index */, const int index) {
+        GlobalLocalizationResult& match = matches[index];
+        match.matcher_index = search_order[index];
+        match.score = -std::numeric_limits<float>::infinity();
+        const float min_score = compute_min_score(best_score.load());
+        // MatchFullSubmap() only finds scores above its 'min_score', but
+        // poses scoring exactly 'min_score' are wanted as well, except at the
+        // 'cutoff'.
+        if (matchers[match.matcher_index]->MatchFullSubmap(
+                filtered_point_cloud,
+                min_score == cutoff
+                    ? cutoff
+                    : std::nextafter(min_score,
+                                     -std::numeric_limits<float>::infinity()),
+                &match.score, &match.pose_estimate)) {
+          common::UpdateMaximum(&best_score, match.score);
+        }
+      });
+
+  const float min_score = compute_min_score(best_score.load());
+  for (const GlobalLocalizationResult& match : matches) {
+    if (match.score > cutoff && match.score >= min_score) {
+      results->push_back(match);
     }
   }
-  return success;
+  // 'matches' are in search order, which a stable sort preserves for ties.
+  std::stable_sort(results->begin(), results->end(),
+                   [](const GlobalLocalizationResult& lhs,
+                      const GlobalLocalizationResult& rhs) {
+                     return lhs.score > rhs.score;
+                   });
+  return !results->empty();
+}
+
+std::vector<float> ComputeGlobalLocalizationPriorities(
+    const std::vector<
+        cartographer::mapping_2d::scan_matching::FastCorrelativeScanMatcher*>&
+        matchers,
+    const Eigen::Vector2d& position) {
+  std::vector<float> priorities;
+  priorities.reserve(matchers.size());
+  for (const FastCorrelativeScanMatcher* const matcher : matchers) {
+    const MapLimits& limits = matcher->limits();
+    const Eigen::Vector2d center =
+        limits.max() - 0.5 * limits.resolution() *
+                           Eigen::Vector2d(limits.cell_limits().num_y_cells,
+                                           limits.cell_limits().num_x_cells);
+    priorities.push_back(-(center - position).norm());
+  }
+  return priorities;
 }
 
 }  // namespace scan_matching
@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "Eigen/Geometry"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/mapping_2d/scan_matching/fast_correlative_scan_matcher.h"
 #include "cartographer/sensor/voxel_filter.h"
 
@@ -44,6 +45,43 @@ bool PerformGlobalLocalization(
     const cartographer::sensor::PointCloud& point_cloud,
     transform::Rigid2d* best_pose_estimate, float* best_score);
 
+struct GlobalLocalizationResult {
+  // Index into the 'matchers' of the matcher which found this pose.
+  int matcher_index;
+  transform::Rigid2d pose_estimate;
+  float score;
+};
+
+// Like above, but searches the 'matchers' with 'num_threads' threads, all but
+// the calling thread taken from 'thread_pool'. Matchers with higher
+// 'priorities' are searched first, so that their scores prune the search of
+// the others. If 'priorities' is empty, the matchers are searched in order.
+//
+// 'results' is set to the best pose of each matcher which scores above the
+// 'cutoff' and at most 'alternatives_score_margin' below the best score,
+// ordered by decreasing score. Ties are ordered as the matchers are searched.
+// This does not depend on the 'num_threads'. Returns true if 'results' is not
+// empty.
+bool PerformGlobalLocalization(
+    float cutoff, float alternatives_score_margin,
+    const cartographer::sensor::AdaptiveVoxelFilter& voxel_filter,
+    const std::vector<
+        cartographer::mapping_2d::scan_matching::FastCorrelativeScanMatcher*>&
+        matchers,
+    const std::vector<float>& priorities,
+    const cartographer::sensor::PointCloud& point_cloud, int num_threads,
+    common::ThreadPool* thread_pool,
+    std::vector<GlobalLocalizationResult>* results);
+
+// Returns 'priorities' for PerformGlobalLocalization() which prefer the
+// 'matchers' whose grids are centered closest to the 'position', e.g. the last
+// known position.
+std::vector<float> ComputeGlobalLocalizationPriorities(
+    const std::vector<
+        cartographer::mapping_2d::scan_matching::FastCorrelativeScanMatcher*>&
+        matchers,
+    const Eigen::Vector2d& position);
+
 }  // namespace scan_matching
 }  // namespace mapping_2d
 }  // namespace cartographer
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_2d/scan_matching/fast_global_localizer.h"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
+#include "cartographer/common/make_unique.h"
+#include "cartographer/common/thread_pool.h"
+#include "cartographer/mapping_2d/probability_grid.h"
+#include "cartographer/mapping_2d/range_data_inserter.h"
+#include "cartographer/transform/rigid_transform_test_helpers.h"
+#include "cartographer/transform/transform.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+namespace {
+
+class FastGlobalLocalizerTest : public ::testing::Test {
+ protected:
+  FastGlobalLocalizerTest()
+      : voxel_filter_(CreateVoxelFilterTestOptions()),
+        thread_pool_(3) {
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          insert_free_space = true,
+          hit_probability = 0.7,
+          miss_probability = 0.4,
+        })text");
+    RangeDataInserter range_data_inserter(
+        CreateRangeDataInserterOptions(parameter_dictionary.get()));
+    parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          linear_search_window = 3.,
+          angular_search_window = 1.,
+          branch_and_bound_depth = 6,
+          num_threads = 2,
+        })text");
+    const proto::FastCorrelativeScanMatcherOptions options =
+        CreateFastCorrelativeScanMatcherOptions(parameter_dictionary.get());
+
+    point_cloud_.emplace_back(-2.5f, 0.5f, 0.f);
+    point_cloud_.emplace_back(-2.25f, 0.5f, 0.f);
+    point_cloud_.emplace_back(0.f, 0.5f, 0.f);
+    point_cloud_.emplace_back(0.25f, 1.6f, 0.f);
+    point_cloud_.emplace_back(2.5f, 0.5f, 0.f);
+    point_cloud_.emplace_back(2.0f, 1.8f, 0.f);
+
+    // Submaps next to each other, of which only some contain the scan.
+    std::mt19937 prng(42);
+    std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+    for (int i = 0; i != 6; ++i) {
+      const Eigen::Vector2d max(5. + 10. * i, 5.);
+      probability_grids_.push_back(common::make_unique<ProbabilityGrid>(
+          MapLimits(0.05, max, CellLimits(200, 200))));
+      if (i % 2 == 0) {
+        const transform::Rigid2f pose(
+            {max.x() - 5. + distribution(prng), distribution(prng)},
+            0.5 * distribution(prng));
+        range_data_inserter.Insert(
+            sensor::RangeData{
+                Eigen::Vector3f(pose.translation().x(),
+                                pose.translation().y(), 0.f),
+                sensor::TransformPointCloud(point_cloud_,
+                                            transform::Embed3D(pose)),
+                {}},
+            probability_grids_.back().get());
+      }
+      probability_grids_.back()->FinishUpdate();
+      scan_matchers_.push_back(common::make_unique<FastCorrelativeScanMatcher>(
+          *probability_grids_.back(), options, &thread_pool_));
+      matchers_.push_back(scan_matchers_.back().get());
+    }
+  }
+
+  static sensor::proto::AdaptiveVoxelFilterOptions
+  CreateVoxelFilterTestOptions() {
+    sensor::proto::AdaptiveVoxelFilterOptions options;
+    options.set_max_length(0.1f);
+    options.set_min_num_points(100.f);
+    options.set_max_range(50.f);
+    return options;
+  }
+
+  sensor::AdaptiveVoxelFilter voxel_filter_;
+  common::ThreadPool thread_pool_;
+  sensor::PointCloud point_cloud_;
+  std::vector<std::unique_ptr<ProbabilityGrid>> probability_grids_;
+  std::vector<std::unique_ptr<FastCorrelativeScanMatcher>> scan_matchers_;
+  std::vector<FastCorrelativeScanMatcher*> matchers_;
+};
+
+TEST_F(FastGlobalLocalizerTest, ParallelSearchFindsSameResults) {
+  constexpr float kCutoff = 0.1f;
+  constexpr float kAlternativesScoreMargin = 1.f;
+  std::vector<GlobalLocalizationResult> expected_results;
+  EXPECT_TRUE(PerformGlobalLocalization(
+      kCutoff, kAlternativesScoreMargin, voxel_filter_, matchers_, {},
+      point_cloud_, 1 /* num_threads */, nullptr /* thread_pool */,
+      &expected_results));
+  ASSERT_EQ(3, expected_results.size());
+  for (size_t i = 1; i < expected_results.size(); ++i) {
+    EXPECT_GE(expected_results[i - 1].score, expected_results[i].score);
+  }
+
+  transform::Rigid2d best_pose_estimate;
+  float best_score;
+  EXPECT_TRUE(PerformGlobalLocalization(kCutoff, voxel_filter_, matchers_,
+                                        point_cloud_, &best_pose_estimate,
+                                        &best_score));
+  EXPECT_EQ(expected_results.front().score, best_score);
+
+  for (const Eigen::Vector2d& last_known_position :
+       {Eigen::Vector2d(0., 0.), Eigen::Vector2d(50., 0.)}) {
+    std::vector<GlobalLocalizationResult> results;
+    EXPECT_TRUE(PerformGlobalLocalization(
+        kCutoff, kAlternativesScoreMargin, voxel_filter_, matchers_,
+        ComputeGlobalLocalizationPriorities(matchers_, last_known_position),
+        point_cloud_, 4 /* num_threads */, &thread_pool_, &results));
+    ASSERT_EQ(expected_results.size(), results.size());
+    for (size_t i = 0; i != results.size(); ++i) {
+      EXPECT_EQ(expected_results[i].matcher_index, results[i].matcher_index);
+      EXPECT_EQ(expected_results[i].score, results[i].score);
+      EXPECT_THAT(results[i].pose_estimate,
+                  transform::IsNearly(expected_results[i].pose_estimate, 1e-9));
+    }
+  }
+}
+
+TEST_F(FastGlobalLocalizerTest, PrioritiesPreferNearbySubmaps) {
+  const std::vector<float> priorities = ComputeGlobalLocalizationPriorities(
+      matchers_, Eigen::Vector2d(20., 0.));
+  ASSERT_EQ(matchers_.size(), priorities.size());
+  for (size_t i = 0; i != priorities.size(); ++i) {
+    if (i != 2) {
+      EXPECT_GT(priorities[2], priorities[i]);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
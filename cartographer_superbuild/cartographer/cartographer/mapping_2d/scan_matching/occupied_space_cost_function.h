@@ -0,0 +1,156 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_OCCUPIED_SPACE_COST_FUNCTION_H_
+#define CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_OCCUPIED_SPACE_COST_FUNCTION_H_
+
+#include <climits>
+#include <cmath>
+
+#include "Eigen/Core"
+#include "cartographer/mapping_2d/probability_lookup_grid.h"
+#include "cartographer/sensor/point_cloud.h"
+#include "ceres/ceres.h"
+#include "ceres/cubic_interpolation.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+
+// Computes the same cost as the 'OccupiedSpaceCostFunctor', but with hand
+// derived Jacobians: the bicubic interpolation yields the value and spatial
+// gradient of the map at each point in one pass, which is then chained through
+// the 2D rigid transform. The points are transformed all at once.
+class OccupiedSpaceCostFunction : public ceres::CostFunction {
+ public:
+  OccupiedSpaceCostFunction(const double scaling_factor,
+                            const sensor::PointCloud& point_cloud,
+                            const ProbabilityLookupGrid& probability_grid)
+      : scaling_factor_(scaling_factor),
+        points_(2, point_cloud.size()),
+        probability_grid_(&probability_grid) {
+    for (size_t i = 0; i < point_cloud.size(); ++i) {
+      points_.col(i) = point_cloud[i].head<2>().cast<double>();
+    }
+    set_num_residuals(point_cloud.size());
+    mutable_parameter_block_sizes()->push_back(3);
+  }
+
+  // Rebinds this cost function to another 'point_cloud' and
+  // 'probability_grid', so that it can be reused across problems.
+  void Rebind(const double scaling_factor,
+              const sensor::PointCloud& point_cloud,
+              const ProbabilityLookupGrid& probability_grid) {
+    scaling_factor_ = scaling_factor;
+    points_.resize(2, point_cloud.size());
+    for (size_t i = 0; i < point_cloud.size(); ++i) {
+      points_.col(i) = point_cloud[i].head<2>().cast<double>();
+    }
+    probability_grid_ = &probability_grid;
+    set_num_residuals(point_cloud.size());
+  }
+
+  OccupiedSpaceCostFunction(const OccupiedSpaceCostFunction&) = delete;
+  OccupiedSpaceCostFunction& operator=(const OccupiedSpaceCostFunction&) =
+      delete;
+
+  bool Evaluate(double const* const* parameters, double* residuals,
+                double** jacobians) const override {
+    const double* const pose = parameters[0];
+    const double cos_theta = std::cos(pose[2]);
+    const double sin_theta = std::sin(pose[2]);
+    Eigen::Matrix2d rotation;
+    rotation << cos_theta, -sin_theta, sin_theta, cos_theta;
+    // Rotated points, to which the translation is not yet applied.
+    const Eigen::Matrix2Xd rotated_points = rotation * points_;
+
+    const MapLimits& limits = probability_grid_->limits();
+    const double inverse_resolution = 1. / limits.resolution();
+    const Eigen::ArrayXd rows =
+        (limits.max().x() - pose[0] - rotated_points.row(0).array()) *
+            inverse_resolution +
+        (kPadding - 0.5);
+    const Eigen::ArrayXd columns =
+        (limits.max().y() - pose[1] - rotated_points.row(1).array()) *
+            inverse_resolution +
+        (kPadding - 0.5);
+
+    const GridArrayAdapter adapter(*probability_grid_);
+    ceres::BiCubicInterpolator<GridArrayAdapter> interpolator(adapter);
+    double* const jacobian = jacobians == nullptr ? nullptr : jacobians[0];
+    for (int i = 0; i < points_.cols(); ++i) {
+      double value;
+      if (jacobian == nullptr) {
+        interpolator.Evaluate(rows[i], columns[i], &value);
+      } else {
+        double dvalue_drow;
+        double dvalue_dcolumn;
+        interpolator.Evaluate(rows[i], columns[i], &value, &dvalue_drow,
+                              &dvalue_dcolumn);
+        // The row decreases with x, the column with y. Rotating by 'theta'
+        // moves the rotated point (x, y) in direction (-y, x).
+        const double dresidual_drow =
+            scaling_factor_ * inverse_resolution * dvalue_drow;
+        const double dresidual_dcolumn =
+            scaling_factor_ * inverse_resolution * dvalue_dcolumn;
+        jacobian[3 * i] = dresidual_drow;
+        jacobian[3 * i + 1] = dresidual_dcolumn;
+        jacobian[3 * i + 2] = -dresidual_drow * rotated_points(1, i) +
+                              dresidual_dcolumn * rotated_points(0, i);
+      }
+      residuals[i] = scaling_factor_ * (1. - value);
+    }
+    return true;
+  }
+
+ private:
+  static constexpr int kPadding = INT_MAX / 4;
+  class GridArrayAdapter {
+   public:
+    enum { DATA_DIMENSION = 1 };
+
+    explicit GridArrayAdapter(const ProbabilityLookupGrid& probability_grid)
+        : probability_grid_(probability_grid) {}
+
+    void GetValue(const int row, const int column, double* const value) const {
+      *value = static_cast<double>(probability_grid_.GetProbability(
+          column - kPadding, row - kPadding));
+    }
+
+    int NumRows() const {
+      return probability_grid_.limits().cell_limits().num_y_cells +
+             2 * kPadding;
+    }
+
+    int NumCols() const {
+      return probability_grid_.limits().cell_limits().num_x_cells +
+             2 * kPadding;
+    }
+
+   private:
+    const ProbabilityLookupGrid& probability_grid_;
+  };
+
+  double scaling_factor_;
+  Eigen::Matrix2Xd points_;
+  const ProbabilityLookupGrid* probability_grid_;
+};
+
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
+
+#endif  // CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_OCCUPIED_SPACE_COST_FUNCTION_H_
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_2d/scan_matching/occupied_space_cost_function.h"
+
+#include <random>
+#include <vector>
+
+#include "cartographer/mapping/probability_values.h"
+#include "cartographer/mapping_2d/scan_matching/occupied_space_cost_functor.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+namespace {
+
+TEST(OccupiedSpaceCostFunctionTest, MatchesAutoDiff) {
+  std::mt19937 prng(42);
+  std::uniform_real_distribution<float> probability_distribution(
+      mapping::kMinProbability, mapping::kMaxProbability);
+  ProbabilityGrid probability_grid(
+      MapLimits(0.1, Eigen::Vector2d(2., 3.), CellLimits(40, 30)));
+  for (int y = 5; y < 25; ++y) {
+    for (int x = 5; x < 35; ++x) {
+      probability_grid.SetProbability(Eigen::Array2i(x, y),
+                                      probability_distribution(prng));
+    }
+  }
+  const ProbabilityLookupGrid lookup_grid(probability_grid);
+
+  // Some of the points fall outside of the grid.
+  std::uniform_real_distribution<float> point_distribution(-2.f, 2.f);
+  sensor::PointCloud point_cloud;
+  for (int i = 0; i < 50; ++i) {
+    point_cloud.emplace_back(point_distribution(prng),
+                             point_distribution(prng), 0.f);
+  }
+
+  const double kScalingFactor = 3.;
+  const OccupiedSpaceCostFunction analytic_cost_function(
+      kScalingFactor, point_cloud, lookup_grid);
+  const ceres::AutoDiffCostFunction<OccupiedSpaceCostFunctor, ceres::DYNAMIC,
+                                    3>
+      auto_diff_cost_function(
+          new OccupiedSpaceCostFunctor(kScalingFactor, point_cloud,
+                                       lookup_grid),
+          point_cloud.size());
+  ASSERT_EQ(auto_diff_cost_function.num_residuals(),
+            analytic_cost_function.num_residuals());
+  ASSERT_EQ(auto_diff_cost_function.parameter_block_sizes(),
+            analytic_cost_function.parameter_block_sizes());
+
+  const int num_residuals = point_cloud.size();
+  for (const auto& pose : {Eigen::Vector3d(0., 0., 0.),
+                           Eigen::Vector3d(0.3, -0.42, 0.7),
+                           Eigen::Vector3d(-1.1, 0.9, -2.5)}) {
+    const double* const parameters[] = {pose.data()};
+    std::vector<double> expected_residuals(num_residuals);
+    std::vector<double> expected_jacobian(3 * num_residuals);
+    double* expected_jacobians[] = {expected_jacobian.data()};
+    ASSERT_TRUE(auto_diff_cost_function.Evaluate(
+        parameters, expected_residuals.data(), expected_jacobians));
+
+    std::vector<double> residuals(num_residuals);
+    std::vector<double> jacobian(3 * num_residuals);
+    double* jacobians[] = {jacobian.data()};
+    ASSERT_TRUE(analytic_cost_function.Evaluate(parameters, residuals.data(),
+                                                jacobians));
+    for (int i = 0; i < num_residuals; ++i) {
+      EXPECT_NEAR(expected_residuals[i], residuals[i], 1e-9);
+    }
+    for (int i = 0; i < 3 * num_residuals; ++i) {
+      EXPECT_NEAR(expected_jacobian[i], jacobian[i], 1e-6) << i;
+    }
+
+    std::vector<double> residuals_only(num_residuals);
+    ASSERT_TRUE(analytic_cost_function.Evaluate(
+        parameters, residuals_only.data(), nullptr));
+    EXPECT_EQ(residuals, residuals_only);
+  }
+}
+
+}  // namespace
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
@@ -19,7 +19,7 @@
 
 #include "Eigen/Core"
 #include "Eigen/Geometry"
-#include "cartographer/mapping_2d/probability_grid.h"
+#include "cartographer/mapping_2d/probability_lookup_grid.h"
 #include "cartographer/sensor/point_cloud.h"
 #include "ceres/ceres.h"
 #include "ceres/cubic_interpolation.h"
@@ -37,7 +37,7 @@ class OccupiedSpaceCostFunctor {
   // level, and point cloud.
   OccupiedSpaceCostFunctor(const double scaling_factor,
                            const sensor::PointCloud& point_cloud,
-                           const ProbabilityGrid& probability_grid)
+                           const ProbabilityLookupGrid& probability_grid)
       : scaling_factor_(scaling_factor),
         point_cloud_(point_cloud),
         probability_grid_(probability_grid) {}
@@ -79,17 +79,14 @@ class OccupiedSpaceCostFunctor {
    public:
     enum { DATA_DIMENSION = 1 };
 
-    explicit GridArrayAdapter(const ProbabilityGrid& probability_grid)
+    explicit GridArrayAdapter(const ProbabilityLookupGrid& probability_grid)
         : probability_grid_(probability_grid) {}
 
+    // Cells outside the limits are looked up as 'kMinProbability' by the
+    // 'ProbabilityLookupGrid', so no bounds check is needed here.
     void GetValue(const int row, const int column, double* const value) const {
-      if (row < kPadding || column < kPadding || row >= NumRows() - kPadding ||
-          column >= NumCols() - kPadding) {
-        *value = mapping::kMinProbability;
-      } else {
-        *value = static_cast<double>(probability_grid_.GetProbability(
-            Eigen::Array2i(column - kPadding, row - kPadding)));
-      }
+      *value = static_cast<double>(probability_grid_.GetProbability(
+          column - kPadding, row - kPadding));
     }
 
     int NumRows() const {
@@ -103,12 +100,12 @@ class OccupiedSpaceCostFunctor {
     }
 
    private:
-    const ProbabilityGrid& probability_grid_;
+    const ProbabilityLookupGrid& probability_grid_;
   };
 
   const double scaling_factor_;
   const sensor::PointCloud& point_cloud_;
-  const ProbabilityGrid& probability_grid_;
+  const ProbabilityLookupGrid& probability_grid_;
 };
 
 }  // namespace scan_matching
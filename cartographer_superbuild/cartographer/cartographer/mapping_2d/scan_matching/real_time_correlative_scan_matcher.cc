@@ -23,6 +23,7 @@
 
 #include "Eigen/Geometry"
 #include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/make_unique.h"
 #include "cartographer/common/math.h"
 #include "cartographer/mapping_2d/probability_grid.h"
 #include "cartographer/sensor/point_cloud.h"
@@ -33,6 +34,58 @@ namespace cartographer {
 namespace mapping_2d {
 namespace scan_matching {
 
+namespace {
+
+// Sets the score of each candidate in ['begin', 'end'), all of which have to
+// use 'discrete_scan', to the sum of the probabilities at its points. The sums
+// for all offsets in the bounding box of the candidates are accumulated in
+// 'sums' row by row, so that the innermost loop adds contiguous probabilities
+// and can be vectorized.
+void SumProbabilities(const ProbabilityLookupGrid& probability_grid,
+                      const DiscreteScan& discrete_scan,
+                      const std::vector<Candidate>::iterator begin,
+                      const std::vector<Candidate>::iterator end,
+                      std::vector<float>* const sums) {
+  int min_x_offset = begin->x_index_offset;
+  int max_x_offset = begin->x_index_offset;
+  int min_y_offset = begin->y_index_offset;
+  int max_y_offset = begin->y_index_offset;
+  for (auto it = begin; it != end; ++it) {
+    min_x_offset = std::min(min_x_offset, it->x_index_offset);
+    max_x_offset = std::max(max_x_offset, it->x_index_offset);
+    min_y_offset = std::min(min_y_offset, it->y_index_offset);
+    max_y_offset = std::max(max_y_offset, it->y_index_offset);
+  }
+  const int num_x_offsets = max_x_offset - min_x_offset + 1;
+  const int num_y_offsets = max_y_offset - min_y_offset + 1;
+  sums->assign(num_x_offsets * num_y_offsets, 0.f);
+  for (const Eigen::Array2i& xy_index : discrete_scan) {
+    const int x = xy_index.x() + min_x_offset;
+    for (int y_offset = min_y_offset; y_offset <= max_y_offset; ++y_offset) {
+      const int y = xy_index.y() + y_offset;
+      float* const row_sums =
+          sums->data() + (y_offset - min_y_offset) * num_x_offsets;
+      const float* const probabilities =
+          probability_grid.GetProbabilities(x, y, num_x_offsets);
+      if (probabilities != nullptr) {
+        for (int i = 0; i != num_x_offsets; ++i) {
+          row_sums[i] += probabilities[i];
+        }
+      } else {
+        for (int i = 0; i != num_x_offsets; ++i) {
+          row_sums[i] += probability_grid.GetProbability(x + i, y);
+        }
+      }
+    }
+  }
+  for (auto it = begin; it != end; ++it) {
+    it->score = (*sums)[(it->y_index_offset - min_y_offset) * num_x_offsets +
+                        it->x_index_offset - min_x_offset];
+  }
+}
+
+}  // namespace
+
 proto::RealTimeCorrelativeScanMatcherOptions
 CreateRealTimeCorrelativeScanMatcherOptions(
     common::LuaParameterDictionary* const parameter_dictionary) {
@@ -45,27 +98,41 @@ CreateRealTimeCorrelativeScanMatcherOptions(
       parameter_dictionary->GetDouble("translation_delta_cost_weight"));
   options.set_rotation_delta_cost_weight(
       parameter_dictionary->GetDouble("rotation_delta_cost_weight"));
+  options.set_num_threads(parameter_dictionary->GetInt("num_threads"));
+  options.set_coarse_search_width(
+      parameter_dictionary->GetInt("coarse_search_width"));
   CHECK_GE(options.translation_delta_cost_weight(), 0.);
   CHECK_GE(options.rotation_delta_cost_weight(), 0.);
+  CHECK_GT(options.num_threads(), 0);
+  CHECK_GT(options.coarse_search_width(), 0);
   return options;
 }
 
 RealTimeCorrelativeScanMatcher::RealTimeCorrelativeScanMatcher(
     const proto::RealTimeCorrelativeScanMatcherOptions& options)
-    : options_(options) {}
+    : options_(options) {
+  if (options_.num_threads() > 1) {
+    // Matching is on the critical path of local SLAM, so the threads keep
+    // their priority.
+    thread_pool_ = common::make_unique<common::ThreadPool>(
+        options_.num_threads() - 1, common::ThreadPool::Priority::kForeground);
+  }
+}
 
-std::vector<Candidate>
-RealTimeCorrelativeScanMatcher::GenerateExhaustiveSearchCandidates(
-    const SearchParameters& search_parameters) const {
+std::vector<Candidate> RealTimeCorrelativeScanMatcher::GenerateCandidates(
+    const SearchParameters& search_parameters,
+    const int linear_step_size) const {
   int num_candidates = 0;
   for (int scan_index = 0; scan_index != search_parameters.num_scans;
        ++scan_index) {
     const int num_linear_x_candidates =
         (search_parameters.linear_bounds[scan_index].max_x -
-         search_parameters.linear_bounds[scan_index].min_x + 1);
+         search_parameters.linear_bounds[scan_index].min_x + linear_step_size) /
+        linear_step_size;
     const int num_linear_y_candidates =
         (search_parameters.linear_bounds[scan_index].max_y -
-         search_parameters.linear_bounds[scan_index].min_y + 1);
+         search_parameters.linear_bounds[scan_index].min_y + linear_step_size) /
+        linear_step_size;
     num_candidates += num_linear_x_candidates * num_linear_y_candidates;
   }
   std::vector<Candidate> candidates;
@@ -74,11 +141,11 @@ RealTimeCorrelativeScanMatcher::GenerateExhaustiveSearchCandidates(
        ++scan_index) {
     for (int x_index_offset = search_parameters.linear_bounds[scan_index].min_x;
          x_index_offset <= search_parameters.linear_bounds[scan_index].max_x;
-         ++x_index_offset) {
+         x_index_offset += linear_step_size) {
       for (int y_index_offset =
                search_parameters.linear_bounds[scan_index].min_y;
            y_index_offset <= search_parameters.linear_bounds[scan_index].max_y;
-           ++y_index_offset) {
+           y_index_offset += linear_step_size) {
         candidates.emplace_back(scan_index, x_index_offset, y_index_offset,
                                 search_parameters);
       }
@@ -88,12 +155,39 @@ RealTimeCorrelativeScanMatcher::GenerateExhaustiveSearchCandidates(
   return candidates;
 }
 
+double RealTimeCorrelativeScanMatcher::ComputeDeltaWeight(
+    const double x, const double y, const double orientation) const {
+  return std::exp(-common::Pow2(
+      std::hypot(x, y) * options_.translation_delta_cost_weight() +
+      std::abs(orientation) * options_.rotation_delta_cost_weight()));
+}
+
 double RealTimeCorrelativeScanMatcher::Match(
     const transform::Rigid2d& initial_pose_estimate,
     const sensor::PointCloud& point_cloud,
     const ProbabilityGrid& probability_grid,
     transform::Rigid2d* pose_estimate) const {
+  return Match(initial_pose_estimate, point_cloud,
+               ProbabilityLookupGrid(probability_grid), pose_estimate);
+}
+
+double RealTimeCorrelativeScanMatcher::Match(
+    const transform::Rigid2d& initial_pose_estimate,
+    const sensor::PointCloud& point_cloud,
+    const ProbabilityLookupGrid& probability_grid,
+    transform::Rigid2d* pose_estimate) const {
+  return Match(initial_pose_estimate, point_cloud, probability_grid,
+               1. /* search_window_scale */, pose_estimate);
+}
+
+double RealTimeCorrelativeScanMatcher::Match(
+    const transform::Rigid2d& initial_pose_estimate,
+    const sensor::PointCloud& point_cloud,
+    const ProbabilityLookupGrid& probability_grid,
+    const double search_window_scale,
+    transform::Rigid2d* pose_estimate) const {
   CHECK_NOTNULL(pose_estimate);
+  CHECK_GT(search_window_scale, 0.);
 
   const Eigen::Rotation2Dd initial_rotation = initial_pose_estimate.rotation();
   const sensor::PointCloud rotated_point_cloud = sensor::TransformPointCloud(
@@ -101,7 +195,8 @@ double RealTimeCorrelativeScanMatcher::Match(
       transform::Rigid3f::Rotation(Eigen::AngleAxisf(
           initial_rotation.cast<float>().angle(), Eigen::Vector3f::UnitZ())));
   const SearchParameters search_parameters(
-      options_.linear_search_window(), options_.angular_search_window(),
+      search_window_scale * options_.linear_search_window(),
+      search_window_scale * options_.angular_search_window(),
       rotated_point_cloud, probability_grid.limits().resolution());
 
   const std::vector<sensor::PointCloud> rotated_scans =
@@ -110,13 +205,17 @@ double RealTimeCorrelativeScanMatcher::Match(
       probability_grid.limits(), rotated_scans,
       Eigen::Translation2f(initial_pose_estimate.translation().x(),
                            initial_pose_estimate.translation().y()));
-  std::vector<Candidate> candidates =
-      GenerateExhaustiveSearchCandidates(search_parameters);
-  ScoreCandidates(probability_grid, discrete_scans, search_parameters,
-                  &candidates);
-
-  const Candidate& best_candidate =
-      *std::max_element(candidates.begin(), candidates.end());
+  Candidate best_candidate(0, 0, 0, search_parameters);
+  if (options_.coarse_search_width() > 1) {
+    best_candidate =
+        SearchCoarseToFine(probability_grid, discrete_scans, search_parameters);
+  } else {
+    std::vector<Candidate> candidates =
+        GenerateCandidates(search_parameters, 1 /* linear_step_size */);
+    ScoreCandidates(probability_grid, discrete_scans, search_parameters,
+                    &candidates);
+    best_candidate = *std::max_element(candidates.begin(), candidates.end());
+  }
   *pose_estimate = transform::Rigid2d(
       {initial_pose_estimate.translation().x() + best_candidate.x,
        initial_pose_estimate.translation().y() + best_candidate.y},
@@ -125,30 +224,143 @@ double RealTimeCorrelativeScanMatcher::Match(
 }
 
 void RealTimeCorrelativeScanMatcher::ScoreCandidates(
-    const ProbabilityGrid& probability_grid,
+    const ProbabilityLookupGrid& probability_grid,
     const std::vector<DiscreteScan>& discrete_scans,
     const SearchParameters& search_parameters,
     std::vector<Candidate>* const candidates) const {
-  for (Candidate& candidate : *candidates) {
-    candidate.score = 0.f;
-    for (const Eigen::Array2i& xy_index :
-         discrete_scans[candidate.scan_index]) {
-      const Eigen::Array2i proposed_xy_index(
-          xy_index.x() + candidate.x_index_offset,
-          xy_index.y() + candidate.y_index_offset);
-      const float probability =
-          probability_grid.GetProbability(proposed_xy_index);
-      candidate.score += probability;
+  // Split the candidates into runs with the same 'scan_index'.
+  std::vector<std::vector<Candidate>::iterator> run_begins;
+  for (auto it = candidates->begin(); it != candidates->end(); ++it) {
+    if (run_begins.empty() || run_begins.back()->scan_index != it->scan_index) {
+      run_begins.push_back(it);
+    }
+  }
+  run_begins.push_back(candidates->end());
+  const int num_runs = run_begins.size() - 1;
+
+  // Scratch memory of each worker.
+  std::vector<std::vector<float>> sums(options_.num_threads());
+  common::ParallelFor(
+      num_runs, options_.num_threads(), thread_pool_.get(),
+      [&](const int worker_index, const int run) {
+        const int scan_index = run_begins[run]->scan_index;
+        SumProbabilities(probability_grid, discrete_scans[scan_index],
+                         run_begins[run], run_begins[run + 1],
+                         &sums[worker_index]);
+        const float num_points =
+            static_cast<float>(discrete_scans[scan_index].size());
+        for (auto it = run_begins[run]; it != run_begins[run + 1]; ++it) {
+          it->score /= num_points;
+          it->score *= ComputeDeltaWeight(it->x, it->y, it->orientation);
+          CHECK_GT(it->score, 0.f);
+        }
+      });
+}
+
+Candidate RealTimeCorrelativeScanMatcher::SearchCoarseToFine(
+    const ProbabilityLookupGrid& probability_grid,
+    const std::vector<DiscreteScan>& discrete_scans,
+    const SearchParameters& search_parameters) const {
+  const int width = options_.coarse_search_width();
+  // The precomputation grid has to be rebuilt for every match since the
+  // matching submap changes with every insertion. Only the cells which the
+  // blocks of candidates can reach are needed, which for a submap that is much
+  // larger than the search window is just a small part of it.
+  Eigen::Array2i min_xy_index =
+      Eigen::Array2i::Constant(std::numeric_limits<int>::max());
+  Eigen::Array2i max_xy_index =
+      Eigen::Array2i::Constant(std::numeric_limits<int>::min());
+  for (int scan_index = 0; scan_index != search_parameters.num_scans;
+       ++scan_index) {
+    const SearchParameters::LinearBounds& linear_bounds =
+        search_parameters.linear_bounds[scan_index];
+    for (const Eigen::Array2i& xy_index : discrete_scans[scan_index]) {
+      min_xy_index = min_xy_index.min(
+          xy_index + Eigen::Array2i(linear_bounds.min_x, linear_bounds.min_y));
+      max_xy_index = max_xy_index.max(
+          xy_index + Eigen::Array2i(linear_bounds.max_x + width - 1,
+                                    linear_bounds.max_y + width - 1));
+    }
+  }
+  const CellLimits& cell_limits = probability_grid.limits().cell_limits();
+  const Eigen::Array2i max_grid_xy_index(cell_limits.num_x_cells - 1,
+                                         cell_limits.num_y_cells - 1);
+  const Eigen::Array2i origin = min_xy_index.max(0).min(max_grid_xy_index);
+  const Eigen::Array2i end = max_xy_index.min(max_grid_xy_index).max(origin);
+  std::vector<float> reusable_intermediate_grid;
+  const PrecomputationGrid precomputation_grid(
+      probability_grid, origin,
+      CellLimits(end.x() - origin.x() + 1, end.y() - origin.y() + 1), width,
+      &reusable_intermediate_grid);
+  // Values of the precomputation grid are rounded, which can lower the bound
+  // by up to half a step. This is added back so that it stays an upper bound.
+  const float rounding_slack = 0.5f * (PrecomputationGrid::ToProbability(1.f) -
+                                       PrecomputationGrid::ToProbability(0.f));
+
+  std::vector<Candidate> coarse_candidates =
+      GenerateCandidates(search_parameters, width);
+  for (Candidate& coarse_candidate : coarse_candidates) {
+    const SearchParameters::LinearBounds& linear_bounds =
+        search_parameters.linear_bounds[coarse_candidate.scan_index];
+    const DiscreteScan& discrete_scan =
+        discrete_scans[coarse_candidate.scan_index];
+    int sum = 0;
+    for (const Eigen::Array2i& xy_index : discrete_scan) {
+      sum += precomputation_grid.GetValue(
+          xy_index + Eigen::Array2i(coarse_candidate.x_index_offset,
+                                    coarse_candidate.y_index_offset));
+    }
+    // The offset within the block which is closest to the initial pose
+    // estimate has the largest delta weight.
+    const Candidate closest_candidate(
+        coarse_candidate.scan_index,
+        common::Clamp(0, coarse_candidate.x_index_offset,
+                      std::min(coarse_candidate.x_index_offset + width - 1,
+                               linear_bounds.max_x)),
+        common::Clamp(0, coarse_candidate.y_index_offset,
+                      std::min(coarse_candidate.y_index_offset + width - 1,
+                               linear_bounds.max_y)),
+        search_parameters);
+    coarse_candidate.score =
+        (PrecomputationGrid::ToProbability(
+             sum / static_cast<float>(discrete_scan.size())) +
+         rounding_slack) *
+        ComputeDeltaWeight(closest_candidate.x, closest_candidate.y,
+                           closest_candidate.orientation);
+  }
+  std::sort(coarse_candidates.begin(), coarse_candidates.end(),
+            std::greater<Candidate>());
+
+  // All scores are positive, so the first block is always searched.
+  Candidate best_candidate(0, 0, 0, search_parameters);
+  best_candidate.score = 0.f;
+  std::vector<Candidate> candidates;
+  for (const Candidate& coarse_candidate : coarse_candidates) {
+    if (coarse_candidate.score <= best_candidate.score) {
+      break;
+    }
+    const SearchParameters::LinearBounds& linear_bounds =
+        search_parameters.linear_bounds[coarse_candidate.scan_index];
+    candidates.clear();
+    for (int x_index_offset = coarse_candidate.x_index_offset;
+         x_index_offset <= std::min(coarse_candidate.x_index_offset + width - 1,
+                                    linear_bounds.max_x);
+         ++x_index_offset) {
+      for (int y_index_offset = coarse_candidate.y_index_offset;
+           y_index_offset <=
+           std::min(coarse_candidate.y_index_offset + width - 1,
+                    linear_bounds.max_y);
+           ++y_index_offset) {
+        candidates.emplace_back(coarse_candidate.scan_index, x_index_offset,
+                                y_index_offset, search_parameters);
+      }
     }
-    candidate.score /=
-        static_cast<float>(discrete_scans[candidate.scan_index].size());
-    candidate.score *=
-        std::exp(-common::Pow2(std::hypot(candidate.x, candidate.y) *
-                                   options_.translation_delta_cost_weight() +
-                               std::abs(candidate.orientation) *
-                                   options_.rotation_delta_cost_weight()));
-    CHECK_GT(candidate.score, 0.f);
+    ScoreCandidates(probability_grid, discrete_scans, search_parameters,
+                    &candidates);
+    best_candidate = std::max(
+        best_candidate, *std::max_element(candidates.begin(), candidates.end()));
   }
+  return best_candidate;
 }
 
 }  // namespace scan_matching
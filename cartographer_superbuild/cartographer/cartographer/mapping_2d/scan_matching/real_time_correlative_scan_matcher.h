@@ -41,8 +41,11 @@
 #include <vector>
 
 #include "Eigen/Core"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/mapping_2d/probability_grid.h"
+#include "cartographer/mapping_2d/probability_lookup_grid.h"
 #include "cartographer/mapping_2d/scan_matching/correlative_scan_matcher.h"
+#include "cartographer/mapping_2d/scan_matching/fast_correlative_scan_matcher.h"
 #include "cartographer/mapping_2d/scan_matching/proto/real_time_correlative_scan_matcher_options.pb.h"
 
 namespace cartographer {
@@ -72,21 +75,56 @@ class RealTimeCorrelativeScanMatcher {
                const ProbabilityGrid& probability_grid,
                transform::Rigid2d* pose_estimate) const;
 
+  // Same as above, but scores candidates against a precomputed
+  // 'probability_grid'.
+  double Match(const transform::Rigid2d& initial_pose_estimate,
+               const sensor::PointCloud& point_cloud,
+               const ProbabilityLookupGrid& probability_grid,
+               transform::Rigid2d* pose_estimate) const;
+
+  // Same as above, but with search windows 'search_window_scale' times the
+  // configured size, e.g. to save time when the CPU is overloaded.
+  double Match(const transform::Rigid2d& initial_pose_estimate,
+               const sensor::PointCloud& point_cloud,
+               const ProbabilityLookupGrid& probability_grid,
+               double search_window_scale,
+               transform::Rigid2d* pose_estimate) const;
+
   // Computes the score for each Candidate in a collection. The cost is computed
   // as the sum of probabilities, different from the Ceres CostFunctions:
   // http://ceres-solver.org/modeling.html
   //
+  // Runs of consecutive candidates for the same discrete scan are scored
+  // together, and distributed over 'num_threads' threads.
+  //
   // Visible for testing.
-  void ScoreCandidates(const ProbabilityGrid& probability_grid,
+  void ScoreCandidates(const ProbabilityLookupGrid& probability_grid,
                        const std::vector<DiscreteScan>& discrete_scans,
                        const SearchParameters& search_parameters,
                        std::vector<Candidate>* candidates) const;
 
  private:
-  std::vector<Candidate> GenerateExhaustiveSearchCandidates(
-      const SearchParameters& search_parameters) const;
+  // Generates candidates for every 'linear_step_size'-th offset in x and y
+  // within the linear bounds.
+  std::vector<Candidate> GenerateCandidates(
+      const SearchParameters& search_parameters, int linear_step_size) const;
+
+  // Returns the factor by which the score of a candidate with the relative
+  // pose ('x', 'y', 'orientation') is reduced for its distance from the
+  // initial pose estimate.
+  double ComputeDeltaWeight(double x, double y, double orientation) const;
+
+  // Returns the best candidate found by scoring blocks of
+  // 'coarse_search_width' x 'coarse_search_width' offsets with an upper bound
+  // and scoring all offsets of a block only while its bound beats the best
+  // candidate so far.
+  Candidate SearchCoarseToFine(const ProbabilityLookupGrid& probability_grid,
+                               const std::vector<DiscreteScan>& discrete_scans,
+                               const SearchParameters& search_parameters) const;
 
   const proto::RealTimeCorrelativeScanMatcherOptions options_;
+  // Runs the work of all but the calling thread if 'num_threads' > 1.
+  std::unique_ptr<common::ThreadPool> thread_pool_;
 };
 
 }  // namespace scan_matching
@@ -18,13 +18,17 @@
 
 #include <cmath>
 #include <memory>
+#include <random>
+#include <string>
 
 #include "Eigen/Geometry"
 #include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
 #include "cartographer/common/make_unique.h"
 #include "cartographer/mapping_2d/probability_grid.h"
 #include "cartographer/mapping_2d/range_data_inserter.h"
+#include "cartographer/mapping_2d/xy_index.h"
 #include "cartographer/sensor/point_cloud.h"
+#include "cartographer/transform/rigid_transform_test_helpers.h"
 #include "cartographer/transform/transform.h"
 #include "gtest/gtest.h"
 
@@ -66,6 +70,8 @@ class RealTimeCorrelativeScanMatcherTest : public ::testing::Test {
           "angular_search_window = 0.16, "
           "translation_delta_cost_weight = 0., "
           "rotation_delta_cost_weight = 0., "
+          "num_threads = 1, "
+          "coarse_search_width = 1, "
           "}");
       real_time_correlative_scan_matcher_ =
           common::make_unique<RealTimeCorrelativeScanMatcher>(
@@ -90,8 +96,8 @@ TEST_F(RealTimeCorrelativeScanMatcherTest,
   std::vector<Candidate> candidates;
   candidates.emplace_back(0, 0, 0, SearchParameters(0, 0, 0., 0.));
   real_time_correlative_scan_matcher_->ScoreCandidates(
-      probability_grid_, discrete_scans, SearchParameters(0, 0, 0., 0.),
-      &candidates);
+      ProbabilityLookupGrid(probability_grid_), discrete_scans,
+      SearchParameters(0, 0, 0., 0.), &candidates);
   EXPECT_EQ(0, candidates[0].scan_index);
   EXPECT_EQ(0, candidates[0].x_index_offset);
   EXPECT_EQ(0, candidates[0].y_index_offset);
@@ -108,8 +114,8 @@ TEST_F(RealTimeCorrelativeScanMatcherTest,
   std::vector<Candidate> candidates;
   candidates.emplace_back(0, 0, 1, SearchParameters(0, 0, 0., 0.));
   real_time_correlative_scan_matcher_->ScoreCandidates(
-      probability_grid_, discrete_scans, SearchParameters(0, 0, 0., 0.),
-      &candidates);
+      ProbabilityLookupGrid(probability_grid_), discrete_scans,
+      SearchParameters(0, 0, 0., 0.), &candidates);
   EXPECT_EQ(0, candidates[0].scan_index);
   EXPECT_EQ(0, candidates[0].x_index_offset);
   EXPECT_EQ(1, candidates[0].y_index_offset);
@@ -118,6 +124,110 @@ TEST_F(RealTimeCorrelativeScanMatcherTest,
   EXPECT_GT(0.7, candidates[0].score);
 }
 
+TEST_F(RealTimeCorrelativeScanMatcherTest, ScoreCandidatesInParallel) {
+  auto parameter_dictionary = common::MakeDictionary(
+      "return {"
+      "linear_search_window = 0.6, "
+      "angular_search_window = 0.16, "
+      "translation_delta_cost_weight = 0., "
+      "rotation_delta_cost_weight = 0., "
+      "num_threads = 3, "
+      "coarse_search_width = 1, "
+      "}");
+  const RealTimeCorrelativeScanMatcher scan_matcher(
+      CreateRealTimeCorrelativeScanMatcherOptions(parameter_dictionary.get()));
+  const SearchParameters search_parameters(
+      0.6, 0.16, point_cloud_, probability_grid_.limits().resolution());
+  const std::vector<DiscreteScan> discrete_scans = DiscretizeScans(
+      probability_grid_.limits(),
+      GenerateRotatedScans(point_cloud_, search_parameters),
+      Eigen::Translation2f(0.1f, -0.05f));
+  // Most of these candidates move points out of the small grid.
+  std::vector<Candidate> candidates;
+  for (int scan_index = 0; scan_index != search_parameters.num_scans;
+       ++scan_index) {
+    for (int x_index_offset = -12; x_index_offset <= 12; ++x_index_offset) {
+      for (int y_index_offset = -12; y_index_offset <= 12; ++y_index_offset) {
+        candidates.emplace_back(scan_index, x_index_offset, y_index_offset,
+                                search_parameters);
+      }
+    }
+  }
+  scan_matcher.ScoreCandidates(ProbabilityLookupGrid(probability_grid_),
+                               discrete_scans, search_parameters, &candidates);
+  for (const Candidate& candidate : candidates) {
+    float expected_score = 0.f;
+    for (const Eigen::Array2i& xy_index :
+         discrete_scans[candidate.scan_index]) {
+      expected_score += probability_grid_.GetProbability(
+          xy_index + Eigen::Array2i(candidate.x_index_offset,
+                                    candidate.y_index_offset));
+    }
+    expected_score /= discrete_scans[candidate.scan_index].size();
+    EXPECT_NEAR(expected_score, candidate.score, 1e-6);
+  }
+}
+
+TEST(RealTimeCorrelativeScanMatcherCoarseToFineTest, MatchesExhaustiveSearch) {
+  std::mt19937 prng(42);
+  std::uniform_real_distribution<float> probability_distribution(
+      mapping::kMinProbability, mapping::kMaxProbability);
+  // The grid is much larger than the search window, so that the precomputation
+  // grid only covers part of it, and the scan lies partially outside of it for
+  // some of the initial pose estimates.
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(2., 2.), CellLimits(80, 80)));
+  for (const Eigen::Array2i& xy_index :
+       XYIndexRangeIterator(Eigen::Array2i(5, 5), Eigen::Array2i(74, 74))) {
+    probability_grid.SetProbability(xy_index, probability_distribution(prng));
+  }
+  std::uniform_real_distribution<float> point_distribution(-0.7f, 0.7f);
+  sensor::PointCloud point_cloud;
+  for (int i = 0; i < 30; ++i) {
+    point_cloud.emplace_back(point_distribution(prng),
+                             point_distribution(prng), 0.f);
+  }
+
+  const auto create_scan_matcher = [](const int coarse_search_width) {
+    auto parameter_dictionary = common::MakeDictionary(
+        "return {"
+        "linear_search_window = 0.5, "
+        "angular_search_window = 0.2, "
+        "translation_delta_cost_weight = 0.5, "
+        "rotation_delta_cost_weight = 0.5, "
+        "num_threads = 1, "
+        "coarse_search_width = " +
+        std::to_string(coarse_search_width) + ", }");
+    return common::make_unique<RealTimeCorrelativeScanMatcher>(
+        CreateRealTimeCorrelativeScanMatcherOptions(
+            parameter_dictionary.get()));
+  };
+  const auto exhaustive_scan_matcher = create_scan_matcher(1);
+  const ProbabilityLookupGrid probability_lookup_grid(probability_grid);
+  for (const int coarse_search_width : {2, 3, 8}) {
+    const auto coarse_to_fine_scan_matcher =
+        create_scan_matcher(coarse_search_width);
+    for (const transform::Rigid2d& initial_pose_estimate :
+         {transform::Rigid2d::Identity(),
+          transform::Rigid2d({0.1, -0.2}, 0.1),
+          transform::Rigid2d({-0.3, 0.05}, -0.5),
+          transform::Rigid2d({-1.7, 1.8}, 0.3),
+          transform::Rigid2d({1.9, -1.6}, 2.)}) {
+      transform::Rigid2d expected_pose_estimate;
+      const double expected_score = exhaustive_scan_matcher->Match(
+          initial_pose_estimate, point_cloud, probability_lookup_grid,
+          &expected_pose_estimate);
+      transform::Rigid2d pose_estimate;
+      const double score = coarse_to_fine_scan_matcher->Match(
+          initial_pose_estimate, point_cloud, probability_lookup_grid,
+          &pose_estimate);
+      EXPECT_EQ(expected_score, score);
+      EXPECT_THAT(pose_estimate,
+                  transform::IsNearly(expected_pose_estimate, 1e-9));
+    }
+  }
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_2d
@@ -36,6 +36,9 @@ class RotationDeltaCostFunctor {
   RotationDeltaCostFunctor(const RotationDeltaCostFunctor&) = delete;
   RotationDeltaCostFunctor& operator=(const RotationDeltaCostFunctor&) = delete;
 
+  // Rebinds the functor to another 'angle'.
+  void Rebind(const double angle) { angle_ = angle; }
+
   template <typename T>
   bool operator()(const T* const pose, T* residual) const {
     residual[0] = scaling_factor_ * (pose[2] - angle_);
@@ -44,7 +47,7 @@ class RotationDeltaCostFunctor {
 
  private:
   const double scaling_factor_;
-  const double angle_;
+  double angle_;
 };
 
 }  // namespace scan_matching
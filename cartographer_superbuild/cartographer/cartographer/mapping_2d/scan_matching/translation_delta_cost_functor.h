@@ -41,6 +41,12 @@ class TranslationDeltaCostFunctor {
   TranslationDeltaCostFunctor& operator=(const TranslationDeltaCostFunctor&) =
       delete;
 
+  // Rebinds the functor to another 'initial_pose_estimate'.
+  void Rebind(const transform::Rigid2d& initial_pose_estimate) {
+    x_ = initial_pose_estimate.translation().x();
+    y_ = initial_pose_estimate.translation().y();
+  }
+
   template <typename T>
   bool operator()(const T* const pose, T* residual) const {
     residual[0] = scaling_factor_ * (pose[0] - x_);
@@ -50,8 +56,8 @@ class TranslationDeltaCostFunctor {
 
  private:
   const double scaling_factor_;
-  const double x_;
-  const double y_;
+  double x_;
+  double y_;
 };
 
 }  // namespace scan_matching
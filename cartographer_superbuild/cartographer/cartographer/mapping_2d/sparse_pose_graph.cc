@@ -43,7 +43,13 @@ SparsePoseGraph::SparsePoseGraph(
     common::ThreadPool* thread_pool)
     : options_(options),
       optimization_problem_(options_.optimization_problem_options()),
-      constraint_builder_(options_.constraint_builder_options(), thread_pool) {}
+      constraint_builder_(options_.constraint_builder_options(), thread_pool) {
+  if (options_.place_recognition_num_candidates() > 0) {
+    place_recognition_index_ =
+        common::make_unique<sparse_pose_graph::PlaceRecognitionIndex>(
+            options_.place_recognition_num_candidates());
+  }
+}
 
 SparsePoseGraph::~SparsePoseGraph() {
   WaitForAllComputations();
@@ -107,6 +113,11 @@ void SparsePoseGraph::AddScan(
 
   const transform::Rigid3d optimized_pose(
       GetLocalToGlobalTransform(trajectory_id) * transform::Embed3D(pose));
+  Eigen::VectorXf scan_descriptor;
+  if (options_.place_recognition_num_candidates() > 0) {
+    scan_descriptor = sparse_pose_graph::ComputeScanDescriptor(
+        range_data_in_pose, options_.place_recognition_max_range());
+  }
 
   common::MutexLocker locker(&mutex_);
 //  if(num_trajectory_nodes_ > kNumTrajectoryNode_){
@@ -157,7 +168,7 @@ void SparsePoseGraph::AddScan(
   const bool newly_finished_submap = insertion_submaps.front()->finished();
     AddWorkItem([=]() REQUIRES(mutex_) {
     ComputeConstraintsForScan(trajectory_id, insertion_submaps,
-                              newly_finished_submap, pose);
+                              newly_finished_submap, pose, scan_descriptor);
   });
 }
 
@@ -183,8 +194,11 @@ void SparsePoseGraph::ComputeConstraint(const mapping::NodeId& node_id,
                                         const mapping::SubmapId& submap_id) {
   CHECK(submap_data_.at(submap_id).state == SubmapState::kFinished);
 
-  // Only globally match against submaps not in this trajectory.
+  // Only globally match against submaps not in this trajectory, and only
+  // against those which look similar to the scan.
   if (node_id.trajectory_id != submap_id.trajectory_id &&
+      (place_recognition_index_ == nullptr ||
+       place_recognition_index_->IsCandidate(node_id, submap_id)) &&
       global_localization_samplers_[node_id.trajectory_id]->Pulse()) {
     constraint_builder_.MaybeAddGlobalConstraint(
         submap_id, submap_data_.at(submap_id).submap.get(), node_id,
@@ -243,7 +257,8 @@ void SparsePoseGraph::ComputeConstraintsForOldScans(
 void SparsePoseGraph::ComputeConstraintsForScan(
     const int trajectory_id,
     std::vector<std::shared_ptr<const Submap>> insertion_submaps,
-    const bool newly_finished_submap, const transform::Rigid2d& pose) {
+    const bool newly_finished_submap, const transform::Rigid2d& pose,
+    const Eigen::VectorXf& scan_descriptor) {
   const std::vector<mapping::SubmapId> submap_ids =
       GrowSubmapTransformsAsNeeded(trajectory_id, insertion_submaps); //optimization problem : Add Submaps
   CHECK_EQ(submap_ids.size(), insertion_submaps.size());
@@ -283,6 +298,9 @@ void SparsePoseGraph::ComputeConstraintsForScan(
   const auto& scan_data = trajectory_nodes_.at(scan_node_id).constant_data;
   optimization_problem_.AddTrajectoryNode(
       matching_id.trajectory_id, scan_data->time, pose, optimized_pose);
+  if (place_recognition_index_ != nullptr) {
+    place_recognition_index_->AddNode(scan_node_id, scan_descriptor);
+  }
   for (size_t i = 0; i < insertion_submaps.size(); ++i) {
     const mapping::SubmapId submap_id = submap_ids[i];
     // Even if this was the last scan added to 'submap_id', the submap will only
@@ -320,6 +338,10 @@ void SparsePoseGraph::ComputeConstraintsForScan(
     SubmapData& finished_submap_data = submap_data_.at(finished_submap_id);
     CHECK(finished_submap_data.state == SubmapState::kActive);
     finished_submap_data.state = SubmapState::kFinished;
+    if (place_recognition_index_ != nullptr) {
+      place_recognition_index_->AddSubmap(finished_submap_id,
+                                          finished_submap_data.node_ids);
+    }
     // We have a new completed submap, so we look into adding constraints for
     // old scans.
     ComputeConstraintsForOldScans(finished_submap_id);
@@ -429,11 +451,25 @@ void SparsePoseGraph::AddSubmapFromProto(const int trajectory_id,
   std::shared_ptr<const Submap> submap_ptr =
       std::make_shared<const Submap>(submap.submap_2d());
   const transform::Rigid2d initial_pose_2d = transform::Project2D(initial_pose);
+  // The scans inserted into the submap are not known, so it is described by
+  // what a scan from its origin would see.
+  Eigen::VectorXf submap_descriptor;
+  if (options_.place_recognition_num_candidates() > 0) {
+    submap_descriptor = sparse_pose_graph::ComputeSubmapDescriptor(
+        submap_ptr->probability_grid(),
+        submap_ptr->local_pose().translation().head<2>().cast<float>(),
+        options_.place_recognition_max_range());
+  }
 
   common::MutexLocker locker(&mutex_);
   const mapping::SubmapId submap_id =
       submap_data_.Append(trajectory_id, SubmapData());
   submap_data_.at(submap_id).submap = submap_ptr;
+  if (submap.has_precomputation_grid_stack_2d()) {
+    constraint_builder_.AddSubmapScanMatcherFromProto(
+        submap_id, &submap_ptr->probability_grid(),
+        submap.precomputation_grid_stack_2d());
+  }
   // Immediately show the submap at the optimized pose.
   CHECK_GE(static_cast<size_t>(submap_data_.num_trajectories()),
            optimized_submap_transforms_.size());
@@ -446,13 +482,36 @@ void SparsePoseGraph::AddSubmapFromProto(const int trajectory_id,
            submap_id.submap_index);
   optimized_submap_transforms_.at(trajectory_id)
       .push_back(sparse_pose_graph::SubmapData{initial_pose_2d});
-  AddWorkItem([this, submap_id, initial_pose_2d]() REQUIRES(mutex_) {
+  PublishLocalToGlobalTransforms();
+  AddWorkItem([=]() REQUIRES(mutex_) {
     CHECK_EQ(frozen_trajectories_.count(submap_id.trajectory_id), 1);
     submap_data_.at(submap_id).state = SubmapState::kFinished;
+    if (place_recognition_index_ != nullptr) {
+      place_recognition_index_->AddSubmapDescriptor(submap_id,
+                                                    submap_descriptor);
+    }
     optimization_problem_.AddSubmap(submap_id.trajectory_id, initial_pose_2d);
   });
 }
 
+void SparsePoseGraph::AddPrecomputationGridsToProto(
+    const mapping::SubmapId& submap_id, mapping::proto::Submap* const submap) {
+  std::shared_ptr<const Submap> submap_ptr;
+  {
+    common::MutexLocker locker(&mutex_);
+    const SubmapData& submap_data = submap_data_.at(submap_id);
+    if (submap_data.state != SubmapState::kFinished) {
+      return;
+    }
+    submap_ptr = submap_data.submap;
+  }
+  // Building and serializing the grids may take long, so it is done without
+  // blocking the pose graph. The finished submap does not change anymore.
+  *submap->mutable_precomputation_grid_stack_2d() =
+      constraint_builder_.SubmapScanMatcherToProto(
+          submap_id, &submap_ptr->probability_grid());
+}
+
 void SparsePoseGraph::AddTrimmer(
     std::unique_ptr<mapping::PoseGraphTrimmer> trimmer) {
   common::MutexLocker locker(&mutex_);
@@ -516,6 +575,7 @@ void SparsePoseGraph::RunOptimization() {
   }
   optimized_submap_transforms_ = submap_data;
   num_trimmed_submaps_at_last_optimization_ = num_trimmed_submaps;
+  PublishLocalToGlobalTransforms();
   connected_components_ = trajectory_connectivity_.ConnectedComponents();
   reverse_connected_components_.clear();
   for (size_t i = 0; i != connected_components_.size(); ++i) {
@@ -549,6 +609,27 @@ transform::Rigid3d SparsePoseGraph::GetLocalToGlobalTransform(
       trajectory_id);
 }
 
+const common::SeqLock<transform::Rigid3d>&
+SparsePoseGraph::GetLocalToGlobalTransformSnapshot(const int trajectory_id) {
+  common::MutexLocker locker(&mutex_);
+  auto& snapshot = local_to_global_transform_snapshots_[trajectory_id];
+  if (snapshot == nullptr) {
+    snapshot = common::make_unique<common::SeqLock<transform::Rigid3d>>(
+        ComputeLocalToGlobalTransform(optimized_submap_transforms_,
+                                      num_trimmed_submaps_at_last_optimization_,
+                                      trajectory_id));
+  }
+  return *snapshot;
+}
+
+void SparsePoseGraph::PublishLocalToGlobalTransforms() {
+  for (const auto& entry : local_to_global_transform_snapshots_) {
+    entry.second->Write(ComputeLocalToGlobalTransform(
+        optimized_submap_transforms_, num_trimmed_submaps_at_last_optimization_,
+        entry.first));
+  }
+}
+
 std::vector<std::vector<int>> SparsePoseGraph::GetConnectedTrajectories() {
   common::MutexLocker locker(&mutex_);
   return connected_components_;
@@ -696,12 +777,18 @@ void SparsePoseGraph::TrimmingHandle::MarkSubmapAsTrimmed(
   submap_data.submap.reset();
   parent_->constraint_builder_.DeleteScanMatcher(submap_id);
   parent_->optimization_problem_.TrimSubmap(submap_id);
+  if (parent_->place_recognition_index_ != nullptr) {
+    parent_->place_recognition_index_->RemoveSubmap(submap_id);
+  }
 
   // Mark the 'nodes_to_remove' as trimmed and remove their data.
   for (const mapping::NodeId& node_id : nodes_to_remove) {
     CHECK(!parent_->trajectory_nodes_.at(node_id).trimmed());
     parent_->trajectory_nodes_.at(node_id).constant_data.reset();
     parent_->optimization_problem_.TrimTrajectoryNode(node_id);
+    if (parent_->place_recognition_index_ != nullptr) {
+      parent_->place_recognition_index_->RemoveNode(node_id);
+    }
   }
 }
 
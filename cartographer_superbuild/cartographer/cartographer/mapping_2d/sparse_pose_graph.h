@@ -30,6 +30,7 @@
 #include "Eigen/Geometry"
 #include "cartographer/common/fixed_ratio_sampler.h"
 #include "cartographer/common/mutex.h"
+#include "cartographer/common/seqlock.h"
 #include "cartographer/common/thread_pool.h"
 #include "cartographer/common/time.h"
 #include "cartographer/mapping/pose_graph_trimmer.h"
@@ -37,6 +38,7 @@
 #include "cartographer/mapping/trajectory_connectivity.h"
 #include "cartographer/mapping_2d/sparse_pose_graph/constraint_builder.h"
 #include "cartographer/mapping_2d/sparse_pose_graph/optimization_problem.h"
+#include "cartographer/mapping_2d/sparse_pose_graph/place_recognition_index.h"
 #include "cartographer/mapping_2d/submaps.h"
 #include "cartographer/sensor/point_cloud.h"
 #include "cartographer/transform/rigid_transform.h"
@@ -86,6 +88,14 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
                           const transform::Rigid3d& initial_pose,
                           const mapping::proto::Submap& submap) override;
   void AddTrimmer(std::unique_ptr<mapping::PoseGraphTrimmer> trimmer) override;
+
+  // Adds the precomputation grids of the scan matcher for the submap with
+  // 'submap_id' to its serialized 'submap', if it is finished. These are
+  // restored by AddSubmapFromProto().
+  void AddPrecomputationGridsToProto(const mapping::SubmapId& submap_id,
+                                     mapping::proto::Submap* submap)
+      EXCLUDES(mutex_);
+
   void RunFinalOptimization() override;
   std::vector<std::vector<int>> GetConnectedTrajectories() override;
   int num_submaps(int trajectory_id) EXCLUDES(mutex_) override;
@@ -95,6 +105,8 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
   GetAllSubmapData() EXCLUDES(mutex_) override;
   transform::Rigid3d GetLocalToGlobalTransform(int trajectory_id)
       EXCLUDES(mutex_) override;
+  const common::SeqLock<transform::Rigid3d>& GetLocalToGlobalTransformSnapshot(
+      int trajectory_id) EXCLUDES(mutex_) override;
   std::vector<std::vector<mapping::TrajectoryNode>> GetTrajectoryNodes()
       override EXCLUDES(mutex_);
   std::vector<Constraint> constraints() override EXCLUDES(mutex_);
@@ -131,8 +143,8 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
   void ComputeConstraintsForScan(
       int trajectory_id,
       std::vector<std::shared_ptr<const Submap>> insertion_submaps,
-      bool newly_finished_submap, const transform::Rigid2d& pose)
-      REQUIRES(mutex_);
+      bool newly_finished_submap, const transform::Rigid2d& pose,
+      const Eigen::VectorXf& scan_descriptor) REQUIRES(mutex_);
 
   // Computes constraints for a scan and submap pair.
   void ComputeConstraint(const mapping::NodeId& node_id,
@@ -162,6 +174,10 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
       const std::vector<int>& num_trimmed_submaps, int trajectory_id) const
       REQUIRES(mutex_);
 
+  // Writes the current local to global transforms into the snapshots handed
+  // out so far.
+  void PublishLocalToGlobalTransforms() REQUIRES(mutex_);
+
   mapping::SparsePoseGraph::SubmapData GetSubmapDataUnderLock(
       const mapping::SubmapId& submap_id) REQUIRES(mutex_);
 
@@ -189,6 +205,10 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
   // Current optimization problem.
   sparse_pose_graph::OptimizationProblem optimization_problem_;
   sparse_pose_graph::ConstraintBuilder constraint_builder_ GUARDED_BY(mutex_);
+  // Shortlists the submaps for global matching. Only present if
+  // 'place_recognition_num_candidates' is positive.
+  std::unique_ptr<sparse_pose_graph::PlaceRecognitionIndex>
+      place_recognition_index_ GUARDED_BY(mutex_);
   std::vector<Constraint> constraints_ GUARDED_BY(mutex_);
 
   // Submaps get assigned an ID and state as soon as they are seen, even
@@ -213,6 +233,9 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
   std::vector<int> num_trimmed_submaps_at_last_optimization_ GUARDED_BY(mutex_);
   std::vector<std::deque<sparse_pose_graph::SubmapData>>
       optimized_submap_transforms_ GUARDED_BY(mutex_);
+  // Lock-free copies of the local to global transforms by trajectory ID.
+  std::map<int, std::unique_ptr<common::SeqLock<transform::Rigid3d>>>
+      local_to_global_transform_snapshots_ GUARDED_BY(mutex_);
 
   // List of all trimmers to consult when optimizations finish.
   std::vector<std::unique_ptr<mapping::PoseGraphTrimmer>> trimmers_
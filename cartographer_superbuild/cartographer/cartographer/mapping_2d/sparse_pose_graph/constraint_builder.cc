@@ -125,10 +125,12 @@ void ConstraintBuilder::WhenDone(
 void ConstraintBuilder::ScheduleSubmapScanMatcherConstructionAndQueueWorkItem(
     const mapping::SubmapId& submap_id, const ProbabilityGrid* const submap,
     const std::function<void()> work_item) {
-  if (submap_scan_matchers_[submap_id].fast_correlative_scan_matcher !=
-      nullptr) {
-    thread_pool_->Schedule(work_item);
+  const auto it = submap_scan_matchers_.find(submap_id);
+  if (it != submap_scan_matchers_.end()) {
+    ++num_scan_matcher_cache_hits_;
+    ScheduleWorkItem(submap_id, &it->second, work_item);
   } else {
+    ++num_scan_matcher_cache_misses_;
     submap_queued_work_items_[submap_id].push_back(work_item);
     if (submap_queued_work_items_[submap_id].size() == 1) {
       thread_pool_->Schedule(
@@ -137,29 +139,137 @@ void ConstraintBuilder::ScheduleSubmapScanMatcherConstructionAndQueueWorkItem(
   }
 }
 
+void ConstraintBuilder::ScheduleWorkItem(
+    const mapping::SubmapId& submap_id,
+    SubmapScanMatcher* const submap_scan_matcher,
+    const std::function<void()> work_item) {
+  ++submap_scan_matcher->num_pending_work_items;
+  submap_ids_by_recency_.splice(submap_ids_by_recency_.begin(),
+                                submap_ids_by_recency_,
+                                submap_scan_matcher->recency_position);
+  thread_pool_->Schedule(work_item);
+}
+
 void ConstraintBuilder::ConstructSubmapScanMatcher(
     const mapping::SubmapId& submap_id, const ProbabilityGrid* const submap) {
-  auto submap_scan_matcher =
-      common::make_unique<scan_matching::FastCorrelativeScanMatcher>(
-          *submap, options_.fast_correlative_scan_matcher_options());
+  auto fast_correlative_scan_matcher =
+      std::make_shared<const scan_matching::FastCorrelativeScanMatcher>(
+          *submap, options_.fast_correlative_scan_matcher_options(),
+          thread_pool_);
   common::MutexLocker locker(&mutex_);
-  submap_scan_matchers_[submap_id] = {submap, std::move(submap_scan_matcher)};
+  SubmapScanMatcher* const submap_scan_matcher = InsertSubmapScanMatcher(
+      submap_id, submap, std::move(fast_correlative_scan_matcher));
   for (const std::function<void()>& work_item :
        submap_queued_work_items_[submap_id]) {
-    thread_pool_->Schedule(work_item);
+    ScheduleWorkItem(submap_id, submap_scan_matcher, work_item);
   }
   submap_queued_work_items_.erase(submap_id);
+  EvictSubmapScanMatchers();
 }
 
-const ConstraintBuilder::SubmapScanMatcher*
-ConstraintBuilder::GetSubmapScanMatcher(const mapping::SubmapId& submap_id) {
-  common::MutexLocker locker(&mutex_);
-  const SubmapScanMatcher* submap_scan_matcher =
+ConstraintBuilder::SubmapScanMatcher*
+ConstraintBuilder::InsertSubmapScanMatcher(
+    const mapping::SubmapId& submap_id, const ProbabilityGrid* const submap,
+    std::shared_ptr<const scan_matching::FastCorrelativeScanMatcher>
+        fast_correlative_scan_matcher) {
+  const size_t num_bytes = fast_correlative_scan_matcher->num_bytes();
+  submap_ids_by_recency_.push_front(submap_id);
+  SubmapScanMatcher* const submap_scan_matcher =
       &submap_scan_matchers_[submap_id];
-  CHECK(submap_scan_matcher->fast_correlative_scan_matcher != nullptr);
+  *submap_scan_matcher = {submap, std::move(fast_correlative_scan_matcher),
+                          num_bytes, 0 /* num_pending_work_items */,
+                          submap_ids_by_recency_.begin()};
+  scan_matcher_cache_num_bytes_ += num_bytes;
   return submap_scan_matcher;
 }
 
+bool ConstraintBuilder::AddSubmapScanMatcherFromProto(
+    const mapping::SubmapId& submap_id, const ProbabilityGrid* const submap,
+    const scan_matching::proto::PrecomputationGridStack& proto) {
+  if (!scan_matching::FastCorrelativeScanMatcher::IsUpToDate(
+          *submap, proto, options_.fast_correlative_scan_matcher_options())) {
+    LOG(WARNING) << "Ignoring stale precomputation grids for submap "
+                 << submap_id << ".";
+    return false;
+  }
+  auto fast_correlative_scan_matcher =
+      std::make_shared<const scan_matching::FastCorrelativeScanMatcher>(
+          *submap, proto, options_.fast_correlative_scan_matcher_options(),
+          thread_pool_);
+  common::MutexLocker locker(&mutex_);
+  // Keep a scan matcher that is already there or being constructed.
+  if (submap_scan_matchers_.count(submap_id) == 0 &&
+      submap_queued_work_items_.count(submap_id) == 0) {
+    InsertSubmapScanMatcher(submap_id, submap,
+                            std::move(fast_correlative_scan_matcher));
+    EvictSubmapScanMatchers();
+  }
+  return true;
+}
+
+scan_matching::proto::PrecomputationGridStack
+ConstraintBuilder::SubmapScanMatcherToProto(
+    const mapping::SubmapId& submap_id, const ProbabilityGrid* const submap) {
+  std::shared_ptr<const scan_matching::FastCorrelativeScanMatcher>
+      fast_correlative_scan_matcher;
+  {
+    common::MutexLocker locker(&mutex_);
+    const auto it = submap_scan_matchers_.find(submap_id);
+    if (it != submap_scan_matchers_.end()) {
+      fast_correlative_scan_matcher = it->second.fast_correlative_scan_matcher;
+    }
+  }
+  if (fast_correlative_scan_matcher == nullptr) {
+    fast_correlative_scan_matcher =
+        std::make_shared<const scan_matching::FastCorrelativeScanMatcher>(
+            *submap, options_.fast_correlative_scan_matcher_options(),
+            thread_pool_);
+  }
+  return fast_correlative_scan_matcher->ToProto();
+}
+
+std::shared_ptr<const scan_matching::FastCorrelativeScanMatcher>
+ConstraintBuilder::GetSubmapScanMatcher(const mapping::SubmapId& submap_id) {
+  common::MutexLocker locker(&mutex_);
+  const auto it = submap_scan_matchers_.find(submap_id);
+  CHECK(it != submap_scan_matchers_.end());
+  CHECK_GT(it->second.num_pending_work_items, 0);
+  --it->second.num_pending_work_items;
+  // Once taken, the scan matcher stays alive until the work item is done even
+  // if it is evicted now.
+  const std::shared_ptr<const scan_matching::FastCorrelativeScanMatcher>
+      fast_correlative_scan_matcher = it->second.fast_correlative_scan_matcher;
+  EvictSubmapScanMatchers();
+  return fast_correlative_scan_matcher;
+}
+
+void ConstraintBuilder::EvictSubmapScanMatchers() {
+  if (options_.scan_matcher_cache_max_megabytes() == 0.) {
+    return;
+  }
+  const double max_num_bytes =
+      options_.scan_matcher_cache_max_megabytes() * 1024. * 1024.;
+  auto recency_it = submap_ids_by_recency_.end();
+  while (scan_matcher_cache_num_bytes_ > max_num_bytes &&
+         recency_it != submap_ids_by_recency_.begin()) {
+    --recency_it;
+    const auto it = submap_scan_matchers_.find(*recency_it);
+    CHECK(it != submap_scan_matchers_.end());
+    if (it->second.num_pending_work_items == 0) {
+      // Erasing invalidates 'recency_it', but its successor stays valid.
+      ++recency_it;
+      EraseSubmapScanMatcher(it);
+    }
+  }
+}
+
+void ConstraintBuilder::EraseSubmapScanMatcher(
+    const std::map<mapping::SubmapId, SubmapScanMatcher>::iterator it) {
+  scan_matcher_cache_num_bytes_ -= it->second.num_bytes;
+  submap_ids_by_recency_.erase(it->second.recency_position);
+  submap_scan_matchers_.erase(it);
+}
+
 void ConstraintBuilder::ComputeConstraint(
     const mapping::SubmapId& submap_id, const Submap* const submap,
     const mapping::NodeId& node_id, bool match_full_submap,
@@ -169,8 +279,8 @@ void ConstraintBuilder::ComputeConstraint(
     std::unique_ptr<ConstraintBuilder::Constraint>* constraint) {
   const transform::Rigid2d initial_pose =
       ComputeSubmapPose(*submap) * initial_relative_pose;
-  const SubmapScanMatcher* const submap_scan_matcher =
-      GetSubmapScanMatcher(submap_id);
+  const std::shared_ptr<const scan_matching::FastCorrelativeScanMatcher>
+      fast_correlative_scan_matcher = GetSubmapScanMatcher(submap_id);
   const sensor::PointCloud filtered_point_cloud =
       adaptive_voxel_filter_.Filter(compressed_point_cloud->Decompress());
 
@@ -187,7 +297,7 @@ void ConstraintBuilder::ComputeConstraint(
   // 2. Prune if the score is too low.
   // 3. Refine.
   if (match_full_submap) {
-    if (submap_scan_matcher->fast_correlative_scan_matcher->MatchFullSubmap(
+    if (fast_correlative_scan_matcher->MatchFullSubmap(
             filtered_point_cloud, options_.global_localization_min_score(),
             &score, &pose_estimate)) {
       CHECK_GT(score, options_.global_localization_min_score());
@@ -199,7 +309,7 @@ void ConstraintBuilder::ComputeConstraint(
       return;
     }
   } else {
-    if (submap_scan_matcher->fast_correlative_scan_matcher->Match(
+    if (fast_correlative_scan_matcher->Match(
             initial_pose, filtered_point_cloud, options_.min_score(), &score,
             &pose_estimate)) {
       // We've reported a successful local match.
@@ -218,8 +328,8 @@ void ConstraintBuilder::ComputeConstraint(
   // CSM estimate.
   ceres::Solver::Summary unused_summary;
   ceres_scan_matcher_.Match(pose_estimate, pose_estimate, filtered_point_cloud,
-                            *submap_scan_matcher->probability_grid,
-                            &pose_estimate, &unused_summary);
+                            *submap->probability_lookup_grid(), &pose_estimate,
+                            &unused_summary);
 
   const transform::Rigid2d constraint_transform =
       ComputeSubmapPose(*submap).inverse() * pose_estimate;
@@ -268,6 +378,17 @@ void ConstraintBuilder::FinishComputation(const int computation_index) {
           LOG(INFO) << constraints_.size() << " computations resulted in "
                     << result.size() << " additional constraints.";
           LOG(INFO) << "Score histogram:\n" << score_histogram_.ToString(10);
+          const int num_scan_matcher_cache_lookups =
+              num_scan_matcher_cache_hits_ + num_scan_matcher_cache_misses_;
+          if (num_scan_matcher_cache_lookups > 0) {
+            LOG(INFO) << "Scan matcher cache: " << submap_scan_matchers_.size()
+                      << " scan matchers using "
+                      << scan_matcher_cache_num_bytes_ / (1024. * 1024.)
+                      << " MiB, hit rate "
+                      << 100. * num_scan_matcher_cache_hits_ /
+                             num_scan_matcher_cache_lookups
+                      << "%.";
+          }
         }
         constraints_.clear();
         callback = std::move(when_done_);
@@ -288,10 +409,23 @@ int ConstraintBuilder::GetNumFinishedScans() {
   return pending_computations_.begin()->first;
 }
 
+int ConstraintBuilder::GetNumCachedScanMatchers() {
+  common::MutexLocker locker(&mutex_);
+  return submap_scan_matchers_.size();
+}
+
+size_t ConstraintBuilder::GetScanMatcherCacheNumBytes() {
+  common::MutexLocker locker(&mutex_);
+  return scan_matcher_cache_num_bytes_;
+}
+
 void ConstraintBuilder::DeleteScanMatcher(const mapping::SubmapId& submap_id) {
   common::MutexLocker locker(&mutex_);
   CHECK(pending_computations_.empty());
-  submap_scan_matchers_.erase(submap_id);
+  const auto it = submap_scan_matchers_.find(submap_id);
+  if (it != submap_scan_matchers_.end()) {
+    EraseSubmapScanMatcher(it);
+  }
 }
 
 }  // namespace sparse_pose_graph
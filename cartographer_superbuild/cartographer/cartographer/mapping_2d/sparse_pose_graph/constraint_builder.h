@@ -21,6 +21,9 @@
 #include <deque>
 #include <functional>
 #include <limits>
+#include <list>
+#include <map>
+#include <memory>
 #include <vector>
 
 #include "Eigen/Core"
@@ -110,11 +113,41 @@ class ConstraintBuilder {
   // Delete data related to 'submap_id'.
   void DeleteScanMatcher(const mapping::SubmapId& submap_id);
 
+  // Restores the scan matcher for the finished 'submap' identified by
+  // 'submap_id' from serialized precomputation grids. Returns false if they
+  // are stale, in which case the scan matcher is built when first needed.
+  //
+  // The pointee of 'submap' must stay valid as long as the scan matcher is
+  // used.
+  bool AddSubmapScanMatcherFromProto(
+      const mapping::SubmapId& submap_id, const ProbabilityGrid* submap,
+      const scan_matching::proto::PrecomputationGridStack& proto);
+
+  // Serializes the precomputation grids of the scan matcher for the finished
+  // 'submap' identified by 'submap_id'. They are computed if the scan matcher
+  // is not cached.
+  scan_matching::proto::PrecomputationGridStack SubmapScanMatcherToProto(
+      const mapping::SubmapId& submap_id, const ProbabilityGrid* submap);
+
+  // Returns the number of cached scan matchers.
+  int GetNumCachedScanMatchers();
+
+  // Returns the number of bytes used by the cached scan matchers.
+  size_t GetScanMatcherCacheNumBytes();
+
  private:
   struct SubmapScanMatcher {
     const ProbabilityGrid* probability_grid;
-    std::unique_ptr<scan_matching::FastCorrelativeScanMatcher>
+    // Shared with the work items currently using it, so that it can be
+    // evicted from the cache while they run.
+    std::shared_ptr<const scan_matching::FastCorrelativeScanMatcher>
         fast_correlative_scan_matcher;
+    size_t num_bytes;
+    // Number of scheduled work items which have not yet taken the scan
+    // matcher. It is not evicted while this is positive.
+    int num_pending_work_items;
+    // Position in 'submap_ids_by_recency_'.
+    std::list<mapping::SubmapId>::iterator recency_position;
   };
 
   // Either schedules the 'work_item', or if needed, schedules the scan matcher
@@ -123,14 +156,39 @@ class ConstraintBuilder {
       const mapping::SubmapId& submap_id, const ProbabilityGrid* submap,
       std::function<void()> work_item) REQUIRES(mutex_);
 
+  // Schedules the 'work_item' which uses the existing 'submap_scan_matcher'
+  // for 'submap_id', and marks it as most recently used.
+  void ScheduleWorkItem(const mapping::SubmapId& submap_id,
+                        SubmapScanMatcher* submap_scan_matcher,
+                        std::function<void()> work_item) REQUIRES(mutex_);
+
   // Constructs the scan matcher for a 'submap', then schedules its work items.
   void ConstructSubmapScanMatcher(const mapping::SubmapId& submap_id,
                                   const ProbabilityGrid* submap)
       EXCLUDES(mutex_);
 
-  // Returns the scan matcher for a submap, which has to exist.
-  const SubmapScanMatcher* GetSubmapScanMatcher(
-      const mapping::SubmapId& submap_id) EXCLUDES(mutex_);
+  // Adds the 'fast_correlative_scan_matcher' for 'submap_id' to the cache as
+  // the most recently used one.
+  SubmapScanMatcher* InsertSubmapScanMatcher(
+      const mapping::SubmapId& submap_id, const ProbabilityGrid* submap,
+      std::shared_ptr<const scan_matching::FastCorrelativeScanMatcher>
+          fast_correlative_scan_matcher) REQUIRES(mutex_);
+
+  // Returns the scan matcher for a submap, which has to exist. Must be called
+  // exactly once by each work item scheduled for the submap.
+  std::shared_ptr<const scan_matching::FastCorrelativeScanMatcher>
+  GetSubmapScanMatcher(const mapping::SubmapId& submap_id) EXCLUDES(mutex_);
+
+  // Evicts the least recently used scan matchers not needed by pending work
+  // items until the cache fits into 'scan_matcher_cache_max_megabytes'. Scan
+  // matchers needed by pending work items can make the cache exceed it for a
+  // while.
+  void EvictSubmapScanMatchers() REQUIRES(mutex_);
+
+  // Removes 'it' from 'submap_scan_matchers_' and updates the bookkeeping.
+  void EraseSubmapScanMatcher(
+      std::map<mapping::SubmapId, SubmapScanMatcher>::iterator it)
+      REQUIRES(mutex_);
 
   // Runs in a background thread and does computations for an additional
   // constraint, assuming 'submap' and 'compressed_point_cloud' do not change
@@ -175,6 +233,17 @@ class ConstraintBuilder {
   std::map<mapping::SubmapId, SubmapScanMatcher> submap_scan_matchers_
       GUARDED_BY(mutex_);
 
+  // IDs of the submaps in 'submap_scan_matchers_', most recently used first.
+  std::list<mapping::SubmapId> submap_ids_by_recency_ GUARDED_BY(mutex_);
+
+  // Sum of the bytes used by 'submap_scan_matchers_'.
+  size_t scan_matcher_cache_num_bytes_ GUARDED_BY(mutex_) = 0;
+
+  // Numbers of work items which found their scan matcher in the cache, and
+  // which had to wait for it to be constructed.
+  int num_scan_matcher_cache_hits_ GUARDED_BY(mutex_) = 0;
+  int num_scan_matcher_cache_misses_ GUARDED_BY(mutex_) = 0;
+
   // Map by 'submap_id' of scan matchers under construction, and the work
   // to do once construction is done.
   std::map<mapping::SubmapId, std::vector<std::function<void()>>>
@@ -0,0 +1,277 @@
+/*
+ * Copyright 2017 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_2d/sparse_pose_graph/constraint_builder.h"
+
+#include <memory>
+#include <vector>
+
+#include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
+#include "cartographer/common/make_unique.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/thread_pool.h"
+#include "cartographer/mapping/sparse_pose_graph/constraint_builder.h"
+#include "cartographer/mapping_2d/range_data_inserter.h"
+#include "cartographer/mapping_2d/scan_matching/fast_correlative_scan_matcher.h"
+#include "cartographer/mapping_2d/submaps.h"
+#include "cartographer/sensor/compressed_point_cloud.h"
+#include "cartographer/transform/rigid_transform_test_helpers.h"
+#include "cartographer/transform/transform.h"
+#include "gmock/gmock.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace sparse_pose_graph {
+namespace {
+
+constexpr int kNumSubmaps = 3;
+
+class ConstraintBuilderTest : public ::testing::Test {
+ protected:
+  ConstraintBuilderTest() : thread_pool_(2) {
+    // A rectangular room with a few obstacles, so that there is exactly one
+    // way for the scan to match.
+    for (float t = -1.5f; t <= 1.5f; t += 0.02f) {
+      point_cloud_.emplace_back(t, -1.f, 0.f);
+      point_cloud_.emplace_back(t, 1.f, 0.f);
+    }
+    for (float t = -1.f; t <= 1.f; t += 0.02f) {
+      point_cloud_.emplace_back(-1.5f, t, 0.f);
+      point_cloud_.emplace_back(1.5f, t, 0.f);
+    }
+    for (float t = 0.f; t <= 0.4f; t += 0.02f) {
+      point_cloud_.emplace_back(0.5f + t, 0.3f, 0.f);
+      point_cloud_.emplace_back(-0.8f, -0.6f + t, 0.f);
+    }
+    compressed_point_cloud_ =
+        common::make_unique<sensor::CompressedPointCloud>(point_cloud_);
+
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          insert_free_space = true,
+          hit_probability = 0.9,
+          miss_probability = 0.4,
+        })text");
+    const RangeDataInserter range_data_inserter(
+        CreateRangeDataInserterOptions(parameter_dictionary.get()));
+    for (int i = 0; i != kNumSubmaps; ++i) {
+      const Eigen::Vector2f origin(10.f * i, -5.f * i);
+      submaps_.push_back(common::make_unique<Submap>(
+          MapLimits(0.05, origin.cast<double>() + Eigen::Vector2d(2., 2.),
+                    CellLimits(80, 80)),
+          origin));
+      submaps_.back()->InsertRangeData(
+          sensor::TransformRangeData(
+              sensor::RangeData{Eigen::Vector3f::Zero(), point_cloud_, {}},
+              transform::Rigid3f::Translation(
+                  Eigen::Vector3f(origin.x(), origin.y(), 0.f))),
+          range_data_inserter);
+      submaps_.back()->Finish();
+    }
+  }
+
+  std::unique_ptr<ConstraintBuilder> CreateConstraintBuilder(
+      const double scan_matcher_cache_max_megabytes) {
+    return common::make_unique<ConstraintBuilder>(
+        mapping::sparse_pose_graph::CreateConstraintBuilderOptions(
+            CreateOptionsDictionary(scan_matcher_cache_max_megabytes).get()),
+        &thread_pool_);
+  }
+
+  std::unique_ptr<common::LuaParameterDictionary> CreateOptionsDictionary(
+      const double scan_matcher_cache_max_megabytes) {
+    return common::MakeDictionary(R"text(
+        return {
+          sampling_ratio = 1.,
+          max_constraint_distance = 6.,
+          adaptive_voxel_filter = {
+            max_length = 1e-2,
+            min_num_points = 1000,
+            max_range = 50.,
+          },
+          min_score = 0.5,
+          global_localization_min_score = 0.6,
+          loop_closure_translation_weight = 1.,
+          loop_closure_rotation_weight = 1.,
+          log_matches = false,
+          scan_matcher_cache_max_megabytes = )text" +
+        std::to_string(scan_matcher_cache_max_megabytes) + R"text(,
+          fast_correlative_scan_matcher = {
+            linear_search_window = 1.,
+            angular_search_window = 0.1,
+            branch_and_bound_depth = 3,
+            num_threads = 1,
+          },
+          ceres_scan_matcher = {
+            occupied_space_weight = 20.,
+            translation_weight = 10.,
+            rotation_weight = 1.,
+            use_analytic_derivatives = true,
+            reuse_problems = false,
+            ceres_solver_options = {
+              use_nonmonotonic_steps = true,
+              max_num_iterations = 50,
+              num_threads = 1,
+            },
+          },
+          fast_correlative_scan_matcher_3d = {
+            branch_and_bound_depth = 3,
+            full_resolution_depth = 3,
+            rotational_histogram_size = 30,
+            min_rotational_score = 0.1,
+            linear_xy_search_window = 4.,
+            linear_z_search_window = 4.,
+            angular_search_window = 0.1,
+            num_threads = 1,
+          },
+          high_resolution_adaptive_voxel_filter = {
+            max_length = 2.,
+            min_num_points = 150,
+            max_range = 15.,
+          },
+          low_resolution_adaptive_voxel_filter = {
+            max_length = 4.,
+            min_num_points = 200,
+            max_range = 60.,
+          },
+          ceres_scan_matcher_3d = {
+            occupied_space_weight_0 = 20.,
+            translation_weight = 10.,
+            rotation_weight = 1.,
+            only_optimize_yaw = true,
+            reuse_problems = false,
+            ceres_solver_options = {
+              use_nonmonotonic_steps = false,
+              max_num_iterations = 10,
+              num_threads = 1,
+            },
+          },
+        })text");
+  }
+
+  // Matches two nodes against each submap, starting from a perturbed relative
+  // pose, and waits for the resulting constraints.
+  ConstraintBuilder::Result ComputeConstraints(
+      ConstraintBuilder* const constraint_builder) {
+    int node_index = 0;
+    for (int i = 0; i != kNumSubmaps; ++i) {
+      for (const transform::Rigid2d& initial_relative_pose :
+           {transform::Rigid2d({0.1, -0.05}, 0.02),
+            transform::Rigid2d({-0.1, 0.1}, -0.03)}) {
+        constraint_builder->MaybeAddConstraint(
+            mapping::SubmapId{0, i}, submaps_[i].get(),
+            mapping::NodeId{0, node_index++}, compressed_point_cloud_.get(),
+            initial_relative_pose);
+        constraint_builder->NotifyEndOfScan();
+      }
+    }
+    ConstraintBuilder::Result result;
+    {
+      common::MutexLocker locker(&mutex_);
+      done_ = false;
+    }
+    constraint_builder->WhenDone(
+        [this, &result](const ConstraintBuilder::Result& constraints) {
+          common::MutexLocker locker(&mutex_);
+          result = constraints;
+          done_ = true;
+        });
+    common::MutexLocker locker(&mutex_);
+    locker.Await([this]() REQUIRES(mutex_) { return done_; });
+    return result;
+  }
+
+  size_t ComputeScanMatcherNumBytes(const Submap& submap) {
+    auto parameter_dictionary = CreateOptionsDictionary(0.);
+    const auto options =
+        mapping::sparse_pose_graph::CreateConstraintBuilderOptions(
+            parameter_dictionary.get());
+    return scan_matching::FastCorrelativeScanMatcher(
+               submap.probability_grid(),
+               options.fast_correlative_scan_matcher_options(), &thread_pool_)
+        .num_bytes();
+  }
+
+  void ExpectAllConstraintsFound(const ConstraintBuilder::Result& result) {
+    ASSERT_EQ(2 * kNumSubmaps, result.size());
+    for (const auto& constraint : result) {
+      // The scans were inserted at the origin of each submap.
+      EXPECT_THAT(constraint.pose.zbar_ij,
+                  transform::IsNearly(transform::Rigid3d::Identity(), 0.05));
+    }
+  }
+
+  // Outlives the threads of 'thread_pool_' which run the 'WhenDone' callback.
+  common::Mutex mutex_;
+  bool done_ GUARDED_BY(mutex_) = false;
+  common::ThreadPool thread_pool_;
+  sensor::PointCloud point_cloud_;
+  std::unique_ptr<sensor::CompressedPointCloud> compressed_point_cloud_;
+  std::vector<std::unique_ptr<Submap>> submaps_;
+};
+
+TEST_F(ConstraintBuilderTest, CachesScanMatchers) {
+  auto constraint_builder =
+      CreateConstraintBuilder(0. /* scan_matcher_cache_max_megabytes */);
+  ExpectAllConstraintsFound(ComputeConstraints(constraint_builder.get()));
+  size_t expected_num_bytes = 0;
+  for (const auto& submap : submaps_) {
+    expected_num_bytes += ComputeScanMatcherNumBytes(*submap);
+  }
+  EXPECT_EQ(kNumSubmaps, constraint_builder->GetNumCachedScanMatchers());
+  EXPECT_EQ(expected_num_bytes,
+            constraint_builder->GetScanMatcherCacheNumBytes());
+
+  ExpectAllConstraintsFound(ComputeConstraints(constraint_builder.get()));
+  EXPECT_EQ(expected_num_bytes,
+            constraint_builder->GetScanMatcherCacheNumBytes());
+  for (int i = 0; i != kNumSubmaps; ++i) {
+    constraint_builder->DeleteScanMatcher(mapping::SubmapId{0, i});
+  }
+  EXPECT_EQ(0, constraint_builder->GetNumCachedScanMatchers());
+  EXPECT_EQ(0, constraint_builder->GetScanMatcherCacheNumBytes());
+}
+
+TEST_F(ConstraintBuilderTest, EvictsScanMatchersExceedingTheBudget) {
+  const size_t num_bytes = ComputeScanMatcherNumBytes(*submaps_.front());
+  // Enough for one scan matcher, but not for two.
+  auto constraint_builder =
+      CreateConstraintBuilder(1.5 * num_bytes / (1024. * 1024.));
+  const ConstraintBuilder::Result first_result =
+      ComputeConstraints(constraint_builder.get());
+  ExpectAllConstraintsFound(first_result);
+  EXPECT_EQ(1, constraint_builder->GetNumCachedScanMatchers());
+  EXPECT_EQ(num_bytes, constraint_builder->GetScanMatcherCacheNumBytes());
+
+  // The evicted scan matchers are built again and find the same constraints.
+  const ConstraintBuilder::Result second_result =
+      ComputeConstraints(constraint_builder.get());
+  ExpectAllConstraintsFound(second_result);
+  for (size_t i = 0; i != first_result.size(); ++i) {
+    EXPECT_EQ(first_result[i].submap_id, second_result[i].submap_id);
+    EXPECT_EQ(first_result[i].node_id.node_index,
+              second_result[i].node_id.node_index);
+    EXPECT_THAT(second_result[i].pose.zbar_ij,
+                transform::IsNearly(first_result[i].pose.zbar_ij, 1e-9));
+  }
+  EXPECT_EQ(1, constraint_builder->GetNumCachedScanMatchers());
+  EXPECT_EQ(num_bytes, constraint_builder->GetScanMatcherCacheNumBytes());
+}
+
+}  // namespace
+}  // namespace sparse_pose_graph
+}  // namespace mapping_2d
+}  // namespace cartographer
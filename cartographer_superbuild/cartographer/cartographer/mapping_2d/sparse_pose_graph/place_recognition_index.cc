@@ -0,0 +1,190 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_2d/sparse_pose_graph/place_recognition_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "cartographer/common/math.h"
+#include "glog/logging.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace sparse_pose_graph {
+
+namespace {
+
+constexpr int kNumRings = 20;
+constexpr int kNumSectors = 60;
+// Number of rays cast by ComputeSubmapDescriptor(), several per sector.
+constexpr int kNumRays = 8 * kNumSectors;
+
+}  // namespace
+
+Eigen::VectorXf ComputeScanDescriptor(const sensor::RangeData& range_data,
+                                      const float max_range) {
+  CHECK_GT(max_range, 0.f);
+  Eigen::Matrix<bool, kNumSectors, kNumRings> occupied_sectors;
+  occupied_sectors.setConstant(false);
+  Eigen::VectorXf descriptor = Eigen::VectorXf::Zero(2 * kNumRings);
+  int num_returns = 0;
+  for (const Eigen::Vector3f& hit : range_data.returns) {
+    const Eigen::Vector2f delta = hit.head<2>() - range_data.origin.head<2>();
+    const float range = delta.norm();
+    if (range >= max_range) {
+      continue;
+    }
+    const int ring = std::min(
+        static_cast<int>(range / max_range * kNumRings), kNumRings - 1);
+    const float angle = std::atan2(delta.y(), delta.x());
+    const int sector =
+        common::Clamp(static_cast<int>((angle + M_PI) / (2. * M_PI) *
+                                       kNumSectors),
+                      0, kNumSectors - 1);
+    descriptor[ring] += 1.f;
+    occupied_sectors(sector, ring) = true;
+    ++num_returns;
+  }
+  if (num_returns > 0) {
+    descriptor.head<kNumRings>() /= num_returns;
+  }
+  descriptor.tail<kNumRings>() =
+      occupied_sectors.cast<float>().colwise().sum().transpose() / kNumSectors;
+  return descriptor;
+}
+
+Eigen::VectorXf ComputeSubmapDescriptor(const ProbabilityGrid& probability_grid,
+                                        const Eigen::Vector2f& origin,
+                                        const float max_range) {
+  CHECK_GT(max_range, 0.f);
+  const MapLimits& limits = probability_grid.limits();
+  const float step = 0.5f * limits.resolution();
+  sensor::RangeData range_data{
+      Eigen::Vector3f(origin.x(), origin.y(), 0.f), {}, {}};
+  for (int i = 0; i != kNumRays; ++i) {
+    const float angle = -M_PI + (i + 0.5f) * (2. * M_PI / kNumRays);
+    const Eigen::Vector2f direction(std::cos(angle), std::sin(angle));
+    for (float range = step; range < max_range; range += step) {
+      const Eigen::Vector2f point = origin + range * direction;
+      const Eigen::Array2i cell_index = limits.GetCellIndex(point);
+      if (!limits.Contains(cell_index)) {
+        break;
+      }
+      if (probability_grid.GetProbability(cell_index) > 0.5f) {
+        range_data.returns.emplace_back(point.x(), point.y(), 0.f);
+        break;
+      }
+    }
+  }
+  return ComputeScanDescriptor(range_data, max_range);
+}
+
+PlaceRecognitionIndex::PlaceRecognitionIndex(const int num_candidates)
+    : num_candidates_(num_candidates) {
+  CHECK_GT(num_candidates_, 0);
+}
+
+void PlaceRecognitionIndex::AddNode(const mapping::NodeId& node_id,
+                                    const Eigen::VectorXf& descriptor) {
+  node_descriptors_[node_id] = descriptor;
+}
+
+void PlaceRecognitionIndex::AddSubmap(
+    const mapping::SubmapId& submap_id,
+    const std::set<mapping::NodeId>& node_ids) {
+  std::vector<const Eigen::VectorXf*> descriptors;
+  for (const mapping::NodeId& node_id : node_ids) {
+    const auto it = node_descriptors_.find(node_id);
+    if (it != node_descriptors_.end()) {
+      descriptors.push_back(&it->second);
+    }
+  }
+  if (descriptors.empty()) {
+    return;
+  }
+  Eigen::MatrixXf& submap_descriptors = submap_descriptors_[submap_id];
+  submap_descriptors.resize(descriptors.front()->size(), descriptors.size());
+  for (size_t i = 0; i != descriptors.size(); ++i) {
+    submap_descriptors.col(i) = *descriptors[i];
+  }
+  max_candidate_distances_.clear();
+}
+
+void PlaceRecognitionIndex::AddSubmapDescriptor(
+    const mapping::SubmapId& submap_id, const Eigen::VectorXf& descriptor) {
+  submap_descriptors_[submap_id] = descriptor;
+  max_candidate_distances_.clear();
+}
+
+void PlaceRecognitionIndex::RemoveSubmap(const mapping::SubmapId& submap_id) {
+  submap_descriptors_.erase(submap_id);
+  max_candidate_distances_.clear();
+}
+
+void PlaceRecognitionIndex::RemoveNode(const mapping::NodeId& node_id) {
+  node_descriptors_.erase(node_id);
+  max_candidate_distances_.erase(node_id);
+}
+
+bool PlaceRecognitionIndex::IsCandidate(const mapping::NodeId& node_id,
+                                        const mapping::SubmapId& submap_id) {
+  const auto submap_it = submap_descriptors_.find(submap_id);
+  const auto node_it = node_descriptors_.find(node_id);
+  if (submap_it == submap_descriptors_.end() ||
+      node_it == node_descriptors_.end()) {
+    // Without descriptors we cannot rule the submap out.
+    return true;
+  }
+  if (max_candidate_distances_.count(node_id) == 0) {
+    max_candidate_distances_[node_id] = ComputeMaxCandidateDistance(node_id);
+  }
+  return ComputeDistance(node_it->second, submap_it->second) <=
+         max_candidate_distances_.at(node_id);
+}
+
+float PlaceRecognitionIndex::ComputeDistance(
+    const Eigen::VectorXf& descriptor,
+    const Eigen::MatrixXf& submap_descriptors) {
+  return (submap_descriptors.colwise() - descriptor)
+      .cwiseAbs()
+      .colwise()
+      .sum()
+      .minCoeff();
+}
+
+float PlaceRecognitionIndex::ComputeMaxCandidateDistance(
+    const mapping::NodeId& node_id) const {
+  const Eigen::VectorXf& descriptor = node_descriptors_.at(node_id);
+  std::vector<float> distances;
+  for (const auto& entry : submap_descriptors_) {
+    if (entry.first.trajectory_id != node_id.trajectory_id) {
+      distances.push_back(ComputeDistance(descriptor, entry.second));
+    }
+  }
+  if (distances.size() < static_cast<size_t>(num_candidates_)) {
+    return std::numeric_limits<float>::infinity();
+  }
+  std::nth_element(distances.begin(), distances.begin() + num_candidates_ - 1,
+                   distances.end());
+  return distances[num_candidates_ - 1];
+}
+
+}  // namespace sparse_pose_graph
+}  // namespace mapping_2d
+}  // namespace cartographer
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_MAPPING_2D_SPARSE_POSE_GRAPH_PLACE_RECOGNITION_INDEX_H_
+#define CARTOGRAPHER_MAPPING_2D_SPARSE_POSE_GRAPH_PLACE_RECOGNITION_INDEX_H_
+
+#include <map>
+#include <set>
+
+#include "Eigen/Core"
+#include "cartographer/mapping/id.h"
+#include "cartographer/mapping_2d/probability_grid.h"
+#include "cartographer/sensor/range_data.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace sparse_pose_graph {
+
+// Computes a descriptor of 'range_data' which does not change when the scan is
+// rotated about its origin. For each of a number of concentric rings of equal
+// width up to 'max_range', it holds the fraction of returns in the ring and
+// the fraction of angular sectors of the ring containing returns.
+Eigen::VectorXf ComputeScanDescriptor(const sensor::RangeData& range_data,
+                                      float max_range);
+
+// Computes the descriptor of the scan a range finder at 'origin' would capture
+// in 'probability_grid', for submaps whose scans are not known, e.g. because
+// they were loaded from a serialized state. Rays end at the first cell which
+// is more likely occupied than free.
+Eigen::VectorXf ComputeSubmapDescriptor(const ProbabilityGrid& probability_grid,
+                                        const Eigen::Vector2f& origin,
+                                        float max_range);
+
+// Shortlists the submaps worth matching a scan against globally, by comparing
+// the descriptor of the scan to the descriptors of the scans inserted into
+// each submap.
+//
+// This class is not thread-safe.
+class PlaceRecognitionIndex {
+ public:
+  explicit PlaceRecognitionIndex(int num_candidates);
+
+  PlaceRecognitionIndex(const PlaceRecognitionIndex&) = delete;
+  PlaceRecognitionIndex& operator=(const PlaceRecognitionIndex&) = delete;
+
+  // Records the 'descriptor' of the scan 'node_id'.
+  void AddNode(const mapping::NodeId& node_id,
+               const Eigen::VectorXf& descriptor);
+
+  // Makes 'submap_id' searchable, described by the previously added scans
+  // 'node_ids' which were inserted into it.
+  void AddSubmap(const mapping::SubmapId& submap_id,
+                 const std::set<mapping::NodeId>& node_ids);
+
+  // Makes 'submap_id' searchable, described by the 'descriptor' computed by
+  // ComputeSubmapDescriptor().
+  void AddSubmapDescriptor(const mapping::SubmapId& submap_id,
+                           const Eigen::VectorXf& descriptor);
+
+  // Removes 'submap_id', e.g. because it was trimmed.
+  void RemoveSubmap(const mapping::SubmapId& submap_id);
+
+  // Removes the descriptor of the scan 'node_id'.
+  void RemoveNode(const mapping::NodeId& node_id);
+
+  // Returns true if 'submap_id' is among the 'num_candidates' submaps of
+  // other trajectories most similar to the scan 'node_id'. While fewer submaps
+  // of other trajectories are known, all of them are candidates.
+  bool IsCandidate(const mapping::NodeId& node_id,
+                   const mapping::SubmapId& submap_id);
+
+ private:
+  // Returns the smallest distance between 'descriptor' and the descriptors of
+  // the scans of 'submap_descriptors'.
+  static float ComputeDistance(const Eigen::VectorXf& descriptor,
+                               const Eigen::MatrixXf& submap_descriptors);
+
+  // Returns the distance of the 'num_candidates_'th most similar submap not in
+  // the trajectory of 'node_id', or infinity if there are not that many.
+  float ComputeMaxCandidateDistance(const mapping::NodeId& node_id) const;
+
+  const int num_candidates_;
+  std::map<mapping::NodeId, Eigen::VectorXf> node_descriptors_;
+  // Descriptors of the scans of each submap as columns.
+  std::map<mapping::SubmapId, Eigen::MatrixXf> submap_descriptors_;
+  // Results of ComputeMaxCandidateDistance(), which are cleared whenever
+  // submaps are added or removed.
+  std::map<mapping::NodeId, float> max_candidate_distances_;
+};
+
+}  // namespace sparse_pose_graph
+}  // namespace mapping_2d
+}  // namespace cartographer
+
+#endif  // CARTOGRAPHER_MAPPING_2D_SPARSE_POSE_GRAPH_PLACE_RECOGNITION_INDEX_H_
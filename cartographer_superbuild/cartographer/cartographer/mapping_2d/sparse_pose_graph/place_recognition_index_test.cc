@@ -0,0 +1,148 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_2d/sparse_pose_graph/place_recognition_index.h"
+
+#include <cmath>
+
+#include "cartographer/mapping_2d/xy_index.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace sparse_pose_graph {
+namespace {
+
+constexpr float kMaxRange = 10.f;
+
+// Returns a scan around 'origin' whose returns are at 'range' in every other
+// of 60 sectors, starting at 'first_sector'.
+sensor::RangeData CreateRingScan(const Eigen::Vector3f& origin,
+                                 const float range, const int first_sector) {
+  sensor::RangeData range_data{origin, {}, {}};
+  for (int i = 0; i != 30; ++i) {
+    const float angle = -M_PI + (first_sector + 2 * i + 0.5f) * M_PI / 30.;
+    range_data.returns.push_back(
+        origin + range * Eigen::Vector3f(std::cos(angle), std::sin(angle), 0.f));
+  }
+  return range_data;
+}
+
+TEST(PlaceRecognitionIndexTest, DescriptorIsRotationInvariant) {
+  const Eigen::VectorXf descriptor = ComputeScanDescriptor(
+      CreateRingScan(Eigen::Vector3f::Zero(), 3.2f, 0), kMaxRange);
+  const Eigen::VectorXf rotated_descriptor = ComputeScanDescriptor(
+      CreateRingScan(Eigen::Vector3f(1.f, -2.f, 0.f), 3.2f, 7), kMaxRange);
+  EXPECT_NEAR(0.f, (descriptor - rotated_descriptor).cwiseAbs().maxCoeff(),
+              1e-6f);
+  EXPECT_NEAR(1.f, descriptor.head(descriptor.size() / 2).sum(), 1e-6f);
+  EXPECT_NEAR(0.5f, descriptor.tail(descriptor.size() / 2).sum(), 1e-6f);
+}
+
+TEST(PlaceRecognitionIndexTest, SubmapDescriptorMatchesScanDescriptor) {
+  const Eigen::Vector2f origin(1.f, -2.f);
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(6., 3.), CellLimits(200, 200)));
+  // Cells at a range of 3.2 around 'origin' are occupied.
+  for (const Eigen::Array2i& xy_index :
+       XYIndexRangeIterator(probability_grid.limits().cell_limits())) {
+    const Eigen::Vector2f cell_center(
+        6.f - (xy_index.y() + 0.5f) * 0.05f,
+        3.f - (xy_index.x() + 0.5f) * 0.05f);
+    if (std::abs((cell_center - origin).norm() - 3.2f) < 0.05f) {
+      probability_grid.SetProbability(xy_index, 0.9f);
+    }
+  }
+  sensor::RangeData ring_scan =
+      CreateRingScan(Eigen::Vector3f(origin.x(), origin.y(), 0.f), 3.2f, 0);
+  const sensor::RangeData other_half_ring_scan =
+      CreateRingScan(Eigen::Vector3f(origin.x(), origin.y(), 0.f), 3.2f, 1);
+  ring_scan.returns.insert(ring_scan.returns.end(),
+                           other_half_ring_scan.returns.begin(),
+                           other_half_ring_scan.returns.end());
+  const Eigen::VectorXf expected_descriptor =
+      ComputeScanDescriptor(ring_scan, kMaxRange);
+  const Eigen::VectorXf descriptor =
+      ComputeSubmapDescriptor(probability_grid, origin, kMaxRange);
+  EXPECT_NEAR(0.f, (descriptor - expected_descriptor).cwiseAbs().maxCoeff(),
+              1e-6f);
+}
+
+TEST(PlaceRecognitionIndexTest, ShortlistsMostSimilarSubmaps) {
+  PlaceRecognitionIndex index(2 /* num_candidates */);
+  for (int submap_index = 0; submap_index != 5; ++submap_index) {
+    const mapping::NodeId node_id{0, submap_index};
+    index.AddNode(node_id,
+                  ComputeScanDescriptor(
+                      CreateRingScan(Eigen::Vector3f::Zero(),
+                                     1.25f + 2.f * submap_index, submap_index),
+                      kMaxRange));
+    index.AddSubmap(mapping::SubmapId{0, submap_index}, {node_id});
+  }
+
+  // With a single submap of another trajectory, it is always a candidate.
+  const mapping::NodeId other_node_id{1, 0};
+  index.AddNode(other_node_id,
+                ComputeScanDescriptor(
+                    CreateRingScan(Eigen::Vector3f::Zero(), 7.f, 3), kMaxRange));
+  index.AddSubmap(mapping::SubmapId{1, 0}, {other_node_id});
+  EXPECT_TRUE(index.IsCandidate(mapping::NodeId{0, 0},
+                                mapping::SubmapId{1, 0}));
+
+  // The query scan has most of its returns at the range of submap 3.
+  sensor::RangeData query = CreateRingScan(Eigen::Vector3f::Zero(), 7.25f, 1);
+  query.returns.push_back(Eigen::Vector3f(5.25f, 0.f, 0.f));
+  const mapping::NodeId query_node_id{1, 1};
+  index.AddNode(query_node_id, ComputeScanDescriptor(query, kMaxRange));
+  EXPECT_TRUE(index.IsCandidate(query_node_id, mapping::SubmapId{0, 3}));
+  EXPECT_TRUE(index.IsCandidate(query_node_id, mapping::SubmapId{0, 2}));
+  EXPECT_FALSE(index.IsCandidate(query_node_id, mapping::SubmapId{0, 0}));
+  EXPECT_FALSE(index.IsCandidate(query_node_id, mapping::SubmapId{0, 4}));
+
+  index.RemoveSubmap(mapping::SubmapId{0, 3});
+  // Submaps without descriptors are not ruled out.
+  EXPECT_TRUE(index.IsCandidate(query_node_id, mapping::SubmapId{0, 3}));
+}
+
+TEST(PlaceRecognitionIndexTest, UpdatesShortlistWhenSubmapsChange) {
+  PlaceRecognitionIndex index(1 /* num_candidates */);
+  const mapping::NodeId node_id{0, 0};
+  index.AddNode(node_id,
+                ComputeScanDescriptor(
+                    CreateRingScan(Eigen::Vector3f::Zero(), 5.25f, 0),
+                    kMaxRange));
+  index.AddSubmapDescriptor(
+      mapping::SubmapId{1, 0},
+      ComputeScanDescriptor(CreateRingScan(Eigen::Vector3f::Zero(), 2.25f, 0),
+                            kMaxRange));
+  EXPECT_TRUE(index.IsCandidate(node_id, mapping::SubmapId{1, 0}));
+
+  // A more similar submap takes the place of the only candidate.
+  index.AddSubmapDescriptor(
+      mapping::SubmapId{1, 1},
+      ComputeScanDescriptor(CreateRingScan(Eigen::Vector3f::Zero(), 5.25f, 3),
+                            kMaxRange));
+  EXPECT_FALSE(index.IsCandidate(node_id, mapping::SubmapId{1, 0}));
+  EXPECT_TRUE(index.IsCandidate(node_id, mapping::SubmapId{1, 1}));
+
+  index.RemoveSubmap(mapping::SubmapId{1, 1});
+  EXPECT_TRUE(index.IsCandidate(node_id, mapping::SubmapId{1, 0}));
+}
+
+}  // namespace
+}  // namespace sparse_pose_graph
+}  // namespace mapping_2d
+}  // namespace cartographer
@@ -19,9 +19,11 @@
 #include <cmath>
 #include <memory>
 #include <random>
+#include <string>
 
 #include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
 #include "cartographer/common/make_unique.h"
+#include "cartographer/common/seqlock.h"
 #include "cartographer/common/thread_pool.h"
 #include "cartographer/common/time.h"
 #include "cartographer/mapping_2d/range_data_inserter.h"
@@ -47,23 +49,32 @@ class SparsePoseGraphTest : public ::testing::Test {
       point_cloud_.emplace_back(r * std::sin(t), r * std::cos(t), 0.f);
     }
 
-    {
-      auto parameter_dictionary = common::MakeDictionary(R"text(
-          return {
-            resolution = 0.05,
-            num_range_data = 1,
-            range_data_inserter = {
-              insert_free_space = true,
-              hit_probability = 0.53,
-              miss_probability = 0.495,
-            },
-          })text");
-      active_submaps_ = common::make_unique<ActiveSubmaps>(
-          CreateSubmapsOptions(parameter_dictionary.get()));
-    }
+    CreateActiveSubmaps();
+    CreateSparsePoseGraph(0 /* place_recognition_num_candidates */,
+                          false /* reuse_problems */);
+    current_pose_ = transform::Rigid2d::Identity();
+  }
+
+  void CreateActiveSubmaps() {
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          resolution = 0.05,
+          num_range_data = 1,
+          range_data_inserter = {
+            insert_free_space = true,
+            hit_probability = 0.53,
+            miss_probability = 0.495,
+          },
+        })text");
+    active_submaps_ = common::make_unique<ActiveSubmaps>(
+        CreateSubmapsOptions(parameter_dictionary.get()));
+  }
 
-    {
-      auto parameter_dictionary = common::MakeDictionary(R"text(
+  void CreateSparsePoseGraph(const int place_recognition_num_candidates,
+                             const bool reuse_problems) {
+    const std::string reuse_problems_string =
+        reuse_problems ? "true" : "false";
+    auto parameter_dictionary = common::MakeDictionary(R"text(
           return {
             optimize_every_n_scans = 1000,
             constraint_builder = {
@@ -79,15 +90,20 @@ class SparsePoseGraphTest : public ::testing::Test {
               loop_closure_translation_weight = 1.,
               loop_closure_rotation_weight = 1.,
               log_matches = true,
+              scan_matcher_cache_max_megabytes = 0.,
               fast_correlative_scan_matcher = {
                 linear_search_window = 3.,
                 angular_search_window = 0.1,
                 branch_and_bound_depth = 3,
+                num_threads = 1,
               },
               ceres_scan_matcher = {
                 occupied_space_weight = 20.,
                 translation_weight = 10.,
                 rotation_weight = 1.,
+                use_analytic_derivatives = true,
+                reuse_problems = )text" +
+        reuse_problems_string + R"text(,
                 ceres_solver_options = {
                   use_nonmonotonic_steps = true,
                   max_num_iterations = 50,
@@ -102,6 +118,7 @@ class SparsePoseGraphTest : public ::testing::Test {
                 linear_xy_search_window = 4.,
                 linear_z_search_window = 4.,
                 angular_search_window = 0.1,
+                num_threads = 1,
               },
               high_resolution_adaptive_voxel_filter = {
                 max_length = 2.,
@@ -118,6 +135,8 @@ class SparsePoseGraphTest : public ::testing::Test {
                 translation_weight = 10.,
                 rotation_weight = 1.,
                 only_optimize_yaw = true,
+                reuse_problems = )text" +
+        reuse_problems_string + R"text(,
                 ceres_solver_options = {
                   use_nonmonotonic_steps = true,
                   max_num_iterations = 50,
@@ -142,13 +161,13 @@ class SparsePoseGraphTest : public ::testing::Test {
             },
             max_num_final_iterations = 200,
             global_sampling_ratio = 0.01,
+            place_recognition_num_candidates = )text" +
+        std::to_string(place_recognition_num_candidates) + R"text(,
+            place_recognition_max_range = 30.,
           })text");
-      sparse_pose_graph_ = common::make_unique<SparsePoseGraph>(
-          mapping::CreateSparsePoseGraphOptions(parameter_dictionary.get()),
-          &thread_pool_);
-    }
-
-    current_pose_ = transform::Rigid2d::Identity();
+    sparse_pose_graph_ = common::make_unique<SparsePoseGraph>(
+        mapping::CreateSparsePoseGraphOptions(parameter_dictionary.get()),
+        &thread_pool_);
   }
 
   void MoveRelativeWithNoise(const transform::Rigid2d& movement,
@@ -274,6 +293,137 @@ TEST_F(SparsePoseGraphTest, OverlappingScans) {
               ::testing::Lt(error_before.translation().norm()));
 }
 
+TEST_F(SparsePoseGraphTest, ReusedProblemsGiveSameResult) {
+  const auto optimize_overlapping_scans = [this](const bool reuse_problems) {
+    CreateActiveSubmaps();
+    CreateSparsePoseGraph(0 /* place_recognition_num_candidates */,
+                          reuse_problems);
+    current_pose_ = transform::Rigid2d::Identity();
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<double> distribution(-1., 1.);
+    for (int i = 0; i != 5; ++i) {
+      const transform::Rigid2d noise(
+          {0.1 * distribution(rng), 0.1 * distribution(rng)},
+          0.1 * distribution(rng));
+      MoveRelativeWithNoise(
+          transform::Rigid2d({0.15 * distribution(rng), 0.4}, 0.), noise);
+    }
+    sparse_pose_graph_->RunFinalOptimization();
+    return sparse_pose_graph_->GetTrajectoryNodes();
+  };
+  const auto expected_nodes =
+      optimize_overlapping_scans(false /* reuse_problems */);
+  const auto nodes = optimize_overlapping_scans(true /* reuse_problems */);
+  ASSERT_EQ(1, expected_nodes.size());
+  ASSERT_EQ(1, nodes.size());
+  ASSERT_EQ(5, expected_nodes[0].size());
+  ASSERT_EQ(expected_nodes[0].size(), nodes[0].size());
+  for (size_t i = 0; i != nodes[0].size(); ++i) {
+    EXPECT_THAT(nodes[0][i].pose,
+                transform::IsNearly(expected_nodes[0][i].pose, 1e-9))
+        << i;
+  }
+}
+
+TEST_F(SparsePoseGraphTest, ShortlistsLoadedSubmapsForGlobalLocalization) {
+  CreateSparsePoseGraph(1 /* place_recognition_num_candidates */,
+                        false /* reuse_problems */);
+  auto parameter_dictionary = common::MakeDictionary(R"text(
+      return {
+        insert_free_space = true,
+        hit_probability = 0.9,
+        miss_probability = 0.45,
+      })text");
+  const RangeDataInserter range_data_inserter(
+      CreateRangeDataInserterOptions(parameter_dictionary.get()));
+  sensor::PointCloud round_room_point_cloud;
+  for (float t = 0.f; t < 2.f * M_PI; t += 0.005f) {
+    round_room_point_cloud.emplace_back(20.f * std::cos(t), 20.f * std::sin(t),
+                                        0.f);
+  }
+  // A large round room which looks nothing like the scans is loaded first.
+  // Only a single global match is sampled, which has to be spent on the
+  // second submap in which the scans were taken.
+  constexpr int kLoadedTrajectoryId = 1;
+  sparse_pose_graph_->FreezeTrajectory(kLoadedTrajectoryId);
+  const auto add_loaded_submap = [&](const MapLimits& limits,
+                                     const sensor::PointCloud& point_cloud) {
+    Submap submap(limits, Eigen::Vector2f::Zero());
+    submap.InsertRangeData(
+        sensor::RangeData{Eigen::Vector3f::Zero(), point_cloud, {}},
+        range_data_inserter);
+    submap.Finish();
+    mapping::proto::Submap proto;
+    submap.ToProto(&proto);
+    sparse_pose_graph_->AddSubmapFromProto(
+        kLoadedTrajectoryId, transform::Rigid3d::Identity(), proto);
+  };
+  add_loaded_submap(
+      MapLimits(0.1, Eigen::Vector2d(21., 21.), CellLimits(420, 420)),
+      round_room_point_cloud);
+  add_loaded_submap(
+      MapLimits(0.05, Eigen::Vector2d(4., 4.), CellLimits(160, 160)),
+      point_cloud_);
+
+  MoveRelative(transform::Rigid2d::Identity());
+  MoveRelative(transform::Rigid2d::Identity());
+  sparse_pose_graph_->RunFinalOptimization();
+  EXPECT_THAT(sparse_pose_graph_->GetConnectedTrajectories(),
+              ::testing::ElementsAre(::testing::UnorderedElementsAre(
+                  0, kLoadedTrajectoryId)));
+}
+
+TEST_F(SparsePoseGraphTest, LocalToGlobalTransformSnapshotsAreUpdated) {
+  constexpr int kTrajectoryId = 0;
+  constexpr int kLoadedTrajectoryId = 1;
+  // Snapshots are taken before anything is known about the trajectories.
+  const common::SeqLock<transform::Rigid3d>& snapshot =
+      sparse_pose_graph_->GetLocalToGlobalTransformSnapshot(kTrajectoryId);
+  const common::SeqLock<transform::Rigid3d>& loaded_snapshot =
+      sparse_pose_graph_->GetLocalToGlobalTransformSnapshot(
+          kLoadedTrajectoryId);
+
+  sparse_pose_graph_->FreezeTrajectory(kLoadedTrajectoryId);
+  Submap submap(MapLimits(0.05, Eigen::Vector2d(4., 4.), CellLimits(160, 160)),
+                Eigen::Vector2f(0.5f, -0.5f));
+  submap.Finish();
+  mapping::proto::Submap proto;
+  submap.ToProto(&proto);
+  const transform::Rigid3d global_submap_pose(
+      Eigen::Vector3d(1., 2., 0.),
+      transform::AngleAxisVectorToRotationQuaternion(
+          Eigen::Vector3d(0., 0., 0.3)));
+  sparse_pose_graph_->AddSubmapFromProto(kLoadedTrajectoryId,
+                                         global_submap_pose, proto);
+  EXPECT_THAT(loaded_snapshot.Read(),
+              transform::IsNearly(sparse_pose_graph_->GetLocalToGlobalTransform(
+                                      kLoadedTrajectoryId),
+                                  1e-9));
+  EXPECT_THAT(loaded_snapshot.Read(),
+              transform::IsNearly(global_submap_pose *
+                                      submap.local_pose().inverse(),
+                                  1e-9));
+
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<double> distribution(-1., 1.);
+  for (int i = 0; i != 5; ++i) {
+    const transform::Rigid2d noise(
+        {0.1 * distribution(rng), 0.1 * distribution(rng)},
+        0.1 * distribution(rng));
+    MoveRelativeWithNoise(
+        transform::Rigid2d({0.15 * distribution(rng), 0.4}, 0.), noise);
+  }
+  sparse_pose_graph_->RunFinalOptimization();
+  EXPECT_THAT(snapshot.Read(),
+              transform::IsNearly(
+                  sparse_pose_graph_->GetLocalToGlobalTransform(kTrajectoryId),
+                  1e-9));
+  EXPECT_THAT(loaded_snapshot.Read(),
+              transform::IsNearly(sparse_pose_graph_->GetLocalToGlobalTransform(
+                                      kLoadedTrajectoryId),
+                                  1e-9));
+}
+
 }  // namespace
 }  // namespace mapping_2d
 }  // namespace cartographer
@@ -30,6 +30,34 @@
 namespace cartographer {
 namespace mapping_2d {
 
+namespace {
+
+// Writes the value and alpha used for visualization of the cell at 'xy_index'
+// to 'cell[0]' and 'cell[1]'.
+void EncodeCell(const ProbabilityGrid& probability_grid,
+                const Eigen::Array2i& xy_index, char* const cell) {
+  if (probability_grid.IsKnown(xy_index)) {
+    // We would like to add 'delta' but this is not possible using a value and
+    // alpha. We use premultiplied alpha, so when 'delta' is positive we can
+    // add it by setting 'alpha' to zero. If it is negative, we set 'value' to
+    // zero, and use 'alpha' to subtract. This is only correct when the pixel
+    // is currently white, so walls will look too gray. This should be hard to
+    // detect visually for the user, though.
+    const int delta = 128 - mapping::ProbabilityToLogOddsInteger(
+                                probability_grid.GetProbability(xy_index));
+    const uint8 alpha = delta > 0 ? 0 : -delta;
+    const uint8 value = delta > 0 ? delta : 0;
+    cell[0] = value;
+    cell[1] = (value || alpha) ? alpha : 1;
+  } else {
+    constexpr uint8 kUnknownLogOdds = 0;
+    cell[0] = static_cast<uint8>(kUnknownLogOdds);  // value
+    cell[1] = 0;                                    // alpha
+  }
+}
+
+}  // namespace
+
 ProbabilityGrid ComputeCroppedProbabilityGrid(
     const ProbabilityGrid& probability_grid) {
   Eigen::Array2i offset;
@@ -85,60 +113,119 @@ void Submap::ToProto(mapping::proto::Submap* const proto) const {
 void Submap::ToResponseProto(
     const transform::Rigid3d&,
     mapping::proto::SubmapQuery::Response* const response) const {
-  response->set_submap_version(num_range_data());
-
-  Eigen::Array2i offset;
-  CellLimits limits;
-  probability_grid_.ComputeCroppedLimits(&offset, &limits);
-
   string cells;
-  for (const Eigen::Array2i& xy_index : XYIndexRangeIterator(limits)) {
-    if (probability_grid_.IsKnown(xy_index + offset)) {
-      // We would like to add 'delta' but this is not possible using a value and
-      // alpha. We use premultiplied alpha, so when 'delta' is positive we can
-      // add it by setting 'alpha' to zero. If it is negative, we set 'value' to
-      // zero, and use 'alpha' to subtract. This is only correct when the pixel
-      // is currently white, so walls will look too gray. This should be hard to
-      // detect visually for the user, though.
-      const int delta =
-          128 - mapping::ProbabilityToLogOddsInteger(
-                    probability_grid_.GetProbability(xy_index + offset));
-      const uint8 alpha = delta > 0 ? 0 : -delta;
-      const uint8 value = delta > 0 ? delta : 0;
-      cells.push_back(value);
-      cells.push_back((value || alpha) ? alpha : 1);
-    } else {
-      constexpr uint8 kUnknownLogOdds = 0;
-      cells.push_back(static_cast<uint8>(kUnknownLogOdds));  // value
-      cells.push_back(0);                                    // alpha
+  {
+    common::MutexLocker locker(&mutex_);
+    if (cached_response_version_ == num_range_data()) {
+      *response = cached_response_;
+      return;
     }
+    UpdateTextureCells();
+    response->set_submap_version(num_range_data());
+
+    Eigen::Array2i offset;
+    CellLimits limits;
+    probability_grid_.ComputeCroppedLimits(&offset, &limits);
+    const int stride = probability_grid_.limits().cell_limits().num_x_cells;
+    cells.reserve(2 * limits.num_x_cells * limits.num_y_cells);
+    for (int y = 0; y != limits.num_y_cells; ++y) {
+      cells.append(texture_cells_, 2 * (offset.x() + (offset.y() + y) * stride),
+                   2 * limits.num_x_cells);
+    }
+
+    response->set_width(limits.num_x_cells);
+    response->set_height(limits.num_y_cells);
+    const double resolution = probability_grid_.limits().resolution();
+    response->set_resolution(resolution);
+    const double max_x =
+        probability_grid_.limits().max().x() - resolution * offset.y();
+    const double max_y =
+        probability_grid_.limits().max().y() - resolution * offset.x();
+    *response->mutable_slice_pose() = transform::ToProto(
+        local_pose().inverse() *
+        transform::Rigid3d::Translation(Eigen::Vector3d(max_x, max_y, 0.)));
   }
+  // Compression is the most expensive part, so we do it without blocking the
+  // insertion of range data.
   common::FastGzipString(cells, response->mutable_cells());
 
-  response->set_width(limits.num_x_cells);
-  response->set_height(limits.num_y_cells);
-  const double resolution = probability_grid_.limits().resolution();
-  response->set_resolution(resolution);
-  const double max_x =
-      probability_grid_.limits().max().x() - resolution * offset.y();
-  const double max_y =
-      probability_grid_.limits().max().y() - resolution * offset.x();
-  *response->mutable_slice_pose() = transform::ToProto(
-      local_pose().inverse() *
-      transform::Rigid3d::Translation(Eigen::Vector3d(max_x, max_y, 0.)));
+  common::MutexLocker locker(&mutex_);
+  if (response->submap_version() > cached_response_version_) {
+    cached_response_ = *response;
+    cached_response_version_ = response->submap_version();
+  }
+  if (finished_) {
+    // The response will not change anymore.
+    string().swap(texture_cells_);
+  }
+}
+
+void Submap::UpdateTextureCells() const {
+  const CellLimits& cell_limits = probability_grid_.limits().cell_limits();
+  const size_t size = 2 * cell_limits.num_x_cells * cell_limits.num_y_cells;
+  // If the grid changed its size, all cells moved and have to be encoded.
+  const bool encode_all_tiles = texture_cells_.size() != size;
+  if (encode_all_tiles) {
+    texture_cells_.assign(size, 0);
+  }
+  constexpr int kTileSize = 1 << ProbabilityGrid::kTileSizeLog2;
+  const Eigen::Array2i max_xy_index(cell_limits.num_x_cells - 1,
+                                    cell_limits.num_y_cells - 1);
+  for (const Eigen::Array2i& tile_index :
+       XYIndexRangeIterator(probability_grid_.tile_limits())) {
+    if (!encode_all_tiles &&
+        probability_grid_.tile_generation(tile_index) <= texture_generation_) {
+      continue;
+    }
+    const Eigen::Array2i tile_min = kTileSize * tile_index;
+    const Eigen::Array2i tile_max =
+        (tile_min + (kTileSize - 1)).min(max_xy_index);
+    for (const Eigen::Array2i& xy_index :
+         XYIndexRangeIterator(tile_min, tile_max)) {
+      EncodeCell(probability_grid_, xy_index,
+                 &texture_cells_[2 * (xy_index.x() +
+                                      xy_index.y() * cell_limits.num_x_cells)]);
+    }
+  }
+  texture_generation_ = probability_grid_.generation();
+}
+
+std::shared_ptr<const ProbabilityLookupGrid> Submap::probability_lookup_grid()
+    const {
+  common::MutexLocker locker(&mutex_);
+  if (probability_lookup_grid_ != nullptr &&
+      probability_lookup_grid_->generation() ==
+          probability_grid_.generation()) {
+    return probability_lookup_grid_;
+  }
+  // A lookup grid still used by a previous caller must not change underneath
+  // it, so it is only updated in place if nobody else holds it.
+  if (probability_lookup_grid_ == nullptr ||
+      !probability_lookup_grid_.unique() ||
+      !probability_lookup_grid_->Update(probability_grid_)) {
+    probability_lookup_grid_ =
+        std::make_shared<ProbabilityLookupGrid>(probability_grid_);
+  }
+  return probability_lookup_grid_;
 }
 
 void Submap::InsertRangeData(const sensor::RangeData& range_data,
                              const RangeDataInserter& range_data_inserter) {
+  common::MutexLocker locker(&mutex_);
   CHECK(!finished_);
   range_data_inserter.Insert(range_data, &probability_grid_);
   SetNumRangeData(num_range_data() + 1);
 }
 
 void Submap::Finish() {
+  common::MutexLocker locker(&mutex_);
   CHECK(!finished_);
   probability_grid_ = ComputeCroppedProbabilityGrid(probability_grid_);
   finished_ = true;
+  // The cropped grid has a different layout. If there is no cached response
+  // yet, it will be encoded once more from scratch.
+  string().swap(texture_cells_);
+  probability_lookup_grid_.reset();
 }
 
 ActiveSubmaps::ActiveSubmaps(const proto::SubmapsOptions& options)
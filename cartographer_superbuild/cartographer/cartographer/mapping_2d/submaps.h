@@ -22,12 +22,15 @@
 
 #include "Eigen/Core"
 #include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/port.h"
 #include "cartographer/mapping/proto/serialization.pb.h"
 #include "cartographer/mapping/proto/submap_visualization.pb.h"
 #include "cartographer/mapping/submaps.h"
 #include "cartographer/mapping/trajectory_node.h"
 #include "cartographer/mapping_2d/map_limits.h"
 #include "cartographer/mapping_2d/probability_grid.h"
+#include "cartographer/mapping_2d/probability_lookup_grid.h"
 #include "cartographer/mapping_2d/proto/submaps_options.pb.h"
 #include "cartographer/mapping_2d/range_data_inserter.h"
 #include "cartographer/sensor/range_data.h"
@@ -52,6 +55,14 @@ class Submap : public mapping::Submap {
   const ProbabilityGrid& probability_grid() const { return probability_grid_; }
   bool finished() const { return finished_; }
 
+  // Returns a lookup grid for 'probability_grid()' for use by the Ceres scan
+  // matcher. It is brought up to date on each call by copying the modified
+  // tiles only, and computed just once for finished submaps.
+  std::shared_ptr<const ProbabilityLookupGrid> probability_lookup_grid() const;
+
+  // Responses are cached per submap version. Only the tiles of the
+  // probability grid modified since the last call are encoded again, and
+  // finished submaps are encoded only once.
   void ToResponseProto(
       const transform::Rigid3d& global_submap_pose,
       mapping::proto::SubmapQuery::Response* response) const override;
@@ -63,8 +74,30 @@ class Submap : public mapping::Submap {
   void Finish();
 
  private:
+  // Brings 'texture_cells_' up to date with 'probability_grid_' by encoding
+  // all tiles modified after 'texture_generation_'.
+  void UpdateTextureCells() const REQUIRES(mutex_);
+
   ProbabilityGrid probability_grid_;
   bool finished_ = false;
+
+  // Guards the cached visualization below, and 'probability_grid_' against
+  // modification while it is being encoded.
+  mutable common::Mutex mutex_;
+
+  // Value and alpha of every cell of 'probability_grid_' as of
+  // 'texture_generation_'. Empty if nothing has been encoded yet.
+  mutable string texture_cells_ GUARDED_BY(mutex_);
+  mutable uint32 texture_generation_ GUARDED_BY(mutex_) = 0;
+
+  // Last response handed out and the submap version it was computed for.
+  mutable mapping::proto::SubmapQuery::Response cached_response_
+      GUARDED_BY(mutex_);
+  mutable int cached_response_version_ GUARDED_BY(mutex_) = -1;
+
+  // Lazily computed copy of 'probability_grid_' for scan matching.
+  mutable std::shared_ptr<ProbabilityLookupGrid> probability_lookup_grid_
+      GUARDED_BY(mutex_);
 };
 
 // Except during initialization when only a single submap exists, there are
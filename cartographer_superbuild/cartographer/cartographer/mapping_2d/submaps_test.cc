@@ -74,7 +74,7 @@ TEST(SubmapsTest, ToFromProto) {
   expected.ToProto(&proto);
   EXPECT_TRUE(proto.has_submap_2d());
   EXPECT_FALSE(proto.has_submap_3d());
-  const auto actual = Submap(proto.submap_2d());
+  const Submap actual(proto.submap_2d());
   EXPECT_TRUE(expected.local_pose().translation().isApprox(
       actual.local_pose().translation(), 1e-6));
   EXPECT_TRUE(expected.local_pose().rotation().isApprox(
@@ -89,6 +89,48 @@ TEST(SubmapsTest, ToFromProto) {
             actual.probability_grid().limits().cell_limits().num_x_cells);
 }
 
+TEST(SubmapsTest, IncrementalResponseMatchesFullEncoding) {
+  proto::RangeDataInserterOptions range_data_inserter_options;
+  range_data_inserter_options.set_hit_probability(0.7);
+  range_data_inserter_options.set_miss_probability(0.4);
+  range_data_inserter_options.set_insert_free_space(true);
+  const RangeDataInserter range_data_inserter(range_data_inserter_options);
+  Submap submap(
+      MapLimits(0.05, Eigen::Vector2d(2.5, 2.5), CellLimits(100, 100)),
+      Eigen::Vector2f::Zero());
+  for (int i = 0; i != 20; ++i) {
+    // Later range data reach outside of the initial limits to make the grid
+    // grow in between.
+    const float range = 0.5f + 0.2f * i;
+    submap.InsertRangeData(
+        {Eigen::Vector3f(0.1f * i, 0.f, 0.f),
+         {Eigen::Vector3f(range, 0.05f * i, 0.f),
+          Eigen::Vector3f(-0.3f, range, 0.f)},
+         {}},
+        range_data_inserter);
+    mapping::proto::SubmapQuery::Response response;
+    submap.ToResponseProto(transform::Rigid3d::Identity(), &response);
+    mapping::proto::SubmapQuery::Response cached_response;
+    submap.ToResponseProto(transform::Rigid3d::Identity(), &cached_response);
+    EXPECT_EQ(response.SerializeAsString(),
+              cached_response.SerializeAsString());
+
+    mapping::proto::Submap proto;
+    submap.ToProto(&proto);
+    mapping::proto::SubmapQuery::Response expected_response;
+    Submap(proto.submap_2d())
+        .ToResponseProto(transform::Rigid3d::Identity(), &expected_response);
+    EXPECT_EQ(i + 1, response.submap_version());
+    EXPECT_EQ(expected_response.width(), response.width());
+    EXPECT_EQ(expected_response.height(), response.height());
+    string expected_cells;
+    common::FastGunzipString(expected_response.cells(), &expected_cells);
+    string cells;
+    common::FastGunzipString(response.cells(), &cells);
+    EXPECT_EQ(expected_cells, cells);
+  }
+}
+
 }  // namespace
 }  // namespace mapping_2d
 }  // namespace cartographer
@@ -56,8 +56,12 @@ void GlobalTrajectoryBuilder::AddOdometerData(const common::Time time,
   local_trajectory_builder_.AddOdometerData(time, pose);
 }
 
-const GlobalTrajectoryBuilder::PoseEstimate&
-GlobalTrajectoryBuilder::pose_estimate() const {
+void GlobalTrajectoryBuilder::Flush() {
+  // Local SLAM in 3D processes range data when it is added.
+}
+
+GlobalTrajectoryBuilder::PoseEstimate GlobalTrajectoryBuilder::pose_estimate()
+    const {
   return local_trajectory_builder_.pose_estimate();
 }
 
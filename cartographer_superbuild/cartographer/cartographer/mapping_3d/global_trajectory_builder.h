@@ -42,7 +42,8 @@ class GlobalTrajectoryBuilder
                           const sensor::PointCloud& ranges) override;
   void AddOdometerData(common::Time time,
                        const transform::Rigid3d& pose) override;
-  const PoseEstimate& pose_estimate() const override;
+  void Flush() override;
+  PoseEstimate pose_estimate() const override;
 
  private:
   const int trajectory_id_;
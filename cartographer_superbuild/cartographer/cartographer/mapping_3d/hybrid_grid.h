@@ -17,9 +17,11 @@
 #ifndef CARTOGRAPHER_MAPPING_3D_HYBRID_GRID_H_
 #define CARTOGRAPHER_MAPPING_3D_HYBRID_GRID_H_
 
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <limits>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -406,22 +408,324 @@ class DynamicGrid {
   std::vector<std::unique_ptr<WrappedGrid>> meta_cells_;
 };
 
+// A grid storing blocks of '2^kBits' x '2^kBits' x '2^kBits' voxels in an open
+// addressing hash table keyed by block index, i.e. only blocks containing
+// accessed voxels take up memory. Blocks are constructed on first access via
+// 'mutable_value()' and are kept in a dense list for iteration. Each block has
+// a bitmask of the voxels accessed via 'mutable_value()', so that iteration
+// skips unknown voxels without looking at them. Negative indices are allowed.
+template <typename TValueType, int kBits>
+class HashedGrid {
+ public:
+  using ValueType = TValueType;
+
+  HashedGrid() : max_abs_block_index_(0) {}
+  HashedGrid(HashedGrid&&) = default;
+  HashedGrid& operator=(HashedGrid&&) = default;
+
+  // Returns the number of voxels per dimension of the smallest grid centered
+  // at the origin containing all blocks, like DynamicGrid::grid_size().
+  int grid_size() const { return (2 * max_abs_block_index_) << kBits; }
+
+  // Returns the number of allocated blocks.
+  int num_blocks() const { return blocks_.size(); }
+
+  // Returns the value stored at 'index'.
+  ValueType value(const Eigen::Array3i& index) const {
+    const int block_index = FindBlock(GetBlockIndex(index));
+    if (block_index == kNoBlock) {
+      return ValueType();
+    }
+    return blocks_[block_index]->cells[GetFlatInnerIndex(index)];
+  }
+
+  // Returns a pointer to the value at 'index' to allow changing it,
+  // constructing a new block as needed.
+  ValueType* mutable_value(const Eigen::Array3i& index) {
+    const Eigen::Array3i block_index = GetBlockIndex(index);
+    int found_block_index = FindBlock(block_index);
+    if (found_block_index == kNoBlock) {
+      found_block_index = AddBlock(block_index);
+    }
+    Block& block = *blocks_[found_block_index];
+    const int flat_inner_index = GetFlatInnerIndex(index);
+    block.accessed[flat_inner_index / 64] |= uint64{1}
+                                             << (flat_inner_index % 64);
+    return &block.cells[flat_inner_index];
+  }
+
+  // An iterator for iterating over all values not comparing equal to the
+  // default constructed value.
+  class Iterator {
+   public:
+    Iterator() : hashed_grid_(nullptr), block_(0), cell_(0) {}
+
+    explicit Iterator(const HashedGrid& hashed_grid)
+        : hashed_grid_(&hashed_grid), block_(0), cell_(0) {
+      AdvanceToValidCell();
+    }
+
+    void Next() {
+      DCHECK(!Done());
+      ++cell_;
+      AdvanceToValidCell();
+    }
+
+    bool Done() const {
+      return hashed_grid_ == nullptr ||
+             block_ == static_cast<int>(hashed_grid_->blocks_.size());
+    }
+
+    Eigen::Array3i GetCellIndex() const {
+      DCHECK(!Done());
+      return hashed_grid_->block_indices_[block_] * (1 << kBits) +
+             To3DIndex(cell_, kBits);
+    }
+
+    const ValueType& GetValue() const {
+      DCHECK(!Done());
+      return hashed_grid_->blocks_[block_]->cells[cell_];
+    }
+
+    void AdvanceToEnd() {
+      if (hashed_grid_ != nullptr) {
+        block_ = hashed_grid_->blocks_.size();
+        cell_ = 0;
+      }
+    }
+
+    bool operator!=(const Iterator& it) const {
+      return it.block_ != block_ || it.cell_ != cell_;
+    }
+
+   private:
+    // Moves to the first accessed cell at or after the current one which does
+    // not hold the default value.
+    void AdvanceToValidCell() {
+      for (; !Done(); ++block_, cell_ = 0) {
+        const Block& block = *hashed_grid_->blocks_[block_];
+        while (cell_ < kNumCells) {
+          const uint64 accessed = block.accessed[cell_ / 64] >> (cell_ % 64);
+          if (accessed == 0) {
+            // Skips the rest of this word.
+            cell_ = (cell_ / 64 + 1) * 64;
+            continue;
+          }
+          if ((accessed & 1) != 0 && !IsDefaultValue(block.cells[cell_])) {
+            return;
+          }
+          ++cell_;
+        }
+      }
+    }
+
+    const HashedGrid* hashed_grid_;
+    int block_;
+    int cell_;
+  };
+
+ private:
+  static constexpr int kNumCells = 1 << (3 * kBits);
+  static constexpr int kNoBlock = -1;
+
+  struct Block {
+    Block() : cells(), accessed() {}
+
+    std::array<ValueType, kNumCells> cells;
+    // Bit 'i' is set if 'cells[i]' was accessed via 'mutable_value()'.
+    std::array<uint64, (kNumCells + 63) / 64> accessed;
+  };
+
+  static Eigen::Array3i GetBlockIndex(const Eigen::Array3i& index) {
+    // Arithmetic shifts round towards negative infinity.
+    return Eigen::Array3i(index.x() >> kBits, index.y() >> kBits,
+                          index.z() >> kBits);
+  }
+
+  static int GetFlatInnerIndex(const Eigen::Array3i& index) {
+    constexpr int kMask = (1 << kBits) - 1;
+    return ToFlatIndex(
+        Eigen::Array3i(index.x() & kMask, index.y() & kMask, index.z() & kMask),
+        kBits);
+  }
+
+  static size_t Hash(const Eigen::Array3i& block_index) {
+    return (static_cast<size_t>(block_index.x()) * 73856093) ^
+           (static_cast<size_t>(block_index.y()) * 19349663) ^
+           (static_cast<size_t>(block_index.z()) * 83492791);
+  }
+
+  // Returns the position of the block at 'block_index' in 'blocks_', or
+  // 'kNoBlock' if it has not been constructed.
+  int FindBlock(const Eigen::Array3i& block_index) const {
+    if (slots_.empty()) {
+      return kNoBlock;
+    }
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = Hash(block_index) & mask;; slot = (slot + 1) & mask) {
+      const int candidate = slots_[slot];
+      if (candidate == kNoBlock ||
+          (block_indices_[candidate] == block_index).all()) {
+        return candidate;
+      }
+    }
+  }
+
+  // Constructs the block at 'block_index' and returns its position in
+  // 'blocks_'.
+  int AddBlock(const Eigen::Array3i& block_index) {
+    // Keeps the load factor at most 1/2 so that probing stays short.
+    if (2 * (blocks_.size() + 1) > slots_.size()) {
+      Rehash(std::max<size_t>(64, 2 * slots_.size()));
+    }
+    const int new_block_index = blocks_.size();
+    blocks_.push_back(common::make_unique<Block>());
+    block_indices_.push_back(block_index);
+    InsertIntoSlots(new_block_index);
+    max_abs_block_index_ = std::max(
+        max_abs_block_index_,
+        std::max((-block_index).maxCoeff(), block_index.maxCoeff() + 1));
+    return new_block_index;
+  }
+
+  void Rehash(const size_t num_slots) {
+    slots_ = std::vector<int>(num_slots, int{kNoBlock});
+    for (size_t i = 0; i != blocks_.size(); ++i) {
+      InsertIntoSlots(i);
+    }
+  }
+
+  void InsertIntoSlots(const int block_index) {
+    const size_t mask = slots_.size() - 1;
+    size_t slot = Hash(block_indices_[block_index]) & mask;
+    while (slots_[slot] != kNoBlock) {
+      slot = (slot + 1) & mask;
+    }
+    slots_[slot] = block_index;
+  }
+
+  // Open addressing hash table of positions in 'blocks_' with linear probing.
+  // Its size is a power of 2.
+  std::vector<int> slots_;
+  // Dense list of blocks with their block indices, in order of construction.
+  std::vector<std::unique_ptr<Block>> blocks_;
+  std::vector<Eigen::Array3i> block_indices_;
+  // Largest distance in blocks from the origin, see 'grid_size()'.
+  int max_abs_block_index_;
+};
+
 template <typename ValueType>
 using Grid = DynamicGrid<NestedGrid<FlatGrid<ValueType, 3>, 3>>;
 
-// Represents a 3D grid as a wide, shallow tree.
 template <typename ValueType>
-class HybridGridBase : public Grid<ValueType> {
+using SparseGrid = HashedGrid<ValueType, 3>;
+
+// Represents a 3D grid as a wide, shallow tree, or, if selected on
+// construction, as a hash of small dense blocks. The latter uses less memory
+// and is faster to iterate for grids which are mostly empty.
+template <typename TValueType>
+class HybridGridBase {
  public:
-  using Iterator = typename Grid<ValueType>::Iterator;
+  using ValueType = TValueType;
+
+  // An iterator for iterating over all values not comparing equal to the
+  // default constructed value.
+  class Iterator {
+   public:
+    explicit Iterator(const HybridGridBase& hybrid_grid)
+        : use_hashed_storage_(hybrid_grid.use_hashed_storage()),
+          grid_iterator_(hybrid_grid.grid_),
+          sparse_grid_iterator_(
+              use_hashed_storage_
+                  ? typename SparseGrid<ValueType>::Iterator(
+                        *hybrid_grid.sparse_grid_)
+                  : typename SparseGrid<ValueType>::Iterator()) {}
+
+    void Next() {
+      if (use_hashed_storage_) {
+        sparse_grid_iterator_.Next();
+      } else {
+        grid_iterator_.Next();
+      }
+    }
+
+    bool Done() const {
+      return use_hashed_storage_ ? sparse_grid_iterator_.Done()
+                                 : grid_iterator_.Done();
+    }
+
+    Eigen::Array3i GetCellIndex() const {
+      return use_hashed_storage_ ? sparse_grid_iterator_.GetCellIndex()
+                                 : grid_iterator_.GetCellIndex();
+    }
+
+    const ValueType& GetValue() const {
+      return use_hashed_storage_ ? sparse_grid_iterator_.GetValue()
+                                 : grid_iterator_.GetValue();
+    }
+
+    void AdvanceToEnd() {
+      grid_iterator_.AdvanceToEnd();
+      sparse_grid_iterator_.AdvanceToEnd();
+    }
+
+    const std::pair<Eigen::Array3i, ValueType> operator*() const {
+      return std::pair<Eigen::Array3i, ValueType>(GetCellIndex(), GetValue());
+    }
+
+    Iterator& operator++() {
+      Next();
+      return *this;
+    }
+
+    bool operator!=(const Iterator& it) const {
+      return use_hashed_storage_
+                 ? sparse_grid_iterator_ != it.sparse_grid_iterator_
+                 : grid_iterator_ != it.grid_iterator_;
+    }
+
+   private:
+    bool use_hashed_storage_;
+    typename Grid<ValueType>::Iterator grid_iterator_;
+    typename SparseGrid<ValueType>::Iterator sparse_grid_iterator_;
+  };
 
   // Creates a new tree-based probability grid with voxels having edge length
   // 'resolution' around the origin which becomes the center of the cell at
   // index (0, 0, 0).
-  explicit HybridGridBase(const float resolution) : resolution_(resolution) {}
+  explicit HybridGridBase(const float resolution)
+      : HybridGridBase(resolution, false /* use_hashed_storage */) {}
+
+  // Same as above, but if 'use_hashed_storage' is true, voxels are stored in a
+  // hash of blocks instead of a tree.
+  HybridGridBase(const float resolution, const bool use_hashed_storage)
+      : resolution_(resolution),
+        sparse_grid_(use_hashed_storage
+                         ? common::make_unique<SparseGrid<ValueType>>()
+                         : nullptr) {}
 
   float resolution() const { return resolution_; }
 
+  bool use_hashed_storage() const { return sparse_grid_ != nullptr; }
+
+  // Returns the current number of voxels per dimension.
+  int grid_size() const {
+    return use_hashed_storage() ? sparse_grid_->grid_size()
+                                : grid_.grid_size();
+  }
+
+  // Returns the value stored at 'index'.
+  ValueType value(const Eigen::Array3i& index) const {
+    return use_hashed_storage() ? sparse_grid_->value(index)
+                                : grid_.value(index);
+  }
+
+  // Returns a pointer to the value at 'index' to allow changing it.
+  ValueType* mutable_value(const Eigen::Array3i& index) {
+    return use_hashed_storage() ? sparse_grid_->mutable_value(index)
+                                : grid_.mutable_value(index);
+  }
+
   // Returns the index of the cell containing the 'point'. Indices are integer
   // vectors identifying cells, for this the coordinates are rounded to the next
   // multiple of the resolution.
@@ -457,6 +761,9 @@ class HybridGridBase : public Grid<ValueType> {
  private:
   // Edge length of each voxel.
   const float resolution_;
+  // Only one of the two holds values, depending on 'use_hashed_storage()'.
+  Grid<ValueType> grid_;
+  std::unique_ptr<SparseGrid<ValueType>> sparse_grid_;
 };
 
 // A grid containing probability values stored using 15 bits, and an update
@@ -466,6 +773,9 @@ class HybridGrid : public HybridGridBase<uint16> {
   explicit HybridGrid(const float resolution)
       : HybridGridBase<uint16>(resolution) {}
 
+  HybridGrid(const float resolution, const bool use_hashed_storage)
+      : HybridGridBase<uint16>(resolution, use_hashed_storage) {}
+
   explicit HybridGrid(const proto::HybridGrid& proto)
       : HybridGrid(proto.resolution()) {
     CHECK_EQ(proto.values_size(), proto.x_indices_size());
@@ -226,6 +226,45 @@ TEST_F(RandomHybridGridTest, FromProto) {
   EXPECT_EQ(member_map, constructed_map);
 }
 
+TEST_F(RandomHybridGridTest, HashedStorage) {
+  HybridGrid hashed_grid(hybrid_grid_.resolution(),
+                         true /* use_hashed_storage */);
+  EXPECT_TRUE(hashed_grid.use_hashed_storage());
+  for (const auto& pair : values_) {
+    const Eigen::Array3i cell_index(std::get<0>(pair.first),
+                                    std::get<1>(pair.first),
+                                    std::get<2>(pair.first));
+    hashed_grid.SetProbability(cell_index, pair.second);
+    // Accessed, but unknown cells are skipped by iteration.
+    hashed_grid.mutable_value(cell_index + 1);
+  }
+  for (const auto& pair : values_) {
+    const Eigen::Array3i cell_index(std::get<0>(pair.first),
+                                    std::get<1>(pair.first),
+                                    std::get<2>(pair.first));
+    EXPECT_EQ(hybrid_grid_.value(cell_index), hashed_grid.value(cell_index));
+    EXPECT_EQ(hybrid_grid_.value(cell_index + 1),
+              hashed_grid.value(cell_index + 1));
+    EXPECT_TRUE((cell_index >= -hashed_grid.grid_size() / 2).all());
+    EXPECT_TRUE((cell_index < hashed_grid.grid_size() / 2).all());
+  }
+
+  ValueMap hybrid_grid_map;
+  for (const auto i : hybrid_grid_) {
+    hybrid_grid_map[std::make_tuple(i.first.x(), i.first.y(), i.first.z())] =
+        i.second;
+  }
+  ValueMap hashed_grid_map;
+  for (const auto i : hashed_grid) {
+    hashed_grid_map[std::make_tuple(i.first.x(), i.first.y(), i.first.z())] =
+        i.second;
+  }
+  EXPECT_EQ(hybrid_grid_map, hashed_grid_map);
+
+  EXPECT_EQ(hybrid_grid_.ToProto().SerializeAsString(),
+            HybridGrid(hashed_grid.ToProto()).ToProto().SerializeAsString());
+}
+
 }  // namespace
 }  // namespace mapping_3d
 }  // namespace cartographer
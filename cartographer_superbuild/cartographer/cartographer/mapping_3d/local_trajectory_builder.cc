@@ -231,8 +231,8 @@ void LocalTrajectoryBuilder::AddOdometerData(
       {time, odometer_pose, pose_estimate_ * odometry_correction_});
 }
 
-const LocalTrajectoryBuilder::PoseEstimate&
-LocalTrajectoryBuilder::pose_estimate() const {
+LocalTrajectoryBuilder::PoseEstimate LocalTrajectoryBuilder::pose_estimate()
+    const {
   return last_pose_estimate_;
 }
 
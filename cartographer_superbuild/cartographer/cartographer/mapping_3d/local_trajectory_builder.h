@@ -62,7 +62,7 @@ class LocalTrajectoryBuilder {
       const sensor::PointCloud& ranges);
   void AddOdometerData(common::Time time,
                        const transform::Rigid3d& odometer_pose);
-  const PoseEstimate& pose_estimate() const;
+  PoseEstimate pose_estimate() const;
 
  private:
   void Predict(common::Time time);
@@ -18,6 +18,7 @@
 
 #include <memory>
 #include <random>
+#include <string>
 
 #include "Eigen/Core"
 #include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
@@ -44,7 +45,8 @@ class LocalTrajectoryBuilderTest : public ::testing::Test {
 
   void SetUp() override { GenerateBubbles(); }
 
-  proto::LocalTrajectoryBuilderOptions CreateTrajectoryBuilderOptions() {
+  proto::LocalTrajectoryBuilderOptions CreateTrajectoryBuilderOptions(
+      const bool reuse_problems, const bool use_hashed_hybrid_grids) {
     auto parameter_dictionary = common::MakeDictionary(R"text(
         return {
           min_range = 0.5,
@@ -70,6 +72,8 @@ class LocalTrajectoryBuilderTest : public ::testing::Test {
             angular_search_window = math.rad(1.),
             translation_delta_cost_weight = 1e-1,
             rotation_delta_cost_weight = 1.,
+            num_threads = 1,
+            coarse_search_width = 1,
           },
 
           ceres_scan_matcher = {
@@ -78,6 +82,8 @@ class LocalTrajectoryBuilderTest : public ::testing::Test {
             translation_weight = 0.1,
             rotation_weight = 0.3,
             only_optimize_yaw = false,
+            reuse_problems = )text" +
+        std::string(reuse_problems ? "true" : "false") + R"text(,
             ceres_solver_options = {
               use_nonmonotonic_steps = true,
               max_num_iterations = 20,
@@ -99,6 +105,8 @@ class LocalTrajectoryBuilderTest : public ::testing::Test {
             high_resolution_max_range = 50.,
             low_resolution = 0.5,
             num_range_data = 45000,
+            use_hashed_hybrid_grids = )text" +
+        std::string(use_hashed_hybrid_grids ? "true" : "false") + R"text(,
             range_data_inserter = {
               hit_probability = 0.7,
               miss_probability = 0.4,
@@ -255,8 +263,23 @@ class LocalTrajectoryBuilderTest : public ::testing::Test {
 };
 
 TEST_F(LocalTrajectoryBuilderTest, MoveInsideCubeUsingOnlyCeresScanMatcher) {
-  local_trajectory_builder_.reset(
-      new LocalTrajectoryBuilder(CreateTrajectoryBuilderOptions()));
+  local_trajectory_builder_.reset(new LocalTrajectoryBuilder(
+      CreateTrajectoryBuilderOptions(false /* reuse_problems */,
+                                     false /* use_hashed_hybrid_grids */)));
+  VerifyAccuracy(GenerateCorkscrewTrajectory(), 1e-1);
+}
+
+TEST_F(LocalTrajectoryBuilderTest, MoveInsideCubeReusingCeresProblems) {
+  local_trajectory_builder_.reset(new LocalTrajectoryBuilder(
+      CreateTrajectoryBuilderOptions(true /* reuse_problems */,
+                                     false /* use_hashed_hybrid_grids */)));
+  VerifyAccuracy(GenerateCorkscrewTrajectory(), 1e-1);
+}
+
+TEST_F(LocalTrajectoryBuilderTest, MoveInsideCubeUsingHashedHybridGrids) {
+  local_trajectory_builder_.reset(new LocalTrajectoryBuilder(
+      CreateTrajectoryBuilderOptions(false /* reuse_problems */,
+                                     true /* use_hashed_hybrid_grids */)));
   VerifyAccuracy(GenerateCorkscrewTrajectory(), 1e-1);
 }
 
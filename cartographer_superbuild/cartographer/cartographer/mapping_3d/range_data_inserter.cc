@@ -16,6 +16,9 @@
 
 #include "cartographer/mapping_3d/range_data_inserter.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "Eigen/Core"
 #include "cartographer/mapping/probability_values.h"
 #include "glog/logging.h"
@@ -25,14 +28,59 @@ namespace mapping_3d {
 
 namespace {
 
-void InsertMissesIntoGrid(const std::vector<uint16>& miss_table,
-                          const Eigen::Vector3f& origin,
-                          const sensor::PointCloud& returns,
-                          HybridGrid* hybrid_grid,
-                          const int num_free_space_voxels) {
-  const Eigen::Array3i origin_cell = hybrid_grid->GetCellIndex(origin);
+constexpr int kBitsPerCoordinate = 21;
+constexpr int kCoordinateOffset = 1 << (kBitsPerCoordinate - 1);
+constexpr uint64 kCoordinateMask = (uint64{1} << kBitsPerCoordinate) - 1;
+
+// Packs 'cell' into a key so that sorting keys orders cells z-major, i.e. in
+// the order in which they are laid out in a HybridGrid.
+uint64 ToKey(const Eigen::Array3i& cell) {
+  DCHECK(((cell + kCoordinateOffset) >= 0).all() &&
+         ((cell + kCoordinateOffset) < 2 * kCoordinateOffset).all())
+      << cell;
+  return (static_cast<uint64>(cell.z() + kCoordinateOffset)
+          << (2 * kBitsPerCoordinate)) |
+         (static_cast<uint64>(cell.y() + kCoordinateOffset)
+          << kBitsPerCoordinate) |
+         static_cast<uint64>(cell.x() + kCoordinateOffset);
+}
+
+Eigen::Array3i FromKey(const uint64 key) {
+  return Eigen::Array3i(
+      static_cast<int>(key & kCoordinateMask) - kCoordinateOffset,
+      static_cast<int>((key >> kBitsPerCoordinate) & kCoordinateMask) -
+          kCoordinateOffset,
+      static_cast<int>(key >> (2 * kBitsPerCoordinate)) - kCoordinateOffset);
+}
+
+// Applies 'table' once to each distinct cell of 'keys' in memory order. Cells
+// already updated since the last FinishUpdate() are left unchanged. If
+// 'updated_cells' is not nullptr, the distinct cells are appended to it.
+void ApplyLookupTableToCells(const std::vector<uint16>& table,
+                             std::vector<uint64>* const keys,
+                             HybridGrid* const hybrid_grid,
+                             std::vector<Eigen::Array3i>* const updated_cells) {
+  std::sort(keys->begin(), keys->end());
+  keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
+  for (const uint64 key : *keys) {
+    const Eigen::Array3i cell = FromKey(key);
+    hybrid_grid->ApplyLookupTable(cell, table);
+    if (updated_cells != nullptr) {
+      updated_cells->push_back(cell);
+    }
+  }
+}
+
+// Appends the keys of the cells of the last 'num_free_space_voxels' samples
+// on each ray from 'origin' to the 'returns' to 'keys'.
+void AppendMissKeys(const Eigen::Vector3f& origin,
+                    const sensor::PointCloud& returns,
+                    const HybridGrid& hybrid_grid,
+                    const int num_free_space_voxels,
+                    std::vector<uint64>* const keys) {
+  const Eigen::Array3i origin_cell = hybrid_grid.GetCellIndex(origin);
   for (const Eigen::Vector3f& hit : returns) {
-    const Eigen::Array3i hit_cell = hybrid_grid->GetCellIndex(hit);
+    const Eigen::Array3i hit_cell = hybrid_grid.GetCellIndex(hit);
 
     const Eigen::Array3i delta = hit_cell - origin_cell;
     const int num_samples = delta.cwiseAbs().maxCoeff();
@@ -45,9 +93,7 @@ void InsertMissesIntoGrid(const std::vector<uint16>& miss_table,
     // Only the last 'num_free_space_voxels' are updated for performance.
     for (int position = std::max(0, num_samples - num_free_space_voxels);
          position < num_samples; ++position) {
-      const Eigen::Array3i miss_cell =
-          origin_cell + delta * position / num_samples;
-      hybrid_grid->ApplyLookupTable(miss_cell, miss_table);
+      keys->push_back(ToKey(origin_cell + delta * position / num_samples));
     }
   }
 }
@@ -78,17 +124,29 @@ RangeDataInserter::RangeDataInserter(
 
 void RangeDataInserter::Insert(const sensor::RangeData& range_data,
                                HybridGrid* hybrid_grid) const {
+  Insert(range_data, hybrid_grid, nullptr /* updated_cells */);
+}
+
+void RangeDataInserter::Insert(
+    const sensor::RangeData& range_data, HybridGrid* hybrid_grid,
+    std::vector<Eigen::Array3i>* const updated_cells) const {
   CHECK_NOTNULL(hybrid_grid);
 
+  // Rays converge near the origin and returns are often denser than the
+  // voxels, so cells are collected and deduplicated before being updated.
+  std::vector<uint64> keys;
+  keys.reserve(range_data.returns.size());
   for (const Eigen::Vector3f& hit : range_data.returns) {
-    const Eigen::Array3i hit_cell = hybrid_grid->GetCellIndex(hit);
-    hybrid_grid->ApplyLookupTable(hit_cell, hit_table_);
+    keys.push_back(ToKey(hybrid_grid->GetCellIndex(hit)));
   }
+  ApplyLookupTableToCells(hit_table_, &keys, hybrid_grid, updated_cells);
 
   // By not starting a new update after hits are inserted, we give hits priority
   // (i.e. no hits will be ignored because of a miss in the same cell).
-  InsertMissesIntoGrid(miss_table_, range_data.origin, range_data.returns,
-                       hybrid_grid, options_.num_free_space_voxels());
+  keys.clear();
+  AppendMissKeys(range_data.origin, range_data.returns, *hybrid_grid,
+                 options_.num_free_space_voxels(), &keys);
+  ApplyLookupTableToCells(miss_table_, &keys, hybrid_grid, updated_cells);
   hybrid_grid->FinishUpdate();
 }
 
@@ -17,6 +17,9 @@
 #ifndef CARTOGRAPHER_MAPPING_3D_RANGE_DATA_INSERTER_H_
 #define CARTOGRAPHER_MAPPING_3D_RANGE_DATA_INSERTER_H_
 
+#include <vector>
+
+#include "Eigen/Core"
 #include "cartographer/mapping_3d/hybrid_grid.h"
 #include "cartographer/mapping_3d/proto/range_data_inserter_options.pb.h"
 #include "cartographer/sensor/point_cloud.h"
@@ -39,6 +42,11 @@ class RangeDataInserter {
   void Insert(const sensor::RangeData& range_data,
               HybridGrid* hybrid_grid) const;
 
+  // Like above, but also appends the indices of all cells that were updated
+  // to 'updated_cells'. A cell may be appended more than once.
+  void Insert(const sensor::RangeData& range_data, HybridGrid* hybrid_grid,
+              std::vector<Eigen::Array3i>* updated_cells) const;
+
  private:
   const proto::RangeDataInserterOptions options_;
   const std::vector<uint16> hit_table_;
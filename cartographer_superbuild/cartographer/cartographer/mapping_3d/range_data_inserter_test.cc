@@ -16,7 +16,9 @@
 
 #include "cartographer/mapping_3d/range_data_inserter.h"
 
+#include <algorithm>
 #include <memory>
+#include <random>
 #include <vector>
 
 #include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
@@ -59,6 +61,10 @@ class RangeDataInserterTest : public ::testing::Test {
 
   const proto::RangeDataInserterOptions& options() const { return options_; }
 
+  const RangeDataInserter& range_data_inserter() const {
+    return *range_data_inserter_;
+  }
+
  private:
   HybridGrid hybrid_grid_;
   std::unique_ptr<RangeDataInserter> range_data_inserter_;
@@ -102,6 +108,51 @@ TEST_F(RangeDataInserterTest, ProbabilityProgression) {
   EXPECT_NEAR(mapping::kMinProbability, GetProbability(0.f, 0.f, -3.f), 1e-3);
 }
 
+// Inserts 'range_data' ray by ray, updating each sample on its own.
+void InsertRayByRay(const proto::RangeDataInserterOptions& options,
+                    const sensor::RangeData& range_data,
+                    HybridGrid* hybrid_grid) {
+  const std::vector<uint16> hit_table = mapping::ComputeLookupTableToApplyOdds(
+      mapping::Odds(options.hit_probability()));
+  const std::vector<uint16> miss_table = mapping::ComputeLookupTableToApplyOdds(
+      mapping::Odds(options.miss_probability()));
+  for (const Eigen::Vector3f& hit : range_data.returns) {
+    hybrid_grid->ApplyLookupTable(hybrid_grid->GetCellIndex(hit), hit_table);
+  }
+  const Eigen::Array3i origin_cell =
+      hybrid_grid->GetCellIndex(range_data.origin);
+  for (const Eigen::Vector3f& hit : range_data.returns) {
+    const Eigen::Array3i delta = hybrid_grid->GetCellIndex(hit) - origin_cell;
+    const int num_samples = delta.cwiseAbs().maxCoeff();
+    for (int position =
+             std::max(0, num_samples - options.num_free_space_voxels());
+         position < num_samples; ++position) {
+      hybrid_grid->ApplyLookupTable(
+          origin_cell + delta * position / num_samples, miss_table);
+    }
+  }
+  hybrid_grid->FinishUpdate();
+}
+
+TEST_F(RangeDataInserterTest, MatchesRayByRayInsertion) {
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> distribution(-20.f, 20.f);
+  HybridGrid hybrid_grid(0.5f);
+  HybridGrid expected_hybrid_grid(0.5f);
+  for (int i = 0; i != 10; ++i) {
+    sensor::RangeData range_data{
+        Eigen::Vector3f(distribution(rng), distribution(rng), 0.f), {}, {}};
+    for (int j = 0; j != 500; ++j) {
+      range_data.returns.emplace_back(distribution(rng), distribution(rng),
+                                      distribution(rng) / 4.f);
+    }
+    range_data_inserter().Insert(range_data, &hybrid_grid);
+    InsertRayByRay(options(), range_data, &expected_hybrid_grid);
+  }
+  EXPECT_EQ(expected_hybrid_grid.ToProto().SerializeAsString(),
+            hybrid_grid.ToProto().SerializeAsString());
+}
+
 }  // namespace
 }  // namespace mapping_3d
 }  // namespace cartographer
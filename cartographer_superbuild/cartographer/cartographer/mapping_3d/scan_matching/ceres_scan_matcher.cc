@@ -50,6 +50,49 @@ struct YawOnlyQuaternionPlus {
   }
 };
 
+std::unique_ptr<ceres::LocalParameterization> CreateRotationParameterization(
+    const proto::CeresScanMatcherOptions& options) {
+  return options.only_optimize_yaw()
+             ? std::unique_ptr<ceres::LocalParameterization>(
+                   common::make_unique<ceres::AutoDiffLocalParameterization<
+                       YawOnlyQuaternionPlus, 4, 1>>())
+             : std::unique_ptr<ceres::LocalParameterization>(
+                   common::make_unique<ceres::QuaternionParameterization>());
+}
+
+// Automatically differentiated occupied space cost whose number of residuals
+// follows the point cloud it is rebound to.
+class RebindableOccupiedSpaceCostFunction
+    : public ceres::AutoDiffCostFunction<OccupiedSpaceCostFunctor,
+                                         ceres::DYNAMIC, 3, 4> {
+ public:
+  // Takes ownership of 'functor'.
+  RebindableOccupiedSpaceCostFunction(OccupiedSpaceCostFunctor* const functor,
+                                      const int num_residuals)
+      : ceres::AutoDiffCostFunction<OccupiedSpaceCostFunctor, ceres::DYNAMIC,
+                                    3, 4>(functor, num_residuals),
+        occupied_space_cost_functor_(functor) {}
+
+  void Rebind(const double scaling_factor,
+              const sensor::PointCloud& point_cloud,
+              const HybridGrid& hybrid_grid,
+              const transform::Rigid3d& initial_pose_estimate) {
+    occupied_space_cost_functor_->Rebind(scaling_factor, point_cloud,
+                                         hybrid_grid, initial_pose_estimate);
+    set_num_residuals(point_cloud.size());
+  }
+
+ private:
+  OccupiedSpaceCostFunctor* const occupied_space_cost_functor_;
+};
+
+double OccupiedSpaceScalingFactor(const double occupied_space_weight,
+                                  const sensor::PointCloud& point_cloud) {
+  CHECK_GT(occupied_space_weight, 0.);
+  return occupied_space_weight /
+         std::sqrt(static_cast<double>(point_cloud.size()));
+}
+
 }  // namespace
 
 proto::CeresScanMatcherOptions CreateCeresScanMatcherOptions(
@@ -69,6 +112,7 @@ proto::CeresScanMatcherOptions CreateCeresScanMatcherOptions(
       parameter_dictionary->GetDouble("rotation_weight"));
   options.set_only_optimize_yaw(
       parameter_dictionary->GetBool("only_optimize_yaw"));
+  options.set_reuse_problems(parameter_dictionary->GetBool("reuse_problems"));
   *options.mutable_ceres_solver_options() =
       common::CreateCeresSolverOptionsProto(
           parameter_dictionary->GetDictionary("ceres_solver_options").get());
@@ -83,27 +127,72 @@ CeresScanMatcher::CeresScanMatcher(
   ceres_solver_options_.linear_solver_type = ceres::DENSE_QR;
 }
 
+CeresScanMatcher::~CeresScanMatcher() {}
+
+struct CeresScanMatcher::ReusableProblem {
+  explicit ReusableProblem(const proto::CeresScanMatcherOptions& options)
+      : problem(CreateProblemOptions()),
+        rotation_parameterization(CreateRotationParameterization(options)),
+        translation_delta_cost_functor(new TranslationDeltaCostFunctor(
+            options.translation_weight(), transform::Rigid3d::Identity())),
+        rotation_delta_cost_functor(new RotationDeltaCostFunctor(
+            options.rotation_weight(), Eigen::Quaterniond::Identity())),
+        translation_delta_cost_function(
+            common::make_unique<
+                ceres::AutoDiffCostFunction<TranslationDeltaCostFunctor, 3, 3>>(
+                translation_delta_cost_functor)),
+        rotation_delta_cost_function(
+            common::make_unique<
+                ceres::AutoDiffCostFunction<RotationDeltaCostFunctor, 3, 4>>(
+                rotation_delta_cost_functor)) {
+    problem.AddParameterBlock(translation, 3);
+    problem.AddParameterBlock(rotation, 4, rotation_parameterization.get());
+  }
+
+  static ceres::Problem::Options CreateProblemOptions() {
+    ceres::Problem::Options problem_options;
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.local_parameterization_ownership =
+        ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.enable_fast_removal = true;
+    return problem_options;
+  }
+
+  ceres::Problem problem;
+  double translation[3] = {0., 0., 0.};
+  // Rotation quaternion as (w, x, y, z).
+  double rotation[4] = {1., 0., 0., 0.};
+  const std::unique_ptr<ceres::LocalParameterization> rotation_parameterization;
+  // One per point cloud and hybrid grid pair, created on first use.
+  std::vector<std::unique_ptr<RebindableOccupiedSpaceCostFunction>>
+      occupied_space_cost_functions;
+  // Owned by the respective cost functions.
+  TranslationDeltaCostFunctor* const translation_delta_cost_functor;
+  RotationDeltaCostFunctor* const rotation_delta_cost_functor;
+  const std::unique_ptr<ceres::CostFunction> translation_delta_cost_function;
+  const std::unique_ptr<ceres::CostFunction> rotation_delta_cost_function;
+};
+
 void CeresScanMatcher::Match(const transform::Rigid3d& previous_pose,
                              const transform::Rigid3d& initial_pose_estimate,
                              const std::vector<PointCloudAndHybridGridPointers>&
                                  point_clouds_and_hybrid_grids,
                              transform::Rigid3d* const pose_estimate,
                              ceres::Solver::Summary* const summary) {
+  if (options_.reuse_problems()) {
+    MatchWithReusableProblem(previous_pose, initial_pose_estimate,
+                             point_clouds_and_hybrid_grids, pose_estimate,
+                             summary);
+    return;
+  }
   ceres::Problem problem;
   CeresPose ceres_pose(
       initial_pose_estimate, nullptr /* translation_parameterization */,
-      options_.only_optimize_yaw()
-          ? std::unique_ptr<ceres::LocalParameterization>(
-                common::make_unique<ceres::AutoDiffLocalParameterization<
-                    YawOnlyQuaternionPlus, 4, 1>>())
-          : std::unique_ptr<ceres::LocalParameterization>(
-                common::make_unique<ceres::QuaternionParameterization>()),
-      &problem);
+      CreateRotationParameterization(options_), &problem);
 
   CHECK_EQ(options_.occupied_space_weight_size(),
            point_clouds_and_hybrid_grids.size());
   for (size_t i = 0; i != point_clouds_and_hybrid_grids.size(); ++i) {
-    CHECK_GT(options_.occupied_space_weight(i), 0.);
     const sensor::PointCloud& point_cloud =
         *point_clouds_and_hybrid_grids[i].first;
     const HybridGrid& hybrid_grid = *point_clouds_and_hybrid_grids[i].second;
@@ -111,9 +200,9 @@ void CeresScanMatcher::Match(const transform::Rigid3d& previous_pose,
         new ceres::AutoDiffCostFunction<OccupiedSpaceCostFunctor,
                                         ceres::DYNAMIC, 3, 4>(
             new OccupiedSpaceCostFunctor(
-                options_.occupied_space_weight(i) /
-                    std::sqrt(static_cast<double>(point_cloud.size())),
-                point_cloud, hybrid_grid),
+                OccupiedSpaceScalingFactor(options_.occupied_space_weight(i),
+                                           point_cloud),
+                point_cloud, hybrid_grid, initial_pose_estimate),
             point_cloud.size()),
         nullptr, ceres_pose.translation(), ceres_pose.rotation());
   }
@@ -135,6 +224,91 @@ void CeresScanMatcher::Match(const transform::Rigid3d& previous_pose,
   *pose_estimate = ceres_pose.ToRigid();
 }
 
+void CeresScanMatcher::MatchWithReusableProblem(
+    const transform::Rigid3d& previous_pose,
+    const transform::Rigid3d& initial_pose_estimate,
+    const std::vector<PointCloudAndHybridGridPointers>&
+        point_clouds_and_hybrid_grids,
+    transform::Rigid3d* const pose_estimate,
+    ceres::Solver::Summary* const summary) {
+  std::unique_ptr<ReusableProblem> reusable_problem = AcquireProblem();
+  double* const translation = reusable_problem->translation;
+  double* const rotation = reusable_problem->rotation;
+  translation[0] = initial_pose_estimate.translation().x();
+  translation[1] = initial_pose_estimate.translation().y();
+  translation[2] = initial_pose_estimate.translation().z();
+  rotation[0] = initial_pose_estimate.rotation().w();
+  rotation[1] = initial_pose_estimate.rotation().x();
+  rotation[2] = initial_pose_estimate.rotation().y();
+  rotation[3] = initial_pose_estimate.rotation().z();
+
+  ceres::Problem& problem = reusable_problem->problem;
+  std::vector<ceres::ResidualBlockId> residual_block_ids;
+  CHECK_EQ(options_.occupied_space_weight_size(),
+           point_clouds_and_hybrid_grids.size());
+  auto& occupied_space_cost_functions =
+      reusable_problem->occupied_space_cost_functions;
+  for (size_t i = 0; i != point_clouds_and_hybrid_grids.size(); ++i) {
+    const sensor::PointCloud& point_cloud =
+        *point_clouds_and_hybrid_grids[i].first;
+    const HybridGrid& hybrid_grid = *point_clouds_and_hybrid_grids[i].second;
+    const double scaling_factor = OccupiedSpaceScalingFactor(
+        options_.occupied_space_weight(i), point_cloud);
+    if (i == occupied_space_cost_functions.size()) {
+      occupied_space_cost_functions.push_back(
+          common::make_unique<RebindableOccupiedSpaceCostFunction>(
+              new OccupiedSpaceCostFunctor(scaling_factor, point_cloud,
+                                           hybrid_grid, initial_pose_estimate),
+              point_cloud.size()));
+    } else {
+      occupied_space_cost_functions[i]->Rebind(
+          scaling_factor, point_cloud, hybrid_grid, initial_pose_estimate);
+    }
+    residual_block_ids.push_back(
+        problem.AddResidualBlock(occupied_space_cost_functions[i].get(),
+                                 nullptr, translation, rotation));
+  }
+  CHECK_GT(options_.translation_weight(), 0.);
+  reusable_problem->translation_delta_cost_functor->Rebind(previous_pose);
+  residual_block_ids.push_back(problem.AddResidualBlock(
+      reusable_problem->translation_delta_cost_function.get(), nullptr,
+      translation));
+  CHECK_GT(options_.rotation_weight(), 0.);
+  reusable_problem->rotation_delta_cost_functor->Rebind(
+      initial_pose_estimate.rotation());
+  residual_block_ids.push_back(problem.AddResidualBlock(
+      reusable_problem->rotation_delta_cost_function.get(), nullptr,
+      rotation));
+
+  ceres::Solve(ceres_solver_options_, &problem, summary);
+
+  *pose_estimate = transform::Rigid3d(
+      Eigen::Map<const Eigen::Vector3d>(translation),
+      Eigen::Quaterniond(rotation[0], rotation[1], rotation[2], rotation[3]));
+  // The parameter blocks stay, so the problem can be reused as is.
+  for (const ceres::ResidualBlockId residual_block_id : residual_block_ids) {
+    problem.RemoveResidualBlock(residual_block_id);
+  }
+  ReleaseProblem(std::move(reusable_problem));
+}
+
+std::unique_ptr<CeresScanMatcher::ReusableProblem>
+CeresScanMatcher::AcquireProblem() {
+  common::MutexLocker locker(&mutex_);
+  if (idle_problems_.empty()) {
+    return common::make_unique<ReusableProblem>(options_);
+  }
+  std::unique_ptr<ReusableProblem> problem = std::move(idle_problems_.back());
+  idle_problems_.pop_back();
+  return problem;
+}
+
+void CeresScanMatcher::ReleaseProblem(
+    std::unique_ptr<ReusableProblem> problem) {
+  common::MutexLocker locker(&mutex_);
+  idle_problems_.push_back(std::move(problem));
+}
+
 }  // namespace scan_matching
 }  // namespace mapping_3d
 }  // namespace cartographer
@@ -17,11 +17,13 @@
 #ifndef CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_CERES_SCAN_MATCHER_H_
 #define CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_CERES_SCAN_MATCHER_H_
 
+#include <memory>
 #include <utility>
 #include <vector>
 
 #include "Eigen/Core"
 #include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/mutex.h"
 #include "cartographer/mapping_3d/hybrid_grid.h"
 #include "cartographer/mapping_3d/scan_matching/proto/ceres_scan_matcher_options.pb.h"
 #include "cartographer/sensor/point_cloud.h"
@@ -41,6 +43,7 @@ using PointCloudAndHybridGridPointers =
 class CeresScanMatcher {
  public:
   explicit CeresScanMatcher(const proto::CeresScanMatcherOptions& options);
+  ~CeresScanMatcher();
 
   CeresScanMatcher(const CeresScanMatcher&) = delete;
   CeresScanMatcher& operator=(const CeresScanMatcher&) = delete;
@@ -56,8 +59,30 @@ class CeresScanMatcher {
              ceres::Solver::Summary* summary);
 
  private:
+  // A problem whose parameter blocks and cost functions are kept across
+  // matches. Only the point clouds, grids and pose estimates are rebound.
+  struct ReusableProblem;
+
+  // Returns an idle problem, or a new one if all are in use.
+  std::unique_ptr<ReusableProblem> AcquireProblem() EXCLUDES(mutex_);
+  void ReleaseProblem(std::unique_ptr<ReusableProblem> problem)
+      EXCLUDES(mutex_);
+
+  // Same as Match(), but rebinds an idle problem instead of setting up a new
+  // one.
+  void MatchWithReusableProblem(
+      const transform::Rigid3d& previous_pose,
+      const transform::Rigid3d& initial_pose_estimate,
+      const std::vector<PointCloudAndHybridGridPointers>&
+          point_clouds_and_hybrid_grids,
+      transform::Rigid3d* pose_estimate, ceres::Solver::Summary* summary);
+
   const proto::CeresScanMatcherOptions options_;
   ceres::Solver::Options ceres_solver_options_;
+
+  common::Mutex mutex_;
+  std::vector<std::unique_ptr<ReusableProblem>> idle_problems_
+      GUARDED_BY(mutex_);
 };
 
 }  // namespace scan_matching
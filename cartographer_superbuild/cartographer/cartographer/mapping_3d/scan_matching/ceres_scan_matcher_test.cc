@@ -17,6 +17,7 @@
 #include "cartographer/mapping_3d/scan_matching/ceres_scan_matcher.h"
 
 #include <memory>
+#include <string>
 
 #include "Eigen/Core"
 #include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
@@ -47,20 +48,26 @@ class CeresScanMatcherTest : public ::testing::Test {
           hybrid_grid_.GetCellIndex(expected_pose_.cast<float>() * point), 1.);
     }
 
+    options_ = CreateOptions(false /* reuse_problems */);
+    ceres_scan_matcher_.reset(new CeresScanMatcher(options_));
+  }
+
+  proto::CeresScanMatcherOptions CreateOptions(const bool reuse_problems) {
     auto parameter_dictionary = common::MakeDictionary(R"text(
         return {
           occupied_space_weight_0 = 1.,
           translation_weight = 0.01,
           rotation_weight = 0.1,
           only_optimize_yaw = false,
+          reuse_problems = )text" +
+        std::string(reuse_problems ? "true" : "false") + R"text(,
           ceres_solver_options = {
             use_nonmonotonic_steps = true,
             max_num_iterations = 10,
             num_threads = 1,
           },
         })text");
-    options_ = CreateCeresScanMatcherOptions(parameter_dictionary.get());
-    ceres_scan_matcher_.reset(new CeresScanMatcher(options_));
+    return CreateCeresScanMatcherOptions(parameter_dictionary.get());
   }
 
   void TestFromInitialPose(const transform::Rigid3d& initial_pose) {
@@ -115,6 +122,50 @@ TEST_F(CeresScanMatcherTest, FullPoseCorrection) {
                          Eigen::AngleAxisd(0.05, Eigen::Vector3d(1., 0., 0.))));
 }
 
+TEST_F(CeresScanMatcherTest, ReusesProblemAcrossMatches) {
+  ceres_scan_matcher_.reset(
+      new CeresScanMatcher(CreateOptions(true /* reuse_problems */)));
+  TestFromInitialPose(
+      transform::Rigid3d::Translation(Eigen::Vector3d(-0.8, 0., 0.)));
+  // A different number of points changes the number of residuals.
+  point_cloud_.pop_back();
+  TestFromInitialPose(
+      transform::Rigid3d::Translation(Eigen::Vector3d(-1., 0., -0.2)));
+  TestFromInitialPose(
+      transform::Rigid3d::Translation(Eigen::Vector3d(-0.9, -0.2, 0.2)));
+}
+
+TEST_F(CeresScanMatcherTest, ReusedProblemGivesSameResult) {
+  CeresScanMatcher reusing_ceres_scan_matcher(
+      CreateOptions(true /* reuse_problems */));
+  sensor::PointCloud fewer_points = point_cloud_;
+  fewer_points.pop_back();
+  for (const transform::Rigid3d& initial_pose :
+       {transform::Rigid3d::Translation(Eigen::Vector3d(-0.8, 0., 0.)),
+        transform::Rigid3d(
+            Eigen::Vector3d(-1., 0., -0.2),
+            Eigen::Quaterniond(
+                Eigen::AngleAxisd(0.05, Eigen::Vector3d::UnitZ()))),
+        transform::Rigid3d::Translation(Eigen::Vector3d(-0.9, -0.2, 0.2))}) {
+    for (const sensor::PointCloud* point_cloud :
+         {&point_cloud_, &fewer_points}) {
+      transform::Rigid3d expected_pose;
+      ceres::Solver::Summary expected_summary;
+      ceres_scan_matcher_->Match(initial_pose, initial_pose,
+                                 {{point_cloud, &hybrid_grid_}},
+                                 &expected_pose, &expected_summary);
+      transform::Rigid3d pose;
+      ceres::Solver::Summary summary;
+      reusing_ceres_scan_matcher.Match(initial_pose, initial_pose,
+                                       {{point_cloud, &hybrid_grid_}}, &pose,
+                                       &summary);
+      EXPECT_NEAR(expected_summary.initial_cost, summary.initial_cost, 1e-12);
+      EXPECT_NEAR(expected_summary.final_cost, summary.final_cost, 1e-12);
+      EXPECT_THAT(pose, transform::IsNearly(expected_pose, 1e-12));
+    }
+  }
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_3d
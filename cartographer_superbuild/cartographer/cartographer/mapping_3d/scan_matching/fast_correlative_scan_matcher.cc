@@ -20,6 +20,7 @@
 #include <cmath>
 #include <functional>
 #include <limits>
+#include <utility>
 
 #include "Eigen/Geometry"
 #include "cartographer/common/make_unique.h"
@@ -51,18 +52,47 @@ CreateFastCorrelativeScanMatcherOptions(
       parameter_dictionary->GetDouble("linear_z_search_window"));
   options.set_angular_search_window(
       parameter_dictionary->GetDouble("angular_search_window"));
+  options.set_num_threads(parameter_dictionary->GetInt("num_threads"));
+  CHECK_GT(options.num_threads(), 0);
   return options;
 }
 
+uint64 ComputeHybridGridHash(const HybridGrid& hybrid_grid) {
+  // FNV-1a over each cell, summed up over all cells.
+  const auto add_bytes = [](const void* const data, const size_t size,
+                            uint64* const hash) {
+    const unsigned char* const bytes =
+        reinterpret_cast<const unsigned char*>(data);
+    for (size_t i = 0; i != size; ++i) {
+      *hash = (*hash ^ bytes[i]) * 1099511628211ull;
+    }
+  };
+  uint64 hash = 0;
+  for (auto it = HybridGrid::Iterator(hybrid_grid); !it.Done(); it.Next()) {
+    const Eigen::Array3i cell_index = it.GetCellIndex();
+    const uint16 value = it.GetValue();
+    uint64 cell_hash = 14695981039346656037ull;
+    add_bytes(cell_index.data(), 3 * sizeof(int), &cell_hash);
+    add_bytes(&value, sizeof(value), &cell_hash);
+    hash += cell_hash;
+  }
+  const float resolution = hybrid_grid.resolution();
+  add_bytes(&resolution, sizeof(resolution), &hash);
+  return hash;
+}
+
 class PrecomputationGridStack {
  public:
   PrecomputationGridStack(
       const HybridGrid& hybrid_grid,
-      const proto::FastCorrelativeScanMatcherOptions& options) {
+      const proto::FastCorrelativeScanMatcherOptions& options,
+      common::ThreadPool* const thread_pool) {
     CHECK_GE(options.branch_and_bound_depth(), 1);
     CHECK_GE(options.full_resolution_depth(), 1);
     precomputation_grids_.reserve(options.branch_and_bound_depth());
     precomputation_grids_.push_back(ConvertToPrecomputationGrid(hybrid_grid));
+    // Scratch memory shared by all depths.
+    std::vector<PrecomputationGridCell> reusable_cells;
     Eigen::Array3i last_width = Eigen::Array3i::Ones();
     for (int depth = 1; depth != options.branch_and_bound_depth(); ++depth) {
       const bool half_resolution = depth >= options.full_resolution_depth();
@@ -73,12 +103,30 @@ class PrecomputationGridStack {
           (next_width - last_width +
            (full_voxels_per_high_resolution_voxel - 1)) /
           full_voxels_per_high_resolution_voxel;
-      precomputation_grids_.push_back(
-          PrecomputeGrid(precomputation_grids_.back(), half_resolution, shift));
+      precomputation_grids_.push_back(PrecomputeGrid(
+          precomputation_grids_.back(), half_resolution, shift,
+          options.num_threads(), thread_pool, &reusable_cells));
       last_width = next_width;
     }
   }
 
+  explicit PrecomputationGridStack(
+      const proto::PrecomputationGridStack& proto) {
+    CHECK_GE(proto.precomputation_grid_size(), 1);
+    precomputation_grids_.reserve(proto.precomputation_grid_size());
+    for (const mapping_3d::proto::HybridGrid& precomputation_grid_proto :
+         proto.precomputation_grid()) {
+      precomputation_grids_.emplace_back(precomputation_grid_proto);
+    }
+  }
+
+  void ToProto(proto::PrecomputationGridStack* const proto) const {
+    for (const PrecomputationGrid& precomputation_grid :
+         precomputation_grids_) {
+      *proto->add_precomputation_grid() = precomputation_grid.ToProto();
+    }
+  }
+
   const PrecomputationGrid& Get(int depth) const {
     return precomputation_grids_.at(depth);
   }
@@ -91,17 +139,69 @@ class PrecomputationGridStack {
 
 FastCorrelativeScanMatcher::FastCorrelativeScanMatcher(
     const HybridGrid& hybrid_grid,
-    const std::vector<mapping::TrajectoryNode>& nodes,
-    const proto::FastCorrelativeScanMatcherOptions& options)
+    const Eigen::VectorXf& rotational_scan_matcher_histogram,
+    const proto::FastCorrelativeScanMatcherOptions& options,
+    common::ThreadPool* const thread_pool)
+    : options_(options),
+      thread_pool_(thread_pool),
+      hybrid_grid_(hybrid_grid),
+      resolution_(hybrid_grid.resolution()),
+      width_in_voxels_(hybrid_grid.grid_size()),
+      rotational_scan_matcher_(rotational_scan_matcher_histogram) {
+  CHECK_EQ(rotational_scan_matcher_histogram.size(),
+           options_.rotational_histogram_size());
+}
+
+FastCorrelativeScanMatcher::FastCorrelativeScanMatcher(
+    const HybridGrid& hybrid_grid,
+    const proto::PrecomputationGridStack& proto,
+    const proto::FastCorrelativeScanMatcherOptions& options,
+    common::ThreadPool* const thread_pool)
     : options_(options),
+      thread_pool_(thread_pool),
+      hybrid_grid_(hybrid_grid),
       resolution_(hybrid_grid.resolution()),
       width_in_voxels_(hybrid_grid.grid_size()),
+      rotational_scan_matcher_(Eigen::Map<const Eigen::VectorXf>(
+          proto.rotational_scan_matcher_histogram().data(),
+          proto.rotational_scan_matcher_histogram_size())),
+      precomputation_grid_stack_requested_(true),
+      hybrid_grid_hash_(proto.hybrid_grid_hash()),
       precomputation_grid_stack_(
-          common::make_unique<PrecomputationGridStack>(hybrid_grid, options)),
-      rotational_scan_matcher_(nodes, options_.rotational_histogram_size()) {}
+          common::make_unique<PrecomputationGridStack>(proto)) {
+  CHECK_EQ(proto.precomputation_grid_size(), options.branch_and_bound_depth());
+  CHECK_EQ(proto.rotational_scan_matcher_histogram_size(),
+           options_.rotational_histogram_size());
+}
 
 FastCorrelativeScanMatcher::~FastCorrelativeScanMatcher() {}
 
+bool FastCorrelativeScanMatcher::IsUpToDate(
+    const HybridGrid& hybrid_grid,
+    const proto::PrecomputationGridStack& proto,
+    const proto::FastCorrelativeScanMatcherOptions& options) {
+  return proto.precomputation_grid_size() ==
+             options.branch_and_bound_depth() &&
+         proto.rotational_scan_matcher_histogram_size() ==
+             options.rotational_histogram_size() &&
+         proto.hybrid_grid_hash() == ComputeHybridGridHash(hybrid_grid);
+}
+
+proto::PrecomputationGridStack FastCorrelativeScanMatcher::ToProto() const {
+  EnsurePrecomputationGridStack();
+  proto::PrecomputationGridStack result;
+  {
+    common::MutexLocker locker(&mutex_);
+    result.set_hybrid_grid_hash(hybrid_grid_hash_);
+  }
+  precomputation_grid_stack_->ToProto(&result);
+  const Eigen::VectorXf& histogram = rotational_scan_matcher_.histogram();
+  for (int i = 0; i != histogram.size(); ++i) {
+    result.add_rotational_scan_matcher_histogram(histogram[i]);
+  }
+  return result;
+}
+
 bool FastCorrelativeScanMatcher::Match(
     const transform::Rigid3d& initial_pose_estimate,
     const sensor::PointCloud& coarse_point_cloud,
@@ -149,16 +249,28 @@ bool FastCorrelativeScanMatcher::MatchWithSearchParameters(
   CHECK_NOTNULL(score);
   CHECK_NOTNULL(pose_estimate);
 
+  // The rotational scan matcher is cheap and rejects many matches before the
+  // expensive precomputation grids are needed.
+  std::vector<float> angles;
+  std::vector<float> rotational_scores;
+  ComputeRotations(search_parameters, coarse_point_cloud, fine_point_cloud,
+                   initial_pose_estimate.cast<float>(), &angles,
+                   &rotational_scores);
+  if (angles.empty()) {
+    return false;
+  }
+  EnsurePrecomputationGridStack();
+
   const std::vector<DiscreteScan> discrete_scans = GenerateDiscreteScans(
-      search_parameters, coarse_point_cloud, fine_point_cloud,
-      initial_pose_estimate.cast<float>());
+      search_parameters, coarse_point_cloud,
+      initial_pose_estimate.cast<float>(), angles, rotational_scores);
 
   const std::vector<Candidate> lowest_resolution_candidates =
       ComputeLowestResolutionCandidates(search_parameters, discrete_scans);
 
-  const Candidate best_candidate = BranchAndBound(
-      search_parameters, discrete_scans, lowest_resolution_candidates,
-      precomputation_grid_stack_->max_depth(), min_score);
+  const Candidate best_candidate =
+      ParallelBranchAndBound(search_parameters, discrete_scans,
+                             lowest_resolution_candidates, min_score);
   if (best_candidate.score > min_score) {
     *score = best_candidate.score;
     const auto& discrete_scan = discrete_scans[best_candidate.scan_index];
@@ -174,6 +286,26 @@ bool FastCorrelativeScanMatcher::MatchWithSearchParameters(
   return false;
 }
 
+void FastCorrelativeScanMatcher::EnsurePrecomputationGridStack() const {
+  {
+    common::MutexLocker locker(&mutex_);
+    if (precomputation_grid_stack_requested_) {
+      locker.Await([this]() REQUIRES(mutex_) {
+        return precomputation_grid_stack_ != nullptr;
+      });
+      return;
+    }
+    precomputation_grid_stack_requested_ = true;
+  }
+  // Building takes long, so 'mutex_' is not held meanwhile.
+  const uint64 hybrid_grid_hash = ComputeHybridGridHash(hybrid_grid_);
+  auto precomputation_grid_stack = common::make_unique<PrecomputationGridStack>(
+      hybrid_grid_, options_, thread_pool_);
+  common::MutexLocker locker(&mutex_);
+  hybrid_grid_hash_ = hybrid_grid_hash;
+  precomputation_grid_stack_ = std::move(precomputation_grid_stack);
+}
+
 DiscreteScan FastCorrelativeScanMatcher::DiscretizeScan(
     const FastCorrelativeScanMatcher::SearchParameters& search_parameters,
     const sensor::PointCloud& point_cloud, const transform::Rigid3f& pose,
@@ -218,12 +350,12 @@ DiscreteScan FastCorrelativeScanMatcher::DiscretizeScan(
   return DiscreteScan{pose, cell_indices_per_depth, rotational_score};
 }
 
-std::vector<DiscreteScan> FastCorrelativeScanMatcher::GenerateDiscreteScans(
+void FastCorrelativeScanMatcher::ComputeRotations(
     const FastCorrelativeScanMatcher::SearchParameters& search_parameters,
     const sensor::PointCloud& coarse_point_cloud,
     const sensor::PointCloud& fine_point_cloud,
-    const transform::Rigid3f& initial_pose) const {
-  std::vector<DiscreteScan> result;
+    const transform::Rigid3f& initial_pose, std::vector<float>* const angles,
+    std::vector<float>* const rotational_scores) const {
   // We set this value to something on the order of resolution to make sure that
   // the std::acos() below is defined.
   float max_scan_range = 3.f * resolution_;
@@ -239,16 +371,28 @@ std::vector<DiscreteScan> FastCorrelativeScanMatcher::GenerateDiscreteScans(
       search_parameters.angular_search_window / angular_step_size);
   // TODO(whess): Should there be a small search window for rotations around
   // x and y?
-  std::vector<float> angles;
+  std::vector<float> all_angles;
   for (int rz = -angular_window_size; rz <= angular_window_size; ++rz) {
-    angles.push_back(rz * angular_step_size);
+    all_angles.push_back(rz * angular_step_size);
   }
   const std::vector<float> scores = rotational_scan_matcher_.Match(
-      sensor::TransformPointCloud(fine_point_cloud, initial_pose), angles);
-  for (size_t i = 0; i != angles.size(); ++i) {
-    if (scores[i] < options_.min_rotational_score()) {
-      continue;
+      sensor::TransformPointCloud(fine_point_cloud, initial_pose), all_angles);
+  for (size_t i = 0; i != all_angles.size(); ++i) {
+    if (scores[i] >= options_.min_rotational_score()) {
+      angles->push_back(all_angles[i]);
+      rotational_scores->push_back(scores[i]);
     }
+  }
+}
+
+std::vector<DiscreteScan> FastCorrelativeScanMatcher::GenerateDiscreteScans(
+    const FastCorrelativeScanMatcher::SearchParameters& search_parameters,
+    const sensor::PointCloud& coarse_point_cloud,
+    const transform::Rigid3f& initial_pose, const std::vector<float>& angles,
+    const std::vector<float>& rotational_scores) const {
+  CHECK_EQ(angles.size(), rotational_scores.size());
+  std::vector<DiscreteScan> result;
+  for (size_t i = 0; i != angles.size(); ++i) {
     const Eigen::Vector3f angle_axis(0.f, 0.f, angles[i]);
     // It's important to apply the 'angle_axis' rotation between the translation
     // and rotation of the 'initial_pose', so that the rotation is around the
@@ -257,8 +401,8 @@ std::vector<DiscreteScan> FastCorrelativeScanMatcher::GenerateDiscreteScans(
         initial_pose.translation(),
         transform::AngleAxisVectorToRotationQuaternion(angle_axis) *
             initial_pose.rotation());
-    result.push_back(
-        DiscretizeScan(search_parameters, coarse_point_cloud, pose, scores[i]));
+    result.push_back(DiscretizeScan(search_parameters, coarse_point_cloud, pose,
+                                    rotational_scores[i]));
   }
   return result;
 }
@@ -334,11 +478,58 @@ FastCorrelativeScanMatcher::ComputeLowestResolutionCandidates(
   return lowest_resolution_candidates;
 }
 
+Candidate FastCorrelativeScanMatcher::ParallelBranchAndBound(
+    const FastCorrelativeScanMatcher::SearchParameters& search_parameters,
+    const std::vector<DiscreteScan>& discrete_scans,
+    const std::vector<Candidate>& candidates, const float min_score) const {
+  std::atomic<float> best_score(min_score);
+  const int max_depth = precomputation_grid_stack_->max_depth();
+  if (options_.num_threads() == 1 || max_depth == 0) {
+    return BranchAndBound(search_parameters, discrete_scans, candidates,
+                          max_depth, min_score, &best_score);
+  }
+
+  // As in 2D, each thread keeps the first best candidate among those it is
+  // handed out, and ties between threads go to the earliest candidate.
+  Candidate initial_candidate(0, Eigen::Array3i::Zero());
+  initial_candidate.score = min_score;
+  std::vector<Candidate> best_candidates(options_.num_threads(),
+                                         initial_candidate);
+  std::vector<int> best_candidate_indices(options_.num_threads(),
+                                          candidates.size());
+  common::ParallelFor(
+      candidates.size(), options_.num_threads(), thread_pool_,
+      [&](const int thread_index, const int index) {
+        Candidate& best_candidate = best_candidates[thread_index];
+        const Candidate candidate = BranchAndBound(
+            search_parameters, discrete_scans, {candidates[index]}, max_depth,
+            best_candidate.score, &best_score);
+        if (candidate.score > best_candidate.score) {
+          best_candidate = candidate;
+          best_candidate_indices[thread_index] = index;
+        }
+      });
+
+  int best_thread_index = 0;
+  for (int thread_index = 1; thread_index != options_.num_threads();
+       ++thread_index) {
+    const float score = best_candidates[thread_index].score;
+    const float best_thread_score = best_candidates[best_thread_index].score;
+    if (score > best_thread_score ||
+        (score == best_thread_score &&
+         best_candidate_indices[thread_index] <
+             best_candidate_indices[best_thread_index])) {
+      best_thread_index = thread_index;
+    }
+  }
+  return best_candidates[best_thread_index];
+}
+
 Candidate FastCorrelativeScanMatcher::BranchAndBound(
     const FastCorrelativeScanMatcher::SearchParameters& search_parameters,
     const std::vector<DiscreteScan>& discrete_scans,
     const std::vector<Candidate>& candidates, const int candidate_depth,
-    float min_score) const {
+    float min_score, std::atomic<float>* const best_score) const {
   if (candidate_depth == 0) {
     // Return the best candidate.
     return *candidates.begin();
@@ -347,7 +538,7 @@ Candidate FastCorrelativeScanMatcher::BranchAndBound(
   Candidate best_high_resolution_candidate(0, Eigen::Array3i::Zero());
   best_high_resolution_candidate.score = min_score;
   for (const Candidate& candidate : candidates) {
-    if (candidate.score <= min_score) {
+    if (candidate.score <= min_score || candidate.score < best_score->load()) {
       break;
     }
     std::vector<Candidate> higher_resolution_candidates;
@@ -377,7 +568,8 @@ Candidate FastCorrelativeScanMatcher::BranchAndBound(
         best_high_resolution_candidate,
         BranchAndBound(search_parameters, discrete_scans,
                        higher_resolution_candidates, candidate_depth - 1,
-                       best_high_resolution_candidate.score));
+                       best_high_resolution_candidate.score, best_score));
+    common::UpdateMaximum(best_score, best_high_resolution_candidate.score);
   }
   return best_high_resolution_candidate;
 }
@@ -20,15 +20,18 @@
 #ifndef CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_FAST_CORRELATIVE_SCAN_MATCHER_H_
 #define CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_FAST_CORRELATIVE_SCAN_MATCHER_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
 #include "Eigen/Core"
+#include "cartographer/common/mutex.h"
 #include "cartographer/common/port.h"
-#include "cartographer/mapping/trajectory_node.h"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/mapping_2d/scan_matching/fast_correlative_scan_matcher.h"
 #include "cartographer/mapping_3d/hybrid_grid.h"
 #include "cartographer/mapping_3d/scan_matching/proto/fast_correlative_scan_matcher_options.pb.h"
+#include "cartographer/mapping_3d/scan_matching/proto/precomputation_grid.pb.h"
 #include "cartographer/mapping_3d/scan_matching/rotational_scan_matcher.h"
 #include "cartographer/sensor/point_cloud.h"
 
@@ -40,6 +43,11 @@ proto::FastCorrelativeScanMatcherOptions
 CreateFastCorrelativeScanMatcherOptions(
     common::LuaParameterDictionary* parameter_dictionary);
 
+// Returns a hash of the resolution and cells of 'hybrid_grid', used to detect
+// serialized precomputation grids which are stale. It does not depend on the
+// order in which cells were added.
+uint64 ComputeHybridGridHash(const HybridGrid& hybrid_grid);
+
 class PrecomputationGridStack;
 
 struct DiscreteScan {
@@ -70,10 +78,29 @@ struct Candidate {
 
 class FastCorrelativeScanMatcher {
  public:
+  // The 'rotational_scan_matcher_histogram' is that of the scans which make up
+  // the 'hybrid_grid', see RotationalScanMatcher::ComputeHistogram(). The
+  // 'thread_pool' runs all but one of the 'num_threads' threads of a match,
+  // and of the construction of each precomputation grid. It may be nullptr if
+  // 'num_threads' is 1.
+  //
+  // The precomputation grids are only built by the first match which passes
+  // the rotational scan matcher, or by ToProto(). The 'hybrid_grid' must stay
+  // valid and unchanged until then.
   FastCorrelativeScanMatcher(
       const HybridGrid& hybrid_grid,
-      const std::vector<mapping::TrajectoryNode>& nodes,
-      const proto::FastCorrelativeScanMatcherOptions& options);
+      const Eigen::VectorXf& rotational_scan_matcher_histogram,
+      const proto::FastCorrelativeScanMatcherOptions& options,
+      common::ThreadPool* thread_pool);
+  // Restores the scan matcher for 'hybrid_grid' from precomputation grids
+  // serialized by ToProto(), which is much faster than computing them. The
+  // 'proto' must have been serialized for the same 'hybrid_grid' and
+  // 'branch_and_bound_depth', see IsUpToDate().
+  FastCorrelativeScanMatcher(
+      const HybridGrid& hybrid_grid,
+      const proto::PrecomputationGridStack& proto,
+      const proto::FastCorrelativeScanMatcherOptions& options,
+      common::ThreadPool* thread_pool);
   ~FastCorrelativeScanMatcher();
 
   FastCorrelativeScanMatcher(const FastCorrelativeScanMatcher&) = delete;
@@ -104,6 +131,16 @@ class FastCorrelativeScanMatcher {
                        transform::Rigid3d* pose_estimate,
                        float* rotational_score) const;
 
+  // Returns true if 'proto' can be used to restore the scan matcher for
+  // 'hybrid_grid' with 'options'.
+  static bool IsUpToDate(
+      const HybridGrid& hybrid_grid,
+      const proto::PrecomputationGridStack& proto,
+      const proto::FastCorrelativeScanMatcherOptions& options);
+
+  // Builds the precomputation grids if no match needed them yet.
+  proto::PrecomputationGridStack ToProto() const;
+
  private:
   struct SearchParameters {
     const int linear_xy_window_size;     // voxels
@@ -117,15 +154,28 @@ class FastCorrelativeScanMatcher {
       const sensor::PointCloud& coarse_point_cloud,
       const sensor::PointCloud& fine_point_cloud, float min_score, float* score,
       transform::Rigid3d* pose_estimate, float* rotational_score) const;
+  // Builds the precomputation grids on first use. They are built without
+  // holding 'mutex_' by the first caller, while concurrent callers wait for it
+  // to finish, so they are only built once.
+  void EnsurePrecomputationGridStack() const EXCLUDES(mutex_);
   DiscreteScan DiscretizeScan(const SearchParameters& search_parameters,
                               const sensor::PointCloud& point_cloud,
                               const transform::Rigid3f& pose,
                               float rotational_score) const;
+  // Computes the rotations around the z axis in the search window and their
+  // rotational scores, keeping only those reaching the minimum rotational
+  // score. This does not need the precomputation grids.
+  void ComputeRotations(const SearchParameters& search_parameters,
+                        const sensor::PointCloud& coarse_point_cloud,
+                        const sensor::PointCloud& fine_point_cloud,
+                        const transform::Rigid3f& initial_pose,
+                        std::vector<float>* angles,
+                        std::vector<float>* rotational_scores) const;
   std::vector<DiscreteScan> GenerateDiscreteScans(
       const SearchParameters& search_parameters,
       const sensor::PointCloud& coarse_point_cloud,
-      const sensor::PointCloud& fine_point_cloud,
-      const transform::Rigid3f& initial_pose) const;
+      const transform::Rigid3f& initial_pose, const std::vector<float>& angles,
+      const std::vector<float>& rotational_scores) const;
   std::vector<Candidate> GenerateLowestResolutionCandidates(
       const SearchParameters& search_parameters, int num_discrete_scans) const;
   void ScoreCandidates(int depth,
@@ -134,16 +184,35 @@ class FastCorrelativeScanMatcher {
   std::vector<Candidate> ComputeLowestResolutionCandidates(
       const SearchParameters& search_parameters,
       const std::vector<DiscreteScan>& discrete_scans) const;
+  // Searches the lowest resolution 'candidates' with 'num_threads' threads.
+  // Returns the same candidate as the sequential BranchAndBound().
+  Candidate ParallelBranchAndBound(
+      const SearchParameters& search_parameters,
+      const std::vector<DiscreteScan>& discrete_scans,
+      const std::vector<Candidate>& candidates, float min_score) const;
+  // Candidates are pruned if their score is at most 'min_score', or below
+  // 'best_score', which is the best score found so far by any thread.
   Candidate BranchAndBound(const SearchParameters& search_parameters,
                            const std::vector<DiscreteScan>& discrete_scans,
                            const std::vector<Candidate>& candidates,
-                           int candidate_depth, float min_score) const;
+                           int candidate_depth, float min_score,
+                           std::atomic<float>* best_score) const;
 
   const proto::FastCorrelativeScanMatcherOptions options_;
+  common::ThreadPool* const thread_pool_;
+  const HybridGrid& hybrid_grid_;
   const float resolution_;
   const int width_in_voxels_;
-  std::unique_ptr<PrecomputationGridStack> precomputation_grid_stack_;
   RotationalScanMatcher rotational_scan_matcher_;
+
+  mutable common::Mutex mutex_;
+  // Set when the first caller starts building the precomputation grids.
+  mutable bool precomputation_grid_stack_requested_ GUARDED_BY(mutex_) = false;
+  // Set together with the precomputation grids.
+  mutable uint64 hybrid_grid_hash_ GUARDED_BY(mutex_) = 0;
+  // Set once while holding 'mutex_' and never changed afterwards, so it may be
+  // read without holding 'mutex_' after EnsurePrecomputationGridStack().
+  mutable std::unique_ptr<PrecomputationGridStack> precomputation_grid_stack_;
 };
 
 }  // namespace scan_matching
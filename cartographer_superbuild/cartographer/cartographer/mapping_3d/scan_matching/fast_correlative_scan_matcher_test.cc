@@ -22,6 +22,8 @@
 #include <string>
 
 #include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/mapping_3d/range_data_inserter.h"
 #include "cartographer/transform/rigid_transform_test_helpers.h"
 #include "cartographer/transform/transform.h"
@@ -47,6 +49,7 @@ CreateFastCorrelativeScanMatcherTestOptions(const int branch_and_bound_depth) {
       "linear_xy_search_window = 0.8, "
       "linear_z_search_window = 0.8, "
       "angular_search_window = 0.3, "
+      "num_threads = 1, "
       "}");
   return CreateFastCorrelativeScanMatcherOptions(parameter_dictionary.get());
 }
@@ -62,6 +65,28 @@ CreateRangeDataInserterTestOptions() {
   return CreateRangeDataInserterOptions(parameter_dictionary.get());
 }
 
+sensor::PointCloud CreateTestPointCloud() {
+  return {Eigen::Vector3f(4.f, 0.f, 0.f), Eigen::Vector3f(4.5f, 0.f, 0.f),
+          Eigen::Vector3f(5.f, 0.f, 0.f), Eigen::Vector3f(5.5f, 0.f, 0.f),
+          Eigen::Vector3f(0.f, 4.f, 0.f), Eigen::Vector3f(0.f, 4.5f, 0.f),
+          Eigen::Vector3f(0.f, 5.f, 0.f), Eigen::Vector3f(0.f, 5.5f, 0.f),
+          Eigen::Vector3f(0.f, 0.f, 4.f), Eigen::Vector3f(0.f, 0.f, 4.5f),
+          Eigen::Vector3f(0.f, 0.f, 5.f), Eigen::Vector3f(0.f, 0.f, 5.5f)};
+}
+
+// Inserts 'point_cloud' observed from 'pose' into 'hybrid_grid'.
+void InsertPointCloud(const sensor::PointCloud& point_cloud,
+                      const transform::Rigid3f& pose,
+                      HybridGrid* const hybrid_grid) {
+  RangeDataInserter range_data_inserter(CreateRangeDataInserterTestOptions());
+  range_data_inserter.Insert(
+      sensor::RangeData{pose.translation(),
+                        sensor::TransformPointCloud(point_cloud, pose),
+                        {}},
+      hybrid_grid);
+  hybrid_grid->FinishUpdate();
+}
+
 TEST(FastCorrelativeScanMatcherTest, CorrectPose) {
   std::mt19937 prng(42);
   std::uniform_real_distribution<float> distribution(-1.f, 1.f);
@@ -96,8 +121,12 @@ TEST(FastCorrelativeScanMatcherTest, CorrectPose) {
         &hybrid_grid);
     hybrid_grid.FinishUpdate();
 
-    FastCorrelativeScanMatcher fast_correlative_scan_matcher(hybrid_grid, {},
-                                                             options);
+    FastCorrelativeScanMatcher fast_correlative_scan_matcher(
+        hybrid_grid,
+        RotationalScanMatcher::ComputeHistogram(
+            sensor::TransformPointCloud(point_cloud, expected_pose),
+            options.rotational_histogram_size()),
+        options, nullptr /* thread_pool */);
     float score = 0.f;
     transform::Rigid3d pose_estimate;
     float rotational_score = 0.f;
@@ -113,6 +142,231 @@ TEST(FastCorrelativeScanMatcherTest, CorrectPose) {
   }
 }
 
+TEST(FastCorrelativeScanMatcherTest, ParallelMatchingGivesSameResult) {
+  std::mt19937 prng(42);
+  std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+  RangeDataInserter range_data_inserter(CreateRangeDataInserterTestOptions());
+  constexpr float kMinScore = 0.1f;
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(5);
+  auto parallel_options = options;
+  parallel_options.set_num_threads(4);
+  // Declared before the thread pool, so that its threads are joined before
+  // they can no longer notify the mutex.
+  common::Mutex mutex;
+  int num_matched_in_thread_pool = 0;
+  common::ThreadPool thread_pool(3);
+
+  const sensor::PointCloud point_cloud{
+      Eigen::Vector3f(4.f, 0.f, 0.f), Eigen::Vector3f(4.5f, 0.f, 0.f),
+      Eigen::Vector3f(5.f, 0.f, 0.f), Eigen::Vector3f(5.5f, 0.f, 0.f),
+      Eigen::Vector3f(0.f, 4.f, 0.f), Eigen::Vector3f(0.f, 4.5f, 0.f),
+      Eigen::Vector3f(0.f, 5.f, 0.f), Eigen::Vector3f(0.f, 5.5f, 0.f),
+      Eigen::Vector3f(0.f, 0.f, 4.f), Eigen::Vector3f(0.f, 0.f, 4.5f),
+      Eigen::Vector3f(0.f, 0.f, 5.f), Eigen::Vector3f(0.f, 0.f, 5.5f)};
+
+  for (int i = 0; i != 5; ++i) {
+    const transform::Rigid3f expected_pose =
+        transform::Rigid3f::Translation(
+            Eigen::Vector3f(0.7f * distribution(prng),
+                            0.7f * distribution(prng),
+                            0.7f * distribution(prng))) *
+        transform::Rigid3f::Rotation(Eigen::AngleAxisf(
+            0.2f * distribution(prng), Eigen::Vector3f::UnitZ()));
+    HybridGrid hybrid_grid(0.05f);
+    range_data_inserter.Insert(
+        sensor::RangeData{
+            expected_pose.translation(),
+            sensor::TransformPointCloud(point_cloud, expected_pose),
+            {}},
+        &hybrid_grid);
+    hybrid_grid.FinishUpdate();
+    const Eigen::VectorXf histogram = RotationalScanMatcher::ComputeHistogram(
+        sensor::TransformPointCloud(point_cloud, expected_pose),
+        options.rotational_histogram_size());
+
+    const FastCorrelativeScanMatcher fast_correlative_scan_matcher(
+        hybrid_grid, histogram, options, nullptr /* thread_pool */);
+    const FastCorrelativeScanMatcher parallel_fast_correlative_scan_matcher(
+        hybrid_grid, histogram, parallel_options, &thread_pool);
+    float score = 0.f;
+    float parallel_score = 0.f;
+    transform::Rigid3d pose_estimate;
+    transform::Rigid3d parallel_pose_estimate;
+    float rotational_score = 0.f;
+    float parallel_rotational_score = 0.f;
+    EXPECT_TRUE(fast_correlative_scan_matcher.Match(
+        transform::Rigid3d::Identity(), point_cloud, point_cloud, kMinScore,
+        &score, &pose_estimate, &rotational_score));
+    EXPECT_TRUE(parallel_fast_correlative_scan_matcher.Match(
+        transform::Rigid3d::Identity(), point_cloud, point_cloud, kMinScore,
+        &parallel_score, &parallel_pose_estimate, &parallel_rotational_score));
+    EXPECT_EQ(score, parallel_score);
+    EXPECT_EQ(rotational_score, parallel_rotational_score);
+    EXPECT_THAT(parallel_pose_estimate,
+                transform::IsNearly(pose_estimate, 1e-9));
+
+    EXPECT_TRUE(fast_correlative_scan_matcher.MatchFullSubmap(
+        Eigen::Quaterniond::Identity(), point_cloud, point_cloud, kMinScore,
+        &score, &pose_estimate, &rotational_score));
+    // The constraint builder matches from within work items of the same
+    // thread pool, so the other threads may be busy.
+    thread_pool.Schedule([&]() {
+      EXPECT_TRUE(parallel_fast_correlative_scan_matcher.MatchFullSubmap(
+          Eigen::Quaterniond::Identity(), point_cloud, point_cloud, kMinScore,
+          &parallel_score, &parallel_pose_estimate,
+          &parallel_rotational_score));
+      common::MutexLocker locker(&mutex);
+      ++num_matched_in_thread_pool;
+    });
+    {
+      common::MutexLocker locker(&mutex);
+      locker.Await([&num_matched_in_thread_pool, i]() {
+        return num_matched_in_thread_pool == i + 1;
+      });
+    }
+    EXPECT_EQ(score, parallel_score);
+    EXPECT_EQ(rotational_score, parallel_rotational_score);
+    EXPECT_THAT(parallel_pose_estimate,
+                transform::IsNearly(pose_estimate, 1e-9));
+  }
+}
+
+TEST(FastCorrelativeScanMatcherTest, RestoredFromProto) {
+  RangeDataInserter range_data_inserter(CreateRangeDataInserterTestOptions());
+  constexpr float kMinScore = 0.1f;
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(5);
+
+  const sensor::PointCloud point_cloud{
+      Eigen::Vector3f(4.f, 0.f, 0.f), Eigen::Vector3f(4.5f, 0.f, 0.f),
+      Eigen::Vector3f(5.f, 0.f, 0.f), Eigen::Vector3f(5.5f, 0.f, 0.f),
+      Eigen::Vector3f(0.f, 4.f, 0.f), Eigen::Vector3f(0.f, 4.5f, 0.f),
+      Eigen::Vector3f(0.f, 5.f, 0.f), Eigen::Vector3f(0.f, 5.5f, 0.f),
+      Eigen::Vector3f(0.f, 0.f, 4.f), Eigen::Vector3f(0.f, 0.f, 4.5f),
+      Eigen::Vector3f(0.f, 0.f, 5.f), Eigen::Vector3f(0.f, 0.f, 5.5f)};
+  const transform::Rigid3f expected_pose =
+      transform::Rigid3f::Translation(Eigen::Vector3f(0.3f, -0.2f, 0.1f)) *
+      transform::Rigid3f::Rotation(
+          Eigen::AngleAxisf(0.1f, Eigen::Vector3f::UnitZ()));
+  HybridGrid hybrid_grid(0.05f);
+  range_data_inserter.Insert(
+      sensor::RangeData{expected_pose.translation(),
+                        sensor::TransformPointCloud(point_cloud, expected_pose),
+                        {}},
+      &hybrid_grid);
+  hybrid_grid.FinishUpdate();
+  const Eigen::VectorXf histogram = RotationalScanMatcher::ComputeHistogram(
+      sensor::TransformPointCloud(point_cloud, expected_pose),
+      options.rotational_histogram_size());
+
+  const FastCorrelativeScanMatcher fast_correlative_scan_matcher(
+      hybrid_grid, histogram, options, nullptr /* thread_pool */);
+  const proto::PrecomputationGridStack proto =
+      fast_correlative_scan_matcher.ToProto();
+  ASSERT_EQ(options.branch_and_bound_depth(),
+            proto.precomputation_grid_size());
+  EXPECT_TRUE(
+      FastCorrelativeScanMatcher::IsUpToDate(hybrid_grid, proto, options));
+  EXPECT_FALSE(FastCorrelativeScanMatcher::IsUpToDate(
+      hybrid_grid, proto, CreateFastCorrelativeScanMatcherTestOptions(4)));
+
+  // Precomputation grids built in parallel are the same.
+  auto parallel_options = options;
+  parallel_options.set_num_threads(3);
+  common::ThreadPool thread_pool(2);
+  const FastCorrelativeScanMatcher parallel_fast_correlative_scan_matcher(
+      hybrid_grid, histogram, parallel_options, &thread_pool);
+  EXPECT_EQ(
+      proto.SerializeAsString(),
+      parallel_fast_correlative_scan_matcher.ToProto().SerializeAsString());
+
+  const FastCorrelativeScanMatcher restored_fast_correlative_scan_matcher(
+      hybrid_grid, proto, options, nullptr /* thread_pool */);
+  float score = 0.f;
+  float restored_score = 0.f;
+  transform::Rigid3d pose_estimate;
+  transform::Rigid3d restored_pose_estimate;
+  float rotational_score = 0.f;
+  float restored_rotational_score = 0.f;
+  EXPECT_TRUE(fast_correlative_scan_matcher.Match(
+      transform::Rigid3d::Identity(), point_cloud, point_cloud, kMinScore,
+      &score, &pose_estimate, &rotational_score));
+  EXPECT_TRUE(restored_fast_correlative_scan_matcher.Match(
+      transform::Rigid3d::Identity(), point_cloud, point_cloud, kMinScore,
+      &restored_score, &restored_pose_estimate, &restored_rotational_score));
+  EXPECT_EQ(score, restored_score);
+  EXPECT_EQ(rotational_score, restored_rotational_score);
+  EXPECT_THAT(restored_pose_estimate,
+              transform::IsNearly(pose_estimate, 1e-9));
+
+  // Changing the hybrid grid makes the serialized grids stale.
+  hybrid_grid.SetProbability(Eigen::Array3i(10, 10, 10), 0.9f);
+  EXPECT_FALSE(
+      FastCorrelativeScanMatcher::IsUpToDate(hybrid_grid, proto, options));
+}
+
+TEST(FastCorrelativeScanMatcherTest, RotationalMismatchSkipsPrecomputation) {
+  constexpr float kMinScore = 0.1f;
+  auto options = CreateFastCorrelativeScanMatcherTestOptions(5);
+  // Rotational scores are at most 1, so all matches are rejected by the
+  // rotational scan matcher.
+  options.set_min_rotational_score(1.1f);
+  const sensor::PointCloud point_cloud = CreateTestPointCloud();
+  HybridGrid hybrid_grid(0.05f);
+  InsertPointCloud(point_cloud, transform::Rigid3f::Identity(), &hybrid_grid);
+
+  const FastCorrelativeScanMatcher fast_correlative_scan_matcher(
+      hybrid_grid,
+      RotationalScanMatcher::ComputeHistogram(
+          point_cloud, options.rotational_histogram_size()),
+      options, nullptr /* thread_pool */);
+  float score = 0.f;
+  transform::Rigid3d pose_estimate;
+  float rotational_score = 0.f;
+  EXPECT_FALSE(fast_correlative_scan_matcher.Match(
+      transform::Rigid3d::Identity(), point_cloud, point_cloud, kMinScore,
+      &score, &pose_estimate, &rotational_score));
+  EXPECT_FALSE(fast_correlative_scan_matcher.MatchFullSubmap(
+      Eigen::Quaterniond::Identity(), point_cloud, point_cloud, kMinScore,
+      &score, &pose_estimate, &rotational_score));
+
+  // The precomputation grids have not been built by the rejected matches, so
+  // they are built from the hybrid grid as it is now.
+  hybrid_grid.SetProbability(Eigen::Array3i(10, 10, 10), 0.9f);
+  EXPECT_TRUE(FastCorrelativeScanMatcher::IsUpToDate(
+      hybrid_grid, fast_correlative_scan_matcher.ToProto(), options));
+}
+
+TEST(FastCorrelativeScanMatcherTest, ToProtoWithoutMatchGivesSameGrids) {
+  constexpr float kMinScore = 0.1f;
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(5);
+  const sensor::PointCloud point_cloud = CreateTestPointCloud();
+  const transform::Rigid3f expected_pose =
+      transform::Rigid3f::Translation(Eigen::Vector3f(-0.2f, 0.1f, 0.2f)) *
+      transform::Rigid3f::Rotation(
+          Eigen::AngleAxisf(-0.1f, Eigen::Vector3f::UnitZ()));
+  HybridGrid hybrid_grid(0.05f);
+  InsertPointCloud(point_cloud, expected_pose, &hybrid_grid);
+  const Eigen::VectorXf histogram = RotationalScanMatcher::ComputeHistogram(
+      sensor::TransformPointCloud(point_cloud, expected_pose),
+      options.rotational_histogram_size());
+
+  // The precomputation grids of this scan matcher are built by a match.
+  const FastCorrelativeScanMatcher matched_fast_correlative_scan_matcher(
+      hybrid_grid, histogram, options, nullptr /* thread_pool */);
+  float score = 0.f;
+  transform::Rigid3d pose_estimate;
+  float rotational_score = 0.f;
+  EXPECT_TRUE(matched_fast_correlative_scan_matcher.Match(
+      transform::Rigid3d::Identity(), point_cloud, point_cloud, kMinScore,
+      &score, &pose_estimate, &rotational_score));
+
+  const FastCorrelativeScanMatcher fast_correlative_scan_matcher(
+      hybrid_grid, histogram, options, nullptr /* thread_pool */);
+  EXPECT_EQ(
+      matched_fast_correlative_scan_matcher.ToProto().SerializeAsString(),
+      fast_correlative_scan_matcher.ToProto().SerializeAsString());
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_3d
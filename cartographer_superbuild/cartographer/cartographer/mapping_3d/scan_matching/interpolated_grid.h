@@ -17,6 +17,7 @@
 #ifndef CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_INTERPOLATED_GRID_H_
 #define CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_INTERPOLATED_GRID_H_
 
+#include <array>
 #include <cmath>
 
 #include "cartographer/mapping_3d/hybrid_grid.h"
@@ -35,11 +36,19 @@ namespace scan_matching {
 class InterpolatedGrid {
  public:
   explicit InterpolatedGrid(const HybridGrid& hybrid_grid)
-      : hybrid_grid_(hybrid_grid) {}
+      : hybrid_grid_(&hybrid_grid) {}
 
   InterpolatedGrid(const InterpolatedGrid&) = delete;
   InterpolatedGrid& operator=(const InterpolatedGrid&) = delete;
 
+  // Makes this interpolate 'hybrid_grid' instead.
+  void Rebind(const HybridGrid& hybrid_grid) { hybrid_grid_ = &hybrid_grid; }
+
+  // Probabilities of the 8 voxels around an interpolation point, ordered as
+  // q111, q112, q121, q122, q211, q212, q221, q222 where e.g. q112 is the voxel
+  // at the lower index plus (0, 0, 1).
+  using CornerProbabilities = std::array<float, 8>;
+
   // Returns the interpolated probability at (x, y, z) of the HybridGrid
   // used to perform the interpolation.
   //
@@ -49,26 +58,67 @@ class InterpolatedGrid {
   // the values, and have vanishing derivative at the interval boundaries.
   template <typename T>
   T GetProbability(const T& x, const T& y, const T& z) const {
-    double x1, y1, z1, x2, y2, z2;
-    ComputeInterpolationDataPoints(x, y, z, &x1, &y1, &z1, &x2, &y2, &z2);
-
-    const Eigen::Array3i index1 =
-        hybrid_grid_.GetCellIndex(Eigen::Vector3f(x1, y1, z1));
-    const double q111 = hybrid_grid_.GetProbability(index1);
-    const double q112 =
-        hybrid_grid_.GetProbability(index1 + Eigen::Array3i(0, 0, 1));
-    const double q121 =
-        hybrid_grid_.GetProbability(index1 + Eigen::Array3i(0, 1, 0));
-    const double q122 =
-        hybrid_grid_.GetProbability(index1 + Eigen::Array3i(0, 1, 1));
-    const double q211 =
-        hybrid_grid_.GetProbability(index1 + Eigen::Array3i(1, 0, 0));
-    const double q212 =
-        hybrid_grid_.GetProbability(index1 + Eigen::Array3i(1, 0, 1));
-    const double q221 =
-        hybrid_grid_.GetProbability(index1 + Eigen::Array3i(1, 1, 0));
-    const double q222 =
-        hybrid_grid_.GetProbability(index1 + Eigen::Array3i(1, 1, 1));
+    const Eigen::Array3i lower_index = GetLowerIndex(x, y, z);
+    return Interpolate(x, y, z, lower_index,
+                       GetCornerProbabilities(lower_index));
+  }
+
+  // Returns the index of the voxel whose center is the lower corner of the
+  // interpolation interval containing (x, y, z). For each dimension, this is
+  // the largest voxel index so that the corresponding center is at most the
+  // given coordinate, i.e., not necessarily the voxel containing (x, y, z).
+  template <typename T>
+  Eigen::Array3i GetLowerIndex(const T& x, const T& y, const T& z) const {
+    const Eigen::Vector3f point(ScalarPart(x), ScalarPart(y), ScalarPart(z));
+    // Index of the cell containing (x, y, z).
+    Eigen::Array3i index = hybrid_grid_->GetCellIndex(point);
+    const Eigen::Vector3f center = hybrid_grid_->GetCenterOfCell(index);
+    // Move to the next lower voxel.
+    if (center.x() > ScalarPart(x)) {
+      --index.x();
+    }
+    if (center.y() > ScalarPart(y)) {
+      --index.y();
+    }
+    if (center.z() > ScalarPart(z)) {
+      --index.z();
+    }
+    return index;
+  }
+
+  // Looks up the probabilities of the voxels around 'lower_index'.
+  CornerProbabilities GetCornerProbabilities(
+      const Eigen::Array3i& lower_index) const {
+    CornerProbabilities corner_probabilities;
+    for (int i = 0; i != 8; ++i) {
+      corner_probabilities[i] = hybrid_grid_->GetProbability(
+          lower_index + Eigen::Array3i((i >> 2) & 1, (i >> 1) & 1, i & 1));
+    }
+    return corner_probabilities;
+  }
+
+  // Same as GetProbability(), but with the 'lower_index' of (x, y, z) and the
+  // 'corner_probabilities' around it already looked up.
+  template <typename T>
+  T Interpolate(const T& x, const T& y, const T& z,
+                const Eigen::Array3i& lower_index,
+                const CornerProbabilities& corner_probabilities) const {
+    const Eigen::Vector3f lower = hybrid_grid_->GetCenterOfCell(lower_index);
+    const double x1 = lower.x();
+    const double y1 = lower.y();
+    const double z1 = lower.z();
+    const double x2 = lower.x() + hybrid_grid_->resolution();
+    const double y2 = lower.y() + hybrid_grid_->resolution();
+    const double z2 = lower.z() + hybrid_grid_->resolution();
+
+    const double q111 = corner_probabilities[0];
+    const double q112 = corner_probabilities[1];
+    const double q121 = corner_probabilities[2];
+    const double q122 = corner_probabilities[3];
+    const double q211 = corner_probabilities[4];
+    const double q212 = corner_probabilities[5];
+    const double q221 = corner_probabilities[6];
+    const double q222 = corner_probabilities[7];
 
     const T normalized_x = (x - x1) / (x2 - x1);
     const T normalized_y = (y - y1) / (y2 - y1);
@@ -103,49 +153,15 @@ class InterpolatedGrid {
   }
 
  private:
-  template <typename T>
-  void ComputeInterpolationDataPoints(const T& x, const T& y, const T& z,
-                                      double* x1, double* y1, double* z1,
-                                      double* x2, double* y2,
-                                      double* z2) const {
-    const Eigen::Vector3f lower = CenterOfLowerVoxel(x, y, z);
-    *x1 = lower.x();
-    *y1 = lower.y();
-    *z1 = lower.z();
-    *x2 = lower.x() + hybrid_grid_.resolution();
-    *y2 = lower.y() + hybrid_grid_.resolution();
-    *z2 = lower.z() + hybrid_grid_.resolution();
-  }
-
-  // Center of the next lower voxel, i.e., not necessarily the voxel containing
-  // (x, y, z). For each dimension, the largest voxel index so that the
-  // corresponding center is at most the given coordinate.
-  Eigen::Vector3f CenterOfLowerVoxel(const double x, const double y,
-                                     const double z) const {
-    // Center of the cell containing (x, y, z).
-    Eigen::Vector3f center = hybrid_grid_.GetCenterOfCell(
-        hybrid_grid_.GetCellIndex(Eigen::Vector3f(x, y, z)));
-    // Move to the next lower voxel center.
-    if (center.x() > x) {
-      center.x() -= hybrid_grid_.resolution();
-    }
-    if (center.y() > y) {
-      center.y() -= hybrid_grid_.resolution();
-    }
-    if (center.z() > z) {
-      center.z() -= hybrid_grid_.resolution();
-    }
-    return center;
-  }
+  static double ScalarPart(const double value) { return value; }
 
   // Uses the scalar part of a Ceres Jet.
   template <typename T>
-  Eigen::Vector3f CenterOfLowerVoxel(const T& jet_x, const T& jet_y,
-                                     const T& jet_z) const {
-    return CenterOfLowerVoxel(jet_x.a, jet_y.a, jet_z.a);
+  static double ScalarPart(const T& jet) {
+    return jet.a;
   }
 
-  const HybridGrid& hybrid_grid_;
+  const HybridGrid* hybrid_grid_;
 };
 
 }  // namespace scan_matching
@@ -17,6 +17,8 @@
 #ifndef CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_OCCUPIED_SPACE_COST_FUNCTOR_H_
 #define CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_OCCUPIED_SPACE_COST_FUNCTOR_H_
 
+#include <vector>
+
 #include "Eigen/Core"
 #include "cartographer/mapping_3d/hybrid_grid.h"
 #include "cartographer/mapping_3d/scan_matching/interpolated_grid.h"
@@ -34,17 +36,34 @@ namespace scan_matching {
 class OccupiedSpaceCostFunctor {
  public:
   // Creates an OccupiedSpaceCostFunctor using the specified grid, 'rotation' to
-  // add to all poses, and point cloud.
+  // add to all poses, and point cloud. The voxels around each point at
+  // 'initial_pose_estimate' are looked up once, so that evaluations near it
+  // do not have to.
   OccupiedSpaceCostFunctor(const double scaling_factor,
                            const sensor::PointCloud& point_cloud,
-                           const HybridGrid& hybrid_grid)
+                           const HybridGrid& hybrid_grid,
+                           const transform::Rigid3d& initial_pose_estimate)
       : scaling_factor_(scaling_factor),
-        point_cloud_(point_cloud),
-        interpolated_grid_(hybrid_grid) {}
+        point_cloud_(&point_cloud),
+        interpolated_grid_(hybrid_grid) {
+    CacheCornerProbabilities(initial_pose_estimate);
+  }
 
   OccupiedSpaceCostFunctor(const OccupiedSpaceCostFunctor&) = delete;
   OccupiedSpaceCostFunctor& operator=(const OccupiedSpaceCostFunctor&) = delete;
 
+  // Rebinds the functor to another 'point_cloud', 'hybrid_grid' and
+  // 'initial_pose_estimate'.
+  void Rebind(const double scaling_factor,
+              const sensor::PointCloud& point_cloud,
+              const HybridGrid& hybrid_grid,
+              const transform::Rigid3d& initial_pose_estimate) {
+    scaling_factor_ = scaling_factor;
+    point_cloud_ = &point_cloud;
+    interpolated_grid_.Rebind(hybrid_grid);
+    CacheCornerProbabilities(initial_pose_estimate);
+  }
+
   template <typename T>
   bool operator()(const T* const translation, const T* const rotation,
                   T* const residual) const {
@@ -58,20 +77,49 @@ class OccupiedSpaceCostFunctor {
   template <typename T>
   bool Evaluate(const transform::Rigid3<T>& transform,
                 T* const residual) const {
-    for (size_t i = 0; i < point_cloud_.size(); ++i) {
+    for (size_t i = 0; i < point_cloud_->size(); ++i) {
       const Eigen::Matrix<T, 3, 1> world =
-          transform * point_cloud_[i].cast<T>();
+          transform * (*point_cloud_)[i].cast<T>();
+      const Eigen::Array3i lower_index =
+          interpolated_grid_.GetLowerIndex(world[0], world[1], world[2]);
+      const CachedCorners& cached_corners = cached_corners_[i];
       const T probability =
-          interpolated_grid_.GetProbability(world[0], world[1], world[2]);
+          (lower_index == cached_corners.lower_index).all()
+              ? interpolated_grid_.Interpolate(
+                    world[0], world[1], world[2], lower_index,
+                    cached_corners.probabilities)
+              : interpolated_grid_.Interpolate(
+                    world[0], world[1], world[2], lower_index,
+                    interpolated_grid_.GetCornerProbabilities(lower_index));
       residual[i] = scaling_factor_ * (1. - probability);
     }
     return true;
   }
 
  private:
-  const double scaling_factor_;
-  const sensor::PointCloud& point_cloud_;
-  const InterpolatedGrid interpolated_grid_;
+  struct CachedCorners {
+    Eigen::Array3i lower_index;
+    InterpolatedGrid::CornerProbabilities probabilities;
+  };
+
+  // Since scan matching only moves points slightly, most evaluations fall into
+  // the same interpolation interval as the initial estimate.
+  void CacheCornerProbabilities(const transform::Rigid3d& pose) {
+    cached_corners_.resize(point_cloud_->size());
+    for (size_t i = 0; i < point_cloud_->size(); ++i) {
+      const Eigen::Vector3d world = pose * (*point_cloud_)[i].cast<double>();
+      CachedCorners& cached_corners = cached_corners_[i];
+      cached_corners.lower_index =
+          interpolated_grid_.GetLowerIndex(world[0], world[1], world[2]);
+      cached_corners.probabilities =
+          interpolated_grid_.GetCornerProbabilities(cached_corners.lower_index);
+    }
+  }
+
+  double scaling_factor_;
+  const sensor::PointCloud* point_cloud_;
+  InterpolatedGrid interpolated_grid_;
+  std::vector<CachedCorners> cached_corners_;
 };
 
 }  // namespace scan_matching
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2017 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_3d/scan_matching/occupied_space_cost_functor.h"
+
+#include <random>
+#include <vector>
+
+#include "Eigen/Core"
+#include "Eigen/Geometry"
+#include "cartographer/mapping_3d/hybrid_grid.h"
+#include "cartographer/mapping_3d/scan_matching/interpolated_grid.h"
+#include "cartographer/sensor/point_cloud.h"
+#include "cartographer/transform/rigid_transform.h"
+#include "ceres/jet.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_3d {
+namespace scan_matching {
+namespace {
+
+// Derivatives with respect to the 3 translation and 4 rotation parameters.
+using Jet = ceres::Jet<double, 7>;
+
+constexpr double kScalingFactor = 2.;
+
+class OccupiedSpaceCostFunctorTest : public ::testing::Test {
+ protected:
+  OccupiedSpaceCostFunctorTest() : hybrid_grid_(0.1f) {
+    std::mt19937 prng(42);
+    std::uniform_real_distribution<float> probability_distribution(0.1f, 0.9f);
+    for (int z = -10; z != 10; ++z) {
+      for (int y = -20; y != 20; ++y) {
+        for (int x = -20; x != 20; ++x) {
+          hybrid_grid_.SetProbability(Eigen::Array3i(x, y, z),
+                                      probability_distribution(prng));
+        }
+      }
+    }
+    std::uniform_real_distribution<float> point_distribution(-1.f, 1.f);
+    for (int i = 0; i != 50; ++i) {
+      point_cloud_.emplace_back(point_distribution(prng),
+                                point_distribution(prng),
+                                0.5f * point_distribution(prng));
+    }
+  }
+
+  // Evaluates 'functor' at 'pose' and expects the same residuals and
+  // Jacobians as interpolating the grid without any cached voxels.
+  void ExpectMatchesUncachedCost(const OccupiedSpaceCostFunctor& functor,
+                                 const transform::Rigid3d& pose) {
+    const Jet translation[3] = {Jet(pose.translation().x(), 0),
+                                Jet(pose.translation().y(), 1),
+                                Jet(pose.translation().z(), 2)};
+    const Jet rotation[4] = {
+        Jet(pose.rotation().w(), 3), Jet(pose.rotation().x(), 4),
+        Jet(pose.rotation().y(), 5), Jet(pose.rotation().z(), 6)};
+    std::vector<Jet> residuals(point_cloud_.size());
+    ASSERT_TRUE(functor(translation, rotation, residuals.data()));
+
+    const InterpolatedGrid interpolated_grid(hybrid_grid_);
+    const transform::Rigid3<Jet> transform(
+        Eigen::Matrix<Jet, 3, 1>(translation[0], translation[1],
+                                 translation[2]),
+        Eigen::Quaternion<Jet>(rotation[0], rotation[1], rotation[2],
+                               rotation[3]));
+    for (size_t i = 0; i != point_cloud_.size(); ++i) {
+      const Eigen::Matrix<Jet, 3, 1> world =
+          transform * point_cloud_[i].cast<Jet>();
+      const Jet expected_residual =
+          kScalingFactor *
+          (1. - interpolated_grid.GetProbability(world[0], world[1], world[2]));
+      EXPECT_NEAR(expected_residual.a, residuals[i].a, 1e-12) << i;
+      for (int j = 0; j != 7; ++j) {
+        EXPECT_NEAR(expected_residual.v[j], residuals[i].v[j], 1e-12)
+            << i << " " << j;
+      }
+    }
+  }
+
+  // Returns how many points are in another interpolation interval at 'pose'
+  // than at 'initial_pose'.
+  int CountPointsChangingInterval(const transform::Rigid3d& initial_pose,
+                                  const transform::Rigid3d& pose) {
+    const InterpolatedGrid interpolated_grid(hybrid_grid_);
+    int num_points_changing_interval = 0;
+    for (const Eigen::Vector3f& point : point_cloud_) {
+      const Eigen::Vector3d initial_world = initial_pose * point.cast<double>();
+      const Eigen::Vector3d world = pose * point.cast<double>();
+      if ((interpolated_grid.GetLowerIndex(initial_world.x(), initial_world.y(),
+                                           initial_world.z()) !=
+           interpolated_grid.GetLowerIndex(world.x(), world.y(), world.z()))
+              .any()) {
+        ++num_points_changing_interval;
+      }
+    }
+    return num_points_changing_interval;
+  }
+
+  HybridGrid hybrid_grid_;
+  sensor::PointCloud point_cloud_;
+};
+
+TEST_F(OccupiedSpaceCostFunctorTest, CachedCostEqualsUncachedCost) {
+  const transform::Rigid3d initial_pose(
+      Eigen::Vector3d(0.1, -0.2, 0.05),
+      Eigen::Quaterniond(Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitZ())));
+  const OccupiedSpaceCostFunctor functor(kScalingFactor, point_cloud_,
+                                         hybrid_grid_, initial_pose);
+
+  ExpectMatchesUncachedCost(functor, initial_pose);
+  const transform::Rigid3d slightly_moved_pose =
+      transform::Rigid3d::Translation(Eigen::Vector3d(0.005, -0.003, 0.002)) *
+      initial_pose;
+  ExpectMatchesUncachedCost(functor, slightly_moved_pose);
+  const transform::Rigid3d moved_pose =
+      transform::Rigid3d(Eigen::Vector3d(0.13, 0.07, -0.04),
+                         Eigen::Quaterniond(Eigen::AngleAxisd(
+                             0.1, Eigen::Vector3d::UnitX()))) *
+      initial_pose;
+  EXPECT_LT(0, CountPointsChangingInterval(initial_pose, moved_pose));
+  ExpectMatchesUncachedCost(functor, moved_pose);
+}
+
+TEST_F(OccupiedSpaceCostFunctorTest, RebindCachesTheNewPose) {
+  OccupiedSpaceCostFunctor functor(kScalingFactor, point_cloud_, hybrid_grid_,
+                                   transform::Rigid3d::Identity());
+  const transform::Rigid3d pose =
+      transform::Rigid3d::Translation(Eigen::Vector3d(0.25, -0.15, 0.1));
+  ASSERT_LT(0, CountPointsChangingInterval(transform::Rigid3d::Identity(),
+                                           pose));
+  functor.Rebind(kScalingFactor, point_cloud_, hybrid_grid_, pose);
+  ExpectMatchesUncachedCost(functor, pose);
+  ExpectMatchesUncachedCost(functor, transform::Rigid3d::Identity());
+}
+
+}  // namespace
+}  // namespace scan_matching
+}  // namespace mapping_3d
+}  // namespace cartographer
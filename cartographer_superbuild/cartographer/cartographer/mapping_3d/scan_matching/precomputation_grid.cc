@@ -17,6 +17,8 @@
 #include "cartographer/mapping_3d/scan_matching/precomputation_grid.h"
 
 #include <algorithm>
+#include <utility>
+#include <vector>
 
 #include "Eigen/Core"
 #include "cartographer/common/math.h"
@@ -45,8 +47,54 @@ Eigen::Array3i CellIndexAtHalfResolution(const Eigen::Array3i& cell_index) {
       DivideByTwoRoundingTowardsNegativeInfinity(cell_index[2]));
 }
 
+// Updates the 8 cells of 'result' which take the maximum over the cell at
+// 'cell_index' with the given 'value'.
+void AddToPrecomputedGrid(const Eigen::Array3i& cell_index, const uint8 value,
+                          const bool half_resolution,
+                          const Eigen::Array3i& shift,
+                          PrecomputationGrid* const result) {
+  for (int i = 0; i != 8; ++i) {
+    // We use this value to update 8 values in the resulting grid, at
+    // position (x - {0, 'shift'}, y - {0, 'shift'}, z - {0, 'shift'}).
+    // If 'shift' is 2 ** (depth - 1), where depth 0 is the original grid,
+    // this results in precomputation grids analogous to the 2D case.
+    const Eigen::Array3i shifted_cell_index =
+        cell_index - shift * PrecomputationGrid::GetOctant(i);
+    auto* const cell_value = result->mutable_value(
+        half_resolution ? CellIndexAtHalfResolution(shifted_cell_index)
+                        : shifted_cell_index);
+    *cell_value = std::max(value, *cell_value);
+  }
+}
+
 }  // namespace
 
+PrecomputationGrid::PrecomputationGrid(
+    const mapping_3d::proto::HybridGrid& proto)
+    : PrecomputationGrid(proto.resolution()) {
+  CHECK_EQ(proto.values_size(), proto.x_indices_size());
+  CHECK_EQ(proto.values_size(), proto.y_indices_size());
+  CHECK_EQ(proto.values_size(), proto.z_indices_size());
+  for (int i = 0; i < proto.values_size(); ++i) {
+    CHECK_GE(proto.values(i), 0);
+    CHECK_LE(proto.values(i), 255);
+    *mutable_value(Eigen::Array3i(proto.x_indices(i), proto.y_indices(i),
+                                  proto.z_indices(i))) = proto.values(i);
+  }
+}
+
+mapping_3d::proto::HybridGrid PrecomputationGrid::ToProto() const {
+  mapping_3d::proto::HybridGrid result;
+  result.set_resolution(resolution());
+  for (auto it = Iterator(*this); !it.Done(); it.Next()) {
+    result.add_x_indices(it.GetCellIndex().x());
+    result.add_y_indices(it.GetCellIndex().y());
+    result.add_z_indices(it.GetCellIndex().z());
+    result.add_values(it.GetValue());
+  }
+  return result;
+}
+
 PrecomputationGrid ConvertToPrecomputationGrid(const HybridGrid& hybrid_grid) {
   PrecomputationGrid result(hybrid_grid.resolution());
   for (auto it = HybridGrid::Iterator(hybrid_grid); !it.Done(); it.Next()) {
@@ -66,15 +114,49 @@ PrecomputationGrid PrecomputeGrid(const PrecomputationGrid& grid,
                                   const Eigen::Array3i& shift) {
   PrecomputationGrid result(grid.resolution());
   for (auto it = PrecomputationGrid::Iterator(grid); !it.Done(); it.Next()) {
-    for (int i = 0; i != 8; ++i) {
-      // We use this value to update 8 values in the resulting grid, at
-      // position (x - {0, 'shift'}, y - {0, 'shift'}, z - {0, 'shift'}).
-      // If 'shift' is 2 ** (depth - 1), where depth 0 is the original grid,
-      // this results in precomputation grids analogous to the 2D case.
-      const Eigen::Array3i cell_index =
-          it.GetCellIndex() - shift * PrecomputationGrid::GetOctant(i);
-      auto* const cell_value = result.mutable_value(
-          half_resolution ? CellIndexAtHalfResolution(cell_index) : cell_index);
+    AddToPrecomputedGrid(it.GetCellIndex(), it.GetValue(), half_resolution,
+                         shift, &result);
+  }
+  return result;
+}
+
+PrecomputationGrid PrecomputeGrid(
+    const PrecomputationGrid& grid, const bool half_resolution,
+    const Eigen::Array3i& shift, const int num_threads,
+    common::ThreadPool* const thread_pool,
+    std::vector<PrecomputationGridCell>* const reusable_cells) {
+  CHECK_GE(num_threads, 1);
+  if (num_threads == 1) {
+    return PrecomputeGrid(grid, half_resolution, shift);
+  }
+  std::vector<PrecomputationGridCell>& cells = *reusable_cells;
+  cells.clear();
+  for (auto it = PrecomputationGrid::Iterator(grid); !it.Done(); it.Next()) {
+    cells.push_back(PrecomputationGridCell{it.GetCellIndex(), it.GetValue()});
+  }
+
+  std::vector<PrecomputationGrid> partial_results;
+  partial_results.reserve(num_threads);
+  for (int block_index = 0; block_index != num_threads; ++block_index) {
+    partial_results.emplace_back(grid.resolution());
+  }
+  common::ParallelFor(
+      num_threads, num_threads, thread_pool,
+      [&](const int /* thread_index */, const int block_index) {
+        const size_t begin = cells.size() * block_index / num_threads;
+        const size_t end = cells.size() * (block_index + 1) / num_threads;
+        for (size_t i = begin; i != end; ++i) {
+          AddToPrecomputedGrid(cells[i].cell_index, cells[i].value,
+                               half_resolution, shift,
+                               &partial_results[block_index]);
+        }
+      });
+
+  PrecomputationGrid result = std::move(partial_results.front());
+  for (int block_index = 1; block_index != num_threads; ++block_index) {
+    for (auto it = PrecomputationGrid::Iterator(partial_results[block_index]);
+         !it.Done(); it.Next()) {
+      auto* const cell_value = result.mutable_value(it.GetCellIndex());
       *cell_value = std::max(it.GetValue(), *cell_value);
     }
   }
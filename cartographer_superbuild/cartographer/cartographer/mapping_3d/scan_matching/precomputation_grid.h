@@ -17,7 +17,11 @@
 #ifndef CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_PRECOMPUTATION_GRID_H_
 #define CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_PRECOMPUTATION_GRID_H_
 
+#include <vector>
+
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/mapping_3d/hybrid_grid.h"
+#include "cartographer/mapping_3d/proto/hybrid_grid.pb.h"
 
 namespace cartographer {
 namespace mapping_3d {
@@ -27,6 +31,8 @@ class PrecomputationGrid : public HybridGridBase<uint8> {
  public:
   explicit PrecomputationGrid(const float resolution)
       : HybridGridBase<uint8>(resolution) {}
+  // Restores a grid serialized by ToProto().
+  explicit PrecomputationGrid(const mapping_3d::proto::HybridGrid& proto);
 
   // Maps values from [0, 255] to [kMinProbability, kMaxProbability].
   static float ToProbability(float value) {
@@ -34,6 +40,15 @@ class PrecomputationGrid : public HybridGridBase<uint8> {
            value *
                ((mapping::kMaxProbability - mapping::kMinProbability) / 255.f);
   }
+
+  // Serializes the non-zero cells, with values in [1, 255].
+  mapping_3d::proto::HybridGrid ToProto() const;
+};
+
+// A non-zero cell of a PrecomputationGrid.
+struct PrecomputationGridCell {
+  Eigen::Array3i cell_index;
+  uint8 value;
 };
 
 // Converts a HybridGrid to a PrecomputationGrid representing the same data,
@@ -50,6 +65,18 @@ PrecomputationGrid PrecomputeGrid(const PrecomputationGrid& grid,
                                   bool half_resolution,
                                   const Eigen::Array3i& shift);
 
+// Same as above, but the cells of 'grid' are split into 'num_threads' blocks
+// which are contiguous in iteration order, and thus spatially, and processed in
+// parallel. The results only overlap at the block boundaries and are merged
+// afterwards. The 'thread_pool' runs all but one of the threads and may be
+// nullptr if 'num_threads' is 1. 'reusable_cells' is used as scratch memory,
+// and can be kept between calls to avoid reallocating it.
+PrecomputationGrid PrecomputeGrid(
+    const PrecomputationGrid& grid, bool half_resolution,
+    const Eigen::Array3i& shift, int num_threads,
+    common::ThreadPool* thread_pool,
+    std::vector<PrecomputationGridCell>* reusable_cells);
+
 }  // namespace scan_matching
 }  // namespace mapping_3d
 }  // namespace cartographer
@@ -76,6 +76,55 @@ TEST(PrecomputedGridGeneratorTest, TestAgainstNaiveAlgorithm) {
   }
 }
 
+TEST(PrecomputedGridGeneratorTest, ParallelMatchesSequential) {
+  HybridGrid hybrid_grid(0.5f);
+  std::mt19937 rng(9823);
+  std::uniform_int_distribution<int> coordinate_distribution(-70, 69);
+  std::uniform_real_distribution<float> value_distribution(
+      mapping::kMinProbability, mapping::kMaxProbability);
+  for (int i = 0; i < 5000; ++i) {
+    hybrid_grid.SetProbability(
+        Eigen::Array3i(coordinate_distribution(rng),
+                       coordinate_distribution(rng),
+                       coordinate_distribution(rng)),
+        value_distribution(rng));
+  }
+  const PrecomputationGrid grid = ConvertToPrecomputationGrid(hybrid_grid);
+
+  common::ThreadPool thread_pool(3);
+  std::vector<PrecomputationGridCell> reusable_cells;
+  for (const bool half_resolution : {false, true}) {
+    const Eigen::Array3i shift(1, 2, 3);
+    const PrecomputationGrid expected =
+        PrecomputeGrid(grid, half_resolution, shift);
+    const PrecomputationGrid actual = PrecomputeGrid(
+        grid, half_resolution, shift, 4 /* num_threads */, &thread_pool,
+        &reusable_cells);
+    int num_cells = 0;
+    for (auto it = PrecomputationGrid::Iterator(expected); !it.Done();
+         it.Next()) {
+      EXPECT_EQ(it.GetValue(), actual.value(it.GetCellIndex()));
+      ++num_cells;
+    }
+    for (auto it = PrecomputationGrid::Iterator(actual); !it.Done();
+         it.Next()) {
+      --num_cells;
+    }
+    EXPECT_EQ(0, num_cells);
+  }
+}
+
+TEST(PrecomputedGridGeneratorTest, ToProto) {
+  PrecomputationGrid grid(0.25f);
+  *grid.mutable_value(Eigen::Array3i(1, -2, 3)) = 17;
+  *grid.mutable_value(Eigen::Array3i(-40, 5, 0)) = 255;
+  const PrecomputationGrid restored_grid(grid.ToProto());
+  EXPECT_EQ(grid.resolution(), restored_grid.resolution());
+  EXPECT_EQ(17, restored_grid.value(Eigen::Array3i(1, -2, 3)));
+  EXPECT_EQ(255, restored_grid.value(Eigen::Array3i(-40, 5, 0)));
+  EXPECT_EQ(2, grid.ToProto().values_size());
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_3d
@@ -37,15 +37,20 @@ class RotationDeltaCostFunctor {
   explicit RotationDeltaCostFunctor(const double scaling_factor,
                                     const Eigen::Quaterniond& initial_rotation)
       : scaling_factor_(scaling_factor) {
+    Rebind(initial_rotation);
+  }
+
+  RotationDeltaCostFunctor(const RotationDeltaCostFunctor&) = delete;
+  RotationDeltaCostFunctor& operator=(const RotationDeltaCostFunctor&) = delete;
+
+  // Rebinds the functor to another 'initial_rotation'.
+  void Rebind(const Eigen::Quaterniond& initial_rotation) {
     initial_rotation_inverse_[0] = initial_rotation.w();
     initial_rotation_inverse_[1] = -initial_rotation.x();
     initial_rotation_inverse_[2] = -initial_rotation.y();
     initial_rotation_inverse_[3] = -initial_rotation.z();
   }
 
-  RotationDeltaCostFunctor(const RotationDeltaCostFunctor&) = delete;
-  RotationDeltaCostFunctor& operator=(const RotationDeltaCostFunctor&) = delete;
-
   template <typename T>
   bool operator()(const T* const rotation_quaternion, T* residual) const {
     T delta[4];
@@ -16,6 +16,7 @@
 
 #include "cartographer/mapping_3d/scan_matching/rotational_scan_matcher.h"
 
+#include <cmath>
 #include <map>
 #include <vector>
 
@@ -144,16 +145,16 @@ void AddValuesToHistogram(const std::vector<AngleValuePair>& value_vector,
 
 }  // namespace
 
-RotationalScanMatcher::RotationalScanMatcher(
-    const std::vector<mapping::TrajectoryNode>& nodes, const int histogram_size)
-    : histogram_(Eigen::VectorXf::Zero(histogram_size)) {
-  for (const mapping::TrajectoryNode& node : nodes) {
-    AddValuesToHistogram(
-        GetValuesForHistogram(sensor::TransformPointCloud(
-            node.constant_data->range_data.returns.Decompress(),
-            node.pose.cast<float>())),
-        0.f, &histogram_);
-  }
+RotationalScanMatcher::RotationalScanMatcher(const Eigen::VectorXf& histogram)
+    : histogram_(histogram), histogram_norm_(histogram.norm()) {
+  CHECK_GT(histogram_.size(), 0);
+}
+
+Eigen::VectorXf RotationalScanMatcher::ComputeHistogram(
+    const sensor::PointCloud& point_cloud, const int histogram_size) {
+  Eigen::VectorXf histogram = Eigen::VectorXf::Zero(histogram_size);
+  AddValuesToHistogram(GetValuesForHistogram(point_cloud), 0.f, &histogram);
+  return histogram;
 }
 
 std::vector<float> RotationalScanMatcher::Match(
@@ -161,27 +162,45 @@ std::vector<float> RotationalScanMatcher::Match(
     const std::vector<float>& angles) const {
   std::vector<float> result;
   result.reserve(angles.size());
-  const std::vector<AngleValuePair> value_vector =
-      GetValuesForHistogram(point_cloud);
+  const Eigen::VectorXf scan_histogram =
+      ComputeHistogram(point_cloud, histogram_.size());
+  // We compute the dot product of normalized histograms as a measure of
+  // similarity.
+  const float normalization = scan_histogram.norm() * histogram_norm_;
+  if (normalization < 1e-3f) {
+    result.resize(angles.size(), 1.f);
+    return result;
+  }
+  // Rotating the scan histogram by a whole number of buckets only shifts it,
+  // so all shifts are scored at once. Angles in between are linearly
+  // interpolated.
+  const Eigen::VectorXf correlation =
+      ComputeCircularCorrelation(scan_histogram);
+  const int size = histogram_.size();
   for (const float angle : angles) {
-    Eigen::VectorXf scan_histogram = Eigen::VectorXf::Zero(histogram_.size());
-    AddValuesToHistogram(value_vector, angle, &scan_histogram);
-    result.push_back(MatchHistogram(scan_histogram));
+    const float shift = angle / static_cast<float>(M_PI) * size;
+    const int lower_shift = static_cast<int>(std::floor(shift));
+    const float fraction = shift - lower_shift;
+    const int k = lower_shift % size + size;
+    result.push_back(((1.f - fraction) * correlation[k % size] +
+                      fraction * correlation[(k + 1) % size]) /
+                     normalization);
   }
   return result;
 }
 
-float RotationalScanMatcher::MatchHistogram(
+Eigen::VectorXf RotationalScanMatcher::ComputeCircularCorrelation(
     const Eigen::VectorXf& scan_histogram) const {
-  // We compute the dot product of normalized histograms as a measure of
-  // similarity.
-  const float scan_histogram_norm = scan_histogram.norm();
-  const float histogram_norm = histogram_.norm();
-  const float normalization = scan_histogram_norm * histogram_norm;
-  if (normalization < 1e-3f) {
-    return 1.f;
+  const int size = histogram_.size();
+  CHECK_EQ(scan_histogram.size(), size);
+  Eigen::VectorXf correlation(size);
+  for (int k = 0; k != size; ++k) {
+    // Bucket m of the scan histogram moves to bucket m + k.
+    correlation[k] =
+        histogram_.tail(size - k).dot(scan_histogram.head(size - k)) +
+        histogram_.head(k).dot(scan_histogram.tail(k));
   }
-  return histogram_.dot(scan_histogram) / normalization;
+  return correlation;
 }
 
 }  // namespace scan_matching
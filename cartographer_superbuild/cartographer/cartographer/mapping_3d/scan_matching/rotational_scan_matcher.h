@@ -20,7 +20,6 @@
 #include <vector>
 
 #include "Eigen/Geometry"
-#include "cartographer/mapping/trajectory_node.h"
 #include "cartographer/sensor/point_cloud.h"
 
 namespace cartographer {
@@ -29,22 +28,34 @@ namespace scan_matching {
 
 class RotationalScanMatcher {
  public:
-  explicit RotationalScanMatcher(
-      const std::vector<mapping::TrajectoryNode>& nodes, int histogram_size);
+  // Takes the sum of the histograms of the point clouds, in the submap frame,
+  // which make up the submap. See ComputeHistogram().
+  explicit RotationalScanMatcher(const Eigen::VectorXf& histogram);
 
   RotationalScanMatcher(const RotationalScanMatcher&) = delete;
   RotationalScanMatcher& operator=(const RotationalScanMatcher&) = delete;
 
+  // Computes the histogram of 'point_cloud' with 'histogram_size' buckets.
+  // Histograms of several point clouds can be summed.
+  static Eigen::VectorXf ComputeHistogram(const sensor::PointCloud& point_cloud,
+                                          int histogram_size);
+
   // Scores how well a 'point_cloud' can be understood as rotated by certain
-  // 'angles' relative to the 'nodes'. Each angle results in a score between
+  // 'angles' relative to the submap. Each angle results in a score between
   // 0 (worst) and 1 (best).
   std::vector<float> Match(const sensor::PointCloud& point_cloud,
                            const std::vector<float>& angles) const;
 
+  const Eigen::VectorXf& histogram() const { return histogram_; }
+
  private:
-  float MatchHistogram(const Eigen::VectorXf& scan_histogram) const;
+  // Returns for each k the dot product of the submap histogram and
+  // 'scan_histogram' rotated by k buckets.
+  Eigen::VectorXf ComputeCircularCorrelation(
+      const Eigen::VectorXf& scan_histogram) const;
 
-  Eigen::VectorXf histogram_;
+  const Eigen::VectorXf histogram_;
+  const float histogram_norm_;
 };
 
 }  // namespace scan_matching
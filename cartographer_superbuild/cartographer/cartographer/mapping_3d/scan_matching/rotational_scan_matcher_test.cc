@@ -0,0 +1,95 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_3d/scan_matching/rotational_scan_matcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Eigen/Geometry"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_3d {
+namespace scan_matching {
+namespace {
+
+constexpr int kHistogramSize = 60;
+
+// Returns points along the three walls of a room which is not symmetric under
+// any rotation, on two slices.
+sensor::PointCloud CreateRoom() {
+  sensor::PointCloud point_cloud;
+  for (const float z : {0.f, 1.f}) {
+    for (int i = 0; i != 20; ++i) {
+      point_cloud.emplace_back(-3.f + 0.3f * i, -2.f, z);
+    }
+    for (int i = 0; i != 10; ++i) {
+      point_cloud.emplace_back(3.f + 0.2f * i, -2.f + 0.35f * i, z);
+    }
+    for (int i = 0; i != 15; ++i) {
+      point_cloud.emplace_back(-3.f + 0.1f * i, -2.f + 0.4f * i, z);
+    }
+  }
+  return point_cloud;
+}
+
+TEST(RotationalScanMatcherTest, FindsRotation) {
+  const sensor::PointCloud room = CreateRoom();
+  const RotationalScanMatcher rotational_scan_matcher(
+      RotationalScanMatcher::ComputeHistogram(room, kHistogramSize));
+
+  std::vector<float> angles;
+  for (int i = 0; i != kHistogramSize; ++i) {
+    angles.push_back(i * M_PI / kHistogramSize);
+  }
+  constexpr int kExpectedIndex = 17;
+  const sensor::PointCloud rotated_room = sensor::TransformPointCloud(
+      room, transform::Rigid3f::Rotation(Eigen::AngleAxisf(
+                -angles[kExpectedIndex], Eigen::Vector3f::UnitZ())));
+  const std::vector<float> scores =
+      rotational_scan_matcher.Match(rotated_room, angles);
+  ASSERT_EQ(angles.size(), scores.size());
+  EXPECT_EQ(kExpectedIndex,
+            std::max_element(scores.begin(), scores.end()) - scores.begin());
+  for (const float score : scores) {
+    EXPECT_LE(0.f, score);
+    EXPECT_GE(1.f + 1e-5f, score);
+  }
+
+  // Angles in between two buckets score in between.
+  const float in_between_score = rotational_scan_matcher.Match(
+      rotated_room,
+      {0.5f * (angles[kExpectedIndex] + angles[kExpectedIndex + 1])})[0];
+  EXPECT_LE(std::min(scores[kExpectedIndex], scores[kExpectedIndex + 1]),
+            in_between_score + 1e-5f);
+  EXPECT_GE(std::max(scores[kExpectedIndex], scores[kExpectedIndex + 1]),
+            in_between_score - 1e-5f);
+}
+
+TEST(RotationalScanMatcherTest, EmptyHistogramMatchesEverything) {
+  const RotationalScanMatcher rotational_scan_matcher(
+      Eigen::VectorXf::Zero(kHistogramSize));
+  const std::vector<float> scores =
+      rotational_scan_matcher.Match(CreateRoom(), {0.f, 1.f, -2.f});
+  EXPECT_EQ(std::vector<float>(3, 1.f), scores);
+}
+
+}  // namespace
+}  // namespace scan_matching
+}  // namespace mapping_3d
+}  // namespace cartographer
@@ -42,6 +42,13 @@ class TranslationDeltaCostFunctor {
   TranslationDeltaCostFunctor& operator=(const TranslationDeltaCostFunctor&) =
       delete;
 
+  // Rebinds the functor to another 'initial_pose_estimate'.
+  void Rebind(const transform::Rigid3d& initial_pose_estimate) {
+    x_ = initial_pose_estimate.translation().x();
+    y_ = initial_pose_estimate.translation().y();
+    z_ = initial_pose_estimate.translation().z();
+  }
+
   template <typename T>
   bool operator()(const T* const translation, T* residual) const {
     residual[0] = scaling_factor_ * (translation[0] - x_);
@@ -52,9 +59,9 @@ class TranslationDeltaCostFunctor {
 
  private:
   const double scaling_factor_;
-  const double x_;
-  const double y_;
-  const double z_;
+  double x_;
+  double y_;
+  double z_;
 };
 
 }  // namespace scan_matching
@@ -31,6 +31,7 @@
 #include "cartographer/common/make_unique.h"
 #include "cartographer/common/math.h"
 #include "cartographer/mapping/sparse_pose_graph/proto/constraint_builder_options.pb.h"
+#include "cartographer/mapping_3d/scan_matching/rotational_scan_matcher.h"
 #include "cartographer/sensor/compressed_point_cloud.h"
 #include "cartographer/sensor/voxel_filter.h"
 #include "glog/logging.h"
@@ -44,7 +45,12 @@ SparsePoseGraph::SparsePoseGraph(
     : options_(options),
       optimization_problem_(options_.optimization_problem_options(),
                             sparse_pose_graph::OptimizationProblem::FixZ::kNo),
-      constraint_builder_(options_.constraint_builder_options(), thread_pool) {}
+      constraint_builder_(options_.constraint_builder_options(), thread_pool) {
+  if (options_.place_recognition_num_candidates() != 0) {
+    LOG(WARNING) << "Place recognition is only implemented in 2D, ignoring "
+                    "'place_recognition_num_candidates'.";
+  }
+}
 
 SparsePoseGraph::~SparsePoseGraph() {
   WaitForAllComputations();
@@ -98,6 +104,21 @@ void SparsePoseGraph::AddScan(
     const std::vector<std::shared_ptr<const Submap>>& insertion_submaps) {
   const transform::Rigid3d optimized_pose(
       GetLocalToGlobalTransform(trajectory_id) * pose);
+  // Histograms are computed before taking the lock, so that submap histograms
+  // only need to be summed up when scans are added to them.
+  const int histogram_size = options_.constraint_builder_options()
+                                 .fast_correlative_scan_matcher_options_3d()
+                                 .rotational_histogram_size();
+  std::vector<Eigen::VectorXf> rotational_scan_matcher_histograms;
+  for (const auto& insertion_submap : insertion_submaps) {
+    rotational_scan_matcher_histograms.push_back(
+        scan_matching::RotationalScanMatcher::ComputeHistogram(
+            sensor::TransformPointCloud(
+                range_data_in_tracking.returns,
+                (insertion_submap->local_pose().inverse() * pose)
+                    .cast<float>()),
+            histogram_size));
+  }
   common::MutexLocker locker(&mutex_);
   trajectory_nodes_.Append(
       trajectory_id, mapping::TrajectoryNode{
@@ -121,6 +142,8 @@ void SparsePoseGraph::AddScan(
     const mapping::SubmapId submap_id =
         submap_data_.Append(trajectory_id, SubmapData());
     submap_data_.at(submap_id).submap = insertion_submaps.back();
+    submap_data_.at(submap_id).rotational_scan_matcher_histogram =
+        Eigen::VectorXf::Zero(histogram_size);
   }
 
   // Make sure we have a sampler for this trajectory.
@@ -135,6 +158,7 @@ void SparsePoseGraph::AddScan(
   const bool newly_finished_submap = insertion_submaps.front()->finished();
   AddWorkItem([=]() REQUIRES(mutex_) {
     ComputeConstraintsForScan(trajectory_id, insertion_submaps,
+                              rotational_scan_matcher_histograms,
                               newly_finished_submap, pose);
   });
 }
@@ -173,14 +197,6 @@ void SparsePoseGraph::ComputeConstraint(const mapping::NodeId& node_id,
                                 .at(node_id.node_index)
                                 .point_cloud_pose;
 
-  std::vector<mapping::TrajectoryNode> submap_nodes;
-  for (const mapping::NodeId& submap_node_id :
-       submap_data_.at(submap_id).node_ids) {
-    submap_nodes.push_back(mapping::TrajectoryNode{
-        trajectory_nodes_.at(submap_node_id).constant_data,
-        inverse_submap_pose * trajectory_nodes_.at(submap_node_id).pose});
-  }
-
   // Only globally match against submaps not in this trajectory.
   if (node_id.trajectory_id != submap_id.trajectory_id &&
       global_localization_samplers_[node_id.trajectory_id]->Pulse()) {
@@ -199,7 +215,8 @@ void SparsePoseGraph::ComputeConstraint(const mapping::NodeId& node_id,
     constraint_builder_.MaybeAddGlobalConstraint(
         submap_id, submap_data_.at(submap_id).submap.get(), node_id,
         &trajectory_nodes_.at(node_id).constant_data->range_data.returns,
-        submap_nodes, initial_relative_pose.rotation(),
+        submap_data_.at(submap_id).rotational_scan_matcher_histogram,
+        initial_relative_pose.rotation(),
         &trajectory_connectivity_);
   } else {
     const bool scan_and_submap_trajectories_connected =
@@ -212,7 +229,8 @@ void SparsePoseGraph::ComputeConstraint(const mapping::NodeId& node_id,
       constraint_builder_.MaybeAddConstraint(
           submap_id, submap_data_.at(submap_id).submap.get(), node_id,
           &trajectory_nodes_.at(node_id).constant_data->range_data.returns,
-          submap_nodes, initial_relative_pose);
+          submap_data_.at(submap_id).rotational_scan_matcher_histogram,
+          initial_relative_pose);
     }
   }
 }
@@ -237,10 +255,13 @@ void SparsePoseGraph::ComputeConstraintsForOldScans(
 void SparsePoseGraph::ComputeConstraintsForScan(
     const int trajectory_id,
     std::vector<std::shared_ptr<const Submap>> insertion_submaps,
+    const std::vector<Eigen::VectorXf>& rotational_scan_matcher_histograms,
     const bool newly_finished_submap, const transform::Rigid3d& pose) {
   const std::vector<mapping::SubmapId> submap_ids =
       GrowSubmapTransformsAsNeeded(trajectory_id, insertion_submaps);
   CHECK_EQ(submap_ids.size(), insertion_submaps.size());
+  CHECK_EQ(rotational_scan_matcher_histograms.size(),
+           insertion_submaps.size());
   const mapping::SubmapId matching_id = submap_ids.front();
   const transform::Rigid3d optimized_pose =
       optimization_problem_.submap_data()
@@ -265,6 +286,8 @@ void SparsePoseGraph::ComputeConstraintsForScan(
     // be marked as finished in 'submap_data_' further below.
     CHECK(submap_data_.at(submap_id).state == SubmapState::kActive);
     submap_data_.at(submap_id).node_ids.emplace(node_id);
+    submap_data_.at(submap_id).rotational_scan_matcher_histogram +=
+        rotational_scan_matcher_histograms[i];
     const transform::Rigid3d constraint_transform =
         insertion_submaps[i]->local_pose().inverse() * pose;
     constraints_.push_back(
@@ -390,6 +413,20 @@ void SparsePoseGraph::AddSubmapFromProto(const int trajectory_id,
   const mapping::SubmapId submap_id =
       submap_data_.Append(trajectory_id, SubmapData());
   submap_data_.at(submap_id).submap = submap_ptr;
+  if (submap.has_precomputation_grid_stack_3d() &&
+      constraint_builder_.AddSubmapScanMatcherFromProto(
+          submap_id, submap_ptr.get(), submap.precomputation_grid_stack_3d())) {
+    const auto& histogram = submap.precomputation_grid_stack_3d()
+                                .rotational_scan_matcher_histogram();
+    submap_data_.at(submap_id).rotational_scan_matcher_histogram =
+        Eigen::Map<const Eigen::VectorXf>(histogram.data(), histogram.size());
+  } else {
+    // No scans are known for this submap, so its rotations are not scored.
+    submap_data_.at(submap_id).rotational_scan_matcher_histogram =
+        Eigen::VectorXf::Zero(options_.constraint_builder_options()
+                                  .fast_correlative_scan_matcher_options_3d()
+                                  .rotational_histogram_size());
+  }
   // Immediately show the submap at the optimized pose.
   CHECK_GE(static_cast<size_t>(submap_data_.num_trajectories()),
            optimized_submap_transforms_.size());
@@ -398,6 +435,7 @@ void SparsePoseGraph::AddSubmapFromProto(const int trajectory_id,
            submap_id.submap_index);
   optimized_submap_transforms_.at(trajectory_id)
       .push_back(sparse_pose_graph::SubmapData{initial_pose});
+  PublishLocalToGlobalTransforms();
   AddWorkItem([this, submap_id, initial_pose]() REQUIRES(mutex_) {
     CHECK_EQ(frozen_trajectories_.count(submap_id.trajectory_id), 1);
     submap_data_.at(submap_id).state = SubmapState::kFinished;
@@ -405,6 +443,27 @@ void SparsePoseGraph::AddSubmapFromProto(const int trajectory_id,
   });
 }
 
+void SparsePoseGraph::AddPrecomputationGridsToProto(
+    const mapping::SubmapId& submap_id, mapping::proto::Submap* const submap) {
+  std::shared_ptr<const Submap> submap_ptr;
+  Eigen::VectorXf rotational_scan_matcher_histogram;
+  {
+    common::MutexLocker locker(&mutex_);
+    const SubmapData& submap_data = submap_data_.at(submap_id);
+    if (submap_data.state != SubmapState::kFinished) {
+      return;
+    }
+    submap_ptr = submap_data.submap;
+    rotational_scan_matcher_histogram =
+        submap_data.rotational_scan_matcher_histogram;
+  }
+  // Building and serializing the grids may take long, so it is done without
+  // blocking the pose graph. The finished submap does not change anymore.
+  *submap->mutable_precomputation_grid_stack_3d() =
+      constraint_builder_.SubmapScanMatcherToProto(
+          submap_id, submap_ptr.get(), rotational_scan_matcher_histogram);
+}
+
 void SparsePoseGraph::AddTrimmer(
     std::unique_ptr<mapping::PoseGraphTrimmer> trimmer) {
   common::MutexLocker locker(&mutex_);
@@ -457,6 +516,7 @@ void SparsePoseGraph::RunOptimization() {
     }
   }
   optimized_submap_transforms_ = optimization_problem_.submap_data();
+  PublishLocalToGlobalTransforms();
   connected_components_ = trajectory_connectivity_.ConnectedComponents();
   reverse_connected_components_.clear();
   for (size_t i = 0; i != connected_components_.size(); ++i) {
@@ -489,6 +549,25 @@ transform::Rigid3d SparsePoseGraph::GetLocalToGlobalTransform(
                                        trajectory_id);
 }
 
+const common::SeqLock<transform::Rigid3d>&
+SparsePoseGraph::GetLocalToGlobalTransformSnapshot(const int trajectory_id) {
+  common::MutexLocker locker(&mutex_);
+  auto& snapshot = local_to_global_transform_snapshots_[trajectory_id];
+  if (snapshot == nullptr) {
+    snapshot = common::make_unique<common::SeqLock<transform::Rigid3d>>(
+        ComputeLocalToGlobalTransform(optimized_submap_transforms_,
+                                      trajectory_id));
+  }
+  return *snapshot;
+}
+
+void SparsePoseGraph::PublishLocalToGlobalTransforms() {
+  for (const auto& entry : local_to_global_transform_snapshots_) {
+    entry.second->Write(ComputeLocalToGlobalTransform(
+        optimized_submap_transforms_, entry.first));
+  }
+}
+
 std::vector<std::vector<int>> SparsePoseGraph::GetConnectedTrajectories() {
   common::MutexLocker locker(&mutex_);
   return connected_components_;
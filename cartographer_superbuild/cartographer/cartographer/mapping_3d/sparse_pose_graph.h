@@ -30,6 +30,7 @@
 #include "Eigen/Geometry"
 #include "cartographer/common/fixed_ratio_sampler.h"
 #include "cartographer/common/mutex.h"
+#include "cartographer/common/seqlock.h"
 #include "cartographer/common/thread_pool.h"
 #include "cartographer/common/time.h"
 #include "cartographer/mapping/pose_graph_trimmer.h"
@@ -84,6 +85,14 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
                           const transform::Rigid3d& initial_pose,
                           const mapping::proto::Submap& submap) override;
   void AddTrimmer(std::unique_ptr<mapping::PoseGraphTrimmer> trimmer) override;
+
+  // Adds the precomputation grids of the scan matcher for the submap with
+  // 'submap_id' to its serialized 'submap', if it is finished. These are
+  // restored by AddSubmapFromProto().
+  void AddPrecomputationGridsToProto(const mapping::SubmapId& submap_id,
+                                     mapping::proto::Submap* submap)
+      EXCLUDES(mutex_);
+
   void RunFinalOptimization() override;
   std::vector<std::vector<int>> GetConnectedTrajectories() override;
   int num_submaps(int trajectory_id) EXCLUDES(mutex_) override;
@@ -93,6 +102,8 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
   GetAllSubmapData() EXCLUDES(mutex_) override;
   transform::Rigid3d GetLocalToGlobalTransform(int trajectory_id)
       EXCLUDES(mutex_) override;
+  const common::SeqLock<transform::Rigid3d>& GetLocalToGlobalTransformSnapshot(
+      int trajectory_id) EXCLUDES(mutex_) override;
   std::vector<std::vector<mapping::TrajectoryNode>> GetTrajectoryNodes()
       override EXCLUDES(mutex_);
   std::vector<Constraint> constraints() override EXCLUDES(mutex_);
@@ -110,6 +121,10 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
     // becomes 'finished'.
     std::set<mapping::NodeId> node_ids;
 
+    // Sum of the rotational scan matcher histograms of the scans in
+    // 'node_ids', in the submap frame.
+    Eigen::VectorXf rotational_scan_matcher_histogram;
+
     SubmapState state = SubmapState::kActive;
   };
 
@@ -124,9 +139,12 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
       REQUIRES(mutex_);
 
   // Adds constraints for a scan, and starts scan matching in the background.
+  // 'rotational_scan_matcher_histograms' holds the histogram of the scan in the
+  // frame of each of the 'insertion_submaps'.
   void ComputeConstraintsForScan(
       int trajectory_id,
       std::vector<std::shared_ptr<const Submap>> insertion_submaps,
+      const std::vector<Eigen::VectorXf>& rotational_scan_matcher_histograms,
       bool newly_finished_submap, const transform::Rigid3d& pose)
       REQUIRES(mutex_);
 
@@ -157,6 +175,10 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
           submap_transforms,
       int trajectory_id) const REQUIRES(mutex_);
 
+  // Writes the current local to global transforms into the snapshots handed
+  // out so far.
+  void PublishLocalToGlobalTransforms() REQUIRES(mutex_);
+
   mapping::SparsePoseGraph::SubmapData GetSubmapDataUnderLock(
       const mapping::SubmapId& submap_id) REQUIRES(mutex_);
 
@@ -204,6 +226,9 @@ class SparsePoseGraph : public mapping::SparsePoseGraph {
   // Current submap transforms used for displaying data.
   std::vector<std::vector<sparse_pose_graph::SubmapData>>
       optimized_submap_transforms_ GUARDED_BY(mutex_);
+  // Lock-free copies of the local to global transforms by trajectory ID.
+  std::map<int, std::unique_ptr<common::SeqLock<transform::Rigid3d>>>
+      local_to_global_transform_snapshots_ GUARDED_BY(mutex_);
 
   // List of all trimmers to consult when optimizations finish.
   std::vector<std::unique_ptr<mapping::PoseGraphTrimmer>> trimmers_
@@ -51,7 +51,6 @@ ConstraintBuilder::~ConstraintBuilder() {
   common::MutexLocker locker(&mutex_);
   CHECK_EQ(constraints_.size(), 0) << "WhenDone() was not called";
   CHECK_EQ(pending_computations_.size(), 0);
-  CHECK_EQ(submap_queued_work_items_.size(), 0);
   CHECK(when_done_ == nullptr);
 }
 
@@ -59,7 +58,7 @@ void ConstraintBuilder::MaybeAddConstraint(
     const mapping::SubmapId& submap_id, const Submap* const submap,
     const mapping::NodeId& node_id,
     const sensor::CompressedPointCloud* const compressed_point_cloud,
-    const std::vector<mapping::TrajectoryNode>& submap_nodes,
+    const Eigen::VectorXf& rotational_scan_matcher_histogram,
     const transform::Rigid3d& initial_pose) {
   if (initial_pose.translation().norm() > options_.max_constraint_distance()) {
     return;
@@ -70,14 +69,15 @@ void ConstraintBuilder::MaybeAddConstraint(
     auto* const constraint = &constraints_.back();
     ++pending_computations_[current_computation_];
     const int current_computation = current_computation_;
-    ScheduleSubmapScanMatcherConstructionAndQueueWorkItem(
-        submap_id, submap_nodes, submap, [=]() EXCLUDES(mutex_) {
-          ComputeConstraint(submap_id, submap, node_id,
-                            false,   /* match_full_submap */
-                            nullptr, /* trajectory_connectivity */
-                            compressed_point_cloud, initial_pose, constraint);
-          FinishComputation(current_computation);
-        });
+    MaybeConstructSubmapScanMatcher(submap_id,
+                                    rotational_scan_matcher_histogram, submap);
+    thread_pool_->Schedule([=]() EXCLUDES(mutex_) {
+      ComputeConstraint(submap_id, submap, node_id,
+                        false,   /* match_full_submap */
+                        nullptr, /* trajectory_connectivity */
+                        compressed_point_cloud, initial_pose, constraint);
+      FinishComputation(current_computation);
+    });
   }
 }
 
@@ -85,7 +85,7 @@ void ConstraintBuilder::MaybeAddGlobalConstraint(
     const mapping::SubmapId& submap_id, const Submap* const submap,
     const mapping::NodeId& node_id,
     const sensor::CompressedPointCloud* const compressed_point_cloud,
-    const std::vector<mapping::TrajectoryNode>& submap_nodes,
+    const Eigen::VectorXf& rotational_scan_matcher_histogram,
     const Eigen::Quaterniond& gravity_alignment,
     mapping::TrajectoryConnectivity* const trajectory_connectivity) {
   common::MutexLocker locker(&mutex_);
@@ -93,14 +93,15 @@ void ConstraintBuilder::MaybeAddGlobalConstraint(
   auto* const constraint = &constraints_.back();
   ++pending_computations_[current_computation_];
   const int current_computation = current_computation_;
-  ScheduleSubmapScanMatcherConstructionAndQueueWorkItem(
-      submap_id, submap_nodes, submap, [=]() EXCLUDES(mutex_) {
-        ComputeConstraint(
-            submap_id, submap, node_id, true, /* match_full_submap */
-            trajectory_connectivity, compressed_point_cloud,
-            transform::Rigid3d::Rotation(gravity_alignment), constraint);
-        FinishComputation(current_computation);
-      });
+  MaybeConstructSubmapScanMatcher(submap_id, rotational_scan_matcher_histogram,
+                                  submap);
+  thread_pool_->Schedule([=]() EXCLUDES(mutex_) {
+    ComputeConstraint(submap_id, submap, node_id, true, /* match_full_submap */
+                      trajectory_connectivity, compressed_point_cloud,
+                      transform::Rigid3d::Rotation(gravity_alignment),
+                      constraint);
+    FinishComputation(current_computation);
+  });
 }
 
 void ConstraintBuilder::NotifyEndOfScan() {
@@ -120,49 +121,78 @@ void ConstraintBuilder::WhenDone(
       [this, current_computation] { FinishComputation(current_computation); });
 }
 
-void ConstraintBuilder::ScheduleSubmapScanMatcherConstructionAndQueueWorkItem(
+void ConstraintBuilder::MaybeConstructSubmapScanMatcher(
     const mapping::SubmapId& submap_id,
-    const std::vector<mapping::TrajectoryNode>& submap_nodes,
-    const Submap* const submap, const std::function<void()> work_item) {
-  if (submap_scan_matchers_[submap_id].fast_correlative_scan_matcher !=
-      nullptr) {
-    thread_pool_->Schedule(work_item);
-  } else {
-    submap_queued_work_items_[submap_id].push_back(work_item);
-    if (submap_queued_work_items_[submap_id].size() == 1) {
-      thread_pool_->Schedule([=]() {
-        ConstructSubmapScanMatcher(submap_id, submap_nodes, submap);
-      });
-    }
+    const Eigen::VectorXf& rotational_scan_matcher_histogram,
+    const Submap* const submap) {
+  if (submap_scan_matchers_.count(submap_id) != 0) {
+    return;
   }
+  submap_scan_matchers_[submap_id] = {
+      &submap->high_resolution_hybrid_grid(),
+      &submap->low_resolution_hybrid_grid(),
+      common::make_unique<scan_matching::FastCorrelativeScanMatcher>(
+          submap->high_resolution_hybrid_grid(),
+          rotational_scan_matcher_histogram,
+          options_.fast_correlative_scan_matcher_options_3d(), thread_pool_)};
 }
 
-void ConstraintBuilder::ConstructSubmapScanMatcher(
-    const mapping::SubmapId& submap_id,
-    const std::vector<mapping::TrajectoryNode>& submap_nodes,
-    const Submap* const submap) {
+bool ConstraintBuilder::AddSubmapScanMatcherFromProto(
+    const mapping::SubmapId& submap_id, const Submap* const submap,
+    const scan_matching::proto::PrecomputationGridStack& proto) {
+  if (!scan_matching::FastCorrelativeScanMatcher::IsUpToDate(
+          submap->high_resolution_hybrid_grid(), proto,
+          options_.fast_correlative_scan_matcher_options_3d())) {
+    LOG(WARNING) << "Ignoring stale precomputation grids for submap "
+                 << submap_id << ".";
+    return false;
+  }
   auto submap_scan_matcher =
       common::make_unique<scan_matching::FastCorrelativeScanMatcher>(
-          submap->high_resolution_hybrid_grid(), submap_nodes,
-          options_.fast_correlative_scan_matcher_options_3d());
+          submap->high_resolution_hybrid_grid(), proto,
+          options_.fast_correlative_scan_matcher_options_3d(), thread_pool_);
   common::MutexLocker locker(&mutex_);
-  submap_scan_matchers_[submap_id] = {&submap->high_resolution_hybrid_grid(),
-                                      &submap->low_resolution_hybrid_grid(),
-                                      std::move(submap_scan_matcher)};
-  for (const std::function<void()>& work_item :
-       submap_queued_work_items_[submap_id]) {
-    thread_pool_->Schedule(work_item);
+  // Keep a scan matcher that is already there.
+  if (submap_scan_matchers_.count(submap_id) == 0) {
+    submap_scan_matchers_[submap_id] = {&submap->high_resolution_hybrid_grid(),
+                                        &submap->low_resolution_hybrid_grid(),
+                                        std::move(submap_scan_matcher)};
+  }
+  return true;
+}
+
+scan_matching::proto::PrecomputationGridStack
+ConstraintBuilder::SubmapScanMatcherToProto(
+    const mapping::SubmapId& submap_id, const Submap* const submap,
+    const Eigen::VectorXf& rotational_scan_matcher_histogram) {
+  const scan_matching::FastCorrelativeScanMatcher*
+      fast_correlative_scan_matcher = nullptr;
+  {
+    common::MutexLocker locker(&mutex_);
+    const auto it = submap_scan_matchers_.find(submap_id);
+    if (it != submap_scan_matchers_.end()) {
+      fast_correlative_scan_matcher =
+          it->second.fast_correlative_scan_matcher.get();
+    }
+  }
+  // Constructed scan matchers are never removed, so this can be done without
+  // holding the lock.
+  if (fast_correlative_scan_matcher != nullptr) {
+    return fast_correlative_scan_matcher->ToProto();
   }
-  submap_queued_work_items_.erase(submap_id);
+  return scan_matching::FastCorrelativeScanMatcher(
+             submap->high_resolution_hybrid_grid(),
+             rotational_scan_matcher_histogram,
+             options_.fast_correlative_scan_matcher_options_3d(), thread_pool_)
+      .ToProto();
 }
 
 const ConstraintBuilder::SubmapScanMatcher*
 ConstraintBuilder::GetSubmapScanMatcher(const mapping::SubmapId& submap_id) {
   common::MutexLocker locker(&mutex_);
-  const SubmapScanMatcher* submap_scan_matcher =
-      &submap_scan_matchers_[submap_id];
-  CHECK(submap_scan_matcher->fast_correlative_scan_matcher != nullptr);
-  return submap_scan_matcher;
+  const auto it = submap_scan_matchers_.find(submap_id);
+  CHECK(it != submap_scan_matchers_.end());
+  return &it->second;
 }
 
 void ConstraintBuilder::ComputeConstraint(
@@ -273,7 +303,6 @@ void ConstraintBuilder::FinishComputation(const int computation_index) {
       pending_computations_.erase(computation_index);
     }
     if (pending_computations_.empty()) {
-      CHECK_EQ(submap_queued_work_items_.size(), 0);
       if (when_done_ != nullptr) {
         for (const std::unique_ptr<OptimizationProblem::Constraint>&
                  constraint : constraints_) {
@@ -69,7 +69,9 @@ class ConstraintBuilder {
 
   // Schedules exploring a new constraint between 'submap' identified by
   // 'submap_id', and the 'compressed_point_cloud' for 'node_id'.
-  // The 'initial_pose' is relative to the 'submap'.
+  // The 'initial_pose' is relative to the 'submap'. The
+  // 'rotational_scan_matcher_histogram' is the sum of the histograms of the
+  // scans inserted into the 'submap', in the submap frame.
   //
   // The pointees of 'submap' and 'compressed_point_cloud' must stay valid until
   // all computations are finished.
@@ -77,7 +79,7 @@ class ConstraintBuilder {
       const mapping::SubmapId& submap_id, const Submap* submap,
       const mapping::NodeId& node_id,
       const sensor::CompressedPointCloud* compressed_point_cloud,
-      const std::vector<mapping::TrajectoryNode>& submap_nodes,
+      const Eigen::VectorXf& rotational_scan_matcher_histogram,
       const transform::Rigid3d& initial_pose);
 
   // Schedules exploring a new constraint between 'submap' identified by
@@ -94,7 +96,7 @@ class ConstraintBuilder {
       const mapping::SubmapId& submap_id, const Submap* submap,
       const mapping::NodeId& node_id,
       const sensor::CompressedPointCloud* compressed_point_cloud,
-      const std::vector<mapping::TrajectoryNode>& submap_nodes,
+      const Eigen::VectorXf& rotational_scan_matcher_histogram,
       const Eigen::Quaterniond& gravity_alignment,
       mapping::TrajectoryConnectivity* trajectory_connectivity);
 
@@ -108,6 +110,25 @@ class ConstraintBuilder {
   // Returns the number of consecutive finished scans.
   int GetNumFinishedScans();
 
+  // Restores the scan matcher for the finished 'submap' identified by
+  // 'submap_id' from serialized precomputation grids. Returns false if they
+  // are stale, in which case the scan matcher is built when first needed.
+  //
+  // The pointee of 'submap' must stay valid as long as the scan matcher is
+  // used.
+  bool AddSubmapScanMatcherFromProto(
+      const mapping::SubmapId& submap_id, const Submap* submap,
+      const scan_matching::proto::PrecomputationGridStack& proto)
+      EXCLUDES(mutex_);
+
+  // Serializes the precomputation grids of the scan matcher for the finished
+  // 'submap' identified by 'submap_id'. They are computed if no match needed
+  // them yet.
+  scan_matching::proto::PrecomputationGridStack SubmapScanMatcherToProto(
+      const mapping::SubmapId& submap_id, const Submap* submap,
+      const Eigen::VectorXf& rotational_scan_matcher_histogram)
+      EXCLUDES(mutex_);
+
  private:
   struct SubmapScanMatcher {
     const HybridGrid* high_resolution_hybrid_grid;
@@ -116,18 +137,13 @@ class ConstraintBuilder {
         fast_correlative_scan_matcher;
   };
 
-  // Either schedules the 'work_item', or if needed, schedules the scan matcher
-  // construction and queues the 'work_item'.
-  void ScheduleSubmapScanMatcherConstructionAndQueueWorkItem(
-      const mapping::SubmapId& submap_id,
-      const std::vector<mapping::TrajectoryNode>& submap_nodes,
-      const Submap* submap, std::function<void()> work_item) REQUIRES(mutex_);
-
-  // Constructs the scan matcher for a 'submap', then schedules its work items.
-  void ConstructSubmapScanMatcher(
+  // Constructs the scan matcher for 'submap' if there is none yet. This is
+  // cheap since its precomputation grids are only built once a match passes
+  // the rotational scan matcher.
+  void MaybeConstructSubmapScanMatcher(
       const mapping::SubmapId& submap_id,
-      const std::vector<mapping::TrajectoryNode>& submap_nodes,
-      const Submap* submap) EXCLUDES(mutex_);
+      const Eigen::VectorXf& rotational_scan_matcher_histogram,
+      const Submap* submap) REQUIRES(mutex_);
 
   // Returns the scan matcher for a submap, which has to exist.
   const SubmapScanMatcher* GetSubmapScanMatcher(
@@ -172,15 +188,11 @@ class ConstraintBuilder {
   // keep pointers valid when adding more entries.
   std::deque<std::unique_ptr<Constraint>> constraints_ GUARDED_BY(mutex_);
 
-  // Map of already constructed scan matchers by 'submap_id'.
+  // Map of already constructed scan matchers by 'submap_id'. They are shared
+  // by all threads matching against the same submap.
   std::map<mapping::SubmapId, SubmapScanMatcher> submap_scan_matchers_
       GUARDED_BY(mutex_);
 
-  // Map by 'submap_id' of scan matchers under construction, and the work
-  // to do once construction is done.
-  std::map<mapping::SubmapId, std::vector<std::function<void()>>>
-      submap_queued_work_items_ GUARDED_BY(mutex_);
-
   common::FixedRatioSampler sampler_;
   const sensor::AdaptiveVoxelFilter adaptive_voxel_filter_;
   scan_matching::CeresScanMatcher ceres_scan_matcher_;
@@ -0,0 +1,283 @@
+/*
+ * Copyright 2017 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_3d/sparse_pose_graph/constraint_builder.h"
+
+#include <memory>
+#include <vector>
+
+#include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
+#include "cartographer/common/make_unique.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/thread_pool.h"
+#include "cartographer/mapping/sparse_pose_graph/constraint_builder.h"
+#include "cartographer/mapping_3d/range_data_inserter.h"
+#include "cartographer/mapping_3d/scan_matching/rotational_scan_matcher.h"
+#include "cartographer/mapping_3d/submaps.h"
+#include "cartographer/sensor/compressed_point_cloud.h"
+#include "cartographer/transform/rigid_transform_test_helpers.h"
+#include "cartographer/transform/transform.h"
+#include "gmock/gmock.h"
+
+namespace cartographer {
+namespace mapping_3d {
+namespace sparse_pose_graph {
+namespace {
+
+constexpr int kNumSubmaps = 3;
+constexpr int kRotationalHistogramSize = 30;
+
+class ConstraintBuilderTest : public ::testing::Test {
+ protected:
+  ConstraintBuilderTest() : thread_pool_(2) {
+    // Walls and two posts fix the horizontal pose, the floor fixes the height.
+    for (float s = -1.f; s <= 1.5f; s += 0.1f) {
+      for (float t = -3.f; t <= 3.f; t += 0.1f) {
+        point_cloud_.emplace_back(t, -2.f, s);
+        point_cloud_.emplace_back(t, 2.f, s);
+      }
+      for (float t = -2.f; t <= 2.f; t += 0.1f) {
+        point_cloud_.emplace_back(-3.f, t, s);
+        point_cloud_.emplace_back(3.f, t, s);
+      }
+      point_cloud_.emplace_back(1.f, 0.5f, s);
+      point_cloud_.emplace_back(-1.5f, -1.f, s);
+    }
+    for (float s = -3.f; s <= 3.f; s += 0.2f) {
+      for (float t = -2.f; t <= 2.f; t += 0.2f) {
+        point_cloud_.emplace_back(s, t, -1.f);
+      }
+    }
+    compressed_point_cloud_ =
+        common::make_unique<sensor::CompressedPointCloud>(point_cloud_);
+    histogram_ = scan_matching::RotationalScanMatcher::ComputeHistogram(
+        point_cloud_, kRotationalHistogramSize);
+
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          hit_probability = 0.7,
+          miss_probability = 0.4,
+          num_free_space_voxels = 0,
+        })text");
+    const RangeDataInserter range_data_inserter(
+        CreateRangeDataInserterOptions(parameter_dictionary.get()));
+    for (int i = 0; i != kNumSubmaps; ++i) {
+      const transform::Rigid3d local_pose = transform::Rigid3d::Translation(
+          Eigen::Vector3d(10. * i, -5. * i, 0.));
+      submaps_.push_back(common::make_unique<Submap>(
+          0.1 /* high_resolution */, 0.5 /* low_resolution */,
+          false /* use_hashed_hybrid_grids */, local_pose));
+      submaps_.back()->InsertRangeData(
+          sensor::TransformRangeData(
+              sensor::RangeData{Eigen::Vector3f::Zero(), point_cloud_, {}},
+              local_pose.cast<float>()),
+          range_data_inserter, 10 /* high_resolution_max_range */);
+      submaps_.back()->Finish();
+    }
+  }
+
+  std::unique_ptr<ConstraintBuilder> CreateConstraintBuilder() {
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          sampling_ratio = 1.,
+          max_constraint_distance = 6.,
+          adaptive_voxel_filter = {
+            max_length = 0.3,
+            min_num_points = 200,
+            max_range = 50.,
+          },
+          min_score = 0.5,
+          global_localization_min_score = 0.6,
+          loop_closure_translation_weight = 1.,
+          loop_closure_rotation_weight = 1.,
+          log_matches = false,
+          scan_matcher_cache_max_megabytes = 0.,
+          fast_correlative_scan_matcher = {
+            linear_search_window = 1.,
+            angular_search_window = 0.1,
+            branch_and_bound_depth = 3,
+            num_threads = 1,
+          },
+          ceres_scan_matcher = {
+            occupied_space_weight = 20.,
+            translation_weight = 10.,
+            rotation_weight = 1.,
+            use_analytic_derivatives = true,
+            reuse_problems = false,
+            ceres_solver_options = {
+              use_nonmonotonic_steps = true,
+              max_num_iterations = 50,
+              num_threads = 1,
+            },
+          },
+          fast_correlative_scan_matcher_3d = {
+            branch_and_bound_depth = 4,
+            full_resolution_depth = 2,
+            rotational_histogram_size = 30,
+            min_rotational_score = 0.5,
+            linear_xy_search_window = 0.6,
+            linear_z_search_window = 0.3,
+            angular_search_window = 0.1,
+            num_threads = 1,
+          },
+          high_resolution_adaptive_voxel_filter = {
+            max_length = 0.3,
+            min_num_points = 300,
+            max_range = 15.,
+          },
+          low_resolution_adaptive_voxel_filter = {
+            max_length = 1.,
+            min_num_points = 200,
+            max_range = 60.,
+          },
+          ceres_scan_matcher_3d = {
+            occupied_space_weight_0 = 20.,
+            occupied_space_weight_1 = 10.,
+            translation_weight = 1.,
+            rotation_weight = 1.,
+            only_optimize_yaw = false,
+            reuse_problems = false,
+            ceres_solver_options = {
+              use_nonmonotonic_steps = false,
+              max_num_iterations = 20,
+              num_threads = 1,
+            },
+          },
+        })text");
+    return common::make_unique<ConstraintBuilder>(
+        mapping::sparse_pose_graph::CreateConstraintBuilderOptions(
+            parameter_dictionary.get()),
+        &thread_pool_);
+  }
+
+  // Matches two nodes against each submap, starting from relative poses
+  // perturbed by whole voxels, and waits for the resulting constraints. The
+  // submaps are described by 'rotational_scan_matcher_histogram'.
+  ConstraintBuilder::Result ComputeConstraints(
+      ConstraintBuilder* const constraint_builder,
+      const Eigen::VectorXf& rotational_scan_matcher_histogram) {
+    int node_index = 0;
+    for (int i = 0; i != kNumSubmaps; ++i) {
+      for (const transform::Rigid3d& initial_relative_pose :
+           {transform::Rigid3d(
+                Eigen::Vector3d(0.1, -0.1, 0.),
+                transform::AngleAxisVectorToRotationQuaternion(
+                    Eigen::Vector3d(0., 0., 0.02))),
+            transform::Rigid3d(
+                Eigen::Vector3d(-0.2, 0.1, 0.1),
+                transform::AngleAxisVectorToRotationQuaternion(
+                    Eigen::Vector3d(0., 0., -0.03)))}) {
+        constraint_builder->MaybeAddConstraint(
+            mapping::SubmapId{0, i}, submaps_[i].get(),
+            mapping::NodeId{0, node_index++}, compressed_point_cloud_.get(),
+            rotational_scan_matcher_histogram, initial_relative_pose);
+        constraint_builder->NotifyEndOfScan();
+      }
+    }
+    ConstraintBuilder::Result result;
+    {
+      common::MutexLocker locker(&mutex_);
+      done_ = false;
+    }
+    constraint_builder->WhenDone(
+        [this, &result](const ConstraintBuilder::Result& constraints) {
+          common::MutexLocker locker(&mutex_);
+          result = constraints;
+          done_ = true;
+        });
+    common::MutexLocker locker(&mutex_);
+    locker.Await([this]() REQUIRES(mutex_) { return done_; });
+    return result;
+  }
+
+  void ExpectAllConstraintsFound(const ConstraintBuilder::Result& result) {
+    ASSERT_EQ(2 * kNumSubmaps, result.size());
+    for (const auto& constraint : result) {
+      // The scans were inserted at the origin of each submap.
+      EXPECT_THAT(constraint.pose.zbar_ij,
+                  transform::IsNearly(transform::Rigid3d::Identity(), 0.1));
+    }
+  }
+
+  // Outlives the threads of 'thread_pool_' which run the 'WhenDone' callback.
+  common::Mutex mutex_;
+  bool done_ GUARDED_BY(mutex_) = false;
+  common::ThreadPool thread_pool_;
+  sensor::PointCloud point_cloud_;
+  std::unique_ptr<sensor::CompressedPointCloud> compressed_point_cloud_;
+  Eigen::VectorXf histogram_;
+  std::vector<std::unique_ptr<Submap>> submaps_;
+};
+
+TEST_F(ConstraintBuilderTest, RotationalMismatchGivesNoConstraints) {
+  auto constraint_builder = CreateConstraintBuilder();
+  // The submaps seem to contain the scans rotated by 45 degrees, which is
+  // outside of the angular search window.
+  const Eigen::VectorXf rotated_histogram =
+      scan_matching::RotationalScanMatcher::ComputeHistogram(
+          sensor::TransformPointCloud(
+              point_cloud_,
+              transform::Rigid3f::Rotation(Eigen::AngleAxisf(
+                  M_PI / 4., Eigen::Vector3f::UnitZ()))),
+          kRotationalHistogramSize);
+  EXPECT_TRUE(
+      ComputeConstraints(constraint_builder.get(), rotated_histogram).empty());
+
+  // The precomputation grids of the scan matchers which never matched are the
+  // same as those of fresh ones.
+  auto other_constraint_builder = CreateConstraintBuilder();
+  for (int i = 0; i != kNumSubmaps; ++i) {
+    const mapping::SubmapId submap_id{0, i};
+    EXPECT_EQ(other_constraint_builder
+                  ->SubmapScanMatcherToProto(submap_id, submaps_[i].get(),
+                                             rotated_histogram)
+                  .SerializeAsString(),
+              constraint_builder
+                  ->SubmapScanMatcherToProto(submap_id, submaps_[i].get(),
+                                             rotated_histogram)
+                  .SerializeAsString());
+  }
+}
+
+TEST_F(ConstraintBuilderTest, RestoresScanMatchersFromProto) {
+  auto constraint_builder = CreateConstraintBuilder();
+  const ConstraintBuilder::Result expected =
+      ComputeConstraints(constraint_builder.get(), histogram_);
+  ExpectAllConstraintsFound(expected);
+
+  auto restored_constraint_builder = CreateConstraintBuilder();
+  for (int i = 0; i != kNumSubmaps; ++i) {
+    const mapping::SubmapId submap_id{0, i};
+    EXPECT_TRUE(restored_constraint_builder->AddSubmapScanMatcherFromProto(
+        submap_id, submaps_[i].get(),
+        constraint_builder->SubmapScanMatcherToProto(
+            submap_id, submaps_[i].get(), histogram_)));
+  }
+  const ConstraintBuilder::Result actual =
+      ComputeConstraints(restored_constraint_builder.get(), histogram_);
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i != expected.size(); ++i) {
+    EXPECT_EQ(expected[i].submap_id, actual[i].submap_id);
+    EXPECT_EQ(expected[i].node_id.node_index, actual[i].node_id.node_index);
+    EXPECT_THAT(actual[i].pose.zbar_ij,
+                transform::IsNearly(expected[i].pose.zbar_ij, 1e-9));
+  }
+}
+
+}  // namespace
+}  // namespace sparse_pose_graph
+}  // namespace mapping_3d
+}  // namespace cartographer
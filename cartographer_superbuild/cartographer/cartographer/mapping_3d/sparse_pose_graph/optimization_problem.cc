@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
@@ -69,6 +70,18 @@ struct ConstantYawQuaternionPlus {
   }
 };
 
+// Returns an iterator to the last datum of 'imu_data' not after 'time', or to
+// the first datum if there is none.
+std::deque<sensor::ImuData>::const_iterator FindImuData(
+    const std::deque<sensor::ImuData>& imu_data, const common::Time time) {
+  CHECK(!imu_data.empty());
+  auto it = imu_data.cbegin();
+  while ((it + 1) != imu_data.cend() && (it + 1)->time <= time) {
+    ++it;
+  }
+  return it;
+}
+
 }  // namespace
 
 OptimizationProblem::OptimizationProblem(
@@ -97,6 +110,51 @@ void OptimizationProblem::AddTrajectoryNode(
   node_data_.resize(
       std::max(node_data_.size(), static_cast<size_t>(trajectory_id) + 1));
   node_data_[trajectory_id].push_back(NodeData{time, point_cloud_pose});
+  preintegrated_imu_data_.resize(node_data_.size());
+  preintegrated_imu_data_[trajectory_id].emplace_back();
+  // The first node of a trajectory might be added before any IMU data.
+  imu_data_.resize(std::max(imu_data_.size(), node_data_.size()));
+
+  const auto& node_data = node_data_[trajectory_id];
+  auto& preintegrated_imu_data = preintegrated_imu_data_[trajectory_id];
+  std::deque<sensor::ImuData>& imu_data = imu_data_[trajectory_id];
+  const size_t node_index = node_data.size() - 1;
+  if (node_index >= 1) {
+    auto it = FindImuData(imu_data, node_data[node_index - 1].time);
+    preintegrated_imu_data[node_index].delta_rotation =
+        IntegrateImu(imu_data, node_data[node_index - 1].time,
+                     node_data[node_index].time, &it)
+            .delta_rotation;
+  }
+  if (node_index >= 2) {
+    // Now that the next node is known, the velocity change around the
+    // previous node can be integrated.
+    const common::Time first_time = node_data[node_index - 2].time;
+    const common::Time second_time = node_data[node_index - 1].time;
+    const common::Time third_time = node_data[node_index].time;
+    const common::Time first_center =
+        first_time + (second_time - first_time) / 2;
+    const common::Time second_center =
+        second_time + (third_time - second_time) / 2;
+    auto it = FindImuData(imu_data, first_time);
+    const IntegrateImuResult<double> result_to_first_center =
+        IntegrateImu(imu_data, first_time, first_center, &it);
+    const IntegrateImuResult<double> result_center_to_center =
+        IntegrateImu(imu_data, first_center, second_center, &it);
+    PreintegratedImuData& previous_node_imu_data =
+        preintegrated_imu_data[node_index - 1];
+    previous_node_imu_data.delta_velocity =
+        (previous_node_imu_data.delta_rotation.inverse() *
+         result_to_first_center.delta_rotation) *
+        result_center_to_center.delta_velocity;
+  }
+
+  // Only IMU data from the second to last node on is needed from now on.
+  const common::Time oldest_needed_time =
+      node_data[node_index == 0 ? 0 : node_index - 1].time;
+  while (imu_data.size() > 1 && imu_data[1].time <= oldest_needed_time) {
+    imu_data.pop_front();
+  }
 }
 
 void OptimizationProblem::AddSubmap(const int trajectory_id,
@@ -218,46 +276,21 @@ void OptimizationProblem::Solve(const std::vector<Constraint>& constraints,
     TrajectoryData& trajectory_data = trajectory_data_.at(trajectory_id);
     problem.AddParameterBlock(trajectory_data.imu_calibration.data(), 4,
                               new ceres::QuaternionParameterization());
-    const std::deque<sensor::ImuData>& imu_data = imu_data_.at(trajectory_id);
-    CHECK(!imu_data.empty());
-
-    // Skip IMU data before the first node of this trajectory.
-    auto it = imu_data.cbegin();
-    while ((it + 1) != imu_data.cend() && (it + 1)->time <= node_data[0].time) {
-      ++it;
-    }
+    const auto& preintegrated_imu_data =
+        preintegrated_imu_data_.at(trajectory_id);
 
     for (size_t node_index = 1; node_index < node_data.size(); ++node_index) {
-      auto it2 = it;
-      const IntegrateImuResult<double> result =
-          IntegrateImu(imu_data, node_data[node_index - 1].time,
-                       node_data[node_index].time, &it);
       if (node_index + 1 < node_data.size()) {
-        const common::Time first_time = node_data[node_index - 1].time;
-        const common::Time second_time = node_data[node_index].time;
-        const common::Time third_time = node_data[node_index + 1].time;
-        const common::Duration first_duration = second_time - first_time;
-        const common::Duration second_duration = third_time - second_time;
-        const common::Time first_center = first_time + first_duration / 2;
-        const common::Time second_center = second_time + second_duration / 2;
-        const IntegrateImuResult<double> result_to_first_center =
-            IntegrateImu(imu_data, first_time, first_center, &it2);
-        const IntegrateImuResult<double> result_center_to_center =
-            IntegrateImu(imu_data, first_center, second_center, &it2);
-        // 'delta_velocity' is the change in velocity from the point in time
-        // halfway between the first and second poses to halfway between second
-        // and third pose. It is computed from IMU data and still contains a
-        // delta due to gravity. The orientation of this vector is in the IMU
-        // frame at the second pose.
-        const Eigen::Vector3d delta_velocity =
-            (result.delta_rotation.inverse() *
-             result_to_first_center.delta_rotation) *
-            result_center_to_center.delta_velocity;
+        const common::Duration first_duration =
+            node_data[node_index].time - node_data[node_index - 1].time;
+        const common::Duration second_duration =
+            node_data[node_index + 1].time - node_data[node_index].time;
         problem.AddResidualBlock(
             new ceres::AutoDiffCostFunction<AccelerationCostFunction, 3, 4, 3,
                                             3, 3, 1, 4>(
                 new AccelerationCostFunction(
-                    options_.acceleration_weight(), delta_velocity,
+                    options_.acceleration_weight(),
+                    preintegrated_imu_data[node_index].delta_velocity,
                     common::ToSeconds(first_duration),
                     common::ToSeconds(second_duration))),
             nullptr, C_nodes[trajectory_id].at(node_index).rotation(),
@@ -269,8 +302,9 @@ void OptimizationProblem::Solve(const std::vector<Constraint>& constraints,
       }
       problem.AddResidualBlock(
           new ceres::AutoDiffCostFunction<RotationCostFunction, 3, 4, 4, 4>(
-              new RotationCostFunction(options_.rotation_weight(),
-                                       result.delta_rotation)),
+              new RotationCostFunction(
+                  options_.rotation_weight(),
+                  preintegrated_imu_data[node_index].delta_rotation)),
           nullptr, C_nodes[trajectory_id].at(node_index - 1).rotation(),
           C_nodes[trajectory_id].at(node_index).rotation(),
           trajectory_data.imu_calibration.data());
@@ -330,6 +364,11 @@ const std::vector<std::vector<SubmapData>>& OptimizationProblem::submap_data()
   return submap_data_;
 }
 
+const std::vector<std::vector<PreintegratedImuData>>&
+OptimizationProblem::preintegrated_imu_data() const {
+  return preintegrated_imu_data_;
+}
+
 }  // namespace sparse_pose_graph
 }  // namespace mapping_3d
 }  // namespace cartographer
@@ -44,6 +44,18 @@ struct SubmapData {
   transform::Rigid3d pose;
 };
 
+// IMU data integrated between a node and its neighbors. This is done once when
+// nodes are added, without the IMU calibration which is only applied by the
+// cost functions.
+struct PreintegratedImuData {
+  // Rotation from the previous node to this node.
+  Eigen::Quaterniond delta_rotation = Eigen::Quaterniond::Identity();
+  // Change in velocity from halfway between the previous node and this node
+  // to halfway between this node and the next node. It still contains a delta
+  // due to gravity and is in the IMU frame at this node.
+  Eigen::Vector3d delta_velocity = Eigen::Vector3d::Zero();
+};
+
 // Implements the SPA loop closure method.
 class OptimizationProblem {
  public:
@@ -63,6 +75,8 @@ class OptimizationProblem {
   void AddImuData(int trajectory_id, common::Time time,
                   const Eigen::Vector3d& linear_acceleration,
                   const Eigen::Vector3d& angular_velocity);
+  // Adds a node and integrates the IMU data up to it. Except for the first node
+  // of a trajectory, IMU data up to 'time' must have been added before.
   void AddTrajectoryNode(int trajectory_id, common::Time time,
                          const transform::Rigid3d& point_cloud_pose);
   void AddSubmap(int trajectory_id, const transform::Rigid3d& submap_pose);
@@ -75,6 +89,8 @@ class OptimizationProblem {
 
   const std::vector<std::vector<NodeData>>& node_data() const;
   const std::vector<std::vector<SubmapData>>& submap_data() const;
+  const std::vector<std::vector<PreintegratedImuData>>& preintegrated_imu_data()
+      const;
 
  private:
   struct TrajectoryData {
@@ -84,8 +100,11 @@ class OptimizationProblem {
 
   mapping::sparse_pose_graph::proto::OptimizationProblemOptions options_;
   FixZ fix_z_;
+  // IMU data which has not been integrated yet, starting with the last datum
+  // not after the second to last node of each trajectory.
   std::vector<std::deque<sensor::ImuData>> imu_data_;
   std::vector<std::vector<NodeData>> node_data_;
+  std::vector<std::vector<PreintegratedImuData>> preintegrated_imu_data_;
   std::vector<std::vector<SubmapData>> submap_data_;
   std::vector<TrajectoryData> trajectory_data_;
 };
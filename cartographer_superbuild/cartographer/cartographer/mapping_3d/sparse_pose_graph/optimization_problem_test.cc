@@ -16,12 +16,17 @@
 
 #include "cartographer/mapping_3d/sparse_pose_graph/optimization_problem.h"
 
+#include <cmath>
+#include <deque>
 #include <random>
+#include <vector>
 
 #include "Eigen/Core"
 #include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
 #include "cartographer/common/time.h"
 #include "cartographer/mapping/sparse_pose_graph/optimization_problem_options.h"
+#include "cartographer/mapping_3d/imu_integration.h"
+#include "cartographer/sensor/imu_data.h"
 #include "cartographer/transform/transform.h"
 #include "glog/logging.h"
 #include "gmock/gmock.h"
@@ -185,6 +190,105 @@ TEST_F(OptimizationProblemTest, ReducesNoise) {
   EXPECT_GT(0.8 * rotation_error_before, rotation_error_after);
 }
 
+TEST_F(OptimizationProblemTest, PreintegratesImuData) {
+  constexpr int kNumNodes = 20;
+  const int kTrajectoryId = 0;
+  const common::Time start_time = common::FromUniversal(0);
+
+  // IMU data at 400 Hz with smoothly varying measurements, and nodes at about
+  // 10 Hz whose times do not coincide with IMU data.
+  std::deque<sensor::ImuData> all_imu_data;
+  for (int i = 0; i != 4 * kNumNodes * 10 + 10; ++i) {
+    const double t = 0.0025 * i;
+    all_imu_data.push_back(sensor::ImuData{
+        start_time + common::FromSeconds(t),
+        Eigen::Vector3d(std::sin(3. * t), 0.5 * std::cos(2. * t),
+                        9.81 + 0.2 * std::sin(t)),
+        Eigen::Vector3d(0.3 * std::cos(t), -0.2 * std::sin(2. * t),
+                        0.5 + 0.1 * std::cos(5. * t))});
+  }
+  std::vector<common::Time> node_times;
+  for (int j = 0; j != kNumNodes; ++j) {
+    node_times.push_back(
+        start_time + common::FromSeconds(0.001 + 0.1 * j + 0.013 * (j % 3)));
+  }
+
+  auto imu_it = all_imu_data.cbegin();
+  for (const common::Time node_time : node_times) {
+    for (; imu_it != all_imu_data.cend() && imu_it->time <= node_time;
+         ++imu_it) {
+      optimization_problem_.AddImuData(kTrajectoryId, imu_it->time,
+                                       imu_it->linear_acceleration,
+                                       imu_it->angular_velocity);
+    }
+    optimization_problem_.AddTrajectoryNode(kTrajectoryId, node_time,
+                                            transform::Rigid3d::Identity());
+  }
+
+  // Integrates all IMU data between two points in time.
+  const auto integrate = [&all_imu_data](const common::Time start,
+                                         const common::Time end) {
+    auto it = all_imu_data.cbegin();
+    while ((it + 1)->time <= start) {
+      ++it;
+    }
+    return IntegrateImu(all_imu_data, start, end, &it);
+  };
+  const auto& preintegrated_imu_data =
+      optimization_problem_.preintegrated_imu_data().at(kTrajectoryId);
+  ASSERT_EQ(kNumNodes, preintegrated_imu_data.size());
+  for (int j = 1; j != kNumNodes; ++j) {
+    const IntegrateImuResult<double> result =
+        integrate(node_times[j - 1], node_times[j]);
+    EXPECT_NEAR(0., preintegrated_imu_data[j].delta_rotation.angularDistance(
+                        result.delta_rotation),
+                1e-12)
+        << j;
+    if (j + 1 == kNumNodes) {
+      // The velocity change around the last node is not known yet.
+      EXPECT_EQ(Eigen::Vector3d::Zero(),
+                preintegrated_imu_data[j].delta_velocity);
+      continue;
+    }
+    const common::Time first_center =
+        node_times[j - 1] + (node_times[j] - node_times[j - 1]) / 2;
+    const common::Time second_center =
+        node_times[j] + (node_times[j + 1] - node_times[j]) / 2;
+    const Eigen::Vector3d expected_delta_velocity =
+        (result.delta_rotation.inverse() *
+         integrate(node_times[j - 1], first_center).delta_rotation) *
+        integrate(first_center, second_center).delta_velocity;
+    EXPECT_NEAR(0.,
+                (expected_delta_velocity -
+                 preintegrated_imu_data[j].delta_velocity)
+                    .norm(),
+                1e-12)
+        << j;
+  }
+}
+
+TEST_F(OptimizationProblemTest, AddsFirstNodeBeforeImuData) {
+  const common::Time time = common::FromUniversal(0);
+  optimization_problem_.AddTrajectoryNode(0, time,
+                                          transform::Rigid3d::Identity());
+  optimization_problem_.AddTrajectoryNode(1, time,
+                                          transform::Rigid3d::Identity());
+  optimization_problem_.AddImuData(1, time, Eigen::Vector3d::UnitZ() * 9.81,
+                                   Eigen::Vector3d::UnitZ());
+  optimization_problem_.AddTrajectoryNode(1, time + common::FromSeconds(0.1),
+                                          transform::Rigid3d::Identity());
+
+  const auto& preintegrated_imu_data =
+      optimization_problem_.preintegrated_imu_data();
+  ASSERT_EQ(2, preintegrated_imu_data.size());
+  EXPECT_EQ(1, preintegrated_imu_data[0].size());
+  ASSERT_EQ(2, preintegrated_imu_data[1].size());
+  EXPECT_NEAR(0.1,
+              transform::GetAngle(transform::Rigid3d::Rotation(
+                  preintegrated_imu_data[1][1].delta_rotation)),
+              1e-12);
+}
+
 }  // namespace
 }  // namespace sparse_pose_graph
 }  // namespace mapping_3d
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/mapping_3d/sparse_pose_graph.h"
+
+#include <memory>
+
+#include "cartographer/common/lua_parameter_dictionary_test_helpers.h"
+#include "cartographer/common/make_unique.h"
+#include "cartographer/common/seqlock.h"
+#include "cartographer/common/thread_pool.h"
+#include "cartographer/mapping_3d/submaps.h"
+#include "cartographer/transform/rigid_transform.h"
+#include "cartographer/transform/rigid_transform_test_helpers.h"
+#include "cartographer/transform/transform.h"
+#include "gmock/gmock.h"
+
+namespace cartographer {
+namespace mapping_3d {
+namespace {
+
+class SparsePoseGraphTest : public ::testing::Test {
+ protected:
+  SparsePoseGraphTest() : thread_pool_(1) {
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          optimize_every_n_scans = 1000,
+          constraint_builder = {
+            sampling_ratio = 1.,
+            max_constraint_distance = 6.,
+            adaptive_voxel_filter = {
+              max_length = 1e-2,
+              min_num_points = 1000,
+              max_range = 50.,
+            },
+            min_score = 0.5,
+            global_localization_min_score = 0.6,
+            loop_closure_translation_weight = 1.,
+            loop_closure_rotation_weight = 1.,
+            log_matches = true,
+            scan_matcher_cache_max_megabytes = 0.,
+            fast_correlative_scan_matcher = {
+              linear_search_window = 3.,
+              angular_search_window = 0.1,
+              branch_and_bound_depth = 3,
+              num_threads = 1,
+            },
+            ceres_scan_matcher = {
+              occupied_space_weight = 20.,
+              translation_weight = 10.,
+              rotation_weight = 1.,
+              use_analytic_derivatives = true,
+              reuse_problems = false,
+              ceres_solver_options = {
+                use_nonmonotonic_steps = true,
+                max_num_iterations = 50,
+                num_threads = 1,
+              },
+            },
+            fast_correlative_scan_matcher_3d = {
+              branch_and_bound_depth = 3,
+              full_resolution_depth = 3,
+              rotational_histogram_size = 30,
+              min_rotational_score = 0.1,
+              linear_xy_search_window = 4.,
+              linear_z_search_window = 4.,
+              angular_search_window = 0.1,
+              num_threads = 1,
+            },
+            high_resolution_adaptive_voxel_filter = {
+              max_length = 2.,
+              min_num_points = 150,
+              max_range = 15.,
+            },
+            low_resolution_adaptive_voxel_filter = {
+              max_length = 4.,
+              min_num_points = 200,
+              max_range = 60.,
+            },
+            ceres_scan_matcher_3d = {
+              occupied_space_weight_0 = 20.,
+              translation_weight = 10.,
+              rotation_weight = 1.,
+              only_optimize_yaw = true,
+              reuse_problems = false,
+              ceres_solver_options = {
+                use_nonmonotonic_steps = true,
+                max_num_iterations = 50,
+                num_threads = 1,
+              },
+            },
+          },
+          matcher_translation_weight = 1.,
+          matcher_rotation_weight = 1.,
+          optimization_problem = {
+            acceleration_weight = 1.,
+            rotation_weight = 1e2,
+            huber_scale = 1.,
+            consecutive_scan_translation_penalty_factor = 0.,
+            consecutive_scan_rotation_penalty_factor = 0.,
+            log_solver_summary = true,
+            ceres_solver_options = {
+              use_nonmonotonic_steps = false,
+              max_num_iterations = 200,
+              num_threads = 1,
+            },
+          },
+          max_num_final_iterations = 200,
+          global_sampling_ratio = 0.01,
+          place_recognition_num_candidates = 0,
+          place_recognition_max_range = 30.,
+        })text");
+    sparse_pose_graph_ = common::make_unique<SparsePoseGraph>(
+        mapping::CreateSparsePoseGraphOptions(parameter_dictionary.get()),
+        &thread_pool_);
+  }
+
+  common::ThreadPool thread_pool_;
+  std::unique_ptr<SparsePoseGraph> sparse_pose_graph_;
+};
+
+TEST_F(SparsePoseGraphTest, LocalToGlobalTransformSnapshotIsUpdated) {
+  constexpr int kLoadedTrajectoryId = 0;
+  const common::SeqLock<transform::Rigid3d>& snapshot =
+      sparse_pose_graph_->GetLocalToGlobalTransformSnapshot(
+          kLoadedTrajectoryId);
+  EXPECT_THAT(snapshot.Read(),
+              transform::IsNearly(transform::Rigid3d::Identity(), 1e-9));
+
+  sparse_pose_graph_->FreezeTrajectory(kLoadedTrajectoryId);
+  const transform::Rigid3d local_submap_pose =
+      transform::Rigid3d::Translation(Eigen::Vector3d(0.5, -0.5, 0.2));
+  Submap submap(0.1 /* high_resolution */, 0.5 /* low_resolution */,
+                false /* use_hashed_hybrid_grids */, local_submap_pose);
+  submap.Finish();
+  mapping::proto::Submap proto;
+  submap.ToProto(&proto);
+  const transform::Rigid3d global_submap_pose(
+      Eigen::Vector3d(1., 2., 3.),
+      transform::AngleAxisVectorToRotationQuaternion(
+          Eigen::Vector3d(0.1, -0.2, 0.3)));
+  sparse_pose_graph_->AddSubmapFromProto(kLoadedTrajectoryId,
+                                         global_submap_pose, proto);
+  EXPECT_THAT(snapshot.Read(),
+              transform::IsNearly(sparse_pose_graph_->GetLocalToGlobalTransform(
+                                      kLoadedTrajectoryId),
+                                  1e-9));
+  EXPECT_THAT(snapshot.Read(),
+              transform::IsNearly(
+                  global_submap_pose * local_submap_pose.inverse(), 1e-9));
+
+  sparse_pose_graph_->RunFinalOptimization();
+  EXPECT_THAT(snapshot.Read(),
+              transform::IsNearly(sparse_pose_graph_->GetLocalToGlobalTransform(
+                                      kLoadedTrajectoryId),
+                                  1e-9));
+}
+
+}  // namespace
+}  // namespace mapping_3d
+}  // namespace cartographer
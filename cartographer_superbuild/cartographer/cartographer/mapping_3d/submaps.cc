@@ -16,8 +16,11 @@
 
 #include "cartographer/mapping_3d/submaps.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
+#include <unordered_map>
+#include <vector>
 
 #include "cartographer/common/math.h"
 #include "cartographer/sensor/range_data.h"
@@ -50,100 +53,70 @@ sensor::RangeData FilterRangeDataByMaxRange(const sensor::RangeData& range_data,
   return result;
 }
 
-std::vector<PixelData> AccumulatePixelData(
-    const int width, const int height, const Eigen::Array2i& min_index,
-    const Eigen::Array2i& max_index,
-    const std::vector<Eigen::Array4i>& voxel_indices_and_probabilities) {
-  std::vector<PixelData> accumulated_pixel_data(width * height);
-  for (const Eigen::Array4i& voxel_index_and_probability :
-       voxel_indices_and_probabilities) {
-    const Eigen::Array2i pixel_index = voxel_index_and_probability.head<2>();
-    if ((pixel_index < min_index).any() || (pixel_index > max_index).any()) {
-      // Out of bounds. This could happen because of floating point inaccuracy.
-      continue;
-    }
-    const int x = max_index.x() - pixel_index[0];
-    const int y = max_index.y() - pixel_index[1];
-    PixelData& pixel = accumulated_pixel_data[x * width + y];
-    ++pixel.count;
-    pixel.min_z = std::min(pixel.min_z, voxel_index_and_probability[2]);
-    pixel.max_z = std::max(pixel.max_z, voxel_index_and_probability[2]);
-    const float probability =
-        mapping::ValueToProbability(voxel_index_and_probability[3]);
-    pixel.probability_sum += probability;
-    pixel.max_probability = std::max(pixel.max_probability, probability);
-  }
-  return accumulated_pixel_data;
+uint64 ToColumnKey(const Eigen::Array2i& xy_index) {
+  return (static_cast<uint64>(static_cast<uint32>(xy_index.x())) << 32) |
+         static_cast<uint32>(xy_index.y());
 }
 
-// The first three entries of each returned value are a cell_index and the
-// last is the corresponding probability value. We batch them together like
-// this to only have one vector and have better cache locality.
-std::vector<Eigen::Array4i> ExtractVoxelData(
-    const HybridGrid& hybrid_grid, const transform::Rigid3f& transform,
-    Eigen::Array2i* min_index, Eigen::Array2i* max_index) {
-  std::vector<Eigen::Array4i> voxel_indices_and_probabilities;
-  const float resolution_inverse = 1.f / hybrid_grid.resolution();
+Eigen::Array2i FromColumnKey(const uint64 key) {
+  return Eigen::Array2i(static_cast<int32>(static_cast<uint32>(key >> 32)),
+                        static_cast<int32>(static_cast<uint32>(key)));
+}
 
+// Accumulates the obstructed cells of 'hybrid_grid' at 'xy_index' with z
+// indices in the range ['min_z', 'max_z'].
+PixelData AccumulatePixelData(const HybridGrid& hybrid_grid,
+                              const Eigen::Array2i& xy_index, const int min_z,
+                              const int max_z) {
   constexpr float kXrayObstructedCellProbabilityLimit = 0.501f;
-  for (auto it = HybridGrid::Iterator(hybrid_grid); !it.Done(); it.Next()) {
-    const uint16 probability_value = it.GetValue();
+  PixelData pixel;
+  for (int z = min_z; z <= max_z; ++z) {
+    const uint16 probability_value =
+        hybrid_grid.value(Eigen::Array3i(xy_index.x(), xy_index.y(), z));
+    if (probability_value == 0) {
+      // Unknown cell.
+      continue;
+    }
     const float probability = mapping::ValueToProbability(probability_value);
     if (probability < kXrayObstructedCellProbabilityLimit) {
       // We ignore non-obstructed cells.
       continue;
     }
-
-    const Eigen::Vector3f cell_center_submap =
-        hybrid_grid.GetCenterOfCell(it.GetCellIndex());
-    const Eigen::Vector3f cell_center_global = transform * cell_center_submap;
-    const Eigen::Array4i voxel_index_and_probability(
-        common::RoundToInt(cell_center_global.x() * resolution_inverse),
-        common::RoundToInt(cell_center_global.y() * resolution_inverse),
-        common::RoundToInt(cell_center_global.z() * resolution_inverse),
-        probability_value);
-
-    voxel_indices_and_probabilities.push_back(voxel_index_and_probability);
-    const Eigen::Array2i pixel_index = voxel_index_and_probability.head<2>();
-    *min_index = min_index->cwiseMin(pixel_index);
-    *max_index = max_index->cwiseMax(pixel_index);
+    ++pixel.count;
+    pixel.min_z = std::min(pixel.min_z, z);
+    pixel.max_z = std::max(pixel.max_z, z);
+    pixel.probability_sum += probability;
+    pixel.max_probability = std::max(pixel.max_probability, probability);
   }
-  return voxel_indices_and_probabilities;
+  return pixel;
 }
 
-// Builds texture data containing interleaved value and alpha for the
-// visualization from 'accumulated_pixel_data'.
-string ComputePixelValues(
-    const std::vector<PixelData>& accumulated_pixel_data) {
-  string cell_data;
-  cell_data.reserve(2 * accumulated_pixel_data.size());
+// Writes the interleaved value and alpha used for visualization of 'pixel' to
+// 'cell[0]' and 'cell[1]'.
+void ComputePixelValue(const PixelData& pixel, char* const cell) {
   constexpr float kMinZDifference = 3.f;
   constexpr float kFreeSpaceWeight = 0.15f;
-  for (const PixelData& pixel : accumulated_pixel_data) {
-    // TODO(whess): Take into account submap rotation.
-    // TODO(whess): Document the approach and make it more independent from the
-    // chosen resolution.
-    const float z_difference = pixel.count > 0 ? pixel.max_z - pixel.min_z : 0;
-    if (z_difference < kMinZDifference) {
-      cell_data.push_back(0);  // value
-      cell_data.push_back(0);  // alpha
-      continue;
-    }
-    const float free_space = std::max(z_difference - pixel.count, 0.f);
-    const float free_space_weight = kFreeSpaceWeight * free_space;
-    const float total_weight = pixel.count + free_space_weight;
-    const float free_space_probability = 1.f - pixel.max_probability;
-    const float average_probability = mapping::ClampProbability(
-        (pixel.probability_sum + free_space_probability * free_space_weight) /
-        total_weight);
-    const int delta =
-        128 - mapping::ProbabilityToLogOddsInteger(average_probability);
-    const uint8 alpha = delta > 0 ? 0 : -delta;
-    const uint8 value = delta > 0 ? delta : 0;
-    cell_data.push_back(value);                         // value
-    cell_data.push_back((value || alpha) ? alpha : 1);  // alpha
+  // TODO(whess): Document the approach and make it more independent from the
+  // chosen resolution.
+  const float z_difference = pixel.count > 0 ? pixel.max_z - pixel.min_z : 0;
+  if (z_difference < kMinZDifference) {
+    cell[0] = 0;  // value
+    cell[1] = 0;  // alpha
+    return;
   }
-  return cell_data;
+  const float free_space = std::max(z_difference - pixel.count, 0.f);
+  const float free_space_weight = kFreeSpaceWeight * free_space;
+  const float total_weight = pixel.count + free_space_weight;
+  const float free_space_probability = 1.f - pixel.max_probability;
+  const float average_probability = mapping::ClampProbability(
+      (pixel.probability_sum + free_space_probability * free_space_weight) /
+      total_weight);
+  const int delta =
+      128 - mapping::ProbabilityToLogOddsInteger(average_probability);
+  const uint8 alpha = delta > 0 ? 0 : -delta;
+  const uint8 value = delta > 0 ? delta : 0;
+  cell[0] = value;                         // value
+  cell[1] = (value || alpha) ? alpha : 1;  // alpha
 }
 
 }  // namespace
@@ -158,6 +131,8 @@ proto::SubmapsOptions CreateSubmapsOptions(
   options.set_low_resolution(parameter_dictionary->GetDouble("low_resolution"));
   options.set_num_range_data(
       parameter_dictionary->GetNonNegativeInt("num_range_data"));
+  options.set_use_hashed_hybrid_grids(
+      parameter_dictionary->GetBool("use_hashed_hybrid_grids"));
   *options.mutable_range_data_inserter_options() =
       CreateRangeDataInserterOptions(
           parameter_dictionary->GetDictionary("range_data_inserter").get());
@@ -166,10 +141,11 @@ proto::SubmapsOptions CreateSubmapsOptions(
 }
 
 Submap::Submap(const float high_resolution, const float low_resolution,
+               const bool use_hashed_hybrid_grids,
                const transform::Rigid3d& local_pose)
     : mapping::Submap(local_pose),
-      high_resolution_hybrid_grid_(high_resolution),
-      low_resolution_hybrid_grid_(low_resolution) {}
+      high_resolution_hybrid_grid_(high_resolution, use_hashed_hybrid_grids),
+      low_resolution_hybrid_grid_(low_resolution, use_hashed_hybrid_grids) {}
 
 Submap::Submap(const mapping::proto::Submap3D& proto)
     : mapping::Submap(transform::ToRigid3(proto.local_pose())),
@@ -177,6 +153,7 @@ Submap::Submap(const mapping::proto::Submap3D& proto)
       low_resolution_hybrid_grid_(proto.low_resolution_hybrid_grid()) {
   SetNumRangeData(proto.num_range_data());
   finished_ = proto.finished();
+  projection_needs_all_cells_ = true;
 }
 
 void Submap::ToProto(mapping::proto::Submap* const proto) const {
@@ -191,55 +168,129 @@ void Submap::ToProto(mapping::proto::Submap* const proto) const {
 }
 
 void Submap::ToResponseProto(
-    const transform::Rigid3d& global_submap_pose,
+    const transform::Rigid3d&,
     mapping::proto::SubmapQuery::Response* const response) const {
-  response->set_submap_version(num_range_data());
-  // Generate an X-ray view through the 'hybrid_grid', aligned to the xy-plane
-  // in the global map frame.
-  const float resolution = high_resolution_hybrid_grid_.resolution();
-  response->set_resolution(resolution);
+  string cells;
+  {
+    common::MutexLocker locker(&mutex_);
+    if (cached_response_version_ == num_range_data()) {
+      *response = cached_response_;
+      return;
+    }
+    UpdateProjection();
+    response->set_submap_version(num_range_data());
+    const float resolution = high_resolution_hybrid_grid_.resolution();
+    response->set_resolution(resolution);
 
-  // Compute a bounding box for the texture.
-  Eigen::Array2i min_index(INT_MAX, INT_MAX);
-  Eigen::Array2i max_index(INT_MIN, INT_MIN);
-  const std::vector<Eigen::Array4i> voxel_indices_and_probabilities =
-      ExtractVoxelData(high_resolution_hybrid_grid_,
-                       global_submap_pose.cast<float>(), &min_index,
-                       &max_index);
+    // Compute a bounding box for the texture.
+    Eigen::Array2i min_index(INT_MAX, INT_MAX);
+    Eigen::Array2i max_index(INT_MIN, INT_MIN);
+    for (const auto& entry : projected_columns_) {
+      if (entry.second.obstructed) {
+        const Eigen::Array2i xy_index = FromColumnKey(entry.first);
+        min_index = min_index.cwiseMin(xy_index);
+        max_index = max_index.cwiseMax(xy_index);
+      }
+    }
+    if ((min_index > max_index).any()) {
+      // Nothing is obstructed, so the texture is a single transparent pixel.
+      min_index = max_index = Eigen::Array2i::Zero();
+    }
 
-  const int width = max_index.y() - min_index.y() + 1;
-  const int height = max_index.x() - min_index.x() + 1;
-  response->set_width(width);
-  response->set_height(height);
+    const int width = max_index.y() - min_index.y() + 1;
+    const int height = max_index.x() - min_index.x() + 1;
+    response->set_width(width);
+    response->set_height(height);
+    cells.assign(2 * width * height, 0);
+    for (const auto& entry : projected_columns_) {
+      if (entry.second.obstructed) {
+        const Eigen::Array2i xy_index = FromColumnKey(entry.first);
+        const int x = max_index.x() - xy_index.x();
+        const int y = max_index.y() - xy_index.y();
+        cells[2 * (x * width + y)] = entry.second.pixel[0];
+        cells[2 * (x * width + y) + 1] = entry.second.pixel[1];
+      }
+    }
+    *response->mutable_slice_pose() =
+        transform::ToProto(transform::Rigid3d::Translation(Eigen::Vector3d(
+            max_index.x() * resolution, max_index.y() * resolution, 0.)));
+  }
+  // Compression is the most expensive part, so we do it without blocking the
+  // insertion of range data.
+  common::FastGzipString(cells, response->mutable_cells());
 
-  const std::vector<PixelData> accumulated_pixel_data = AccumulatePixelData(
-      width, height, min_index, max_index, voxel_indices_and_probabilities);
-  const string cell_data = ComputePixelValues(accumulated_pixel_data);
+  common::MutexLocker locker(&mutex_);
+  if (response->submap_version() > cached_response_version_) {
+    cached_response_ = *response;
+    cached_response_version_ = response->submap_version();
+  }
+  if (finished_ && cached_response_version_ == num_range_data()) {
+    // The response will not change anymore. Range data may have been inserted
+    // while compressing, in which case the projection is still needed.
+    std::unordered_map<uint64, ProjectedColumn>().swap(projected_columns_);
+    std::vector<uint64>().swap(dirty_columns_);
+  }
+}
 
-  common::FastGzipString(cell_data, response->mutable_cells());
-  *response->mutable_slice_pose() = transform::ToProto(
-      global_submap_pose.inverse() *
-      transform::Rigid3d::Translation(Eigen::Vector3d(
-          max_index.x() * resolution, max_index.y() * resolution,
-          global_submap_pose.translation().z())));
+void Submap::AddToProjection(const std::vector<Eigen::Array3i>& cells) const {
+  for (const Eigen::Array3i& cell : cells) {
+    const uint64 key = ToColumnKey(cell.head<2>());
+    ProjectedColumn& column =
+        projected_columns_
+            .emplace(key, ProjectedColumn{cell.z(), cell.z(), false, false,
+                                          {0, 0}})
+            .first->second;
+    column.min_z = std::min(column.min_z, cell.z());
+    column.max_z = std::max(column.max_z, cell.z());
+    if (!column.dirty) {
+      column.dirty = true;
+      dirty_columns_.push_back(key);
+    }
+  }
+}
+
+void Submap::UpdateProjection() const {
+  if (projection_needs_all_cells_) {
+    std::vector<Eigen::Array3i> cells;
+    for (auto it = HybridGrid::Iterator(high_resolution_hybrid_grid_);
+         !it.Done(); it.Next()) {
+      cells.push_back(it.GetCellIndex());
+    }
+    AddToProjection(cells);
+    projection_needs_all_cells_ = false;
+  }
+  for (const uint64 key : dirty_columns_) {
+    ProjectedColumn& column = projected_columns_.at(key);
+    const PixelData pixel =
+        AccumulatePixelData(high_resolution_hybrid_grid_, FromColumnKey(key),
+                            column.min_z, column.max_z);
+    column.obstructed = pixel.count > 0;
+    ComputePixelValue(pixel, column.pixel);
+    column.dirty = false;
+  }
+  dirty_columns_.clear();
 }
 
 void Submap::InsertRangeData(const sensor::RangeData& range_data,
                              const RangeDataInserter& range_data_inserter,
                              const int high_resolution_max_range) {
+  common::MutexLocker locker(&mutex_);
   CHECK(!finished_);
   const sensor::RangeData transformed_range_data = sensor::TransformRangeData(
       range_data, local_pose().inverse().cast<float>());
+  std::vector<Eigen::Array3i> updated_cells;
   range_data_inserter.Insert(
       FilterRangeDataByMaxRange(transformed_range_data,
                                 high_resolution_max_range),
-      &high_resolution_hybrid_grid_);
+      &high_resolution_hybrid_grid_, &updated_cells);
+  AddToProjection(updated_cells);
   range_data_inserter.Insert(transformed_range_data,
                              &low_resolution_hybrid_grid_);
   SetNumRangeData(num_range_data() + 1);
 }
 
 void Submap::Finish() {
+  common::MutexLocker locker(&mutex_);
   CHECK(!finished_);
   finished_ = true;
 }
@@ -281,7 +332,9 @@ void ActiveSubmaps::AddSubmap(const transform::Rigid3d& local_pose) {
     submaps_.erase(submaps_.begin());
   }
   submaps_.emplace_back(new Submap(options_.high_resolution(),
-                                   options_.low_resolution(), local_pose));
+                                   options_.low_resolution(),
+                                   options_.use_hashed_hybrid_grids(),
+                                   local_pose));
   LOG(INFO) << "Added submap " << matching_submap_index_ + submaps_.size();
 }
 
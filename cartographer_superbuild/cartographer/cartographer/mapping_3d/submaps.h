@@ -19,9 +19,11 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "Eigen/Geometry"
+#include "cartographer/common/mutex.h"
 #include "cartographer/common/port.h"
 #include "cartographer/mapping/id.h"
 #include "cartographer/mapping/proto/serialization.pb.h"
@@ -44,7 +46,7 @@ proto::SubmapsOptions CreateSubmapsOptions(
 class Submap : public mapping::Submap {
  public:
   Submap(float high_resolution, float low_resolution,
-         const transform::Rigid3d& local_pose);
+         bool use_hashed_hybrid_grids, const transform::Rigid3d& local_pose);
   explicit Submap(const mapping::proto::Submap3D& proto);
 
   void ToProto(mapping::proto::Submap* proto) const override;
@@ -57,6 +59,12 @@ class Submap : public mapping::Submap {
   }
   bool finished() const { return finished_; }
 
+  // Responses are an X-ray view through the high resolution hybrid grid along
+  // the z axis of the submap frame, so that they do not depend on
+  // 'global_submap_pose'. They are cached per submap version, only pixels
+  // whose column of voxels changed since the last call are computed again,
+  // and finished submaps are projected only once. As in 2D, the whole texture
+  // is compressed again for each new version.
   void ToResponseProto(
       const transform::Rigid3d& global_submap_pose,
       mapping::proto::SubmapQuery::Response* response) const override;
@@ -69,9 +77,50 @@ class Submap : public mapping::Submap {
   void Finish();
 
  private:
+  // A column of voxels of the high resolution hybrid grid along the z axis,
+  // projected onto a single pixel.
+  struct ProjectedColumn {
+    // Range of z indices of all cells in this column that were ever updated.
+    int min_z;
+    int max_z;
+    // Whether cells changed since the pixel below was last computed.
+    bool dirty;
+    // Whether the column contains an obstructed cell, i.e. whether it is part
+    // of the texture.
+    bool obstructed;
+    // Value and alpha of the pixel.
+    char pixel[2];
+  };
+
+  // Marks the columns of 'cells' as changed.
+  void AddToProjection(const std::vector<Eigen::Array3i>& cells) const
+      REQUIRES(mutex_);
+  // Brings the pixels of all columns marked as changed up to date.
+  void UpdateProjection() const REQUIRES(mutex_);
+
   HybridGrid high_resolution_hybrid_grid_;
   HybridGrid low_resolution_hybrid_grid_;
   bool finished_ = false;
+
+  // Guards the projection and cached visualization below, and
+  // 'high_resolution_hybrid_grid_' against modification while it is being
+  // projected.
+  mutable common::Mutex mutex_;
+
+  // Columns of the high resolution hybrid grid keyed by their packed xy index.
+  // Empty once the response of a finished submap has been cached.
+  mutable std::unordered_map<uint64, ProjectedColumn> projected_columns_
+      GUARDED_BY(mutex_);
+  // Keys of the columns marked as dirty.
+  mutable std::vector<uint64> dirty_columns_ GUARDED_BY(mutex_);
+  // Whether the cells already in the hybrid grid, e.g. of a submap loaded from
+  // a proto, still have to be added to the projection.
+  mutable bool projection_needs_all_cells_ GUARDED_BY(mutex_) = false;
+
+  // Last response handed out and the submap version it was computed for.
+  mutable mapping::proto::SubmapQuery::Response cached_response_
+      GUARDED_BY(mutex_);
+  mutable int cached_response_version_ GUARDED_BY(mutex_) = -1;
 };
 
 // Except during initialization when only a single submap exists, there are
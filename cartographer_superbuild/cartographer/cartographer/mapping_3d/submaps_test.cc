@@ -16,6 +16,10 @@
 
 #include "cartographer/mapping_3d/submaps.h"
 
+#include <atomic>
+#include <thread>
+
+#include "cartographer/mapping_3d/range_data_inserter.h"
 #include "cartographer/transform/transform.h"
 #include "gmock/gmock.h"
 
@@ -23,15 +27,46 @@ namespace cartographer {
 namespace mapping_3d {
 namespace {
 
+proto::RangeDataInserterOptions CreateTestRangeDataInserterOptions() {
+  proto::RangeDataInserterOptions range_data_inserter_options;
+  range_data_inserter_options.set_hit_probability(0.7);
+  range_data_inserter_options.set_miss_probability(0.4);
+  range_data_inserter_options.set_num_free_space_voxels(5);
+  return range_data_inserter_options;
+}
+
+// A wall that moves a bit further away with every scan 'i'.
+sensor::RangeData CreateWallRangeData(const int i) {
+  sensor::RangeData range_data{Eigen::Vector3f(1.f, 2.f, 0.5f), {}, {}};
+  for (float y = -1.f; y <= 1.f; y += 0.04f) {
+    for (float z = 0.f; z <= 1.f; z += 0.04f) {
+      range_data.returns.emplace_back(3.f + 0.1f * i, y, z);
+    }
+  }
+  return range_data;
+}
+
+// Returns the response of a submap restored from the proto of 'submap', which
+// projects all of its cells at once.
+mapping::proto::SubmapQuery::Response ComputeResponseFromProto(
+    const Submap& submap) {
+  mapping::proto::Submap proto;
+  submap.ToProto(&proto);
+  mapping::proto::SubmapQuery::Response response;
+  Submap(proto.submap_3d())
+      .ToResponseProto(transform::Rigid3d::Identity(), &response);
+  return response;
+}
+
 TEST(SubmapsTest, ToFromProto) {
-  const Submap expected(0.05, 0.25,
+  const Submap expected(0.05, 0.25, false /* use_hashed_hybrid_grids */,
                         transform::Rigid3d(Eigen::Vector3d(1., 2., 0.),
                                            Eigen::Quaterniond(0., 0., 0., 1.)));
   mapping::proto::Submap proto;
   expected.ToProto(&proto);
   EXPECT_FALSE(proto.has_submap_2d());
   EXPECT_TRUE(proto.has_submap_3d());
-  const auto actual = Submap(proto.submap_3d());
+  const Submap actual(proto.submap_3d());
   EXPECT_TRUE(expected.local_pose().translation().isApprox(
       actual.local_pose().translation(), 1e-6));
   EXPECT_TRUE(expected.local_pose().rotation().isApprox(
@@ -42,6 +77,93 @@ TEST(SubmapsTest, ToFromProto) {
   EXPECT_NEAR(expected.low_resolution_hybrid_grid().resolution(), 0.25, 1e-6);
 }
 
+TEST(SubmapsTest, ResponseIsUpdatedIncrementally) {
+  const RangeDataInserter range_data_inserter(
+      CreateTestRangeDataInserterOptions());
+  Submap submap(0.05, 0.25, false /* use_hashed_hybrid_grids */,
+                transform::Rigid3d::Translation(Eigen::Vector3d(1., 2., 0.)));
+
+  mapping::proto::SubmapQuery::Response response;
+  for (int i = 0; i != 3; ++i) {
+    submap.InsertRangeData(CreateWallRangeData(i), range_data_inserter,
+                           10 /* high_resolution_max_range */);
+    response.Clear();
+    submap.ToResponseProto(transform::Rigid3d::Identity(), &response);
+    EXPECT_EQ(i + 1, response.submap_version());
+    EXPECT_EQ(ComputeResponseFromProto(submap).SerializeAsString(),
+              response.SerializeAsString());
+  }
+  EXPECT_GT(response.width(), 1);
+  EXPECT_GT(response.height(), 1);
+
+  // Without new range data, the cached response is returned.
+  submap.Finish();
+  mapping::proto::SubmapQuery::Response cached_response;
+  submap.ToResponseProto(transform::Rigid3d::Identity(), &cached_response);
+  EXPECT_EQ(response.SerializeAsString(), cached_response.SerializeAsString());
+}
+
+TEST(SubmapsTest, ResponseIsUpdatedAfterFinishing) {
+  const RangeDataInserter range_data_inserter(
+      CreateTestRangeDataInserterOptions());
+  Submap submap(0.05, 0.25, false /* use_hashed_hybrid_grids */,
+                transform::Rigid3d::Translation(Eigen::Vector3d(1., 2., 0.)));
+  submap.InsertRangeData(CreateWallRangeData(0), range_data_inserter,
+                         10 /* high_resolution_max_range */);
+  mapping::proto::SubmapQuery::Response response;
+  submap.ToResponseProto(transform::Rigid3d::Identity(), &response);
+  EXPECT_EQ(1, response.submap_version());
+
+  submap.InsertRangeData(CreateWallRangeData(1), range_data_inserter,
+                         10 /* high_resolution_max_range */);
+  submap.Finish();
+  const mapping::proto::SubmapQuery::Response expected_response =
+      ComputeResponseFromProto(submap);
+  for (int i = 0; i != 2; ++i) {
+    // The first query projects the last range data, the second one is cached.
+    response.Clear();
+    submap.ToResponseProto(transform::Rigid3d::Identity(), &response);
+    EXPECT_EQ(2, response.submap_version());
+    EXPECT_EQ(expected_response.SerializeAsString(),
+              response.SerializeAsString());
+  }
+}
+
+TEST(SubmapsTest, ResponseIsUpdatedWhenFinishedWhileQuerying) {
+  const RangeDataInserter range_data_inserter(
+      CreateTestRangeDataInserterOptions());
+  // A query may compress its response while the last range data is inserted
+  // and the submap is finished. This races, so it is tried several times.
+  for (int i = 0; i != 100; ++i) {
+    Submap submap(0.05, 0.25, false /* use_hashed_hybrid_grids */,
+                  transform::Rigid3d::Translation(Eigen::Vector3d(1., 2., 0.)));
+    submap.InsertRangeData(CreateWallRangeData(0), range_data_inserter,
+                           10 /* high_resolution_max_range */);
+    std::atomic<bool> querying(false);
+    std::thread query_thread([&submap, &querying]() {
+      mapping::proto::SubmapQuery::Response response;
+      querying = true;
+      do {
+        response.Clear();
+        submap.ToResponseProto(transform::Rigid3d::Identity(), &response);
+      } while (response.submap_version() != 2);
+    });
+    while (!querying) {
+      std::this_thread::yield();
+    }
+    submap.InsertRangeData(CreateWallRangeData(1), range_data_inserter,
+                           10 /* high_resolution_max_range */);
+    submap.Finish();
+    query_thread.join();
+
+    mapping::proto::SubmapQuery::Response response;
+    submap.ToResponseProto(transform::Rigid3d::Identity(), &response);
+    EXPECT_EQ(2, response.submap_version());
+    EXPECT_EQ(ComputeResponseFromProto(submap).SerializeAsString(),
+              response.SerializeAsString());
+  }
+}
+
 }  // namespace
 }  // namespace mapping_3d
 }  // namespace cartographer
@@ -17,6 +17,8 @@
 #include "cartographer/transform/transform_interpolation_buffer.h"
 
 #include <algorithm>
+#include <cmath>
+#include <limits>
 
 #include "Eigen/Core"
 #include "Eigen/Geometry"
@@ -27,16 +29,73 @@
 namespace cartographer {
 namespace transform {
 
+TransformInterpolationBuffer::Segment::Segment(
+    const TimestampedTransform& start, const TimestampedTransform& end)
+    : start_time_(start.time),
+      duration_(common::ToSeconds(end.time - start.time)),
+      start_translation_(start.transform.translation()),
+      delta_translation_(end.transform.translation() -
+                         start.transform.translation()),
+      start_rotation_(start.transform.rotation()),
+      end_rotation_(end.transform.rotation()),
+      dot_(start_rotation_.dot(end_rotation_)),
+      angle_(std::acos(std::abs(dot_))),
+      sin_angle_(std::sin(angle_)) {}
+
+transform::Rigid3d TransformInterpolationBuffer::Segment::Interpolate(
+    const common::Time time) const {
+  const double factor = common::ToSeconds(time - start_time_) / duration_;
+  const Eigen::Vector3d origin =
+      start_translation_ + delta_translation_ * factor;
+  // Same as Eigen's slerp(), but using the precomputed angle.
+  double start_scale = 1. - factor;
+  double end_scale = factor;
+  if (std::abs(dot_) < 1. - std::numeric_limits<double>::epsilon()) {
+    start_scale = std::sin((1. - factor) * angle_) / sin_angle_;
+    end_scale = std::sin(factor * angle_) / sin_angle_;
+  }
+  if (dot_ < 0.) {
+    end_scale = -end_scale;
+  }
+  const Eigen::Quaterniond rotation(start_scale * start_rotation_.coeffs() +
+                                    end_scale * end_rotation_.coeffs());
+  return transform::Rigid3d(origin, rotation);
+}
+
+TransformInterpolationBuffer::Cursor::Cursor(
+    const TransformInterpolationBuffer* const buffer)
+    : buffer_(buffer) {}
+
+transform::Rigid3d TransformInterpolationBuffer::Cursor::Lookup(
+    const common::Time time) {
+  CHECK(buffer_->Has(time)) << "Missing transform for: " << time;
+  CHECK_GE(time, last_time_) << "Lookups have to be in time order.";
+  last_time_ = time;
+  const auto& timestamped_transforms = buffer_->timestamped_transforms_;
+  while (timestamped_transforms[index_].time < time) {
+    ++index_;
+  }
+  const TimestampedTransform& end = timestamped_transforms[index_];
+  if (end.time == time) {
+    return end.transform;
+  }
+  if (segment_index_ != index_) {
+    segment_ = Segment(timestamped_transforms[index_ - 1], end);
+    segment_index_ = index_;
+  }
+  return segment_.Interpolate(time);
+}
+
 void TransformInterpolationBuffer::Push(const common::Time time,
                                         const transform::Rigid3d& transform) {
-  if (deque_.size() > 0) {
+  if (timestamped_transforms_.size() > 0) {
     CHECK_GE(time, latest_time()) << "New transform is older than latest.";
   }
-  deque_.push_back(TimestampedTransform{time, transform});
+  timestamped_transforms_.push_back(TimestampedTransform{time, transform});
 }
 
 bool TransformInterpolationBuffer::Has(const common::Time time) const {
-  if (deque_.empty()) {
+  if (timestamped_transforms_.empty()) {
     return false;
   }
   return earliest_time() <= time && time <= latest_time();
@@ -45,12 +104,12 @@ bool TransformInterpolationBuffer::Has(const common::Time time) const {
 transform::Rigid3d TransformInterpolationBuffer::Lookup(
     const common::Time time) const {
   CHECK(Has(time)) << "Missing transform for: " << time;
-  auto start =
-      std::lower_bound(deque_.begin(), deque_.end(), time,
-                       [](const TimestampedTransform& timestamped_transform,
-                          const common::Time time) {
-                         return timestamped_transform.time < time;
-                       });
+  auto start = std::lower_bound(
+      timestamped_transforms_.begin(), timestamped_transforms_.end(), time,
+      [](const TimestampedTransform& timestamped_transform,
+         const common::Time time) {
+        return timestamped_transform.time < time;
+      });
   auto end = start;
   if (end->time == time) {
     return end->transform;
@@ -59,29 +118,33 @@ transform::Rigid3d TransformInterpolationBuffer::Lookup(
   if (start->time == time) {
     return start->transform;
   }
+  return Segment(*start, *end).Interpolate(time);
+}
 
-  const double duration = common::ToSeconds(end->time - start->time);
-  const double factor = common::ToSeconds(time - start->time) / duration;
-  const Eigen::Vector3d origin =
-      start->transform.translation() +
-      (end->transform.translation() - start->transform.translation()) * factor;
-  const Eigen::Quaterniond rotation =
-      Eigen::Quaterniond(start->transform.rotation())
-          .slerp(factor, Eigen::Quaterniond(end->transform.rotation()));
-  return transform::Rigid3d(origin, rotation);
+std::vector<transform::Rigid3d> TransformInterpolationBuffer::LookupMany(
+    const std::vector<common::Time>& times) const {
+  Cursor cursor(this);
+  std::vector<transform::Rigid3d> transforms;
+  transforms.reserve(times.size());
+  for (const common::Time time : times) {
+    transforms.push_back(cursor.Lookup(time));
+  }
+  return transforms;
 }
 
 common::Time TransformInterpolationBuffer::earliest_time() const {
   CHECK(!empty()) << "Empty buffer.";
-  return deque_.front().time;
+  return timestamped_transforms_.front().time;
 }
 
 common::Time TransformInterpolationBuffer::latest_time() const {
   CHECK(!empty()) << "Empty buffer.";
-  return deque_.back().time;
+  return timestamped_transforms_.back().time;
 }
 
-bool TransformInterpolationBuffer::empty() const { return deque_.empty(); }
+bool TransformInterpolationBuffer::empty() const {
+  return timestamped_transforms_.empty();
+}
 
 std::unique_ptr<TransformInterpolationBuffer>
 TransformInterpolationBuffer::FromTrajectory(
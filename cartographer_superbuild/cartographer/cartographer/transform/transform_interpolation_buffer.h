@@ -17,9 +17,11 @@
 #ifndef CARTOGRAPHER_TRANSFORM_TRANSFORM_INTERPOLATION_BUFFER_H_
 #define CARTOGRAPHER_TRANSFORM_TRANSFORM_INTERPOLATION_BUFFER_H_
 
-#include <deque>
 #include <memory>
+#include <vector>
 
+#include "Eigen/Core"
+#include "Eigen/Geometry"
 #include "cartographer/common/time.h"
 #include "cartographer/mapping/proto/trajectory.pb.h"
 #include "cartographer/transform/rigid_transform.h"
@@ -30,6 +32,8 @@ namespace transform {
 // A time-ordered buffer of transforms that supports interpolated lookups.
 class TransformInterpolationBuffer {
  public:
+  class Cursor;
+
   static std::unique_ptr<TransformInterpolationBuffer> FromTrajectory(
       const mapping::proto::Trajectory& trajectory);
 
@@ -44,6 +48,11 @@ class TransformInterpolationBuffer {
   // 'time' is available.
   transform::Rigid3d Lookup(common::Time time) const;
 
+  // Returns interpolated transforms at all 'times' which have to be sorted.
+  // Equivalent to, but faster than calling Lookup() for each of them.
+  std::vector<transform::Rigid3d> LookupMany(
+      const std::vector<common::Time>& times) const;
+
   // Returns the timestamp of the earliest transform in the buffer or 0 if the
   // buffer is empty.
   common::Time earliest_time() const;
@@ -61,7 +70,50 @@ class TransformInterpolationBuffer {
     transform::Rigid3d transform;
   };
 
-  std::deque<TimestampedTransform> deque_;
+  // Interpolation between two consecutive transforms. The slerp angle is
+  // computed once, so that interpolating many times within the same segment
+  // is cheap.
+  class Segment {
+   public:
+    Segment() = default;
+    Segment(const TimestampedTransform& start, const TimestampedTransform& end);
+
+    transform::Rigid3d Interpolate(common::Time time) const;
+
+   private:
+    common::Time start_time_;
+    double duration_;
+    Eigen::Vector3d start_translation_;
+    Eigen::Vector3d delta_translation_;
+    Eigen::Quaterniond start_rotation_;
+    Eigen::Quaterniond end_rotation_;
+    double dot_;
+    double angle_;
+    double sin_angle_;
+  };
+
+  std::vector<TimestampedTransform> timestamped_transforms_;
+};
+
+// Looks up transforms at non-decreasing times. Each lookup continues the
+// search where the previous one stopped instead of searching the whole
+// buffer. The buffer must outlive the cursor, but may be pushed to.
+class TransformInterpolationBuffer::Cursor {
+ public:
+  explicit Cursor(const TransformInterpolationBuffer* buffer);
+
+  // Same as TransformInterpolationBuffer::Lookup(). CHECK()s that 'time' is
+  // not earlier than in the previous call.
+  transform::Rigid3d Lookup(common::Time time);
+
+ private:
+  const TransformInterpolationBuffer* const buffer_;
+  common::Time last_time_ = common::Time::min();
+  // Index of the first transform not older than 'last_time_'.
+  size_t index_ = 0;
+  // 'segment_' ends at 'segment_index_' if that is non-zero.
+  size_t segment_index_ = 0;
+  Segment segment_;
 };
 
 }  // namespace transform
@@ -16,6 +16,8 @@
 
 #include "cartographer/transform/transform_interpolation_buffer.h"
 
+#include <vector>
+
 #include "Eigen/Core"
 #include "Eigen/Geometry"
 #include "cartographer/transform/rigid_transform.h"
@@ -62,6 +64,49 @@ TEST(TransformInterpolationBufferTest, testLookup) {
                1e-6));
 }
 
+TEST(TransformInterpolationBufferTest, testLookupMany) {
+  TransformInterpolationBuffer buffer;
+  for (int i = 0; i != 10; ++i) {
+    buffer.Push(common::FromUniversal(100 * i),
+                transform::Rigid3d(
+                    Eigen::Vector3d(i, -2. * i, 0.5 * i * i),
+                    Eigen::Quaterniond(Eigen::AngleAxisd(
+                        1.3 * i, Eigen::Vector3d(1., i, 2.).normalized()))));
+  }
+  std::vector<common::Time> times;
+  for (int i = 0; i <= 900; i += 7) {
+    times.push_back(common::FromUniversal(i));
+  }
+  times.push_back(common::FromUniversal(900));
+  const std::vector<transform::Rigid3d> transforms = buffer.LookupMany(times);
+  ASSERT_EQ(times.size(), transforms.size());
+  for (size_t i = 0; i != times.size(); ++i) {
+    EXPECT_THAT(transforms[i], IsNearly(buffer.Lookup(times[i]), 1e-12));
+  }
+}
+
+TEST(TransformInterpolationBufferTest, testCursorSeesPushedTransforms) {
+  TransformInterpolationBuffer buffer;
+  buffer.Push(common::FromUniversal(50), transform::Rigid3d::Identity());
+  buffer.Push(common::FromUniversal(100), transform::Rigid3d::Translation(
+                                              Eigen::Vector3d(10., 0., 0.)));
+  TransformInterpolationBuffer::Cursor cursor(&buffer);
+  EXPECT_THAT(cursor.Lookup(common::FromUniversal(75)),
+              IsNearly(transform::Rigid3d::Translation(
+                           Eigen::Vector3d(5., 0., 0.)),
+                       1e-6));
+  buffer.Push(common::FromUniversal(200), transform::Rigid3d::Translation(
+                                              Eigen::Vector3d(10., 20., 0.)));
+  EXPECT_THAT(cursor.Lookup(common::FromUniversal(100)),
+              IsNearly(transform::Rigid3d::Translation(
+                           Eigen::Vector3d(10., 0., 0.)),
+                       1e-6));
+  EXPECT_THAT(cursor.Lookup(common::FromUniversal(150)),
+              IsNearly(transform::Rigid3d::Translation(
+                           Eigen::Vector3d(10., 10., 0.)),
+                       1e-6));
+}
+
 }  // namespace
 }  // namespace transform
 }  // namespace cartographer
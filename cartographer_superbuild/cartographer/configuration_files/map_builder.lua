@@ -19,4 +19,5 @@ MAP_BUILDER = {
   use_trajectory_builder_3d = false,
   num_background_threads = 4,
   sparse_pose_graph = SPARSE_POSE_GRAPH,
+  serialize_precomputation_grids = false,
 }
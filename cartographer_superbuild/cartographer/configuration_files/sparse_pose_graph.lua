@@ -27,15 +27,19 @@ SPARSE_POSE_GRAPH = {
     loop_closure_translation_weight = 1.1e4,
     loop_closure_rotation_weight = 1e5,
     log_matches = true,
+    scan_matcher_cache_max_megabytes = 0.,
     fast_correlative_scan_matcher = {
       linear_search_window = 7.,
       angular_search_window = math.rad(30.),
       branch_and_bound_depth = 7,
+      num_threads = 1,
     },
     ceres_scan_matcher = {
       occupied_space_weight = 20.,
       translation_weight = 10.,
       rotation_weight = 1.,
+      use_analytic_derivatives = true,
+      reuse_problems = true,
       ceres_solver_options = {
         use_nonmonotonic_steps = true,
         max_num_iterations = 10,
@@ -50,6 +54,7 @@ SPARSE_POSE_GRAPH = {
       linear_xy_search_window = 5.,
       linear_z_search_window = 1.,
       angular_search_window = math.rad(15.),
+      num_threads = 1,
     },
     high_resolution_adaptive_voxel_filter = {
       max_length = 2.,
@@ -67,6 +72,7 @@ SPARSE_POSE_GRAPH = {
       translation_weight = 10.,
       rotation_weight = 1.,
       only_optimize_yaw = false,
+      reuse_problems = true,
       ceres_solver_options = {
         use_nonmonotonic_steps = false,
         max_num_iterations = 10,
@@ -91,4 +97,6 @@ SPARSE_POSE_GRAPH = {
   },
   max_num_final_iterations = 200,
   global_sampling_ratio = 0.003,
+  place_recognition_num_candidates = 0,
+  place_recognition_max_range = 30.,
 }
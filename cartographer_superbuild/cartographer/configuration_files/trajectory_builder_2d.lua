@@ -34,12 +34,16 @@ TRAJECTORY_BUILDER_2D = {
     angular_search_window = math.rad(20.),
     translation_delta_cost_weight = 1e-1,
     rotation_delta_cost_weight = 1e-1,
+    num_threads = 1,
+    coarse_search_width = 1,
   },
 
   ceres_scan_matcher = {
     occupied_space_weight = 1.,
     translation_weight = 10.,
     rotation_weight = 40.,
+    use_analytic_derivatives = true,
+    reuse_problems = true,
     ceres_solver_options = {
       use_nonmonotonic_steps = false,
       max_num_iterations = 20,
@@ -65,4 +69,13 @@ TRAJECTORY_BUILDER_2D = {
       miss_probability = 0.49,
     },
   },
+
+  pipeline_queue_size = 0,
+
+  admission_controller = {
+    measurement_period = 0.,
+    max_load = 0.9,
+    min_load = 0.5,
+    max_queue_depth = 2,
+  },
 }
@@ -38,6 +38,8 @@ TRAJECTORY_BUILDER_3D = {
     angular_search_window = math.rad(1.),
     translation_delta_cost_weight = 1e-1,
     rotation_delta_cost_weight = 1e-1,
+    num_threads = 1,
+    coarse_search_width = 1,
   },
 
   ceres_scan_matcher = {
@@ -46,6 +48,7 @@ TRAJECTORY_BUILDER_3D = {
     translation_weight = 5.,
     rotation_weight = 4e2,
     only_optimize_yaw = false,
+    reuse_problems = true,
     ceres_solver_options = {
       use_nonmonotonic_steps = false,
       max_num_iterations = 12,
@@ -67,6 +70,7 @@ TRAJECTORY_BUILDER_3D = {
     high_resolution_max_range = 20.,
     low_resolution = 0.45,
     num_range_data = 160,
+    use_hashed_hybrid_grids = false,
     range_data_inserter = {
       hit_probability = 0.55,
       miss_probability = 0.49,